@@ -32,22 +32,38 @@ void CreatePeripherals(std::vector<std::unique_ptr<Input>> *inputs,
   auto *in2 = new InputPin(2, 14, 1, MGOS_GPIO_PULL_NONE, true);
   in2->AddHandler(std::bind(&HandleInputResetSequence, in2, 5, _1, _2));
   inputs->emplace_back(in2);
+  if (mgos_sys_config_get_shelly_mode() == 0) {
+    CreateOutputGroup(3, mgos_sys_config_get_shelly_out_group(), outputs);
+  }
   (void) pms;
 }
 
 void CreateComponents(std::vector<Component *> *comps,
                       std::vector<std::unique_ptr<hap::Accessory>> *accs,
                       HAPAccessoryServerRef *svr) {
+  if (mgos_sys_config_get_shelly_mode() == 1) {
+    // Input 1 and output 1 open, input 2 and output 2 close.
+    CreateHAPWindowCovering(1, 1, 2, 1, 2, mgos_sys_config_get_wc1(), comps,
+                            accs, svr);
+    return;
+  }
   // Use legacy layout if upgraded from an older version (pre-2.1).
-  // However, presence of detached inputs overrides it.
+  // However, presence of detached inputs overrides it, as does an
+  // output group.
   bool compat_20 = (mgos_sys_config_get_shelly_legacy_hap_layout() &&
                     mgos_sys_config_get_sw1_in_mode() != 3 &&
-                    mgos_sys_config_get_sw2_in_mode() != 3);
+                    mgos_sys_config_get_sw2_in_mode() != 3 &&
+                    FindOutput(3) == nullptr);
   if (!compat_20) {
     CreateHAPSwitch(1, mgos_sys_config_get_sw1(), mgos_sys_config_get_ssw1(),
                     comps, accs, svr, false /* to_pri_acc */);
     CreateHAPSwitch(2, mgos_sys_config_get_sw2(), mgos_sys_config_get_ssw2(),
                     comps, accs, svr, false /* to_pri_acc */);
+    if (FindOutput(3) != nullptr) {
+      // No input, group switch is controlled via HAP and RPC only.
+      CreateHAPSwitch(3, mgos_sys_config_get_swg(), nullptr /* ssw_cfg */,
+                      comps, accs, svr, false /* to_pri_acc */);
+    }
   } else {
     CreateHAPSwitch(2, mgos_sys_config_get_sw2(), mgos_sys_config_get_ssw2(),
                     comps, accs, svr, true /* to_pri_acc */);
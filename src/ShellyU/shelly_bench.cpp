@@ -0,0 +1,427 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_bench.hpp"
+
+#include <cstring>
+#include <string>
+
+#include "mgos.h"
+#include "mgos_hap.h"
+#include "mgos_rpc.h"
+#include "mgos_sys_config.h"
+
+#include "shelly_config_store.hpp"
+#include "shelly_debug.hpp"
+#include "shelly_flash_log.hpp"
+#include "shelly_hap_chars.hpp"
+#include "shelly_rpc_service.hpp"
+#include "shelly_switch.hpp"
+#include "shelly_virtual_input.hpp"
+
+// AIDs are base + id and bases are 0x100 apart.
+#define BENCH_MAX_ID 0xff
+// Synthetic pins, well clear of the real ones.
+#define BENCH_PIN_BASE 1000
+
+namespace shelly {
+
+// Switch configs, based on sw1 / ssw1. Names are heap-allocated so that
+// SetConfig can replace them the same way it does with the real ones.
+struct BenchSwitchCfg {
+  explicit BenchSwitchCfg(const std::string &name) {
+    sw = *mgos_sys_config_get_sw1();
+    sw.name = strdup(name.c_str());
+    ssw = *mgos_sys_config_get_ssw1();
+    ssw.name = strdup(name.c_str());
+  }
+  ~BenchSwitchCfg() {
+    free((void *) sw.name);
+    free((void *) ssw.name);
+  }
+
+  struct mgos_config_sw sw;
+  struct mgos_config_ssw ssw;
+
+  BenchSwitchCfg(const BenchSwitchCfg &other) = delete;
+};
+
+// Results of the last accessory tree build.
+struct BenchInfo {
+  int num_accs;
+  int num_comps;
+  int heap_used;
+  int64_t build_us;
+};
+
+static std::vector<std::unique_ptr<BenchSwitchCfg>> s_cfgs;
+static BenchInfo s_info;
+
+static int BenchNumPeripherals() {
+  int n = mgos_sys_config_get_bench_max_accessories();
+  if (n > BENCH_MAX_ID - 1) n = BENCH_MAX_ID - 1;
+  if (n < 0) n = 0;
+  return n;
+}
+
+void BenchCreatePeripherals(std::vector<std::unique_ptr<Input>> *inputs,
+                            std::vector<std::unique_ptr<Output>> *outputs) {
+  // Id 1 is the regular switch, synthetic ones start at 2.
+  for (int id = 2; id < BenchNumPeripherals() + 2; id++) {
+    outputs->emplace_back(new OutputPin(id, BENCH_PIN_BASE + id, 1));
+    inputs->emplace_back(
+        new VirtualInputPin(id, BENCH_PIN_BASE + id, false /* reset */));
+  }
+}
+
+static void BenchCreateSwitches(
+    int *id, int num, int svc_type, int in_mode, const char *prefix,
+    std::vector<Component *> *comps,
+    std::vector<std::unique_ptr<hap::Accessory>> *accs,
+    HAPAccessoryServerRef *svr) {
+  for (int i = 0; i < num; i++, (*id)++) {
+    if (*id >= BenchNumPeripherals() + 2) {
+      LOG(LL_ERROR, ("Out of synthetic peripherals (%d), increase "
+                     "bench.max_accessories",
+                     BenchNumPeripherals()));
+      return;
+    }
+    std::unique_ptr<BenchSwitchCfg> cfg(
+        new BenchSwitchCfg(std::string(prefix) + " " + std::to_string(i + 1)));
+    cfg->sw.enable = true;
+    cfg->sw.svc_type = svc_type;
+    cfg->sw.in_mode = in_mode;
+    cfg->sw.state = false;
+    cfg->sw.initial_state = 0;  // Off.
+    cfg->sw.auto_off = false;
+    CreateHAPSwitch(*id, &cfg->sw, &cfg->ssw, comps, accs, svr,
+                    false /* to_pri_acc */);
+    s_cfgs.emplace_back(std::move(cfg));
+  }
+}
+
+void BenchCreateComponents(std::vector<Component *> *comps,
+                           std::vector<std::unique_ptr<hap::Accessory>> *accs,
+                           HAPAccessoryServerRef *svr) {
+  // Components referencing the old configs are gone by now.
+  s_cfgs.clear();
+  size_t num_accs_before = accs->size(), num_comps_before = comps->size();
+  size_t free_before = mgos_get_free_heap_size();
+  int64_t start = mgos_uptime_micros();
+  int id = 2;
+  BenchCreateSwitches(&id, mgos_sys_config_get_bench_num_switches(), 0, 1,
+                      "Switch", comps, accs, svr);
+  BenchCreateSwitches(&id, mgos_sys_config_get_bench_num_outlets(), 1, 1,
+                      "Outlet", comps, accs, svr);
+  BenchCreateSwitches(&id, mgos_sys_config_get_bench_num_locks(), 2, 1,
+                      "Lock", comps, accs, svr);
+  BenchCreateSwitches(&id, mgos_sys_config_get_bench_num_ssw(), -1, 3,
+                      "Input", comps, accs, svr);
+  s_info.build_us = mgos_uptime_micros() - start;
+  s_info.heap_used = (int) free_before - (int) mgos_get_free_heap_size();
+  s_info.num_accs = (int) (accs->size() - num_accs_before);
+  s_info.num_comps = (int) (comps->size() - num_comps_before);
+  LOG(LL_INFO, ("Bench: %d accessories, %d components, %d heap (%d per acc), "
+                "%d us",
+                s_info.num_accs, s_info.num_comps, s_info.heap_used,
+                (s_info.num_accs > 0 ? s_info.heap_used / s_info.num_accs : 0),
+                (int) s_info.build_us));
+}
+
+static void GetBenchInfoHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                                struct mg_rpc_frame_info *fi,
+                                struct mg_str args) {
+  mg_rpc_send_responsef(
+      ri,
+      "{num_accs: %d, num_comps: %d, heap_used: %d, build_us: %lld, "
+      "max_accessories: %d, ram_free: %u}",
+      s_info.num_accs, s_info.num_comps, s_info.heap_used,
+      (long long) s_info.build_us, BenchNumPeripherals(),
+      (unsigned) mgos_get_free_heap_size());
+  (void) cb_arg;
+  (void) fi;
+  (void) args;
+}
+
+static void SetBenchConfigHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                                  struct mg_rpc_frame_info *fi,
+                                  struct mg_str args) {
+  int num_switches = mgos_sys_config_get_bench_num_switches();
+  int num_outlets = mgos_sys_config_get_bench_num_outlets();
+  int num_locks = mgos_sys_config_get_bench_num_locks();
+  int num_ssw = mgos_sys_config_get_bench_num_ssw();
+
+  json_scanf(args.p, args.len, ri->args_fmt, &num_switches, &num_outlets,
+             &num_locks, &num_ssw);
+
+  if (num_switches < 0 || num_outlets < 0 || num_locks < 0 || num_ssw < 0 ||
+      num_switches + num_outlets + num_locks + num_ssw >
+          BenchNumPeripherals()) {
+    mg_rpc_send_errorf(ri, 400, "invalid number of accessories, max %d",
+                       BenchNumPeripherals());
+    return;
+  }
+  mgos_sys_config_set_bench_num_switches(num_switches);
+  mgos_sys_config_set_bench_num_outlets(num_outlets);
+  mgos_sys_config_set_bench_num_locks(num_locks);
+  mgos_sys_config_set_bench_num_ssw(num_ssw);
+  SaveConfig("bench");
+  // Accessories will be re-created when the server stops.
+  RestartHAPServer();
+  mg_rpc_send_responsef(ri, nullptr);
+
+  (void) cb_arg;
+  (void) fi;
+}
+
+// Microbenchmarks of the hot code paths.
+
+class BenchInput : public Input {
+ public:
+  explicit BenchInput(int id) : Input(id) {
+  }
+  bool GetState() override {
+    return false;
+  }
+  using Input::CallHandlers;
+};
+
+class BenchOutput : public Output {
+ public:
+  explicit BenchOutput(int id) : Output(id) {
+  }
+  bool GetState() override {
+    return state_;
+  }
+  Status SetState(bool on, const char *source) override {
+    bool changed = (on != state_);
+    state_ = on;
+    if (changed) CallHandlers(on);
+    (void) source;
+    return Status::OK();
+  }
+
+ private:
+  bool state_ = false;
+};
+
+struct BenchResult {
+  const char *name;
+  int iters;
+  int64_t total_us;
+  int64_t bytes;  // Written to flash, if applicable.
+};
+
+template <class F>
+static BenchResult BenchRun(const char *name, int iters, F f) {
+  int64_t start = mgos_uptime_micros();
+  for (int i = 0; i < iters; i++) {
+    f(i);
+  }
+  return BenchResult{name, iters, mgos_uptime_micros() - start, 0};
+}
+
+static std::vector<BenchResult> BenchRunAll(int iters) {
+  std::vector<BenchResult> res;
+  // Id beyond synthetic peripherals, not used by anything else.
+  const int id = BENCH_MAX_ID;
+  BenchInput in(id);
+  BenchOutput out(id);
+  BenchSwitchCfg cfg("Bench");
+  cfg.sw.svc_type = -1;
+  cfg.sw.in_mode = (int) ShellySwitch::InMode::kDetached;
+  cfg.sw.initial_state = (int) ShellySwitch::InitialState::kOff;
+  cfg.sw.auto_off = false;
+  cfg.sw.state = false;
+
+  res.push_back(BenchRun("get_info", iters, [](int) { GetInfoJSON(); }));
+
+  res.push_back(BenchRun("debug_info", iters, [](int) {
+    std::string s;
+    shelly_get_debug_info(&s);
+  }));
+
+  // CreateHAPSwitch needs registered peripherals, use the last synthetic one
+  // and keep its output state intact.
+  Output *tree_out = FindOutput(BenchNumPeripherals() + 1);
+  if (tree_out != nullptr) {
+    BenchSwitchCfg tree_cfg("Bench");
+    tree_cfg.sw.svc_type = 0;
+    tree_cfg.sw.initial_state = (int) ShellySwitch::InitialState::kLast;
+    tree_cfg.sw.state = tree_out->GetState();
+    tree_cfg.sw.auto_off = false;
+    res.push_back(BenchRun("accessory_tree", iters, [&](int) {
+      std::vector<Component *> comps;
+      std::vector<std::unique_ptr<hap::Accessory>> accs;
+      accs.emplace_back(new hap::Accessory(SHELLY_HAP_AID_PRIMARY,
+                                           kHAPAccessoryCategory_Bridges,
+                                           "Bench", nullptr));
+      accs.front()->AddHAPService(&mgos_hap_accessory_information_service);
+      accs.front()->AddHAPService(&mgos_hap_protocol_information_service);
+      accs.front()->AddHAPService(&mgos_hap_pairing_service);
+      CreateHAPSwitch(tree_out->id(), &tree_cfg.sw, &tree_cfg.ssw, &comps,
+                      &accs, nullptr, false /* to_pri_acc */);
+    }));
+  }
+
+  ShellySwitch sw(id, &in, &out, nullptr, &cfg.sw);
+  sw.Init();
+
+  std::string cfg_json = mgos::JSONPrintStringf(
+      "{name: %Q, svc_type: %d, in_mode: %d, initial_state: %d, "
+      "auto_off: %B, auto_off_delay: %.3f}",
+      cfg.sw.name, cfg.sw.svc_type, cfg.sw.in_mode, cfg.sw.initial_state,
+      cfg.sw.auto_off, cfg.sw.auto_off_delay);
+  res.push_back(BenchRun("set_config", iters, [&](int) {
+    bool restart_required = false;
+    sw.SetConfig(cfg_json, &restart_required);
+  }));
+
+  // Persistence is skipped by updating the stored state beforehand.
+  res.push_back(BenchRun("switch_set_state", iters, [&](int i) {
+    cfg.sw.state = (i & 1);
+    sw.SetState((i & 1), "bench");
+  }));
+
+  for (int i = 0; i < 4; i++) {
+    in.AddHandler([](Input::Event ev, bool state) {
+      (void) ev;
+      (void) state;
+    });
+  }
+  res.push_back(BenchRun("input_dispatch", iters, [&](int i) {
+    in.CallHandlers(Input::Event::kChange, (i & 1));
+  }));
+
+  bool value = false;
+  hap::BoolCharacteristic ch(
+      1, &kHAPCharacteristicType_On,
+      [&](HAPAccessoryServerRef *, const HAPBoolCharacteristicReadRequest *,
+          bool *v) {
+        *v = value;
+        return kHAPError_None;
+      },
+      false /* supports_notification */,
+      [&](HAPAccessoryServerRef *, const HAPBoolCharacteristicWriteRequest *,
+          bool v) {
+        value = v;
+        return kHAPError_None;
+      });
+  auto *hc = (const HAPBoolCharacteristic *) ch.GetHAPCharacteristic();
+  HAPBoolCharacteristicReadRequest rreq = {};
+  rreq.characteristic = hc;
+  res.push_back(BenchRun("char_read", iters, [&](int) {
+    bool v;
+    hc->callbacks.handleRead(nullptr, &rreq, &v, nullptr);
+  }));
+  HAPBoolCharacteristicWriteRequest wreq = {};
+  wreq.characteristic = hc;
+  res.push_back(BenchRun("char_write", iters, [&](int i) {
+    hc->callbacks.handleWrite(nullptr, &wreq, (i & 1), nullptr);
+  }));
+
+  // Persisting a single setting change: full config file vs overlay.
+  const bool sw1_state = mgos_sys_config_get_sw1_state();
+  for (bool full : {true, false}) {
+    int64_t bytes = 0;
+    auto save = [&](int i) {
+      mgos_sys_config_set_sw1_state((i & 1));
+      bytes += ConfigStoreFlush(full);
+    };
+    res.push_back(BenchRun(full ? "config_save_full" : "config_save_delta",
+                           iters, save));
+    res.back().bytes = bytes;
+  }
+  mgos_sys_config_set_sw1_state(sw1_state);
+  ConfigStoreFlush(true /* full */);
+
+  // Compression of a flash log buffer of typical log lines.
+  std::string log_text;
+  for (int i = 0; log_text.size() < 4000; i++) {
+    char line[120];
+    snprintf(line, sizeof(line),
+             "%.3f shelly_main.cpp:643       Uptime: %d.%02d, conns 0/1/9 "
+             "(0 evicted), RAM: 51544, %d free\n",
+             i * 8.0, i * 8, i % 100, 23000 + (i * 37) % 1000);
+    log_text.append(line);
+  }
+  std::string log_out(LOG_COMPRESS_BOUND(log_text.size()), '\0');
+  int64_t log_bytes = 0;
+  res.push_back(BenchRun("log_compress", iters, [&](int) {
+    log_bytes +=
+        LogCompress((const uint8_t *) log_text.data(), log_text.size(),
+                    (uint8_t *) &log_out[0], log_out.size());
+  }));
+  res.back().bytes = log_bytes;
+
+  return res;
+}
+
+static void RunBenchHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                            struct mg_rpc_frame_info *fi, struct mg_str args) {
+  int iters = 1000;
+
+  json_scanf(args.p, args.len, ri->args_fmt, &iters);
+
+  if (iters <= 0) {
+    mg_rpc_send_errorf(ri, 400, "invalid %s", "iters");
+    return;
+  }
+  // Keep logging out of the measurements.
+  enum cs_log_level log_level = cs_log_threshold;
+  cs_log_set_level(LL_ERROR);
+  size_t free_before = mgos_get_free_heap_size();
+  auto results = BenchRunAll(iters);
+  int heap_leaked = (int) free_before - (int) mgos_get_free_heap_size();
+  cs_log_set_level(log_level);
+
+  std::string res = mgos::JSONPrintStringf(
+      "{version: %Q, fw_build: %Q, iters: %d, heap_leaked: %d, results: {",
+      mgos_sys_ro_vars_get_fw_version(), mgos_sys_ro_vars_get_fw_id(), iters,
+      heap_leaked);
+  bool first = true;
+  for (const auto &r : results) {
+    mgos::JSONAppendStringf(&res, "%s%Q: {total_us: %lld, ns_per_iter: %lld",
+                            (first ? "" : ", "), r.name,
+                            (long long) r.total_us,
+                            (long long) (r.total_us * 1000 / r.iters));
+    if (r.bytes > 0) {
+      mgos::JSONAppendStringf(&res, ", bytes_per_iter: %lld",
+                              (long long) (r.bytes / r.iters));
+    }
+    res.append("}");
+    first = false;
+  }
+  res.append("}}");
+  mg_rpc_send_responsef(ri, "%s", res.c_str());
+
+  (void) cb_arg;
+  (void) fi;
+}
+
+bool BenchRPCInit() {
+  mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.GetBenchInfo", "",
+                     GetBenchInfoHandler, NULL);
+  mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.SetBenchConfig",
+                     "{switches: %d, outlets: %d, locks: %d, ssw: %d}",
+                     SetBenchConfigHandler, NULL);
+  mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.RunBench", "{iters: %d}",
+                     RunBenchHandler, NULL);
+  return true;
+}
+
+}  // namespace shelly
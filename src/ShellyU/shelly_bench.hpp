@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "shelly_main.hpp"
+
+namespace shelly {
+
+// Synthetic accessory scaling benchmark, ShellyUBench build only.
+// Creates bench.num_* switches, outlets, locks and stateless switches
+// in addition to the regular ones and records the cost of doing so.
+
+void BenchCreatePeripherals(std::vector<std::unique_ptr<Input>> *inputs,
+                            std::vector<std::unique_ptr<Output>> *outputs);
+
+void BenchCreateComponents(std::vector<Component *> *comps,
+                           std::vector<std::unique_ptr<hap::Accessory>> *accs,
+                           HAPAccessoryServerRef *svr);
+
+bool BenchRPCInit();
+
+}  // namespace shelly
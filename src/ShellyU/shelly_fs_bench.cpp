@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_fs_bench.hpp"
+
+#include <fcntl.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "mgos.h"
+#include "mgos_rpc.h"
+#include "mgos_vfs.h"
+#include "mgos_vfs_dev.h"
+
+#include "shelly_common.hpp"
+
+#define FS_BENCH_DEV_TYPE "benchflash"
+#define FS_BENCH_MOUNT_POINT "/bench"
+// Same as FS_SIZE on the devices.
+#define FS_BENCH_FS_SIZE 262144
+#define FS_BENCH_SECTOR_SIZE 4096
+#define FS_BENCH_PAGE_SIZE 256
+// Typical timings of the SPI NOR flash used in the devices.
+#define FS_BENCH_ERASE_US 45000
+#define FS_BENCH_PROG_US_PER_PAGE 700
+#define FS_BENCH_READ_NS_PER_BYTE 100
+// Files that stand in for the contents of the filesystem image.
+#define FS_BENCH_FILLER_SIZE 8192
+
+namespace shelly {
+
+// Emulated flash: contents and operation counts, from which time spent in
+// flash operations is derived. NOR semantics, erase sets all bits to 1,
+// writes can only clear them.
+struct BenchFlash {
+  std::vector<uint8_t> data;
+  int64_t num_erases = 0;
+  int64_t bytes_written = 0;
+  int64_t bytes_read = 0;
+
+  int64_t EmulatedMicros() const {
+    return num_erases * FS_BENCH_ERASE_US +
+           bytes_written * FS_BENCH_PROG_US_PER_PAGE / FS_BENCH_PAGE_SIZE +
+           bytes_read * FS_BENCH_READ_NS_PER_BYTE / 1000;
+  }
+};
+
+static BenchFlash s_flash;
+
+static enum mgos_vfs_dev_err BenchFlashOpen(struct mgos_vfs_dev *dev,
+                                            const char *opts) {
+  (void) dev;
+  (void) opts;
+  return MGOS_VFS_DEV_ERR_NONE;
+}
+
+static enum mgos_vfs_dev_err BenchFlashRead(struct mgos_vfs_dev *dev,
+                                            size_t offset, size_t len,
+                                            void *dst) {
+  (void) dev;
+  if (offset + len > s_flash.data.size()) return MGOS_VFS_DEV_ERR_INVAL;
+  memcpy(dst, s_flash.data.data() + offset, len);
+  s_flash.bytes_read += len;
+  return MGOS_VFS_DEV_ERR_NONE;
+}
+
+static enum mgos_vfs_dev_err BenchFlashWrite(struct mgos_vfs_dev *dev,
+                                             size_t offset, size_t len,
+                                             const void *src) {
+  (void) dev;
+  if (offset + len > s_flash.data.size()) return MGOS_VFS_DEV_ERR_INVAL;
+  const uint8_t *sp = static_cast<const uint8_t *>(src);
+  uint8_t *dp = s_flash.data.data() + offset;
+  for (size_t i = 0; i < len; i++) {
+    dp[i] &= sp[i];
+  }
+  s_flash.bytes_written += len;
+  return MGOS_VFS_DEV_ERR_NONE;
+}
+
+static enum mgos_vfs_dev_err BenchFlashErase(struct mgos_vfs_dev *dev,
+                                             size_t offset, size_t len) {
+  (void) dev;
+  if (offset % FS_BENCH_SECTOR_SIZE != 0 || len % FS_BENCH_SECTOR_SIZE != 0 ||
+      offset + len > s_flash.data.size()) {
+    return MGOS_VFS_DEV_ERR_INVAL;
+  }
+  memset(s_flash.data.data() + offset, 0xff, len);
+  s_flash.num_erases += len / FS_BENCH_SECTOR_SIZE;
+  return MGOS_VFS_DEV_ERR_NONE;
+}
+
+static size_t BenchFlashGetSize(struct mgos_vfs_dev *dev) {
+  (void) dev;
+  return s_flash.data.size();
+}
+
+static enum mgos_vfs_dev_err BenchFlashClose(struct mgos_vfs_dev *dev) {
+  (void) dev;
+  return MGOS_VFS_DEV_ERR_NONE;
+}
+
+static enum mgos_vfs_dev_err BenchFlashGetEraseSizes(
+    struct mgos_vfs_dev *dev, size_t sizes[MGOS_VFS_DEV_NUM_ERASE_SIZES]) {
+  (void) dev;
+  memset(sizes, 0, MGOS_VFS_DEV_NUM_ERASE_SIZES * sizeof(sizes[0]));
+  sizes[0] = FS_BENCH_SECTOR_SIZE;
+  return MGOS_VFS_DEV_ERR_NONE;
+}
+
+static const struct mgos_vfs_dev_ops s_bench_flash_ops = {
+    .open = BenchFlashOpen,
+    .read = BenchFlashRead,
+    .write = BenchFlashWrite,
+    .erase = BenchFlashErase,
+    .get_size = BenchFlashGetSize,
+    .close = BenchFlashClose,
+    .get_erase_sizes = BenchFlashGetEraseSizes,
+};
+
+static bool WriteFile(const std::string &name, const std::string &data) {
+  std::string path = std::string(FS_BENCH_MOUNT_POINT "/") + name;
+  int fd = mgos_vfs_open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return false;
+  bool res = (mgos_vfs_write(fd, data.data(), data.size()) ==
+              (ssize_t) data.size());
+  if (mgos_vfs_close(fd) != 0) res = false;
+  return res;
+}
+
+static int64_t Percentile(const std::vector<int64_t> &sorted, int pct) {
+  return sorted[(sorted.size() - 1) * pct / 100];
+}
+
+static StatusOr<std::string> FSBenchRun(const char *fs_type,
+                                        const char *fs_opts, int iters,
+                                        int fill_pct) {
+  s_flash = BenchFlash();
+  s_flash.data.assign(FS_BENCH_FS_SIZE, 0xff);
+  if (!mgos_vfs_mkfs(FS_BENCH_DEV_TYPE, "", fs_type, fs_opts) ||
+      !mgos_vfs_mount(FS_BENCH_MOUNT_POINT, FS_BENCH_DEV_TYPE, "", fs_type,
+                      fs_opts)) {
+    return mgos::Errorf(STATUS_INTERNAL, "failed to create %s", fs_type);
+  }
+  size_t fill_size = mgos_vfs_get_space_total(FS_BENCH_MOUNT_POINT) *
+                     fill_pct / 100;
+  std::string filler(FS_BENCH_FILLER_SIZE, 'F');
+  for (size_t filled = 0; filled + FS_BENCH_FILLER_SIZE <= fill_size;
+       filled += FS_BENCH_FILLER_SIZE) {
+    if (!WriteFile("fill" + std::to_string(filled), filler)) break;
+  }
+  // Files rewritten by the firmware: HAP key-value store and config.
+  // Contents change on every write, like switch state and counters do.
+  static const struct {
+    const char *name;
+    size_t size;
+  } s_files[] = {
+      {"kvs.json", 1536},
+      {"conf9.json", 3072},
+  };
+  std::vector<int64_t> lat;
+  lat.reserve(iters);
+  int num_failed = 0;
+  int64_t erases_before = s_flash.num_erases;
+  int64_t written_before = s_flash.bytes_written;
+  for (int i = 0; i < iters; i++) {
+    const auto &f = s_files[i % ARRAY_SIZE(s_files)];
+    std::string data(f.size, '0' + (i % 10));
+    int64_t start = mgos_uptime_micros();
+    int64_t flash_start = s_flash.EmulatedMicros();
+    if (!WriteFile(f.name, data)) num_failed++;
+    lat.push_back((mgos_uptime_micros() - start) +
+                  (s_flash.EmulatedMicros() - flash_start));
+  }
+  double erases_per_write =
+      (double) (s_flash.num_erases - erases_before) / iters;
+  int64_t bytes_per_write = (s_flash.bytes_written - written_before) / iters;
+  mgos_vfs_umount(FS_BENCH_MOUNT_POINT);
+  if (num_failed == iters) {
+    return mgos::Errorf(STATUS_INTERNAL, "%s: all writes failed", fs_type);
+  }
+  int64_t total_us = 0;
+  for (int64_t l : lat) total_us += l;
+  std::sort(lat.begin(), lat.end());
+  return mgos::JSONPrintStringf(
+      "{mean_us: %lld, p50_us: %lld, p90_us: %lld, p99_us: %lld, "
+      "max_us: %lld, erases_per_write: %.3f, flash_bytes_per_write: %lld, "
+      "failed: %d}",
+      (long long) (total_us / iters), (long long) Percentile(lat, 50),
+      (long long) Percentile(lat, 90), (long long) Percentile(lat, 99),
+      (long long) lat.back(), erases_per_write, (long long) bytes_per_write,
+      num_failed);
+}
+
+static void RunFSBenchHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                              struct mg_rpc_frame_info *fi,
+                              struct mg_str args) {
+  int iters = 500, fill = 50;
+
+  json_scanf(args.p, args.len, ri->args_fmt, &iters, &fill);
+
+  if (iters <= 0) {
+    mg_rpc_send_errorf(ri, 400, "invalid %s", "iters");
+    return;
+  }
+  if (fill < 0 || fill > 90) {
+    mg_rpc_send_errorf(ri, 400, "invalid %s", "fill");
+    return;
+  }
+  static const struct {
+    const char *name;
+    const char *fs_type;
+    const char *fs_opts;
+  } s_fss[] = {
+      {"spiffs", "SPIFFS", "{bs: 4096, ps: 256, es: 4096}"},
+      {"lfs", "LFS", "{bs: 4096}"},
+  };
+  std::string res = mgos::JSONPrintStringf(
+      "{iters: %d, fill: %d, erase_us: %d, prog_us_per_page: %d, results: {",
+      iters, fill, FS_BENCH_ERASE_US, FS_BENCH_PROG_US_PER_PAGE);
+  for (size_t i = 0; i < ARRAY_SIZE(s_fss); i++) {
+    auto r = FSBenchRun(s_fss[i].fs_type, s_fss[i].fs_opts, iters, fill);
+    if (!r.ok()) {
+      mg_rpc_send_errorf(ri, 500, "%s", r.status().ToString().c_str());
+      return;
+    }
+    mgos::JSONAppendStringf(&res, "%s%Q: %s", (i > 0 ? ", " : ""),
+                            s_fss[i].name, r.ValueOrDie().c_str());
+  }
+  res.append("}}");
+  mg_rpc_send_responsef(ri, "%s", res.c_str());
+
+  (void) cb_arg;
+  (void) fi;
+}
+
+bool FSBenchRPCInit() {
+  if (!mgos_vfs_dev_register_type(FS_BENCH_DEV_TYPE, &s_bench_flash_ops)) {
+    return false;
+  }
+  mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.RunFSBench",
+                     "{iters: %d, fill: %d}", RunFSBenchHandler, NULL);
+  return true;
+}
+
+}  // namespace shelly
@@ -18,6 +18,12 @@
 #include "mgos_sys_config.h"
 
 #include "shelly_main.hpp"
+#include "shelly_replay.hpp"
+#include "shelly_virtual_input.hpp"
+#ifdef SHELLY_BENCH
+#include "shelly_bench.hpp"
+#include "shelly_fs_bench.hpp"
+#endif
 
 namespace shelly {
 
@@ -25,9 +31,16 @@ void CreatePeripherals(std::vector<std::unique_ptr<Input>> *inputs,
                        std::vector<std::unique_ptr<Output>> *outputs,
                        std::vector<std::unique_ptr<PowerMeter>> *pms) {
   outputs->emplace_back(new OutputPin(1, 123, 1));
-  auto *in = new InputPin(1, 456, 1, MGOS_GPIO_PULL_NONE, true);
+  auto *in = new VirtualInputPin(1, 456, true);
   in->AddHandler(std::bind(&HandleInputResetSequence, in, -1, _1, _2));
   inputs->emplace_back(in);
+  VirtualInputRPCInit();
+  ReplayRPCInit();
+#ifdef SHELLY_BENCH
+  BenchCreatePeripherals(inputs, outputs);
+  BenchRPCInit();
+  FSBenchRPCInit();
+#endif
   (void) pms;
 }
 
@@ -38,6 +51,9 @@ void CreateComponents(std::vector<Component *> *comps,
   bool to_pri_acc = (mgos_sys_config_get_sw1_in_mode() != 3);
   CreateHAPSwitch(1, mgos_sys_config_get_sw1(), mgos_sys_config_get_ssw1(),
                   comps, accs, svr, to_pri_acc);
+#ifdef SHELLY_BENCH
+  BenchCreateComponents(comps, accs, svr);
+#endif
 }
 
 }  // namespace shelly
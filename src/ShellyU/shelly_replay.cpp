@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_replay.hpp"
+
+#include <cstdlib>
+#include <vector>
+
+#include "mgos.h"
+#include "mgos_rpc.h"
+
+#include "shelly_clock.hpp"
+#include "shelly_main.hpp"
+#include "shelly_switch.hpp"
+#include "shelly_trace.hpp"
+#include "shelly_virtual_input.hpp"
+
+// After the last event time is advanced until no timers are pending (auto
+// off, long press), but no further than this and firing no more than this
+// many timers.
+#define REPLAY_MAX_FLUSH_MICROS (24 * 3600 * 1000000LL)
+#define REPLAY_MAX_FLUSH_TIMERS 10000
+
+namespace shelly {
+
+static ShellySwitch *FindSwitch(int id) {
+  for (auto *c : g_comps) {
+    if (c->id() != id) continue;
+    switch (c->type()) {
+      case Component::Type::kSwitch:
+      case Component::Type::kOutlet:
+      case Component::Type::kLock:
+        return static_cast<ShellySwitch *>(c);
+      default:
+        break;
+    }
+  }
+  return nullptr;
+}
+
+static bool ParseRecord(const struct json_token &tok, TraceRecord *r) {
+  long v[4];
+  for (int i = 0; i < 4; i++) {
+    struct json_token t = JSON_INVALID_TOKEN;
+    if (json_scanf_array_elem(tok.ptr, tok.len, "", i, &t) < 0 ||
+        t.type != JSON_TYPE_NUMBER) {
+      return false;
+    }
+    v[i] = strtol(t.ptr, nullptr, 10);
+  }
+  r->ts_ms = (uint32_t) v[0];
+  r->ev = static_cast<TraceEvent>(v[1]);
+  r->id = (uint8_t) v[2];
+  r->arg = (uint16_t) v[3];
+  return true;
+}
+
+static std::vector<ShellySwitch *> GetSwitches() {
+  std::vector<ShellySwitch *> res;
+  for (auto *c : g_comps) {
+    ShellySwitch *sw = FindSwitch(c->id());
+    if (sw == c) res.push_back(sw);
+  }
+  return res;
+}
+
+// Replay starts with all inputs and outputs off and no timers pending,
+// regardless of what has been done to ShellyU before.
+static void ResetState() {
+  for (auto *vin : GetVirtualInputs()) vin->Reset();
+  for (auto *sw : GetSwitches()) {
+    sw->ClearTimers();
+    sw->SetState(false, "init");
+  }
+}
+
+// Timers still pending after the flush are cancelled before leaving virtual
+// time, so that components don't keep ids of timers that no longer exist.
+// Inputs are reset too, they may be waiting for a timer.
+static void ClearTimers() {
+  for (auto *vin : GetVirtualInputs()) vin->Reset();
+  for (auto *sw : GetSwitches()) sw->ClearTimers();
+}
+
+static bool ApplyRecord(const TraceRecord &r) {
+  switch (r.ev) {
+    case TraceEvent::kInputEdge: {
+      VirtualInputPin *vin = FindVirtualInput(r.id);
+      if (vin == nullptr) return false;
+      vin->SetState(r.arg != 0);
+      return true;
+    }
+    case TraceEvent::kSwitchState: {
+      TraceSource src = static_cast<TraceSource>(r.arg >> 1);
+      // Other sources are derived from inputs and timers.
+      if (src != TraceSource::kHAP && src != TraceSource::kRPC) return true;
+      ShellySwitch *sw = FindSwitch(r.id);
+      if (sw == nullptr) return false;
+      sw->SetState((r.arg & 1) != 0, TraceSourceToString(src));
+      return true;
+    }
+    default:
+      return true;
+  }
+}
+
+static void ReplayTraceHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                               struct mg_rpc_frame_info *fi,
+                               struct mg_str args) {
+  struct json_token events_tok = JSON_INVALID_TOKEN;
+
+  json_scanf(args.p, args.len, ri->args_fmt, &events_tok);
+
+  if (events_tok.type != JSON_TYPE_ARRAY_END) {
+    mg_rpc_send_errorf(ri, 400, "%s is required", "events");
+    return;
+  }
+
+  int num_skipped = 0;
+  std::vector<TraceRecord> records;
+  struct json_token tok = JSON_INVALID_TOKEN;
+  for (int i = 0; json_scanf_array_elem(events_tok.ptr, events_tok.len, "", i,
+                                        &tok) > 0;
+       i++) {
+    TraceRecord r;
+    if (!ParseRecord(tok, &r)) {
+      num_skipped++;
+      continue;
+    }
+    records.push_back(r);
+  }
+  int num_events = (int) records.size();
+  int num_pending = 0;
+  TraceClear();
+  if (num_events > 0) {
+    int64_t ts_micros = records.front().ts_ms * 1000LL;
+    ClockSetVirtual(true, ts_micros);
+    ResetState();
+    TraceClear();
+    for (const auto &r : records) {
+      ts_micros = r.ts_ms * 1000LL;
+      ClockAdvance(ts_micros);
+      if (!ApplyRecord(r)) num_skipped++;
+    }
+    int64_t flush_until = ts_micros + REPLAY_MAX_FLUSH_MICROS;
+    int64_t next;
+    for (int i = 0; i < REPLAY_MAX_FLUSH_TIMERS; i++) {
+      next = ClockNextTimerMicros();
+      if (next < 0 || next > flush_until) break;
+      ClockAdvance(next);
+    }
+    num_pending = ClockNumPendingTimers();
+    ClearTimers();
+    ClockSetVirtual(false);
+  }
+
+  std::string trace = TraceGetJSON();
+  mg_rpc_send_responsef(ri,
+                        "{num_events: %d, num_skipped: %d, "
+                        "num_pending_timers: %d, trace: %s}",
+                        num_events, num_skipped, num_pending, trace.c_str());
+
+  (void) cb_arg;
+  (void) fi;
+}
+
+bool ReplayRPCInit() {
+  mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.ReplayTrace",
+                     "{events: %T}", ReplayTraceHandler, NULL);
+  return true;
+}
+
+}  // namespace shelly
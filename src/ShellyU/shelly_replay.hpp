@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+namespace shelly {
+
+// Replays a trace captured on a device (Shelly.GetTrace) under virtual
+// time. External stimuli (input edges, HAP and RPC switch writes) are
+// injected, everything else is left for the components to derive and is
+// returned for comparison with the original. Replay starts with inputs and
+// outputs off and no timers pending.
+
+bool ReplayRPCInit();
+
+}  // namespace shelly
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_virtual_input.hpp"
+
+#include <vector>
+
+#include "mgos.h"
+#include "mgos_rpc.h"
+
+namespace shelly {
+
+static std::vector<VirtualInputPin *> s_vins;
+
+VirtualInputPin::VirtualInputPin(int id, int pin, bool enable_reset)
+    : InputPin(id, pin, 1, MGOS_GPIO_PULL_NONE, enable_reset) {
+  s_vins.push_back(this);
+}
+
+VirtualInputPin::~VirtualInputPin() {
+  for (auto it = s_vins.begin(); it != s_vins.end(); it++) {
+    if (*it == this) {
+      s_vins.erase(it);
+      break;
+    }
+  }
+}
+
+bool VirtualInputPin::GetState() {
+  return state_;
+}
+
+void VirtualInputPin::SetState(bool state, bool notify) {
+  if (state == state_) return;
+  state_ = state;
+  if (notify) HandleGPIOInt();
+}
+
+void VirtualInputPin::Reset() {
+  state_ = false;
+  ResetState();
+}
+
+VirtualInputPin *FindVirtualInput(int id) {
+  for (auto *vin : s_vins) {
+    if (vin->id() == id) return vin;
+  }
+  return nullptr;
+}
+
+const std::vector<VirtualInputPin *> &GetVirtualInputs() {
+  return s_vins;
+}
+
+static void SetVirtualInputHandler(struct mg_rpc_request_info *ri,
+                                   void *cb_arg, struct mg_rpc_frame_info *fi,
+                                   struct mg_str args) {
+  int id = -1;
+  bool state = false, toggle = false;
+
+  json_scanf(args.p, args.len, ri->args_fmt, &id, &state, &toggle);
+
+  VirtualInputPin *vin = FindVirtualInput(id);
+  if (vin == nullptr) {
+    mg_rpc_send_errorf(ri, 400, "input not found");
+    return;
+  }
+  vin->SetState(toggle ? !vin->GetState() : state);
+  mg_rpc_send_responsef(ri, "{state: %B}", vin->GetState());
+
+  (void) cb_arg;
+  (void) fi;
+}
+
+bool VirtualInputRPCInit() {
+  mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.SetVirtualInput",
+                     "{id: %d, state: %B, toggle: %B}", SetVirtualInputHandler,
+                     NULL);
+  return true;
+}
+
+}  // namespace shelly
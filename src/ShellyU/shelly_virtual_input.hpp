@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "shelly_input.hpp"
+
+namespace shelly {
+
+// Input pin whose state is set programmatically instead of being read from
+// GPIO. Edges go through the same InputPin logic as on real hardware.
+class VirtualInputPin : public InputPin {
+ public:
+  VirtualInputPin(int id, int pin, bool enable_reset);
+  virtual ~VirtualInputPin();
+
+  // Input interface impl.
+  bool GetState() override;
+
+  // If notify is false, state is updated without generating an edge.
+  void SetState(bool state, bool notify = true);
+
+  // Sets state to off without an edge, cancels pending timers and forgets
+  // previous edges.
+  void Reset();
+
+ private:
+  bool state_ = false;
+
+  VirtualInputPin(const VirtualInputPin &other) = delete;
+};
+
+VirtualInputPin *FindVirtualInput(int id);
+const std::vector<VirtualInputPin *> &GetVirtualInputs();
+
+bool VirtualInputRPCInit();
+
+}  // namespace shelly
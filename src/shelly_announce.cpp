@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_announce.hpp"
+
+#include <cmath>
+#include <string>
+
+#include "mgos.h"
+
+#include "shelly_input.hpp"
+#include "shelly_main.hpp"
+
+#define ANNOUNCE_MAGIC_0 'S'
+#define ANNOUNCE_MAGIC_1 'A'
+#define ANNOUNCE_VERSION 1
+#define ANNOUNCE_MAX_ID 8
+
+namespace shelly {
+
+// Packet format, all integers are big-endian:
+//   0  'S' 'A'
+//   2  version
+//   3  flags: bit 0 - sent because of a change
+//   4  seq (4 bytes)
+//   8  uptime, seconds (4 bytes)
+//  12  id_len, device id (id_len bytes)
+// followed by records: type, component id, value length, value.
+enum class AnnounceRecord {
+  kOutput = 1,      // state (1 byte).
+  kInput = 2,       // state (1 byte).
+  kInputEvent = 3,  // last Input::Event (1 byte), number of events (2 bytes).
+  kPower = 4,       // W, float (4 bytes).
+  kEnergy = 5,      // Wh, float (4 bytes).
+  kFreeHeap = 6,    // bytes (4 bytes), component id is 0.
+};
+
+struct InputEventState {
+  uint8_t ev;
+  uint16_t count;
+};
+
+static bool s_enabled = false;
+static struct mg_connection *s_nc = nullptr;
+static uint32_t s_seq = 0;
+static int64_t s_last_sent = 0;
+static int64_t s_last_periodic = 0;
+static bool s_pending = false;
+static mgos_timer_id s_pending_timer_id = MGOS_INVALID_TIMER_ID;
+static InputEventState s_input_events[ANNOUNCE_MAX_ID + 1];
+static float s_last_power[ANNOUNCE_MAX_ID + 1];
+
+static void AppendU16(std::string *s, uint16_t v) {
+  s->push_back((char) (v >> 8));
+  s->push_back((char) (v & 0xff));
+}
+
+static void AppendU32(std::string *s, uint32_t v) {
+  AppendU16(s, v >> 16);
+  AppendU16(s, v & 0xffff);
+}
+
+static void AppendFloat(std::string *s, float v) {
+  uint32_t u;
+  memcpy(&u, &v, sizeof(u));
+  AppendU32(s, u);
+}
+
+static void AppendRecordHeader(std::string *s, AnnounceRecord type, int id,
+                               int len) {
+  s->push_back((char) type);
+  s->push_back((char) id);
+  s->push_back((char) len);
+}
+
+static void AnnounceConnHandler(struct mg_connection *nc, int ev,
+                                void *ev_data, void *user_data) {
+  if (ev == MG_EV_CLOSE && nc == s_nc) s_nc = nullptr;
+  (void) ev_data;
+  (void) user_data;
+}
+
+static void SendAnnouncement(bool changed) {
+  s_pending = false;
+  if (s_nc == nullptr) {
+    std::string addr =
+        std::string("udp://") + mgos_sys_config_get_announce_addr();
+    s_nc = mg_connect(mgos_get_mgr(), addr.c_str(), AnnounceConnHandler,
+                      nullptr);
+    if (s_nc == nullptr) {
+      LOG(LL_ERROR, ("Failed to connect to %s", addr.c_str()));
+      return;
+    }
+  }
+  const char *dev_id = mgos_sys_config_get_device_id();
+  std::string pkt;
+  pkt.reserve(128);
+  pkt.push_back(ANNOUNCE_MAGIC_0);
+  pkt.push_back(ANNOUNCE_MAGIC_1);
+  pkt.push_back(ANNOUNCE_VERSION);
+  pkt.push_back(changed ? 1 : 0);
+  AppendU32(&pkt, ++s_seq);
+  AppendU32(&pkt, (uint32_t) mgos_uptime());
+  pkt.push_back((char) strlen(dev_id));
+  pkt.append(dev_id);
+  for (int id = 1; id <= ANNOUNCE_MAX_ID; id++) {
+    Output *out = FindOutput(id);
+    if (out != nullptr) {
+      AppendRecordHeader(&pkt, AnnounceRecord::kOutput, id, 1);
+      pkt.push_back(out->GetState() ? 1 : 0);
+    }
+    Input *in = FindInput(id);
+    if (in != nullptr) {
+      AppendRecordHeader(&pkt, AnnounceRecord::kInput, id, 1);
+      pkt.push_back(in->GetState() ? 1 : 0);
+      const InputEventState &ies = s_input_events[id];
+      if (ies.count > 0) {
+        AppendRecordHeader(&pkt, AnnounceRecord::kInputEvent, id, 3);
+        pkt.push_back((char) ies.ev);
+        AppendU16(&pkt, ies.count);
+      }
+    }
+    PowerMeter *pm = FindPM(id);
+    if (pm != nullptr) {
+      auto power = pm->GetPowerW();
+      if (power.ok()) {
+        AppendRecordHeader(&pkt, AnnounceRecord::kPower, id, 4);
+        AppendFloat(&pkt, power.ValueOrDie());
+        s_last_power[id] = power.ValueOrDie();
+      }
+      auto energy = pm->GetEnergyWH();
+      if (energy.ok()) {
+        AppendRecordHeader(&pkt, AnnounceRecord::kEnergy, id, 4);
+        AppendFloat(&pkt, energy.ValueOrDie());
+      }
+    }
+  }
+  AppendRecordHeader(&pkt, AnnounceRecord::kFreeHeap, 0, 4);
+  AppendU32(&pkt, (uint32_t) mgos_get_free_heap_size());
+  mg_send(s_nc, pkt.data(), pkt.size());
+  s_last_sent = mgos_uptime_micros();
+}
+
+static void PendingTimerCB(void *arg) {
+  s_pending_timer_id = MGOS_INVALID_TIMER_ID;
+  if (s_pending) SendAnnouncement(true /* changed */);
+  (void) arg;
+}
+
+static void AnnounceStatusChanged() {
+  if (!s_enabled) return;
+  s_pending = true;
+  if (s_pending_timer_id != MGOS_INVALID_TIMER_ID) return;
+  // Rate limit: changes that come in quick succession are sent together.
+  int64_t min_interval = mgos_sys_config_get_announce_min_interval() * 1000;
+  int64_t since_last = mgos_uptime_micros() - s_last_sent;
+  int delay_ms = 0;
+  if (since_last < min_interval) {
+    delay_ms = (min_interval - since_last) / 1000;
+  }
+  // Deferred even with no delay, so all the effects of an event are
+  // included (e.g. input event and the output state change it causes).
+  s_pending_timer_id = mgos_set_timer(delay_ms, 0, PendingTimerCB, nullptr);
+}
+
+static void InputEventHandler(int in_id, Input::Event ev, bool state) {
+  InputEventState &ies = s_input_events[in_id];
+  if (ev != Input::Event::kChange) {
+    ies.ev = (uint8_t) ev;
+    ies.count++;
+  }
+  AnnounceStatusChanged();
+  (void) state;
+}
+
+static void AnnounceTimerCB(void *arg) {
+  float thr = mgos_sys_config_get_announce_power_thr();
+  for (int id = 1; id <= ANNOUNCE_MAX_ID; id++) {
+    PowerMeter *pm = FindPM(id);
+    if (pm == nullptr || thr <= 0) continue;
+    auto power = pm->GetPowerW();
+    if (power.ok() && std::fabs(power.ValueOrDie() - s_last_power[id]) >= thr) {
+      AnnounceStatusChanged();
+      break;
+    }
+  }
+  int64_t interval = mgos_sys_config_get_announce_interval() * 1000000LL;
+  int64_t now = mgos_uptime_micros();
+  if (interval > 0 && now - s_last_periodic >= interval) {
+    s_last_periodic = now;
+    SendAnnouncement(false /* changed */);
+  }
+  (void) arg;
+}
+
+bool AnnounceInit() {
+  if (!mgos_sys_config_get_announce_enable()) return true;
+  if (mgos_conf_str_empty(mgos_sys_config_get_announce_addr())) {
+    LOG(LL_ERROR, ("Announcement address is not set"));
+    return false;
+  }
+  s_enabled = true;
+  for (int id = 1; id <= ANNOUNCE_MAX_ID; id++) {
+    Input *in = FindInput(id);
+    if (in != nullptr) {
+      in->AddHandler([id](Input::Event ev, bool state) {
+        InputEventHandler(id, ev, state);
+      });
+    }
+    Output *out = FindOutput(id);
+    if (out != nullptr) {
+      out->AddHandler([](bool) { AnnounceStatusChanged(); });
+    }
+  }
+  mgos_set_timer(1000, MGOS_TIMER_REPEAT, AnnounceTimerCB, nullptr);
+  LOG(LL_INFO, ("Sending status to %s", mgos_sys_config_get_announce_addr()));
+  return true;
+}
+
+}  // namespace shelly
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+namespace shelly {
+
+// Status announcements: compact binary packets with output and input states,
+// input events and power, sent to a multicast group periodically and when
+// something changes, so the whole network can be monitored by one listener.
+// See tools/announce_listen.py for the format.
+
+bool AnnounceInit();
+
+}  // namespace shelly
@@ -0,0 +1,658 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_binding.hpp"
+
+#include <cmath>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mgos.h"
+#include "mgos_rpc.h"
+#if MG_NET_IF == MG_NET_IF_SOCKET
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#elif MG_NET_IF == MG_NET_IF_LWIP_LOW_LEVEL
+#include "lwip/igmp.h"
+#include "lwip/ip_addr.h"
+#endif
+
+#include "HAP.h"
+#include "HAPCrypto.h"
+
+#include "shelly_config_store.hpp"
+#include "shelly_input.hpp"
+#include "shelly_main.hpp"
+#include "shelly_switch.hpp"
+
+#define BIND_MAGIC_0 'S'
+#define BIND_MAGIC_1 'B'
+#define BIND_VERSION 2
+#define BIND_HDR_LEN 21
+#define BIND_MAC_LEN 16
+#define BIND_MAX_ID_LEN 48
+#define BIND_MAX_PENDING 8
+#define BIND_MAX_PEERS 16
+#define BIND_RETRY_BASE_MS 50
+// Time is not set before this (2020-01-01).
+#define BIND_MIN_TIME 1577836800
+
+namespace shelly {
+
+// Wire format, all integers are big-endian:
+//   0  'S' 'B'
+//   2  version
+//   3  type: 1 - command, 2 - ack
+//   4  flags: bit 0 - ack requested
+//   5  command: action (0 - off, 1 - on, 2 - toggle); ack: result (0 - ok)
+//   6  switch id
+//   7  src_len
+//   8  epoch (4 bytes), incremented and persisted at every boot
+//  12  seq (4 bytes), restarts at 1 in every epoch
+//  16  time (4 bytes), UNIX time when sent, 0 if not set
+//  20  dst_len
+//  21  src (src_len bytes), dst (dst_len bytes)
+//      HMAC-SHA512(key, all of the above), truncated to 16 bytes
+// dst is empty for unicast messages, device id or "*" for multicast.
+// Ack carries the epoch and seq of the command and src/dst swapped.
+//
+// Replay protection: receivers keep the last (epoch, seq) per sender and
+// only apply commands that are newer, so a captured command cannot be
+// applied again as long as the receiver remembers the sender. Commands are
+// also dropped if both sides have time set and the timestamp is off by more
+// than bind.max_skew, this covers receiver reboots and senders that have
+// been evicted from the peer table.
+
+enum class BindMsgType {
+  kCommand = 1,
+  kAck = 2,
+};
+
+enum class BindAction {
+  kOff = 0,
+  kOn = 1,
+  kToggle = 2,
+  kFollow = 3,  // Only in rules, sent as on or off.
+};
+
+struct BindRule {
+  int in_id;
+  Input::Event ev;
+  BindAction action;
+  std::string addr;  // udp://host:port
+  std::string dst;
+  int sw_id;
+};
+
+struct BindPending {
+  uint32_t seq;
+  bool want_ack;
+  int attempts;
+  int64_t first_sent;
+  std::string addr;
+  std::string data;
+  mgos_timer_id timer_id;
+};
+
+struct BindPeer {
+  uint32_t src_hash;
+  uint32_t epoch;
+  uint32_t seq;
+  int64_t last_seen;
+};
+
+enum class BindPeerCheck {
+  kNew = 0,
+  kDup = 1,    // Retry or repeat of the current or an earlier command.
+  kStale = 2,  // From an earlier epoch or too old.
+};
+
+struct BindStats {
+  uint32_t sent, acked, retries, failed;
+  uint32_t rx, rx_dup, rx_stale, rx_bad;
+  int64_t rtt_min, rtt_max, rtt_sum;
+  int64_t apply_max, apply_sum;
+};
+
+static std::vector<BindRule> s_rules;
+static std::vector<std::unique_ptr<BindPending>> s_pending;
+static std::vector<BindPeer> s_peers;
+static std::map<std::string, struct mg_connection *> s_conns;
+static uint32_t s_epoch = 0;
+static uint32_t s_seq = 0;
+static BindStats s_stats = {};
+
+static void PutU32(uint8_t *p, uint32_t v) {
+  p[0] = (v >> 24) & 0xff;
+  p[1] = (v >> 16) & 0xff;
+  p[2] = (v >> 8) & 0xff;
+  p[3] = v & 0xff;
+}
+
+static uint32_t GetU32(const uint8_t *p) {
+  return (((uint32_t) p[0]) << 24) | (((uint32_t) p[1]) << 16) |
+         (((uint32_t) p[2]) << 8) | p[3];
+}
+
+// FNV-1a, only used to key the peer table.
+static uint32_t HashStr(const char *p, size_t len) {
+  uint32_t h = 2166136261U;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ (uint8_t) p[i]) * 16777619U;
+  }
+  return h;
+}
+
+static void ComputeMAC(const uint8_t *data, size_t len, uint8_t *mac) {
+  const char *key = mgos_sys_config_get_bind_key();
+  uint8_t full_mac[HMAC_SHA512_BYTES];
+  HAP_hmac_sha512(full_mac, (const uint8_t *) key, strlen(key), data, len);
+  memcpy(mac, full_mac, BIND_MAC_LEN);
+}
+
+static bool CheckMAC(const uint8_t *data, size_t len, const uint8_t *mac) {
+  uint8_t exp_mac[BIND_MAC_LEN];
+  ComputeMAC(data, len, exp_mac);
+  uint8_t diff = 0;
+  for (int i = 0; i < BIND_MAC_LEN; i++) {
+    diff |= (exp_mac[i] ^ mac[i]);
+  }
+  return (diff == 0);
+}
+
+static std::string BuildMessage(BindMsgType type, uint8_t flags, int arg,
+                                int sw_id, uint32_t epoch, uint32_t seq,
+                                const std::string &src,
+                                const std::string &dst) {
+  std::string res(BIND_HDR_LEN, '\0');
+  uint8_t *p = (uint8_t *) &res[0];
+  p[0] = BIND_MAGIC_0;
+  p[1] = BIND_MAGIC_1;
+  p[2] = BIND_VERSION;
+  p[3] = (uint8_t) type;
+  p[4] = flags;
+  p[5] = (uint8_t) arg;
+  p[6] = (uint8_t) sw_id;
+  p[7] = (uint8_t) src.size();
+  double now = mg_time();
+  PutU32(p + 8, epoch);
+  PutU32(p + 12, seq);
+  PutU32(p + 16, (now >= BIND_MIN_TIME ? (uint32_t) now : 0));
+  p[20] = (uint8_t) dst.size();
+  res.append(src);
+  res.append(dst);
+  uint8_t mac[BIND_MAC_LEN];
+  ComputeMAC((const uint8_t *) res.data(), res.size(), mac);
+  res.append((const char *) mac, sizeof(mac));
+  return res;
+}
+
+static void BindTxHandler(struct mg_connection *nc, int ev, void *ev_data,
+                          void *user_data);
+
+static struct mg_connection *GetConn(const std::string &addr) {
+  auto it = s_conns.find(addr);
+  if (it != s_conns.end()) return it->second;
+  struct mg_connection *nc =
+      mg_connect(mgos_get_mgr(), addr.c_str(), BindTxHandler, nullptr);
+  if (nc == nullptr) {
+    LOG(LL_ERROR, ("Failed to connect to %s", addr.c_str()));
+    return nullptr;
+  }
+  s_conns[addr] = nc;
+  return nc;
+}
+
+static void RemovePending(BindPending *pm) {
+  if (pm->timer_id != MGOS_INVALID_TIMER_ID) {
+    mgos_clear_timer(pm->timer_id);
+  }
+  for (auto it = s_pending.begin(); it != s_pending.end(); it++) {
+    if (it->get() == pm) {
+      s_pending.erase(it);
+      break;
+    }
+  }
+}
+
+static void PendingTimerCB(void *arg);
+
+static void SendPending(BindPending *pm) {
+  struct mg_connection *nc = GetConn(pm->addr);
+  if (nc != nullptr) {
+    mg_send(nc, pm->data.data(), pm->data.size());
+  }
+  if (pm->attempts == 0) {
+    pm->first_sent = mgos_uptime_micros();
+    s_stats.sent++;
+  } else {
+    s_stats.retries++;
+  }
+  pm->attempts++;
+  if (!pm->want_ack &&
+      pm->attempts > mgos_sys_config_get_bind_mcast_repeat()) {
+    RemovePending(pm);
+    return;
+  }
+  // Timer either sends a repeat or gives up waiting for the ack.
+  pm->timer_id = mgos_set_timer(BIND_RETRY_BASE_MS << (pm->attempts - 1), 0,
+                                PendingTimerCB, pm);
+}
+
+static void PendingTimerCB(void *arg) {
+  BindPending *pm = static_cast<BindPending *>(arg);
+  pm->timer_id = MGOS_INVALID_TIMER_ID;
+  if (pm->want_ack && pm->attempts > mgos_sys_config_get_bind_retries()) {
+    LOG(LL_ERROR, ("%s: no ack for seq %u", pm->addr.c_str(),
+                   (unsigned) pm->seq));
+    s_stats.failed++;
+    RemovePending(pm);
+    return;
+  }
+  SendPending(pm);
+}
+
+static void HandleAck(const uint8_t *p) {
+  // Acks for an earlier epoch are stale and may be replayed.
+  if (GetU32(p + 8) != s_epoch) return;
+  uint32_t seq = GetU32(p + 12);
+  for (auto &pm : s_pending) {
+    if (pm->seq != seq || !pm->want_ack) continue;
+    int64_t rtt = mgos_uptime_micros() - pm->first_sent;
+    if (s_stats.acked == 0 || rtt < s_stats.rtt_min) s_stats.rtt_min = rtt;
+    if (rtt > s_stats.rtt_max) s_stats.rtt_max = rtt;
+    s_stats.rtt_sum += rtt;
+    s_stats.acked++;
+    if (p[5] != 0) {
+      LOG(LL_ERROR, ("%s: seq %u failed: %d", pm->addr.c_str(),
+                     (unsigned) seq, p[5]));
+      s_stats.failed++;
+    }
+    RemovePending(pm.get());
+    return;
+  }
+  // Late ack for a command that has already been acked or given up on.
+}
+
+static void SendCommand(const BindRule &r, bool state) {
+  BindAction action = r.action;
+  if (action == BindAction::kFollow) {
+    action = (state ? BindAction::kOn : BindAction::kOff);
+  }
+  bool want_ack = r.dst.empty();
+  std::unique_ptr<BindPending> pm(new BindPending());
+  pm->seq = ++s_seq;
+  pm->want_ack = want_ack;
+  pm->attempts = 0;
+  pm->first_sent = 0;
+  pm->addr = r.addr;
+  pm->timer_id = MGOS_INVALID_TIMER_ID;
+  pm->data = BuildMessage(BindMsgType::kCommand, (want_ack ? 1 : 0),
+                          (int) action, r.sw_id, s_epoch, pm->seq,
+                          mgos_sys_config_get_device_id(), r.dst);
+  if (s_pending.size() >= BIND_MAX_PENDING) {
+    LOG(LL_ERROR, ("Too many pending messages, dropping seq %u",
+                   (unsigned) s_pending.front()->seq));
+    s_stats.failed++;
+    RemovePending(s_pending.front().get());
+  }
+  BindPending *pmp = pm.get();
+  s_pending.emplace_back(std::move(pm));
+  SendPending(pmp);
+}
+
+static void InputEventHandler(int in_id, Input::Event ev, bool state) {
+  for (const auto &r : s_rules) {
+    if (r.in_id != in_id || r.ev != ev) continue;
+    SendCommand(r, state);
+  }
+}
+
+// Checks the message time against ours, if both are known.
+static bool CheckTime(uint32_t msg_time) {
+  int max_skew = mgos_sys_config_get_bind_max_skew();
+  double now = mg_time();
+  if (max_skew <= 0 || msg_time == 0 || now < BIND_MIN_TIME) return true;
+  return (std::fabs(now - msg_time) <= max_skew);
+}
+
+// Checks that the message is newer than the last one seen from the sender,
+// updates the peer table if it is.
+static BindPeerCheck CheckPeer(const char *src, size_t src_len, uint32_t epoch,
+                               uint32_t seq) {
+  uint32_t src_hash = HashStr(src, src_len);
+  int64_t now = mgos_uptime_micros();
+  BindPeer *oldest = nullptr;
+  for (auto &pe : s_peers) {
+    if (pe.src_hash == src_hash) {
+      // Epochs never go backwards, a message from an earlier one is
+      // a replay. Within an epoch, out of order or duplicate messages are
+      // dropped, retries of an older command after a newer one has been
+      // applied are stale.
+      if (epoch < pe.epoch) return BindPeerCheck::kStale;
+      if (epoch == pe.epoch && seq <= pe.seq) return BindPeerCheck::kDup;
+      pe.epoch = epoch;
+      pe.seq = seq;
+      pe.last_seen = now;
+      return BindPeerCheck::kNew;
+    }
+    if (oldest == nullptr || pe.last_seen < oldest->last_seen) oldest = &pe;
+  }
+  BindPeer npe = {src_hash, epoch, seq, now};
+  if (s_peers.size() < BIND_MAX_PEERS) {
+    s_peers.push_back(npe);
+  } else {
+    // Least recently seen peer is forgotten.
+    *oldest = npe;
+  }
+  return BindPeerCheck::kNew;
+}
+
+static int ApplyCommand(int sw_id, BindAction action) {
+  for (auto *c : g_comps) {
+    if (c->id() != sw_id) continue;
+    switch (c->type()) {
+      case Component::Type::kSwitch:
+      case Component::Type::kOutlet:
+      case Component::Type::kLock: {
+        ShellySwitch *sw = static_cast<ShellySwitch *>(c);
+        bool new_state = (action == BindAction::kOn);
+        if (action == BindAction::kToggle) new_state = !sw->GetState();
+        sw->SetState(new_state, "binding");
+        return 0;
+      }
+      default:
+        break;
+    }
+  }
+  return 1;
+}
+
+// Returns false if the message is not valid.
+static bool HandleMessage(struct mg_connection *nc, const uint8_t *p,
+                          size_t len) {
+  if (len < BIND_HDR_LEN + BIND_MAC_LEN || p[0] != BIND_MAGIC_0 ||
+      p[1] != BIND_MAGIC_1 || p[2] != BIND_VERSION) {
+    return false;
+  }
+  size_t src_len = p[7], dst_len = p[20];
+  size_t data_len = BIND_HDR_LEN + src_len + dst_len;
+  if (len != data_len + BIND_MAC_LEN) return false;
+  if (!CheckMAC(p, data_len, p + data_len)) return false;
+  const char *src = (const char *) p + BIND_HDR_LEN;
+  const char *dst = src + src_len;
+  const char *dev_id = mgos_sys_config_get_device_id();
+  if (src_len == strlen(dev_id) && strncmp(src, dev_id, src_len) == 0) {
+    // Our own multicast message.
+    return true;
+  }
+  if (dst_len > 0 && !(dst_len == 1 && dst[0] == '*') &&
+      !(dst_len == strlen(dev_id) && strncmp(dst, dev_id, dst_len) == 0)) {
+    return true;
+  }
+  switch (static_cast<BindMsgType>(p[3])) {
+    case BindMsgType::kCommand:
+      break;
+    case BindMsgType::kAck:
+      HandleAck(p);
+      return true;
+    default:
+      return false;
+  }
+  if (p[5] > (int) BindAction::kToggle) return false;
+  uint32_t epoch = GetU32(p + 8), seq = GetU32(p + 12);
+  int result = 0;
+  s_stats.rx++;
+  BindPeerCheck pc = BindPeerCheck::kStale;
+  if (CheckTime(GetU32(p + 16))) {
+    pc = CheckPeer(src, src_len, epoch, seq);
+  }
+  if (pc == BindPeerCheck::kStale) {
+    // Replayed, not acknowledged.
+    LOG(LL_ERROR, ("%.*s: stale message, epoch %u seq %u", (int) src_len, src,
+                   (unsigned) epoch, (unsigned) seq));
+    s_stats.rx_stale++;
+    return true;
+  }
+  if (pc == BindPeerCheck::kNew) {
+    int64_t start = mgos_uptime_micros();
+    result = ApplyCommand(p[6], static_cast<BindAction>(p[5]));
+    int64_t took = mgos_uptime_micros() - start;
+    if (took > s_stats.apply_max) s_stats.apply_max = took;
+    s_stats.apply_sum += took;
+    LOG(LL_INFO, ("%.*s: seq %u sw %d action %d -> %d", (int) src_len, src,
+                  (unsigned) seq, p[6], p[5], result));
+  } else {
+    // Duplicate, only needs to be acked again.
+    s_stats.rx_dup++;
+  }
+  if (p[4] & 1) {
+    std::string ack =
+        BuildMessage(BindMsgType::kAck, 0, result, p[6], epoch, seq,
+                     dev_id, std::string(src, src_len));
+    mg_send(nc, ack.data(), ack.size());
+  }
+  return true;
+}
+
+static void BindRxHandler(struct mg_connection *nc, int ev, void *ev_data,
+                          void *user_data) {
+  if (ev != MG_EV_RECV) return;
+  struct mbuf *io = &nc->recv_mbuf;
+  if (!HandleMessage(nc, (const uint8_t *) io->buf, io->len)) {
+    s_stats.rx_bad++;
+  }
+  mbuf_remove(io, io->len);
+  (void) ev_data;
+  (void) user_data;
+}
+
+static void BindTxHandler(struct mg_connection *nc, int ev, void *ev_data,
+                          void *user_data) {
+  switch (ev) {
+    case MG_EV_RECV: {
+      BindRxHandler(nc, ev, ev_data, user_data);
+      break;
+    }
+    case MG_EV_CLOSE: {
+      for (auto it = s_conns.begin(); it != s_conns.end(); it++) {
+        if (it->second == nc) {
+          s_conns.erase(it);
+          break;
+        }
+      }
+      break;
+    }
+  }
+}
+
+static bool JoinGroup(struct mg_connection *nc, const char *group) {
+#if MG_NET_IF == MG_NET_IF_SOCKET
+  struct ip_mreq mreq = {};
+  mreq.imr_multiaddr.s_addr = inet_addr(group);
+  mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+  return (setsockopt(nc->sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+                     sizeof(mreq)) == 0);
+#elif MG_NET_IF == MG_NET_IF_LWIP_LOW_LEVEL
+  ip_addr_t grp;
+  if (!ipaddr_aton(group, &grp)) return false;
+  return (igmp_joingroup(IP_ADDR_ANY, &grp) == ERR_OK);
+#else
+  (void) nc;
+  (void) group;
+  return false;
+#endif
+}
+
+static bool ParseEvent(const std::string &s, Input::Event *ev) {
+  for (int i = 0; i <= (int) Input::Event::kLong; i++) {
+    if (s == Input::EventName(static_cast<Input::Event>(i))) {
+      *ev = static_cast<Input::Event>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool ParseAction(const std::string &s, BindAction *action) {
+  static const char *names[] = {"off", "on", "toggle", "follow"};
+  for (int i = 0; i < (int) ARRAY_SIZE(names); i++) {
+    if (s == names[i]) {
+      *action = static_cast<BindAction>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+// <input>:<event>=<action>@<target>/<switch>
+static bool ParseRule(const std::string &s, BindRule *r) {
+  size_t colon = s.find(':'), eq = s.find('='), at = s.find('@');
+  size_t slash = s.rfind('/');
+  if (colon == std::string::npos || eq == std::string::npos ||
+      at == std::string::npos || slash == std::string::npos ||
+      !(colon < eq && eq < at && at < slash)) {
+    return false;
+  }
+  r->in_id = atoi(s.substr(0, colon).c_str());
+  if (!ParseEvent(s.substr(colon + 1, eq - colon - 1), &r->ev)) return false;
+  if (!ParseAction(s.substr(eq + 1, at - eq - 1), &r->action)) return false;
+  if (r->action == BindAction::kFollow && r->ev != Input::Event::kChange) {
+    return false;
+  }
+  std::string target = s.substr(at + 1, slash - at - 1);
+  r->sw_id = atoi(s.substr(slash + 1).c_str());
+  if (target.empty() || r->sw_id < 0 || r->sw_id > 255) return false;
+  char port[8];
+  snprintf(port, sizeof(port), "%d", mgos_sys_config_get_bind_port());
+  if (target.compare(0, 6, "mcast:") == 0) {
+    r->dst = target.substr(6);
+    if (r->dst.empty() || r->dst.size() > BIND_MAX_ID_LEN) return false;
+    r->addr = std::string("udp://") + mgos_sys_config_get_bind_mcast_group() +
+              ":" + port;
+  } else {
+    r->dst.clear();
+    r->addr = "udp://" + target;
+    if (target.find(':') == std::string::npos) {
+      r->addr.append(":").append(port);
+    }
+  }
+  return true;
+}
+
+static void GetBindingsHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                               struct mg_rpc_frame_info *fi,
+                               struct mg_str args) {
+  const BindStats &s = s_stats;
+  mg_rpc_send_responsef(
+      ri,
+      "{enable: %B, rules: %d, pending: %d, peers: %d, "
+      "sent: %u, acked: %u, retries: %u, failed: %u, "
+      "rx: %u, rx_dup: %u, rx_stale: %u, rx_bad: %u, "
+      "rtt_min_us: %lld, rtt_avg_us: %lld, rtt_max_us: %lld, "
+      "apply_avg_us: %lld, apply_max_us: %lld}",
+      mgos_sys_config_get_bind_enable(), (int) s_rules.size(),
+      (int) s_pending.size(), (int) s_peers.size(), (unsigned) s.sent,
+      (unsigned) s.acked, (unsigned) s.retries, (unsigned) s.failed,
+      (unsigned) s.rx, (unsigned) s.rx_dup, (unsigned) s.rx_stale,
+      (unsigned) s.rx_bad,
+      (long long) s.rtt_min,
+      (long long) (s.acked > 0 ? s.rtt_sum / s.acked : 0),
+      (long long) s.rtt_max,
+      (long long) (s.rx > s.rx_dup + s.rx_stale
+                       ? s.apply_sum / (s.rx - s.rx_dup - s.rx_stale)
+                       : 0),
+      (long long) s.apply_max);
+  (void) cb_arg;
+  (void) fi;
+  (void) args;
+}
+
+bool BindingsInit() {
+  mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.GetBindings", "",
+                     GetBindingsHandler, NULL);
+  if (!mgos_sys_config_get_bind_enable()) return true;
+  if (mgos_conf_str_empty(mgos_sys_config_get_bind_key())) {
+    LOG(LL_ERROR, ("Bindings require a key (bind.key)"));
+    return false;
+  }
+  if (strlen(mgos_sys_config_get_device_id()) > BIND_MAX_ID_LEN) {
+    LOG(LL_ERROR, ("Device id is too long"));
+    return false;
+  }
+  // Epoch must be on flash before anything is sent, so that it is never
+  // reused after a crash.
+  s_epoch = (uint32_t) mgos_sys_config_get_bind_epoch() + 1;
+  mgos_sys_config_set_bind_epoch(s_epoch);
+  SaveConfig("bind");
+  if (ConfigStoreFlush(false /* full */) < 0) {
+    LOG(LL_ERROR, ("Failed to save binding epoch"));
+    return false;
+  }
+  char listen_addr[16];
+  snprintf(listen_addr, sizeof(listen_addr), "udp://:%d",
+           mgos_sys_config_get_bind_port());
+  struct mg_connection *lc =
+      mg_bind(mgos_get_mgr(), listen_addr, BindRxHandler, nullptr);
+  if (lc == nullptr) {
+    LOG(LL_ERROR, ("Failed to listen on %s", listen_addr));
+    return false;
+  }
+  const char *group = mgos_sys_config_get_bind_mcast_group();
+  if (!mgos_conf_str_empty(group) && !JoinGroup(lc, group)) {
+    LOG(LL_ERROR, ("Failed to join %s", group));
+  }
+  std::string rules(mgos_sys_config_get_bind_rules()
+                        ? mgos_sys_config_get_bind_rules()
+                        : "");
+  size_t start = 0;
+  while (start < rules.size()) {
+    size_t end = rules.find(';', start);
+    if (end == std::string::npos) end = rules.size();
+    std::string rs = rules.substr(start, end - start);
+    start = end + 1;
+    if (rs.empty()) continue;
+    BindRule r;
+    if (!ParseRule(rs, &r)) {
+      LOG(LL_ERROR, ("Invalid binding rule '%s'", rs.c_str()));
+      continue;
+    }
+    Input *in = FindInput(r.in_id);
+    if (in == nullptr) {
+      LOG(LL_ERROR, ("Invalid binding rule '%s'", rs.c_str()));
+      continue;
+    }
+    bool have_handler = false;
+    for (const auto &r2 : s_rules) {
+      if (r2.in_id == r.in_id) have_handler = true;
+    }
+    if (!have_handler) {
+      int in_id = r.in_id;
+      in->AddHandler([in_id](Input::Event ev, bool state) {
+        InputEventHandler(in_id, ev, state);
+      });
+    }
+    s_rules.push_back(r);
+  }
+  LOG(LL_INFO,
+      ("Listening on %s, %d rules", listen_addr, (int) s_rules.size()));
+  return true;
+}
+
+}  // namespace shelly
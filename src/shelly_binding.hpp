@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+namespace shelly {
+
+// Device-to-device bindings: input events on this device are sent as signed
+// UDP messages to other devices, which apply them to their switches.
+//
+// Rules are configured in bind.rules as a semicolon-separated list of
+//   <input>:<event>=<action>@<target>/<switch>
+// where event is change, single, double or long, action is on, off, toggle
+// or follow (input state, for change events) and target is host[:port]
+// (unicast, acknowledged and retried) or mcast:<device_id> (multicast,
+// repeated, device_id can be * to address all devices).
+// Example: 1:single=toggle@192.168.1.20/1;1:long=off@mcast:*/1
+
+bool BindingsInit();
+
+}  // namespace shelly
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_clock.hpp"
+
+#include <map>
+#include <utility>
+
+#include "mgos.h"
+
+// Real timer ids are addresses of timer records and are aligned, virtual
+// timer ids are odd so the two never clash.
+#define VIRTUAL_TIMER_ID_BASE 1
+#define VIRTUAL_TIMER_ID_STEP 2
+
+namespace shelly {
+
+struct VirtualTimer {
+  mgos_timer_id id;
+  int msecs;
+  int flags;
+  timer_callback cb;
+  void *arg;
+};
+
+static bool s_virtual = false;
+static int64_t s_virtual_now = 0;
+static mgos_timer_id s_next_id = VIRTUAL_TIMER_ID_BASE;
+// Keyed by (due time, id), which keeps order of timers due at the same time.
+static std::map<std::pair<int64_t, mgos_timer_id>, VirtualTimer> s_timers;
+
+double ClockUptime() {
+  if (s_virtual) return s_virtual_now / 1000000.0;
+  return mgos_uptime();
+}
+
+int64_t ClockUptimeMicros() {
+  if (s_virtual) return s_virtual_now;
+  return mgos_uptime_micros();
+}
+
+mgos_timer_id ClockSetTimer(int msecs, int flags, timer_callback cb,
+                            void *arg) {
+  if (!s_virtual) return mgos_set_timer(msecs, flags, cb, arg);
+  if (msecs < 0) msecs = 0;
+  // A repeating timer with no period would fire forever.
+  if ((flags & MGOS_TIMER_REPEAT) && msecs < 1) msecs = 1;
+  VirtualTimer t = {s_next_id, msecs, flags, cb, arg};
+  s_next_id += VIRTUAL_TIMER_ID_STEP;
+  s_timers[std::make_pair(s_virtual_now + msecs * 1000LL, t.id)] = t;
+  return t.id;
+}
+
+void ClockClearTimer(mgos_timer_id id) {
+  if (id == MGOS_INVALID_TIMER_ID) return;
+  // Timers may have been set before switching to or from virtual time,
+  // so the id is checked against pending virtual timers first.
+  for (auto it = s_timers.begin(); it != s_timers.end(); it++) {
+    if (it->second.id == id) {
+      s_timers.erase(it);
+      return;
+    }
+  }
+  if (id & 1) return;  // Virtual timer that has already fired.
+  mgos_clear_timer(id);
+}
+
+void ClockSetVirtual(bool enable, int64_t now_micros) {
+  s_timers.clear();
+  s_virtual = enable;
+  s_virtual_now = now_micros;
+}
+
+bool ClockIsVirtual() {
+  return s_virtual;
+}
+
+void ClockAdvance(int64_t until_micros) {
+  if (!s_virtual) return;
+  while (!s_timers.empty() && s_timers.begin()->first.first <= until_micros) {
+    auto it = s_timers.begin();
+    VirtualTimer t = it->second;
+    s_virtual_now = it->first.first;
+    s_timers.erase(it);
+    if (t.flags & MGOS_TIMER_REPEAT) {
+      s_timers[std::make_pair(s_virtual_now + t.msecs * 1000LL, t.id)] = t;
+    }
+    t.cb(t.arg);
+  }
+  if (until_micros > s_virtual_now) s_virtual_now = until_micros;
+}
+
+int64_t ClockNextTimerMicros() {
+  if (s_timers.empty()) return -1;
+  return s_timers.begin()->first.first;
+}
+
+int ClockNumPendingTimers() {
+  return (int) s_timers.size();
+}
+
+}  // namespace shelly
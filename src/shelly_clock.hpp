@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "mgos_timers.h"
+
+namespace shelly {
+
+// Time and timers used by components. Normally these are the mgos ones,
+// but the clock can be switched to virtual time, in which case timers only
+// fire when time is advanced explicitly. This is used to replay traces.
+
+double ClockUptime();
+int64_t ClockUptimeMicros();
+
+mgos_timer_id ClockSetTimer(int msecs, int flags, timer_callback cb,
+                            void *arg);
+void ClockClearTimer(mgos_timer_id id);
+
+// Switches to virtual time, starting at now_micros. Pending virtual timers
+// are dropped when switching back.
+void ClockSetVirtual(bool enable, int64_t now_micros = 0);
+bool ClockIsVirtual();
+
+// Advances virtual time, firing due timers in order.
+void ClockAdvance(int64_t until_micros);
+
+// Due time of the next virtual timer, -1 if none.
+int64_t ClockNextTimerMicros();
+
+// Number of virtual timers pending.
+int ClockNumPendingTimers();
+
+}  // namespace shelly
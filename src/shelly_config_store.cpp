@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_config_store.hpp"
+
+#include <cstring>
+#include <string>
+
+#include "common/cs_crc32.h"
+#include "common/cs_file.h"
+#include "mgos.h"
+#include "mgos_config_util.h"
+
+#include "shelly_fs_stats.hpp"
+
+#define CONFIG_FILE_NAME "conf9.json"
+#define CONFIG_OVERLAY_FILE_NAME "conf9_delta.json"
+// When the overlay would grow beyond this, config is saved in full instead.
+#define CONFIG_OVERLAY_MAX_SIZE 1024
+
+namespace shelly {
+
+// Config as persisted: config file with the overlay applied.
+static struct mgos_config s_persisted;
+static int s_overlay_size = 0;
+static uint32_t s_overlay_base = 0;
+static const char *s_pending_source = nullptr;
+static mgos_timer_id s_save_timer_id = MGOS_INVALID_TIMER_ID;
+static int s_batch_depth = 0;
+static const char *s_batch_source = nullptr;
+
+// Top-level sections that are only read by the app, after the overlay has
+// been applied.
+static const char *s_app_sections[] = {
+    "announce", "bench", "bind",    "eve", "log",
+    "shelly",   "ssw",   "sw",      "wc",  "webhook",
+};
+
+// CRC of the config file, overlay is only valid on top of the file it was
+// started with. If the file is saved in full by something else
+// (e.g. Config.Save RPC), the overlay is stale.
+static uint32_t GetConfigFileCRC() {
+  size_t size = 0;
+  char *data = cs_read_file(CONFIG_FILE_NAME, &size);
+  if (data == nullptr) return 0;
+  uint32_t crc = cs_crc32(0, data, size);
+  free(data);
+  return crc;
+}
+
+static void ResetOverlay() {
+  remove(CONFIG_OVERLAY_FILE_NAME);
+  s_overlay_size = 0;
+}
+
+static void SetPersisted() {
+  mgos_conf_free(mgos_config_schema(), &s_persisted);
+  memset(&s_persisted, 0, sizeof(s_persisted));
+  mgos_conf_copy(mgos_config_schema(), &mgos_sys_config, &s_persisted);
+}
+
+static void CheckSectionCB(void *data, const char *name, size_t name_len,
+                           const char *path, const struct json_token *tok) {
+  bool *app_only = static_cast<bool *>(data);
+  if (tok->type == JSON_TYPE_OBJECT_START ||
+      tok->type == JSON_TYPE_OBJECT_END || path[0] != '.') {
+    return;
+  }
+  const char *sect = path + 1;
+  const char *end = strchr(sect, '.');
+  size_t sect_len = (end != nullptr ? end - sect : strlen(sect));
+  for (const char *as : s_app_sections) {
+    size_t as_len = strlen(as);
+    // Prefix match: sw1, swg, ssw1, wc1, ...
+    if (sect_len >= as_len && strncmp(sect, as, as_len) == 0) return;
+  }
+  *app_only = false;
+  (void) name;
+  (void) name_len;
+}
+
+static int SaveFull() {
+  if (!mgos_sys_config_save(&mgos_sys_config, false /* try_once */,
+                            NULL /* msg */)) {
+    return -1;
+  }
+  ResetOverlay();
+  SetPersisted();
+  size_t size = 0;
+  char *data = cs_read_file(CONFIG_FILE_NAME, &size);
+  free(data);
+  return (int) size;
+}
+
+static int AppendOverlay(const struct mg_str diff) {
+  uint32_t crc = GetConfigFileCRC();
+  if (s_overlay_size > 0 && crc != s_overlay_base) {
+    LOG(LL_INFO, ("Config file changed, starting new overlay"));
+    ResetOverlay();
+  }
+  FILE *fp = fopen(CONFIG_OVERLAY_FILE_NAME, "a");
+  if (fp == nullptr) return -1;
+  int len = 0;
+  if (s_overlay_size == 0) {
+    s_overlay_base = crc;
+    len += fprintf(fp, "{\"base\": %u}\n", (unsigned) crc);
+  }
+  len += fwrite(diff.p, 1, diff.len, fp);
+  len += fwrite("\n", 1, 1, fp);
+  if (fclose(fp) != 0) return -1;
+  s_overlay_size += len;
+  mgos_conf_parse(diff, "*", mgos_config_schema(), &s_persisted);
+  return len;
+}
+
+int ConfigStoreFlush(bool full, const char *source) {
+  if (s_pending_source != nullptr) source = s_pending_source;
+  if (source == nullptr) source = "other";
+  s_pending_source = nullptr;
+  if (s_save_timer_id != MGOS_INVALID_TIMER_ID) {
+    mgos_clear_timer(s_save_timer_id);
+    s_save_timer_id = MGOS_INVALID_TIMER_ID;
+  }
+  int64_t start = mgos_uptime_micros();
+  struct mbuf diff;
+  mbuf_init(&diff, 0);
+  if (!full) {
+    mgos_conf_emit_cb(&mgos_sys_config, &s_persisted, mgos_config_schema(),
+                      false /* pretty */, &diff, NULL, NULL);
+    bool app_only = true;
+    json_walk(diff.buf, diff.len, CheckSectionCB, &app_only);
+    if (!app_only ||
+        s_overlay_size + (int) diff.len + 1 > CONFIG_OVERLAY_MAX_SIZE) {
+      full = true;
+    }
+  }
+  int res;
+  if (full) {
+    res = SaveFull();
+  } else if (diff.len <= 2) {  // {}
+    res = 0;
+  } else {
+    res = AppendOverlay(mg_mk_str_n(diff.buf, diff.len));
+  }
+  mbuf_free(&diff);
+  if (res > 0) {
+    FSStatsRecordWrite((full ? CONFIG_FILE_NAME : CONFIG_OVERLAY_FILE_NAME),
+                       source, res, mgos_uptime_micros() - start);
+  }
+  return res;
+}
+
+static void SaveTimerCB(void *arg) {
+  s_save_timer_id = MGOS_INVALID_TIMER_ID;
+  ConfigStoreFlush(false /* full */);
+  (void) arg;
+}
+
+void SaveConfig(const char *source) {
+  if (s_batch_depth > 0) {
+    if (s_batch_source == nullptr) s_batch_source = source;
+    return;
+  }
+  int delay_ms = mgos_sys_config_get_shelly_cfg_save_delay();
+  if (s_pending_source == nullptr) s_pending_source = source;
+  if (delay_ms <= 0) {
+    ConfigStoreFlush(false /* full */);
+    return;
+  }
+  if (s_save_timer_id != MGOS_INVALID_TIMER_ID) return;
+  s_save_timer_id = mgos_set_timer(delay_ms, 0, SaveTimerCB, nullptr);
+}
+
+ConfigSaveBatch::ConfigSaveBatch() {
+  s_batch_depth++;
+}
+
+ConfigSaveBatch::~ConfigSaveBatch() {
+  if (--s_batch_depth > 0 || s_batch_source == nullptr) return;
+  const char *source = s_batch_source;
+  s_batch_source = nullptr;
+  SaveConfig(source);
+}
+
+static void RebootCB(int ev, void *ev_data, void *userdata) {
+  if (s_save_timer_id != MGOS_INVALID_TIMER_ID) {
+    ConfigStoreFlush(false /* full */);
+  }
+  (void) ev;
+  (void) ev_data;
+  (void) userdata;
+}
+
+// Returns false if the overlay is damaged and needs to be merged.
+static bool LoadOverlay() {
+  size_t size = 0;
+  char *data = cs_read_file(CONFIG_OVERLAY_FILE_NAME, &size);
+  if (data == nullptr) return true;
+  unsigned base = 0;
+  const char *eol = (const char *) memchr(data, '\n', size);
+  if (eol == nullptr ||
+      json_scanf(data, eol - data, "{base: %u}", &base) != 1 ||
+      base != GetConfigFileCRC()) {
+    LOG(LL_INFO, ("Config overlay is stale, ignored"));
+    free(data);
+    ResetOverlay();
+    return true;
+  }
+  bool ok = true;
+  int num_entries = 0;
+  for (const char *p = eol + 1; p < data + size;) {
+    eol = (const char *) memchr(p, '\n', data + size - p);
+    // Incomplete last line means the write was interrupted.
+    if (eol == nullptr ||
+        !mgos_conf_parse(mg_mk_str_n(p, eol - p), "*", mgos_config_schema(),
+                         &mgos_sys_config)) {
+      ok = false;
+      break;
+    }
+    num_entries++;
+    p = eol + 1;
+  }
+  s_overlay_base = base;
+  s_overlay_size = size;
+  LOG(LL_INFO, ("Applied %d config overlay entries", num_entries));
+  free(data);
+  return ok;
+}
+
+bool ConfigStoreInit() {
+  bool overlay_ok = LoadOverlay();
+  SetPersisted();
+  if (!overlay_ok) {
+    LOG(LL_ERROR, ("Config overlay is damaged, merging"));
+    SaveFull();
+  }
+  mgos_event_add_handler(MGOS_EVENT_REBOOT, RebootCB, nullptr);
+  return true;
+}
+
+}  // namespace shelly
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+namespace shelly {
+
+// Config persistence. Instead of rewriting the whole config file on every
+// change, changed settings are appended to a small overlay file, which is
+// applied on top of the config at boot and merged into the config file
+// when it grows too big. Changes made within shelly.cfg_save_delay ms are
+// written together.
+//
+// Settings read by libraries before the app is initialized (e.g. wifi) are
+// always saved in full, as the overlay is applied too late for them.
+
+bool ConfigStoreInit();
+
+// Persists config changes, source is what triggered the change (for
+// filesystem write statistics).
+void SaveConfig(const char *source);
+
+// Saves requested while a batch exists are done once, when the last batch is
+// destroyed. For changes that persist several settings at once, such as
+// switching an output group.
+class ConfigSaveBatch {
+ public:
+  ConfigSaveBatch();
+  ~ConfigSaveBatch();
+
+ private:
+  ConfigSaveBatch(const ConfigSaveBatch &other) = delete;
+};
+
+// Writes pending changes now: to the overlay or, if full is set, to the
+// config file. source is used if no save is pending. Returns number of bytes
+// written, -1 on error.
+int ConfigStoreFlush(bool full, const char *source = nullptr);
+
+}  // namespace shelly
@@ -23,6 +23,9 @@
 #include "HAPAccessoryServer+Internal.h"
 #include "HAPPlatformTCPStreamManager+Init.h"
 
+#include "shelly_hap_stats.hpp"
+#include "shelly_main.hpp"
+
 static HAPPlatformKeyValueStoreRef s_kvs;
 static HAPPlatformTCPStreamManagerRef s_tcpm;
 
@@ -38,23 +41,26 @@ void shelly_debug_write_nc(struct mg_connection *nc) {
             "Uptime: %.2lf\r\n"
             "RAM: %lu free, %lu min free\r\n"
             "HAP config number: %u\r\n"
-            "HAP connection stats: %u/%u/%u\r\n",
+            "HAP connection stats: %u/%u/%u, %u evicted\r\n",
             MGOS_APP, mgos_sys_ro_vars_get_fw_version(),
             mgos_sys_ro_vars_get_fw_id(), mgos_uptime(),
             (unsigned long) mgos_get_free_heap_size(),
             (unsigned long) mgos_get_min_free_heap_size(), cn,
             (unsigned) tcpm_stats.numPendingTCPStreams,
             (unsigned) tcpm_stats.numActiveTCPStreams,
-            (unsigned) tcpm_stats.maxNumTCPStreams);
+            (unsigned) tcpm_stats.maxNumTCPStreams,
+            (unsigned) shelly::GetNumHAPSessionEvictions());
+  shelly::HAPStatsWriteNC(nc);
   mg_printf(nc, "HAP connections:\r\n");
   time_t now_wall = mg_time();
   int64_t now_micros = mgos_uptime_micros();
+  uint16_t hap_port = HAPPlatformTCPStreamManagerGetListenerPort(s_tcpm);
   int num_hap_connections = 0;
   struct mg_connection *nc2 = NULL;
   struct mg_mgr *mgr = mgos_get_mgr();
   for (nc2 = mg_next(mgr, NULL); nc2 != NULL; nc2 = mg_next(mgr, nc2)) {
     if (nc2->listener == NULL ||
-        ntohs(nc2->listener->sa.sin.sin_port) != 9000) {
+        ntohs(nc2->listener->sa.sin.sin_port) != hap_port) {
       continue;
     }
     char addr[32];
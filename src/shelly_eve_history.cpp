@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_eve_history.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/cs_crc32.h"
+#include "mgos.h"
+
+#include "shelly_fs_stats.hpp"
+#include "shelly_main.hpp"
+
+#define EVE_HISTORY_VERSION 1
+#define EVE_HISTORY_HDR_SIZE 16
+#define EVE_HISTORY_REC_SIZE 8
+#define EVE_HISTORY_MAX_ID 4
+#define EVE_HISTORY_MAX_FILES 16
+// Time is not set before this (2020-01-01).
+#define EVE_HISTORY_MIN_TIME 1577836800
+
+namespace shelly {
+
+static std::vector<std::unique_ptr<EveHistory>> s_hists;
+
+static void PutU16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+static void PutU32(uint8_t *p, uint32_t v) {
+  PutU16(p, v & 0xffff);
+  PutU16(p + 2, v >> 16);
+}
+
+static uint16_t GetU16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t GetU32(const uint8_t *p) {
+  return GetU16(p) | ((uint32_t) GetU16(p + 2) << 16);
+}
+
+static std::string FileName(int id, int k) {
+  char name[16];
+  snprintf(name, sizeof(name), "eve%d_%d.bin", id, k);
+  return name;
+}
+
+static uint32_t FileFirstSeq(uint32_t seq) {
+  return ((seq - 1) / EVE_HISTORY_FILE_RECS) * EVE_HISTORY_FILE_RECS + 1;
+}
+
+static void EncodeRecord(const EveHistoryRecord &r, uint8_t *p) {
+  PutU32(p, r.time);
+  PutU16(p + 4, r.power_dw);
+  p[6] = r.flags;
+  p[7] = cs_crc32(0, p, 7) & 0xff;
+}
+
+static bool DecodeRecord(const uint8_t *p, EveHistoryRecord *r) {
+  if ((cs_crc32(0, p, 7) & 0xff) != p[7]) return false;
+  r->time = GetU32(p);
+  r->power_dw = GetU16(p + 4);
+  r->flags = p[6];
+  return true;
+}
+
+// Returns first_seq and ref_time from the header, 0 if not valid.
+static uint32_t ReadHeader(FILE *fp, uint32_t *ref_time) {
+  uint8_t hdr[EVE_HISTORY_HDR_SIZE];
+  if (fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr)) return 0;
+  if (hdr[0] != 'E' || hdr[1] != 'H' || hdr[2] != EVE_HISTORY_VERSION ||
+      GetU32(hdr + 12) != cs_crc32(0, hdr, 12)) {
+    return 0;
+  }
+  uint32_t first_seq = GetU32(hdr + 4);
+  if (first_seq == 0 || FileFirstSeq(first_seq) != first_seq) return 0;
+  *ref_time = GetU32(hdr + 8);
+  return first_seq;
+}
+
+EveHistory::EveHistory(int id, PowerMeter *pm, Output *out, int num_files,
+                       int flush_records)
+    : id_(id),
+      pm_(pm),
+      out_(out),
+      num_files_(num_files),
+      flush_records_(flush_records) {
+}
+
+EveHistory::~EveHistory() {
+}
+
+int EveHistory::id() const {
+  return id_;
+}
+
+uint32_t EveHistory::ref_time() const {
+  return ref_time_;
+}
+
+uint32_t EveHistory::first_seq() const {
+  return first_seq_;
+}
+
+uint32_t EveHistory::last_seq() const {
+  return next_seq_ - 1;
+}
+
+int EveHistory::capacity() const {
+  return num_files_ * EVE_HISTORY_FILE_RECS;
+}
+
+int EveHistory::FileIndex(uint32_t seq) const {
+  return ((seq - 1) / EVE_HISTORY_FILE_RECS) % num_files_;
+}
+
+bool EveHistory::ScanFile(int k, uint32_t *first_seq, int *count,
+                          bool *torn) {
+  FILE *fp = fopen(FileName(id_, k).c_str(), "rb");
+  if (fp == nullptr) return false;
+  uint32_t ref_time = 0;
+  *first_seq = ReadHeader(fp, &ref_time);
+  *count = 0;
+  *torn = false;
+  if (*first_seq != 0 && FileIndex(*first_seq) == k) {
+    if (ref_time_ == 0) ref_time_ = ref_time;
+    uint8_t rec[EVE_HISTORY_REC_SIZE];
+    EveHistoryRecord r;
+    size_t n;
+    while (*count < EVE_HISTORY_FILE_RECS &&
+           (n = fread(rec, 1, sizeof(rec), fp)) > 0) {
+      if (n != sizeof(rec) || !DecodeRecord(rec, &r)) {
+        *torn = true;
+        break;
+      }
+      (*count)++;
+    }
+  }
+  fclose(fp);
+  return (*count > 0);
+}
+
+// Moves records of the file seq_to is in, up to seq_to, back to RAM,
+// so that the file is written again from the start.
+bool EveHistory::LoadFileHead(uint32_t seq_to) {
+  uint32_t seq = FileFirstSeq(seq_to);
+  if (seq == seq_to) return true;
+  std::vector<EveHistoryRecord> head(seq_to - seq);
+  int n = 0;
+  while (n < (int) head.size()) {
+    int nr = Read(seq + n, head.data() + n, head.size() - n);
+    if (nr <= 0) return false;
+    n += nr;
+  }
+  pending_.insert(pending_.begin(), head.begin(), head.end());
+  pending_seq_ = seq;
+  return true;
+}
+
+void EveHistory::Init() {
+  uint32_t last_seq = 0;
+  bool last_torn = false;
+  std::vector<uint32_t> first_seqs;
+  for (int k = 0; k < num_files_; k++) {
+    uint32_t first_seq;
+    int count;
+    bool torn;
+    if (!ScanFile(k, &first_seq, &count, &torn)) continue;
+    first_seqs.push_back(first_seq);
+    if (first_seq + count - 1 > last_seq) {
+      last_seq = first_seq + count - 1;
+      last_torn = torn;
+    }
+  }
+  next_seq_ = pending_seq_ = last_seq + 1;
+  for (uint32_t first_seq : first_seqs) {
+    // Left over from an earlier round.
+    if (first_seq + capacity() <= last_seq) continue;
+    if (first_seq_ == 0 || first_seq < first_seq_) first_seq_ = first_seq;
+  }
+  // Don't append after a partially written record.
+  if (last_torn) LoadFileHead(next_seq_);
+  mgos_set_timer(EVE_HISTORY_INTERVAL * 1000, MGOS_TIMER_REPEAT, SampleTimerCB,
+                 this);
+  LOG(LL_INFO, ("%d: Eve history %u - %u", id_, (unsigned) first_seq_,
+                (unsigned) last_seq));
+}
+
+int EveHistory::Read(uint32_t seq, EveHistoryRecord *recs, int max) {
+  int n = 0;
+  FILE *fp = nullptr;
+  int fp_k = -1;
+  for (; n < max && seq < next_seq_; n++, seq++) {
+    EveHistoryRecord &r = recs[n];
+    r = {};
+    if (seq < first_seq_) continue;
+    if (seq >= pending_seq_) {
+      r = pending_[seq - pending_seq_];
+      continue;
+    }
+    int k = FileIndex(seq);
+    if (k != fp_k) {
+      if (fp != nullptr) fclose(fp);
+      fp = fopen(FileName(id_, k).c_str(), "rb");
+      fp_k = k;
+      // The file may still hold an earlier round if writing it failed.
+      uint32_t ref_time;
+      if (fp != nullptr && ReadHeader(fp, &ref_time) != FileFirstSeq(seq)) {
+        fclose(fp);
+        fp = nullptr;
+      }
+    }
+    uint8_t rec[EVE_HISTORY_REC_SIZE];
+    long off = EVE_HISTORY_HDR_SIZE +
+               ((seq - 1) % EVE_HISTORY_FILE_RECS) * EVE_HISTORY_REC_SIZE;
+    if (fp == nullptr || fseek(fp, off, SEEK_SET) != 0 ||
+        fread(rec, 1, sizeof(rec), fp) != sizeof(rec) ||
+        !DecodeRecord(rec, &r)) {
+      r = {};
+    }
+  }
+  if (fp != nullptr) fclose(fp);
+  return n;
+}
+
+void EveHistory::Flush() {
+  while (!pending_.empty()) {
+    int64_t start = mgos_uptime_micros();
+    uint32_t seq = pending_seq_;
+    int off = (seq - 1) % EVE_HISTORY_FILE_RECS;
+    int n = std::min((int) pending_.size(), EVE_HISTORY_FILE_RECS - off);
+    std::string data;
+    if (off == 0) {
+      uint8_t hdr[EVE_HISTORY_HDR_SIZE] = {'E', 'H', EVE_HISTORY_VERSION, 0};
+      PutU32(hdr + 4, seq);
+      PutU32(hdr + 8, ref_time_);
+      PutU32(hdr + 12, cs_crc32(0, hdr, 12));
+      data.append((const char *) hdr, sizeof(hdr));
+    }
+    for (int i = 0; i < n; i++) {
+      uint8_t rec[EVE_HISTORY_REC_SIZE];
+      EncodeRecord(pending_[i], rec);
+      data.append((const char *) rec, sizeof(rec));
+    }
+    std::string file_name = FileName(id_, FileIndex(seq));
+    FILE *fp = fopen(file_name.c_str(), (off == 0 ? "wb" : "ab"));
+    bool ok = (fp != nullptr);
+    if (ok) {
+      ok = (fwrite(data.data(), 1, data.size(), fp) == data.size());
+      ok = (fclose(fp) == 0) && ok;
+    }
+    if (!ok) {
+      LOG(LL_ERROR, ("Failed to write %s", file_name.c_str()));
+      // File may end with a partial record now, write it in full next time.
+      LoadFileHead(pending_seq_);
+      return;
+    }
+    if (off == 0) {
+      // Records that were in this file are gone.
+      uint32_t keep = (num_files_ - 1) * EVE_HISTORY_FILE_RECS;
+      if (seq > keep && first_seq_ < seq - keep) first_seq_ = seq - keep;
+    }
+    pending_.erase(pending_.begin(), pending_.begin() + n);
+    pending_seq_ += n;
+    FSStatsRecordWrite(file_name.c_str(), "eve", data.size(),
+                       mgos_uptime_micros() - start);
+  }
+}
+
+void EveHistory::Sample() {
+  double now = mg_time();
+  if (now < EVE_HISTORY_MIN_TIME) return;
+  // Average power over the interval, from the energy counter.
+  float power = -1;
+  auto energy = pm_->GetEnergyWH();
+  if (energy.ok()) {
+    float e = energy.ValueOrDie();
+    if (last_energy_ >= 0 && e >= last_energy_ && now > last_sample_time_) {
+      power = (e - last_energy_) * 3600 / (now - last_sample_time_);
+    }
+    last_energy_ = e;
+  }
+  last_sample_time_ = now;
+  if (power < 0) {
+    auto p = pm_->GetPowerW();
+    power = (p.ok() ? p.ValueOrDie() : 0);
+  }
+  // Writes keep failing, don't grow indefinitely.
+  if (pending_.size() >= 2 * EVE_HISTORY_FILE_RECS) return;
+  EveHistoryRecord r = {};
+  r.time = (uint32_t) now;
+  r.power_dw = std::min(std::max(power * 10, 0.0f), 65535.0f);
+  r.flags = (out_ != nullptr && out_->GetState() ? 1 : 0);
+  if (ref_time_ == 0) ref_time_ = r.time;
+  if (first_seq_ == 0) first_seq_ = next_seq_;
+  pending_.push_back(r);
+  next_seq_++;
+  if ((int) pending_.size() >= flush_records_) Flush();
+}
+
+// static
+void EveHistory::SampleTimerCB(void *arg) {
+  static_cast<EveHistory *>(arg)->Sample();
+}
+
+static void RebootCB(int ev, void *ev_data, void *userdata) {
+  for (auto &h : s_hists) h->Flush();
+  (void) ev;
+  (void) ev_data;
+  (void) userdata;
+}
+
+bool EveHistoryInit() {
+  if (!mgos_sys_config_get_eve_enable()) return true;
+  int num_files = mgos_sys_config_get_eve_history_files();
+  // At least one full file remains when starting the next one.
+  num_files = std::max(2, std::min(num_files, EVE_HISTORY_MAX_FILES));
+  int flush_records = mgos_sys_config_get_eve_flush_records();
+  flush_records =
+      std::max(1, std::min(flush_records, (int) EVE_HISTORY_FILE_RECS));
+  for (int id = 1; id <= EVE_HISTORY_MAX_ID; id++) {
+    PowerMeter *pm = FindPM(id);
+    if (pm == nullptr) continue;
+    std::unique_ptr<EveHistory> h(
+        new EveHistory(id, pm, FindOutput(id), num_files, flush_records));
+    h->Init();
+    s_hists.push_back(std::move(h));
+  }
+  if (!s_hists.empty()) {
+    mgos_event_add_handler(MGOS_EVENT_REBOOT, RebootCB, nullptr);
+  }
+  return true;
+}
+
+EveHistory *EveHistoryGet(int id) {
+  for (auto &h : s_hists) {
+    if (h->id() == id) return h.get();
+  }
+  return nullptr;
+}
+
+}  // namespace shelly
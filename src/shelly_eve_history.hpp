@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+
+#include "shelly_output.hpp"
+#include "shelly_pm.hpp"
+
+// Eve expects energy history entries 10 minutes apart.
+#define EVE_HISTORY_INTERVAL 600
+// Records per file, so that a file takes one flash block.
+#define EVE_HISTORY_FILE_RECS 510
+
+namespace shelly {
+
+struct EveHistoryRecord {
+  uint32_t time;      // UNIX timestamp, 0 - record is missing.
+  uint16_t power_dw;  // Average power over the interval, 0.1 W.
+  uint8_t flags;      // Bit 0 - output is on.
+};
+
+// Power history of a metered channel, served by the Eve history service.
+//
+// Every EVE_HISTORY_INTERVAL seconds (once time is set) a fixed-size record
+// is added. Records are numbered sequentially from 1 and stored in a ring
+// of eve.history_files files per channel, each taking one flash block and
+// holding EVE_HISTORY_FILE_RECS records:
+//
+//   "EH" ver:u8 0:u8 first_seq:u32 ref_time:u32 crc:u32
+//   { time:u32 power_dw:u16 flags:u8 check:u8 } x EVE_HISTORY_FILE_RECS
+//
+// Record seq is always at the same place: file ((seq - 1) / FILE_RECS) %
+// num_files, slot (seq - 1) % FILE_RECS. New records are kept in RAM and
+// appended every eve.flush_records records and before reboot; starting
+// a file again drops the oldest records. ref_time is the time of the first
+// record ever, Eve entry times are relative to it.
+class EveHistory {
+ public:
+  EveHistory(int id, PowerMeter *pm, Output *out, int num_files,
+             int flush_records);
+  ~EveHistory();
+
+  int id() const;
+  uint32_t ref_time() const;
+  uint32_t first_seq() const;  // 0 if empty.
+  uint32_t last_seq() const;   // 0 if empty.
+  int capacity() const;
+
+  void Init();
+
+  // Reads up to max consecutive records starting at seq, from RAM or flash.
+  // Returns the number of records read, unreadable ones have time = 0.
+  int Read(uint32_t seq, EveHistoryRecord *recs, int max);
+
+  void Flush();
+
+ private:
+  int FileIndex(uint32_t seq) const;
+  bool ScanFile(int k, uint32_t *first_seq, int *count, bool *torn);
+  bool LoadFileHead(uint32_t seq_to);
+  void Sample();
+
+  static void SampleTimerCB(void *arg);
+
+  const int id_;
+  PowerMeter *const pm_;
+  Output *const out_;
+  const int num_files_;
+  const int flush_records_;
+
+  uint32_t ref_time_ = 0;
+  uint32_t first_seq_ = 0;
+  uint32_t next_seq_ = 1;
+  // Records not yet written, starting with pending_seq_.
+  std::deque<EveHistoryRecord> pending_;
+  uint32_t pending_seq_ = 1;
+
+  double last_sample_time_ = 0;
+  float last_energy_ = -1;
+
+  EveHistory(const EveHistory &other) = delete;
+};
+
+bool EveHistoryInit();
+
+EveHistory *EveHistoryGet(int id);
+
+}  // namespace shelly
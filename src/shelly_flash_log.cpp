@@ -0,0 +1,417 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_flash_log.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "common/cs_crc32.h"
+#include "mgos.h"
+#include "mgos_debug.h"
+#include "mgos_rpc.h"
+
+#include "shelly_fs_stats.hpp"
+
+#define LOG_MAGIC_0 'S'
+#define LOG_MAGIC_1 'L'
+#define LOG_VERSION 1
+#define LOG_FLAG_COMPRESSED 1
+#define LOG_HDR_SIZE 24
+// Blocks that don't compress are stored raw.
+#define LOG_MAX_BLOCK_SIZE(raw_len) (LOG_HDR_SIZE + (raw_len))
+#define LOG_MIN_BUF_SIZE 512
+#define LOG_MAX_BUF_SIZE 16384
+#define LOG_MAX_FILES 16
+#define LOG_DEFAULT_GET_SIZE 2048
+#define LOG_MAX_GET_SIZE 4096
+
+#define LOG_HT_BITS 10
+#define LOG_MIN_MATCH 3
+#define LOG_MIN_USEFUL_MATCH 4
+#define LOG_MAX_MATCH (0x7f + LOG_MIN_MATCH)
+#define LOG_MAX_LITERALS 0x80
+#define LOG_MAX_DIST 0xffff
+
+namespace shelly {
+
+struct LogBlockHeader {
+  uint8_t flags;
+  uint32_t seq;
+  uint32_t time;
+  uint32_t uptime;
+  uint16_t raw_len;
+  uint16_t len;
+  uint32_t crc;
+};
+
+static std::string s_buf;
+static bool s_flush_pending = false;
+static bool s_line_start = true;
+static int s_level = LL_INFO;
+static size_t s_buf_size = 0;
+static size_t s_file_size = 0;
+static int s_num_files = 0;
+static int s_cur_file = 0;
+static size_t s_cur_size = 0;
+static uint32_t s_seq = 1;
+
+static uint32_t s_flushes = 0;
+static uint32_t s_dropped = 0;
+static uint32_t s_write_errors = 0;
+static uint64_t s_raw_bytes = 0;
+static uint64_t s_written_bytes = 0;
+
+static bool EmitLiterals(const uint8_t *p, size_t n, uint8_t *out,
+                         size_t out_size, size_t *op) {
+  while (n > 0) {
+    size_t run = (n > LOG_MAX_LITERALS ? LOG_MAX_LITERALS : n);
+    if (*op + 1 + run > out_size) return false;
+    out[(*op)++] = run - 1;
+    memcpy(out + *op, p, run);
+    *op += run;
+    p += run;
+    n -= run;
+  }
+  return true;
+}
+
+size_t LogCompress(const uint8_t *in, size_t in_len, uint8_t *out,
+                   size_t out_size) {
+  size_t ip = 0, op = 0, lit_start = 0;
+  // Most recent position of each 3-byte sequence, 0xffff - none.
+  uint16_t *ht = (uint16_t *) malloc((1 << LOG_HT_BITS) * sizeof(*ht));
+  if (ht == nullptr || in_len > LOG_MAX_DIST) {
+    free(ht);
+    return (EmitLiterals(in, in_len, out, out_size, &op) ? op : 0);
+  }
+  memset(ht, 0xff, (1 << LOG_HT_BITS) * sizeof(*ht));
+  bool ok = true;
+  while (ip + LOG_MIN_MATCH <= in_len) {
+    uint32_t v = (in[ip] << 16) | (in[ip + 1] << 8) | in[ip + 2];
+    uint32_t h = (v * 2654435761U) >> (32 - LOG_HT_BITS);
+    size_t cand = ht[h];
+    ht[h] = ip;
+    if (cand == 0xffff || memcmp(in + cand, in + ip, LOG_MIN_MATCH) != 0) {
+      ip++;
+      continue;
+    }
+    size_t len = LOG_MIN_MATCH;
+    while (ip + len < in_len && len < LOG_MAX_MATCH &&
+           in[cand + len] == in[ip + len]) {
+      len++;
+    }
+    // A match takes 3 bytes and the literals after it need a new run header.
+    if (len < LOG_MIN_USEFUL_MATCH) {
+      ip++;
+      continue;
+    }
+    if (!EmitLiterals(in + lit_start, ip - lit_start, out, out_size, &op) ||
+        op + 3 > out_size) {
+      ok = false;
+      break;
+    }
+    size_t dist = ip - cand;
+    out[op++] = 0x80 | (len - LOG_MIN_MATCH);
+    out[op++] = dist >> 8;
+    out[op++] = dist & 0xff;
+    ip += len;
+    lit_start = ip;
+  }
+  free(ht);
+  if (!ok ||
+      !EmitLiterals(in + lit_start, in_len - lit_start, out, out_size, &op)) {
+    return 0;
+  }
+  return op;
+}
+
+static void PutU16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+static void PutU32(uint8_t *p, uint32_t v) {
+  PutU16(p, v & 0xffff);
+  PutU16(p + 2, v >> 16);
+}
+
+static uint16_t GetU16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t GetU32(const uint8_t *p) {
+  return GetU16(p) | ((uint32_t) GetU16(p + 2) << 16);
+}
+
+static std::string LogFileName(int i) {
+  char name[16];
+  snprintf(name, sizeof(name), "log%d.bin", i);
+  return name;
+}
+
+static std::string MakeBlock(const std::string &raw) {
+  std::string block(LOG_MAX_BLOCK_SIZE(raw.size()), '\0');
+  uint8_t *hdr = (uint8_t *) &block[0];
+  uint8_t *data = hdr + LOG_HDR_SIZE;
+  uint8_t flags = LOG_FLAG_COMPRESSED;
+  // Only keep compressed data if it's smaller, otherwise store raw.
+  size_t len = LogCompress((const uint8_t *) raw.data(), raw.size(), data,
+                           raw.size() - 1);
+  if (len == 0) {
+    memcpy(data, raw.data(), raw.size());
+    len = raw.size();
+    flags = 0;
+  }
+  hdr[0] = LOG_MAGIC_0;
+  hdr[1] = LOG_MAGIC_1;
+  hdr[2] = LOG_VERSION;
+  hdr[3] = flags;
+  PutU32(hdr + 4, s_seq);
+  PutU32(hdr + 8, (uint32_t) mg_time());
+  PutU32(hdr + 12, (uint32_t) mgos_uptime());
+  PutU16(hdr + 16, raw.size());
+  PutU16(hdr + 18, len);
+  uint32_t crc = cs_crc32(0, hdr, 20);
+  crc = cs_crc32(crc, data, len);
+  PutU32(hdr + 20, crc);
+  block.resize(LOG_HDR_SIZE + len);
+  return block;
+}
+
+// Reads the next block, returns false at the end of file or if the block is
+// incomplete or corrupted (power lost during write).
+static bool ReadBlock(FILE *fp, LogBlockHeader *bh, std::string *block) {
+  uint8_t hdr[LOG_HDR_SIZE];
+  if (fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr)) return false;
+  if (hdr[0] != LOG_MAGIC_0 || hdr[1] != LOG_MAGIC_1 ||
+      hdr[2] != LOG_VERSION) {
+    return false;
+  }
+  bh->flags = hdr[3];
+  bh->seq = GetU32(hdr + 4);
+  bh->time = GetU32(hdr + 8);
+  bh->uptime = GetU32(hdr + 12);
+  bh->raw_len = GetU16(hdr + 16);
+  bh->len = GetU16(hdr + 18);
+  bh->crc = GetU32(hdr + 20);
+  block->assign((const char *) hdr, sizeof(hdr));
+  block->resize(sizeof(hdr) + bh->len);
+  uint8_t *data = (uint8_t *) &(*block)[sizeof(hdr)];
+  if (fread(data, 1, bh->len, fp) != bh->len) return false;
+  uint32_t crc = cs_crc32(0, hdr, 20);
+  crc = cs_crc32(crc, data, bh->len);
+  return (crc == bh->crc);
+}
+
+// Finds the file with the most recent block to continue from.
+static void ScanFiles() {
+  bool found = false;
+  bool cur_torn = false;
+  uint32_t max_seq = 0;
+  for (int i = 0; i < s_num_files; i++) {
+    FILE *fp = fopen(LogFileName(i).c_str(), "rb");
+    if (fp == nullptr) continue;
+    LogBlockHeader bh;
+    std::string block;
+    size_t size = 0;
+    bool have_seq = false;
+    uint32_t last_seq = 0;
+    while (ReadBlock(fp, &bh, &block)) {
+      size += block.size();
+      last_seq = bh.seq;
+      have_seq = true;
+    }
+    fseek(fp, 0, SEEK_END);
+    bool torn = (ftell(fp) != (long) size);
+    fclose(fp);
+    if (have_seq && (!found || last_seq > max_seq)) {
+      found = true;
+      max_seq = last_seq;
+      s_cur_file = i;
+      s_cur_size = size;
+      cur_torn = torn;
+    }
+  }
+  if (found) {
+    s_seq = max_seq + 1;
+  } else {
+    s_cur_file = s_num_files - 1;
+  }
+  // Don't append after a partially written block, start the next file.
+  if (!found || cur_torn) s_cur_size = s_file_size;
+}
+
+static void Flush() {
+  s_flush_pending = false;
+  if (s_buf.empty()) return;
+  std::string raw;
+  raw.swap(s_buf);
+  s_buf.reserve(s_buf_size);
+  int64_t start = mgos_uptime_micros();
+  std::string block = MakeBlock(raw);
+  const char *mode = "ab";
+  if (s_cur_size > 0 && s_cur_size + block.size() > s_file_size) {
+    s_cur_file = (s_cur_file + 1) % s_num_files;
+    s_cur_size = 0;
+    mode = "wb";
+  }
+  std::string file_name = LogFileName(s_cur_file);
+  FILE *fp = fopen(file_name.c_str(), mode);
+  bool ok = (fp != nullptr);
+  if (ok) {
+    ok = (fwrite(block.data(), 1, block.size(), fp) == block.size());
+    ok = (fclose(fp) == 0) && ok;
+  }
+  if (!ok) {
+    // Don't append to what may be a partial block.
+    s_cur_size = s_file_size;
+    s_write_errors++;
+    return;
+  }
+  s_cur_size += block.size();
+  s_seq++;
+  s_flushes++;
+  s_raw_bytes += raw.size();
+  s_written_bytes += block.size();
+  FSStatsRecordWrite(file_name.c_str(), "log", block.size(),
+                     mgos_uptime_micros() - start);
+}
+
+static void FlushTimerCB(void *arg) {
+  Flush();
+  (void) arg;
+}
+
+static void ScheduleFlush() {
+  if (s_flush_pending) return;
+  s_flush_pending = true;
+  mgos_set_timer(0, 0, FlushTimerCB, nullptr);
+}
+
+// Called for every piece of log output, must not log itself.
+static void LogEventCB(int ev, void *ev_data, void *userdata) {
+  const struct mgos_debug_hook_arg *arg =
+      (const struct mgos_debug_hook_arg *) ev_data;
+  if (arg->level > s_level || arg->len == 0) return;
+  // Lines are prefixed with uptime, output has no timestamps of its own.
+  char ts[24];
+  size_t ts_len = 0;
+  if (s_line_start) {
+    ts_len = snprintf(ts, sizeof(ts), "%.3f ", mgos_uptime());
+  }
+  s_line_start = (arg->data[arg->len - 1] == '\n');
+  if (s_buf.size() + ts_len + arg->len > s_buf_size) {
+    s_dropped += arg->len;
+    ScheduleFlush();
+    return;
+  }
+  s_buf.append(ts, ts_len);
+  s_buf.append(arg->data, arg->len);
+  if (s_buf.size() >= s_buf_size * 3 / 4) ScheduleFlush();
+  (void) ev;
+  (void) userdata;
+}
+
+static void RebootCB(int ev, void *ev_data, void *userdata) {
+  Flush();
+  (void) ev;
+  (void) ev_data;
+  (void) userdata;
+}
+
+static void GetLogHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                          struct mg_rpc_frame_info *fi, struct mg_str args) {
+  unsigned int after = 0;
+  int max_size = LOG_DEFAULT_GET_SIZE;
+  bool flush = false;
+
+  json_scanf(args.p, args.len, ri->args_fmt, &after, &max_size, &flush);
+
+  if (max_size <= 0 || max_size > LOG_MAX_GET_SIZE) {
+    mg_rpc_send_errorf(ri, 400, "invalid %s", "max_size");
+    return;
+  }
+  if (flush) Flush();
+  // Oldest file first, the one after the current.
+  std::string data;
+  uint32_t last_seq = after;
+  bool more = false;
+  for (int k = 1; k <= s_num_files && !more; k++) {
+    int i = (s_cur_file + k) % s_num_files;
+    FILE *fp = fopen(LogFileName(i).c_str(), "rb");
+    if (fp == nullptr) continue;
+    LogBlockHeader bh;
+    std::string block;
+    while (ReadBlock(fp, &bh, &block)) {
+      if (bh.seq <= after) continue;
+      if (!data.empty() && data.size() + block.size() > (size_t) max_size) {
+        more = true;
+        break;
+      }
+      data.append(block);
+      last_seq = bh.seq;
+    }
+    fclose(fp);
+  }
+  mg_rpc_send_responsef(
+      ri,
+      "{data: %V, last_seq: %u, more: %B, enable: %B, buffered: %d, "
+      "flushes: %u, dropped: %u, write_errors: %u, raw_bytes: %llu, "
+      "written_bytes: %llu}",
+      data.data(), (int) data.size(), (unsigned) last_seq, more,
+      mgos_sys_config_get_log_enable(), (int) s_buf.size(),
+      (unsigned) s_flushes, (unsigned) s_dropped, (unsigned) s_write_errors,
+      (unsigned long long) s_raw_bytes, (unsigned long long) s_written_bytes);
+  (void) cb_arg;
+  (void) fi;
+}
+
+bool FlashLogInit() {
+  mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.GetLog",
+                     "{after: %u, max_size: %d, flush: %B}", GetLogHandler,
+                     NULL);
+  if (!mgos_sys_config_get_log_enable()) return true;
+  s_level = mgos_sys_config_get_log_level();
+  int buf_size = mgos_sys_config_get_log_buf_size();
+  if (buf_size < LOG_MIN_BUF_SIZE) buf_size = LOG_MIN_BUF_SIZE;
+  if (buf_size > LOG_MAX_BUF_SIZE) buf_size = LOG_MAX_BUF_SIZE;
+  s_buf_size = buf_size;
+  s_file_size = mgos_sys_config_get_log_file_size();
+  // A block must fit in a file.
+  if (s_file_size < LOG_MAX_BLOCK_SIZE(s_buf_size)) {
+    s_file_size = LOG_MAX_BLOCK_SIZE(s_buf_size);
+  }
+  s_num_files = mgos_sys_config_get_log_num_files();
+  if (s_num_files < 1) s_num_files = 1;
+  if (s_num_files > LOG_MAX_FILES) s_num_files = LOG_MAX_FILES;
+  ScanFiles();
+  s_buf.reserve(s_buf_size);
+  mgos_event_add_handler(MGOS_EVENT_LOG, LogEventCB, nullptr);
+  mgos_event_add_handler(MGOS_EVENT_REBOOT, RebootCB, nullptr);
+  int interval = mgos_sys_config_get_log_flush_interval();
+  if (interval > 0) {
+    mgos_set_timer(interval * 1000, MGOS_TIMER_REPEAT, FlushTimerCB, nullptr);
+  }
+  LOG(LL_INFO, ("Flash log: %d x %d, next seq %u", s_num_files,
+                (int) s_file_size, (unsigned) s_seq));
+  return true;
+}
+
+}  // namespace shelly
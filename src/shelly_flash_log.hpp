@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace shelly {
+
+// Log kept on flash, cheap enough to leave on.
+//
+// Log output is collected in a RAM buffer and written out from a timer,
+// never from the logging call, when the buffer is 3/4 full, every
+// log.flush_interval seconds and before reboot. Each flush appends one
+// block to the current log file, files are rotated when full:
+//
+//   "SL" ver:u8 flags:u8 seq:u32 time:u32 uptime:u32 raw_len:u16 len:u16
+//   crc:u32 data[len]
+//
+// All integers are little-endian, crc is CRC-32 of the header fields before
+// it and the data. With flags bit 0 set, data is compressed (see
+// LogCompress), otherwise it's raw text. tools/log_decode.py reads blocks
+// from the files or fetches them with Shelly.GetLog.
+
+bool FlashLogInit();
+
+// LZ77-style compression, tokens:
+//   0x00-0x7f: literal run of (token + 1) bytes that follow
+//   0x80-0xff: match of (token & 0x7f) + 3 bytes at distance given by the
+//              next two bytes (big-endian, 1 - 65535)
+// Only matches of 4 bytes or more are emitted, so output never exceeds
+// LOG_COMPRESS_BOUND(in_len). Returns output size, 0 if it does not fit in
+// out_size.
+#define LOG_COMPRESS_BOUND(n) ((n) + (n) / 128 + 1)
+size_t LogCompress(const uint8_t *in, size_t in_len, uint8_t *out,
+                   size_t out_size);
+
+}  // namespace shelly
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_fs_migrate.hpp"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "mgos.h"
+#include "mgos_vfs.h"
+#ifdef MGOS_HAVE_OTA_COMMON
+#include "esp_rboot.h"
+#include "esp_vfs_dev_sysflash.h"
+#include "mgos_ota.h"
+#endif
+
+// Type of the filesystem in the previous slot.
+#define FS_MIGRATE_OLD_FS_TYPE "SPIFFS"
+// Overridden by the host tests.
+#ifndef FS_MIGRATE_OLD_MOUNT_POINT
+#define FS_MIGRATE_OLD_MOUNT_POINT "/old"
+#endif
+#define FS_MIGRATE_TMP_SUFFIX ".tmp"
+// Files are assumed to take whole blocks when checking for space.
+#define FS_MIGRATE_BLOCK_SIZE 4096
+
+namespace shelly {
+
+// Copy via a temporary file so that a partially written file never appears
+// under its real name.
+static bool CopyFile(const char *src, const char *dst, size_t *size) {
+  bool res = false;
+  char buf[256];
+  std::string tmp = std::string(dst) + FS_MIGRATE_TMP_SUFFIX;
+  FILE *sf = nullptr, *df = nullptr;
+  *size = 0;
+  if ((sf = fopen(src, "rb")) == nullptr) goto out;
+  if ((df = fopen(tmp.c_str(), "wb")) == nullptr) goto out;
+  while (true) {
+    size_t n = fread(buf, 1, sizeof(buf), sf);
+    if (n == 0) break;
+    if (fwrite(buf, 1, n, df) != n) goto out;
+    *size += n;
+  }
+  if (ferror(sf)) goto out;
+  res = (fclose(df) == 0);
+  df = nullptr;
+  if (res) res = (rename(tmp.c_str(), dst) == 0);
+out:
+  if (df != nullptr) fclose(df);
+  if (sf != nullptr) fclose(sf);
+  if (!res) remove(tmp.c_str());
+  return res;
+}
+
+static bool MountOldFS() {
+#ifdef MGOS_HAVE_OTA_COMMON
+  struct mgos_ota_status ota_status;
+  if (!mgos_ota_get_status(&ota_status)) return false;
+  rboot_config bcfg = rboot_get_config();
+  int old_slot = (ota_status.partition == 0 ? 1 : 0);
+  char dev_opts[48];
+  snprintf(dev_opts, sizeof(dev_opts), "{addr: %u, size: %u}",
+           (unsigned) bcfg.fs_addresses[old_slot],
+           (unsigned) bcfg.fs_sizes[old_slot]);
+  return mgos_vfs_mount(FS_MIGRATE_OLD_MOUNT_POINT, MGOS_VFS_DEV_TYPE_SYSFLASH,
+                        dev_opts, FS_MIGRATE_OLD_FS_TYPE, "");
+#else
+  return false;
+#endif
+}
+
+struct FSMigrateFile {
+  std::string name;
+  size_t size;
+};
+
+// Config and HAP pairings are what the device cannot work without, copy them
+// while there is most space.
+static int CopyOrder(const std::string &name) {
+  if (name.compare(0, 4, "conf") == 0) return 0;
+  if (name == "kvs.json") return 1;
+  return 2;
+}
+
+FSMigrateResult FSMigrate() {
+#ifdef MGOS_HAVE_OTA_COMMON
+  if (!mgos_ota_is_first_boot()) return FSMigrateResult::kNotNeeded;
+#endif
+  // Either an update from firmware that already uses the new type
+  // (merged as usual) or the previous filesystem is not readable.
+  if (!MountOldFS()) return FSMigrateResult::kNotNeeded;
+  DIR *dir = opendir(FS_MIGRATE_OLD_MOUNT_POINT);
+  if (dir == nullptr) {
+    LOG(LL_ERROR, ("Failed to list %s", FS_MIGRATE_OLD_MOUNT_POINT));
+    mgos_vfs_umount(FS_MIGRATE_OLD_MOUNT_POINT);
+    return FSMigrateResult::kFailed;
+  }
+  std::vector<FSMigrateFile> files;
+  size_t space_needed = 0;
+  struct dirent *de;
+  while ((de = readdir(dir)) != nullptr) {
+    const char *name = de->d_name;
+    struct stat st;
+    if (name[0] == '.') continue;
+    // Part of the new image.
+    if (stat(name, &st) == 0) continue;
+    std::string src = std::string(FS_MIGRATE_OLD_MOUNT_POINT "/") + name;
+    if (stat(src.c_str(), &st) != 0) continue;
+    files.push_back({name, (size_t) st.st_size});
+    space_needed += (st.st_size + FS_MIGRATE_BLOCK_SIZE - 1) /
+                    FS_MIGRATE_BLOCK_SIZE * FS_MIGRATE_BLOCK_SIZE;
+  }
+  closedir(dir);
+  std::stable_sort(files.begin(), files.end(),
+                   [](const FSMigrateFile &a, const FSMigrateFile &b) {
+                     return CopyOrder(a.name) < CopyOrder(b.name);
+                   });
+  size_t space_free = mgos_vfs_get_space_free("/");
+  if (space_needed > space_free) {
+    LOG(LL_ERROR, ("%s migration: %d files need %u bytes, %u free",
+                   FS_MIGRATE_OLD_FS_TYPE, (int) files.size(),
+                   (unsigned) space_needed, (unsigned) space_free));
+    mgos_vfs_umount(FS_MIGRATE_OLD_MOUNT_POINT);
+    return FSMigrateResult::kFailed;
+  }
+  int num_copied = 0, num_failed = 0;
+  size_t total_size = 0;
+  bool config_copied = false;
+  for (const auto &f : files) {
+    std::string src = std::string(FS_MIGRATE_OLD_MOUNT_POINT "/") + f.name;
+    size_t size = 0;
+    if (!CopyFile(src.c_str(), f.name.c_str(), &size)) {
+      LOG(LL_ERROR, ("Failed to copy %s", f.name.c_str()));
+      num_failed++;
+      continue;
+    }
+    LOG(LL_INFO, ("Copied %s (%u)", f.name.c_str(), (unsigned) size));
+    num_copied++;
+    total_size += size;
+    if (CopyOrder(f.name) == 0) config_copied = true;
+  }
+  mgos_vfs_umount(FS_MIGRATE_OLD_MOUNT_POINT);
+  LOG(LL_INFO, ("%s migration: %d files (%u bytes) copied, %d failed",
+                FS_MIGRATE_OLD_FS_TYPE, num_copied, (unsigned) total_size,
+                num_failed));
+  if (num_failed > 0) return FSMigrateResult::kFailed;
+  return (config_copied ? FSMigrateResult::kRestart : FSMigrateResult::kDone);
+}
+
+}  // namespace shelly
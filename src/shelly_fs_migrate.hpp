@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+namespace shelly {
+
+// Root filesystem type migration.
+//
+// Firmware update only brings a new filesystem image, files created at
+// runtime (config, HAP key-value store, logs) live in the filesystem of the
+// previous slot. When the type of the root filesystem changes (SPIFFS in
+// stock and older firmware, LittleFS now), the previous filesystem cannot be
+// merged into the new one as usual, so on first boot its files are copied
+// over by the firmware. Files that are part of the new image are not
+// overwritten. The previous slot is only read, so a rollback finds it intact.
+//
+// Config files and kvs.json are copied first. Nothing is copied if the files
+// will not fit.
+enum class FSMigrateResult {
+  kNotNeeded,
+  kDone,
+  // Config files were copied. Config has already been loaded at this point,
+  // device needs to be restarted to pick it up.
+  kRestart,
+  // Not all files could be copied, the update must not be committed.
+  kFailed,
+};
+
+FSMigrateResult FSMigrate();
+
+}  // namespace shelly
@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_fs_stats.hpp"
+
+#include <dirent.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "mgos.h"
+#include "mgos_http_server.h"
+#include "mgos_rpc.h"
+#ifdef MGOS_HAVE_VFS_COMMON
+#include "mgos_vfs.h"
+#endif
+
+#define FS_STATS_FILE_NAME "fsstats.json"
+#define FS_STATS_SAMPLE_INTERVAL_MS 10000
+// Filesystem metadata (SPIFFS object index pages, LittleFS metadata pairs)
+// is updated along with file data, so flash actually written is more than
+// file data written. This is a rough average for small files that are
+// rewritten in full, such as the config, see Shelly.RunFSBench.
+#define FS_STATS_WRITE_AMPLIFICATION 2
+// Rated erase cycles of the flash chips used.
+#define FS_STATS_FLASH_ENDURANCE 100000
+
+namespace shelly {
+
+struct FSWriteStats {
+  std::string name;
+  uint32_t writes;
+  int64_t bytes;
+  int64_t duration_micros;
+};
+
+// File written by a library, checked for changes periodically.
+struct FSSampledFile {
+  std::string name;
+  bool is_log;
+  bool seen;
+  int64_t size;
+  time_t mtime;
+};
+
+static std::vector<FSWriteStats> s_files;
+static std::vector<FSWriteStats> s_sources;
+static std::vector<FSSampledFile> s_sampled;
+static std::string s_kvs_file_name;
+static int64_t s_runtime_base = 0;  // Seconds, from previous boots.
+static int64_t s_last_saved = 0;    // Uptime, seconds.
+
+static FSWriteStats *GetEntry(std::vector<FSWriteStats> *v, const char *name) {
+  for (auto &e : *v) {
+    if (e.name == name) return &e;
+  }
+  v->push_back({name, 0, 0, 0});
+  return &v->back();
+}
+
+static int64_t GetRuntime() {
+  return s_runtime_base + (int64_t) mgos_uptime();
+}
+
+void FSStatsRecordWrite(const char *file_name, const char *source,
+                        size_t bytes, int64_t duration_micros) {
+  FSWriteStats *fe = GetEntry(&s_files, file_name);
+  fe->writes++;
+  fe->bytes += bytes;
+  fe->duration_micros += duration_micros;
+  FSWriteStats *se = GetEntry(&s_sources, source);
+  se->writes++;
+  se->bytes += bytes;
+  se->duration_micros += duration_micros;
+}
+
+static void AppendEntries(std::string *res,
+                          const std::vector<FSWriteStats> &v) {
+  bool first = true;
+  for (const auto &e : v) {
+    mgos::JSONAppendStringf(
+        res, "%s{name: %Q, writes: %u, bytes: %lld, us: %lld}",
+        (first ? "" : ", "), e.name.c_str(), (unsigned) e.writes,
+        (long long) e.bytes, (long long) e.duration_micros);
+    first = false;
+  }
+}
+
+static void SaveStats() {
+  std::string res = mgos::JSONPrintStringf("{runtime: %lld, files: [",
+                                           (long long) GetRuntime());
+  AppendEntries(&res, s_files);
+  res.append("], sources: [");
+  AppendEntries(&res, s_sources);
+  res.append("]}");
+  int64_t start = mgos_uptime_micros();
+  FILE *fp = fopen(FS_STATS_FILE_NAME, "w");
+  if (fp == nullptr) return;
+  fwrite(res.data(), 1, res.size(), fp);
+  fclose(fp);
+  s_last_saved = mgos_uptime();
+  FSStatsRecordWrite(FS_STATS_FILE_NAME, "fs_stats", res.size(),
+                     mgos_uptime_micros() - start);
+}
+
+static void LoadEntries(const struct json_token &tok,
+                        std::vector<FSWriteStats> *v) {
+  struct json_token t;
+  for (int i = 0; json_scanf_array_elem(tok.ptr, tok.len, "", i, &t) > 0;
+       i++) {
+    char *name = nullptr;
+    unsigned writes = 0;
+    long long bytes = 0, us = 0;
+    json_scanf(t.ptr, t.len, "{name: %Q, writes: %u, bytes: %lld, us: %lld}",
+               &name, &writes, &bytes, &us);
+    if (name != nullptr) {
+      v->push_back({name, writes, bytes, us});
+      free(name);
+    }
+  }
+}
+
+static void LoadStats() {
+  char *data = json_fread(FS_STATS_FILE_NAME);
+  if (data == nullptr) return;
+  long long runtime = 0;
+  struct json_token files_tok = JSON_INVALID_TOKEN;
+  struct json_token sources_tok = JSON_INVALID_TOKEN;
+  json_scanf(data, strlen(data), "{runtime: %lld, files: %T, sources: %T}",
+             &runtime, &files_tok, &sources_tok);
+  s_runtime_base = runtime;
+  LoadEntries(files_tok, &s_files);
+  LoadEntries(sources_tok, &s_sources);
+  free(data);
+}
+
+static void CheckSampledFile(FSSampledFile *f, const struct stat &st) {
+  if (!f->seen) {
+    f->seen = true;
+  } else if (f->is_log && st.st_size > f->size) {
+    FSStatsRecordWrite(f->name.c_str(), "log", st.st_size - f->size, 0);
+  } else if (st.st_size != f->size || st.st_mtime != f->mtime) {
+    FSStatsRecordWrite(f->name.c_str(), (f->is_log ? "log" : "hap"),
+                       st.st_size, 0);
+  }
+  f->size = st.st_size;
+  f->mtime = st.st_mtime;
+}
+
+static FSSampledFile *GetSampledFile(const std::string &name, bool is_log,
+                                     bool first_scan) {
+  for (auto &f : s_sampled) {
+    if (f.name == name) return &f;
+  }
+  // Files that appear after the first scan are new, their contents count.
+  s_sampled.push_back({name, is_log, !first_scan, 0, 0});
+  return &s_sampled.back();
+}
+
+static void SampleFiles(bool first_scan) {
+  struct stat st;
+  if (stat(s_kvs_file_name.c_str(), &st) == 0) {
+    CheckSampledFile(GetSampledFile(s_kvs_file_name, false, first_scan), st);
+  }
+#ifdef MGOS_HAVE_FILE_LOGGER
+  if (!mgos_sys_config_get_file_logger_enable()) return;
+  const char *dir = mgos_sys_config_get_file_logger_dir();
+  const char *prefix = mgos_sys_config_get_file_logger_prefix();
+  DIR *dp = opendir(dir);
+  if (dp == nullptr) return;
+  struct dirent *de;
+  while ((de = readdir(dp)) != nullptr) {
+    if (strncmp(de->d_name, prefix, strlen(prefix)) != 0) continue;
+    std::string path(dir);
+    if (path.empty() || path.back() != '/') path.push_back('/');
+    path.append(de->d_name);
+    if (stat(path.c_str(), &st) != 0) continue;
+    CheckSampledFile(GetSampledFile(de->d_name, true, first_scan), st);
+  }
+  closedir(dp);
+#endif
+}
+
+static void SampleTimerCB(void *arg) {
+  SampleFiles(false /* first_scan */);
+  int interval = mgos_sys_config_get_shelly_fs_stats_save_interval();
+  if (interval > 0 && mgos_uptime() - s_last_saved >= interval) {
+    SaveStats();
+  }
+  (void) arg;
+}
+
+static void RebootCB(int ev, void *ev_data, void *userdata) {
+  SaveStats();
+  (void) ev;
+  (void) ev_data;
+  (void) userdata;
+}
+
+struct FSWearEstimate {
+  int64_t fs_size;
+  int64_t bytes;
+  double wear_pct;
+  double bytes_per_day;
+  double remaining_years;  // -1 if not known.
+};
+
+static FSWearEstimate GetWearEstimate() {
+  FSWearEstimate res = {};
+  for (const auto &e : s_files) res.bytes += e.bytes;
+#ifdef MGOS_HAVE_VFS_COMMON
+  res.fs_size = mgos_vfs_get_space_total("/");
+#endif
+  res.remaining_years = -1;
+  int64_t runtime = GetRuntime();
+  if (runtime > 0) res.bytes_per_day = res.bytes * 86400.0 / runtime;
+  if (res.fs_size <= 0) return res;
+  double flash_written = (double) res.bytes * FS_STATS_WRITE_AMPLIFICATION;
+  double flash_total = (double) res.fs_size * FS_STATS_FLASH_ENDURANCE;
+  res.wear_pct = flash_written * 100.0 / flash_total;
+  if (res.bytes_per_day > 0) {
+    double days_left = (flash_total - flash_written) /
+                       (res.bytes_per_day * FS_STATS_WRITE_AMPLIFICATION);
+    res.remaining_years = days_left / 365;
+  }
+  return res;
+}
+
+std::string FSStatsGetJSON() {
+  FSWearEstimate we = GetWearEstimate();
+  std::string res = mgos::JSONPrintStringf(
+      "{runtime: %lld, fs_size: %lld, bytes: %lld, bytes_per_day: %.0f, "
+      "wear_pct: %.6f, remaining_years: %.1f, files: [",
+      (long long) GetRuntime(), (long long) we.fs_size, (long long) we.bytes,
+      we.bytes_per_day, we.wear_pct, we.remaining_years);
+  AppendEntries(&res, s_files);
+  res.append("], sources: [");
+  AppendEntries(&res, s_sources);
+  res.append("]}");
+  return res;
+}
+
+// Not JSON, so JSONAppendStringf cannot be used.
+static void AppendMetric(std::string *res, const char *fmt, ...) {
+  char buf[128];
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (len > 0) res->append(buf, std::min(len, (int) sizeof(buf) - 1));
+}
+
+static void AppendMetrics(std::string *res, const char *label,
+                          const std::vector<FSWriteStats> &v) {
+  for (const auto &e : v) {
+    AppendMetric(res, "shelly_fs_writes_total{%s=\"%s\"} %u\n", label,
+                 e.name.c_str(), (unsigned) e.writes);
+    AppendMetric(res, "shelly_fs_bytes_total{%s=\"%s\"} %lld\n", label,
+                 e.name.c_str(), (long long) e.bytes);
+    AppendMetric(res, "shelly_fs_duration_us_total{%s=\"%s\"} %lld\n",
+                 label, e.name.c_str(), (long long) e.duration_micros);
+  }
+}
+
+std::string FSStatsGetMetrics() {
+  FSWearEstimate we = GetWearEstimate();
+  std::string res(
+      "# TYPE shelly_fs_writes_total counter\n"
+      "# TYPE shelly_fs_bytes_total counter\n"
+      "# TYPE shelly_fs_duration_us_total counter\n");
+  AppendMetrics(&res, "file", s_files);
+  AppendMetrics(&res, "source", s_sources);
+  AppendMetric(&res, "shelly_fs_size_bytes %lld\n", (long long) we.fs_size);
+  AppendMetric(&res, "shelly_fs_wear_percent %.6f\n", we.wear_pct);
+  AppendMetric(&res, "shelly_fs_remaining_years %.1f\n", we.remaining_years);
+  AppendMetric(&res, "shelly_runtime_seconds %lld\n",
+               (long long) GetRuntime());
+  AppendMetric(&res, "shelly_uptime_seconds %d\n", (int) mgos_uptime());
+  AppendMetric(&res, "shelly_heap_free_bytes %u\n",
+               (unsigned) mgos_get_free_heap_size());
+  return res;
+}
+
+void FSStatsReset() {
+  s_files.clear();
+  s_sources.clear();
+  s_runtime_base = -(int64_t) mgos_uptime();
+  SaveStats();
+}
+
+static void GetFSStatsHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                              struct mg_rpc_frame_info *fi,
+                              struct mg_str args) {
+  bool reset = false;
+  json_scanf(args.p, args.len, ri->args_fmt, &reset);
+  if (reset) FSStatsReset();
+  std::string res = FSStatsGetJSON();
+  mg_rpc_send_responsef(ri, "%s", res.c_str());
+  (void) cb_arg;
+  (void) fi;
+}
+
+static void MetricsHandler(struct mg_connection *nc, int ev, void *ev_data,
+                           void *user_data) {
+  if (ev != MG_EV_HTTP_REQUEST) return;
+  std::string res = FSStatsGetMetrics();
+  mg_send_head(nc, 200, res.size(), "Content-Type: text/plain; version=0.0.4");
+  mg_send(nc, res.data(), res.size());
+  (void) ev_data;
+  (void) user_data;
+}
+
+bool FSStatsInit(const char *kvs_file_name) {
+  s_kvs_file_name = kvs_file_name;
+  LoadStats();
+  SampleFiles(true /* first_scan */);
+  s_last_saved = mgos_uptime();
+  mgos_set_timer(FS_STATS_SAMPLE_INTERVAL_MS, MGOS_TIMER_REPEAT, SampleTimerCB,
+                 nullptr);
+  mgos_event_add_handler(MGOS_EVENT_REBOOT, RebootCB, nullptr);
+  mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.GetFSStats",
+                     "{reset: %B}", GetFSStatsHandler, NULL);
+  mgos_register_http_endpoint("/metrics", MetricsHandler, NULL);
+  return true;
+}
+
+}  // namespace shelly
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace shelly {
+
+// Flash write telemetry: number, size and duration of filesystem writes per
+// file and per source that triggered them, persisted across reboots, and an
+// estimate of flash wear derived from them.
+//
+// Writes made by the firmware are recorded explicitly. Files written by
+// libraries (HAP key-value store, file logger) are sampled periodically,
+// multiple writes between samples are counted as one.
+
+bool FSStatsInit(const char *kvs_file_name);
+
+void FSStatsRecordWrite(const char *file_name, const char *source,
+                        size_t bytes, int64_t duration_micros);
+
+std::string FSStatsGetJSON();
+
+// Prometheus text exposition format.
+std::string FSStatsGetMetrics();
+
+void FSStatsReset();
+
+}  // namespace shelly
@@ -29,6 +29,10 @@
 #define SHELLY_HAP_AID_BASE_OUTLET 0x200
 #define SHELLY_HAP_AID_BASE_LOCK 0x300
 #define SHELLY_HAP_AID_BASE_STATELESS_SWITCH 0x400
+#define SHELLY_HAP_AID_BASE_WINDOW_COVERING 0x500
+// All stateless switches in one accessory (shelly.ssw_group).
+// Input ids start at 1, so base AID is free.
+#define SHELLY_HAP_AID_STATELESS_SWITCH_GROUP 0x400
 
 namespace shelly {
 namespace hap {
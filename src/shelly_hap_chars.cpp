@@ -21,8 +21,11 @@
 
 #include "HAPCharacteristic.h"
 
+#include "mgos.h"
+
 #include "shelly_hap_accessory.hpp"
 #include "shelly_hap_service.hpp"
+#include "shelly_hap_stats.hpp"
 
 namespace shelly {
 namespace hap {
@@ -60,8 +63,11 @@ void Characteristic::RaiseEvent() {
   if (svc == nullptr) return;
   const Accessory *acc = svc->parent();
   if (acc == nullptr || acc->server() == nullptr) return;
+  int64_t start = mgos_uptime_micros();
   HAPAccessoryServerRaiseEvent(acc->server(), GetHAPCharacteristic(),
                                svc->GetHAPService(), acc->GetHAPAccessory());
+  HAPStatsRecordRequest(HAPRequestType::kEvent,
+                        mgos_uptime_micros() - start);
 }
 
 StringCharacteristic::StringCharacteristic(uint16_t iid, const HAPUUID *type,
@@ -104,5 +110,56 @@ HAPError StringCharacteristic::HandleReadCB(
   return kHAPError_None;
 }
 
+DataCharacteristic::DataCharacteristic(uint16_t iid, const HAPUUID *type,
+                                       uint32_t max_length,
+                                       ReadHandler read_handler,
+                                       bool supports_notification,
+                                       WriteHandler write_handler,
+                                       const char *debug_description)
+    : Characteristic(iid, kHAPCharacteristicFormat_Data, type,
+                     debug_description),
+      read_handler_(read_handler),
+      write_handler_(write_handler) {
+  HAPDataCharacteristic *c = &hap_char_.char_.data;
+  c->constraints.maxLength = max_length;
+  if (read_handler) {
+    c->properties.readable = true;
+    c->properties.supportsEventNotification = supports_notification;
+    c->callbacks.handleRead = DataCharacteristic::HandleReadCB;
+  }
+  if (write_handler) {
+    c->properties.writable = true;
+    c->callbacks.handleWrite = DataCharacteristic::HandleWriteCB;
+  }
+}
+
+DataCharacteristic::~DataCharacteristic() {
+}
+
+// static
+HAPError DataCharacteristic::HandleReadCB(
+    HAPAccessoryServerRef *server,
+    const HAPDataCharacteristicReadRequest *request, void *value,
+    size_t maxValueBytes, size_t *numValueBytes, void *context) {
+  auto *hci = reinterpret_cast<const HAPCharacteristicWithInstance *>(
+      request->characteristic);
+  auto *c = static_cast<const DataCharacteristic *>(hci->inst);
+  (void) context;
+  return c->read_handler_(server, request, value, maxValueBytes,
+                          numValueBytes);
+}
+
+// static
+HAPError DataCharacteristic::HandleWriteCB(
+    HAPAccessoryServerRef *server,
+    const HAPDataCharacteristicWriteRequest *request, const void *value,
+    size_t numValueBytes, void *context) {
+  auto *hci = reinterpret_cast<const HAPCharacteristicWithInstance *>(
+      request->characteristic);
+  auto *c = static_cast<const DataCharacteristic *>(hci->inst);
+  (void) context;
+  return c->write_handler_(server, request, value, numValueBytes);
+}
+
 }  // namespace hap
 }  // namespace shelly
@@ -197,6 +197,63 @@ class UInt8Characteristic
   }
 };
 
+class FloatCharacteristic
+    : public ScalarCharacteristic<float, HAPFloatCharacteristic,
+                                  HAPFloatCharacteristicReadRequest,
+                                  HAPFloatCharacteristicWriteRequest> {
+ public:
+  FloatCharacteristic(uint16_t iid, const HAPUUID *type, float min, float max,
+                      float step, ReadHandler read_handler,
+                      bool supports_notification,
+                      WriteHandler write_handler = nullptr,
+                      const char *debug_description = nullptr)
+      : ScalarCharacteristic(kHAPCharacteristicFormat_Float, iid, type,
+                             read_handler, supports_notification, write_handler,
+                             debug_description) {
+    HAPFloatCharacteristic *c = &hap_char_.char_.float_;
+    c->constraints.minimumValue = min;
+    c->constraints.maximumValue = max;
+    c->constraints.stepValue = step;
+  }
+  virtual ~FloatCharacteristic() {
+  }
+};
+
+// Opaque data, base64-encoded on the wire. Readable if read_handler is set,
+// writable if write_handler is set.
+class DataCharacteristic : public Characteristic {
+ public:
+  typedef std::function<HAPError(
+      HAPAccessoryServerRef *server,
+      const HAPDataCharacteristicReadRequest *request, void *value,
+      size_t max_len, size_t *len)>
+      ReadHandler;
+  typedef std::function<HAPError(
+      HAPAccessoryServerRef *server,
+      const HAPDataCharacteristicWriteRequest *request, const void *value,
+      size_t len)>
+      WriteHandler;
+
+  DataCharacteristic(uint16_t iid, const HAPUUID *type, uint32_t max_length,
+                     ReadHandler read_handler, bool supports_notification,
+                     WriteHandler write_handler = nullptr,
+                     const char *debug_description = nullptr);
+  virtual ~DataCharacteristic();
+
+ private:
+  static HAPError HandleReadCB(HAPAccessoryServerRef *server,
+                               const HAPDataCharacteristicReadRequest *request,
+                               void *value, size_t maxValueBytes,
+                               size_t *numValueBytes, void *context);
+  static HAPError HandleWriteCB(
+      HAPAccessoryServerRef *server,
+      const HAPDataCharacteristicWriteRequest *request, const void *value,
+      size_t numValueBytes, void *context);
+
+  const ReadHandler read_handler_;
+  const WriteHandler write_handler_;
+};
+
 }  // namespace hap
 }  // namespace shelly
 
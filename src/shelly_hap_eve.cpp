@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_hap_eve.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "mgos.h"
+
+// Eve UUIDs are E863Fxxx-079E-48FF-8F27-9C2605A29F52.
+#define EVE_UUID(x)                                                         \
+  {                                                                         \
+    {                                                                       \
+      0x52, 0x9F, 0xA2, 0x05, 0x26, 0x9C, 0x27, 0x8F, 0xFF, 0x48, 0x9E,    \
+          0x07, (x) & 0xff, ((x) >> 8) & 0xff, 0x63, 0xE8                  \
+    }                                                                       \
+  }
+
+// Eve timestamps are relative to 2001-01-01.
+#define EVE_EPOCH_OFFSET 978307200
+// Maximum number of entries returned by one read.
+#define EVE_MAX_ENTRIES_PER_READ 11
+
+namespace shelly {
+namespace hap {
+
+static const HAPUUID kEveServiceType_History = EVE_UUID(0xF007);
+static const HAPUUID kEveCharacteristicType_HistoryStatus = EVE_UUID(0xF116);
+static const HAPUUID kEveCharacteristicType_HistoryEntries = EVE_UUID(0xF117);
+static const HAPUUID kEveCharacteristicType_HistoryRequest = EVE_UUID(0xF11C);
+static const HAPUUID kEveCharacteristicType_SetTime = EVE_UUID(0xF121);
+static const HAPUUID kEveCharacteristicType_Power = EVE_UUID(0xF10D);
+static const HAPUUID kEveCharacteristicType_TotalConsumption =
+    EVE_UUID(0xF10C);
+
+static uint8_t *PutU16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+static uint8_t *PutU32(uint8_t *p, uint32_t v) {
+  p = PutU16(p, v & 0xffff);
+  return PutU16(p, v >> 16);
+}
+
+static uint8_t *PutBytes(uint8_t *p, const char *data, size_t len) {
+  memcpy(p, data, len);
+  return p + len;
+}
+
+EveHistoryService::EveHistoryService(uint16_t iid, EveHistory *hist)
+    : Service(iid, &kEveServiceType_History, "eve-history"),
+      hist_(hist) {
+  iid++;
+  // Status
+  AddChar(new DataCharacteristic(
+      iid++, &kEveCharacteristicType_HistoryStatus, 64,
+      [this](HAPAccessoryServerRef *, const HAPDataCharacteristicReadRequest *,
+             void *value, size_t max_len, size_t *len) {
+        return HandleStatusRead(static_cast<uint8_t *>(value), max_len, len);
+      },
+      false /* supports_notification */, nullptr /* write_handler */,
+      "eve-history-status"));
+  // Entries
+  AddChar(new DataCharacteristic(
+      iid++, &kEveCharacteristicType_HistoryEntries, 256,
+      [this](HAPAccessoryServerRef *, const HAPDataCharacteristicReadRequest *,
+             void *value, size_t max_len, size_t *len) {
+        return HandleEntriesRead(static_cast<uint8_t *>(value), max_len, len);
+      },
+      false /* supports_notification */, nullptr /* write_handler */,
+      "eve-history-entries"));
+  // Request
+  AddChar(new DataCharacteristic(
+      iid++, &kEveCharacteristicType_HistoryRequest, 64,
+      nullptr /* read_handler */, false /* supports_notification */,
+      [this](HAPAccessoryServerRef *, const HAPDataCharacteristicWriteRequest *,
+             const void *value, size_t len) {
+        return HandleRequestWrite(static_cast<const uint8_t *>(value), len);
+      },
+      "eve-history-request"));
+  // Set time. We have SNTP, ignore.
+  AddChar(new DataCharacteristic(
+      iid++, &kEveCharacteristicType_SetTime, 64, nullptr /* read_handler */,
+      false /* supports_notification */,
+      [](HAPAccessoryServerRef *, const HAPDataCharacteristicWriteRequest *,
+         const void *, size_t) { return kHAPError_None; },
+      "eve-set-time"));
+}
+
+EveHistoryService::~EveHistoryService() {
+}
+
+// Entry first_seq is the reference time marker, records follow it
+// so record seq is entry seq + 1.
+uint32_t EveHistoryService::first_entry() const {
+  uint32_t first_seq = hist_->first_seq();
+  return (first_seq > 0 ? first_seq - 1 : 0);
+}
+
+uint32_t EveHistoryService::last_entry() const {
+  uint32_t last_seq = hist_->last_seq();
+  return (last_seq > 0 ? last_seq + 1 : 0);
+}
+
+HAPError EveHistoryService::HandleStatusRead(uint8_t *buf, size_t max_len,
+                                             size_t *len) {
+  if (max_len < 35) return kHAPError_OutOfResources;
+  uint32_t ref_time = hist_->ref_time();
+  uint32_t last_time = 0;
+  uint32_t last_seq = hist_->last_seq();
+  EveHistoryRecord r;
+  if (last_seq > 0 && hist_->Read(last_seq, &r, 1) == 1 && r.time != 0) {
+    last_time = r.time - ref_time;
+  }
+  uint32_t used = last_entry() - first_entry();
+  uint32_t size = hist_->capacity() + 1;
+  uint8_t *p = buf;
+  p = PutU32(p, last_time);
+  p = PutU32(p, 0);  // Negative offset.
+  p = PutU32(p, (ref_time > 0 ? ref_time - EVE_EPOCH_OFFSET : 0));
+  // Signature: power (0x07) only, other fields are present but zero.
+  p = PutBytes(p, "\x04\x01\x02\x02\x02\x07\x02\x0f\x03", 9);
+  p = PutU16(p, std::min(used, size));
+  p = PutU16(p, size);
+  p = PutU32(p, first_entry());
+  p = PutBytes(p, "\x00\x00\x00\x00\x01\x01", 6);
+  *len = p - buf;
+  return kHAPError_None;
+}
+
+HAPError EveHistoryService::HandleEntriesRead(uint8_t *buf, size_t max_len,
+                                              size_t *len) {
+  uint8_t *p = buf;
+  uint32_t first_seq = hist_->first_seq();
+  // Entries are read from flash in batches, not all at once.
+  EveHistoryRecord recs[EVE_MAX_ENTRIES_PER_READ];
+  int num_recs = 0, ri = 0;
+  for (int i = 0; i < EVE_MAX_ENTRIES_PER_READ; i++) {
+    if (!transfer_ || first_seq == 0 || next_entry_ > last_entry()) break;
+    if ((size_t)(p - buf) + 21 > max_len) break;
+    uint32_t e = next_entry_;
+    if (e < first_seq) e = first_seq;
+    if (e == first_seq) {
+      // Reference time marker.
+      *p++ = 0x15;
+      p = PutU32(p, e);
+      p = PutBytes(p, "\x01\x00\x00\x00\x81", 5);
+      p = PutU32(p, hist_->ref_time() - EVE_EPOCH_OFFSET);
+      p = PutBytes(p, "\x00\x00\x00\x00\x00\x00\x00", 7);
+      prev_time_ = hist_->ref_time();
+      next_entry_ = e + 1;
+      continue;
+    }
+    if (ri == num_recs) {
+      num_recs = hist_->Read(e - 1, recs, EVE_MAX_ENTRIES_PER_READ - i);
+      ri = 0;
+      if (num_recs <= 0) break;
+    }
+    const EveHistoryRecord &r = recs[ri++];
+    uint32_t t = r.time;
+    if (t == 0) {
+      // Lost record, keep the spacing.
+      t = (prev_time_ != 0 ? prev_time_ : hist_->ref_time()) +
+          EVE_HISTORY_INTERVAL;
+    }
+    prev_time_ = t;
+    *p++ = 0x14;
+    p = PutU32(p, e);
+    p = PutU32(p, t - hist_->ref_time());
+    *p++ = 0x1f;
+    p = PutU16(p, 0);
+    p = PutU16(p, 0);
+    p = PutU16(p, r.power_dw);
+    p = PutU16(p, 0);
+    p = PutU16(p, 0);
+    next_entry_ = e + 1;
+  }
+  if (p == buf) {
+    // Transfer complete.
+    *p++ = 0;
+    transfer_ = false;
+  }
+  *len = p - buf;
+  return kHAPError_None;
+}
+
+HAPError EveHistoryService::HandleRequestWrite(const uint8_t *data,
+                                               size_t len) {
+  if (len < 6) return kHAPError_InvalidData;
+  uint32_t addr = data[2] | (data[3] << 8) | (data[4] << 16) |
+                  ((uint32_t) data[5] << 24);
+  if (addr == 0) addr = 1;
+  next_entry_ = std::max(addr, first_entry() + 1);
+  prev_time_ = 0;
+  transfer_ = true;
+  LOG(LL_DEBUG, ("Eve history request from %u, entries %u - %u",
+                 (unsigned) addr, (unsigned) first_entry(),
+                 (unsigned) last_entry()));
+  return kHAPError_None;
+}
+
+std::unique_ptr<Service> CreateEveServices(int id, Service *sw_svc,
+                                           PowerMeter *pm) {
+  const int id1 = id - 1;
+  uint16_t iid = SHELLY_HAP_IID_BASE_EVE + (SHELLY_HAP_IID_STEP_EVE * id1);
+  // Power
+  sw_svc->AddChar(new FloatCharacteristic(
+      iid++, &kEveCharacteristicType_Power, 0, 65535, 0.1,
+      [pm](HAPAccessoryServerRef *, const HAPFloatCharacteristicReadRequest *,
+           float *value) {
+        auto power = pm->GetPowerW();
+        if (!power.ok()) return kHAPError_Busy;
+        *value = power.ValueOrDie();
+        return kHAPError_None;
+      },
+      false /* supports_notification */, nullptr /* write_handler */,
+      "eve-power"));
+  // Total consumption, since boot.
+  sw_svc->AddChar(new FloatCharacteristic(
+      iid++, &kEveCharacteristicType_TotalConsumption, 0, 1000000, 0.001,
+      [pm](HAPAccessoryServerRef *, const HAPFloatCharacteristicReadRequest *,
+           float *value) {
+        auto energy = pm->GetEnergyWH();
+        if (!energy.ok()) return kHAPError_Busy;
+        *value = energy.ValueOrDie() / 1000.0f;
+        return kHAPError_None;
+      },
+      false /* supports_notification */, nullptr /* write_handler */,
+      "eve-total-consumption"));
+  EveHistory *hist = EveHistoryGet(id);
+  if (hist == nullptr) return nullptr;
+  return std::unique_ptr<Service>(new EveHistoryService(iid, hist));
+}
+
+}  // namespace hap
+}  // namespace shelly
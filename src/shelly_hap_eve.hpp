@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+
+#include "shelly_eve_history.hpp"
+#include "shelly_hap_service.hpp"
+#include "shelly_pm.hpp"
+
+namespace shelly {
+namespace hap {
+
+// Eve (Elgato) history service, serves power history of one channel.
+class EveHistoryService : public Service {
+ public:
+  EveHistoryService(uint16_t iid, EveHistory *hist);
+  virtual ~EveHistoryService();
+
+ private:
+  uint32_t first_entry() const;
+  uint32_t last_entry() const;
+
+  HAPError HandleStatusRead(uint8_t *buf, size_t max_len, size_t *len);
+  HAPError HandleEntriesRead(uint8_t *buf, size_t max_len, size_t *len);
+  HAPError HandleRequestWrite(const uint8_t *data, size_t len);
+
+  EveHistory *const hist_;
+  bool transfer_ = false;
+  uint32_t next_entry_ = 0;
+  uint32_t prev_time_ = 0;
+
+  EveHistoryService(const EveHistoryService &other) = delete;
+};
+
+// Adds Eve power and consumption characteristics to sw_svc and returns
+// the history service for channel id, if history is kept for it.
+std::unique_ptr<Service> CreateEveServices(int id, Service *sw_svc,
+                                           PowerMeter *pm);
+
+}  // namespace hap
+}  // namespace shelly
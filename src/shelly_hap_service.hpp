@@ -32,6 +32,10 @@
 #define SHELLY_HAP_IID_STEP_LOCK 4
 #define SHELLY_HAP_IID_BASE_STATELESS_SWITCH 0x400
 #define SHELLY_HAP_IID_STEP_STATELESS_SWITCH 4
+#define SHELLY_HAP_IID_BASE_WINDOW_COVERING 0x500
+#define SHELLY_HAP_IID_STEP_WINDOW_COVERING 5
+#define SHELLY_HAP_IID_BASE_EVE 0x600
+#define SHELLY_HAP_IID_STEP_EVE 8
 #define SHELLY_HAP_IID_BASE_SERVICE_LABEL 0x1030
 
 namespace shelly {
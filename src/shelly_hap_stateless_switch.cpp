@@ -19,6 +19,7 @@
 
 #include "mgos.h"
 
+#include "shelly_clock.hpp"
 #include "shelly_hap_accessory.hpp"
 #include "shelly_hap_chars.hpp"
 
@@ -40,7 +41,9 @@ StatelessSwitch::StatelessSwitch(int id, Input *in, struct mgos_config_ssw *cfg,
 }
 
 StatelessSwitch::~StatelessSwitch() {
-  in_->RemoveHandler(handler_id_);
+  if (in_ != nullptr) {
+    in_->RemoveHandler(handler_id_);
+  }
 }
 
 Status StatelessSwitch::Init() {
@@ -83,21 +86,22 @@ Status StatelessSwitch::Init() {
 StatusOr<std::string> StatelessSwitch::GetInfo() const {
   double last_ev_age = -1;
   if (last_ev_ts_ > 0) {
-    last_ev_age = mgos_uptime() - last_ev_ts_;
+    last_ev_age = ClockUptime() - last_ev_ts_;
   }
   return mgos::JSONPrintStringf(
-      "{id: %d, type: %d, name: %Q, in_mode: %d, "
+      "{id: %d, type: %d, name: %Q, in_mode: %d, group: %B, "
       "last_ev: %d, last_ev_age: %.3f}",
-      id(), type(), (cfg_->name ? cfg_->name : ""), cfg_->in_mode, last_ev_,
-      last_ev_age);
+      id(), type(), (cfg_->name ? cfg_->name : ""), cfg_->in_mode,
+      mgos_sys_config_get_shelly_ssw_group(), last_ev_, last_ev_age);
 }
 
 Status StatelessSwitch::SetConfig(const std::string &config_json,
                                   bool *restart_required) {
   char *name = nullptr;
   int in_mode = -1;
-  json_scanf(config_json.c_str(), config_json.size(), "{name: %Q, in_mode: %d}",
-             &name, &in_mode);
+  bool group = mgos_sys_config_get_shelly_ssw_group();
+  json_scanf(config_json.c_str(), config_json.size(),
+             "{name: %Q, in_mode: %d, group: %B}", &name, &in_mode, &group);
   mgos::ScopedCPtr name_owner(name);
   *restart_required = false;
   // Validation.
@@ -114,6 +118,11 @@ Status StatelessSwitch::SetConfig(const std::string &config_json,
     *restart_required = true;
   }
   cfg_->in_mode = in_mode;
+  // Layout is shared by all the inputs.
+  if (group != mgos_sys_config_get_shelly_ssw_group()) {
+    mgos_sys_config_set_shelly_ssw_group(group);
+    *restart_required = true;
+  }
   return Status::OK();
 }
 
@@ -155,7 +164,7 @@ void StatelessSwitch::InputEventHandler(Input::Event ev, bool state) {
 
 void StatelessSwitch::RaiseEvent(uint8_t ev) {
   last_ev_ = ev;
-  last_ev_ts_ = mgos_uptime();
+  last_ev_ts_ = ClockUptime();
   LOG(LL_INFO, ("Input %d: HAP event (mode %d): %d", id(), cfg_->in_mode, ev));
   chars_[1]->RaiseEvent();
 }
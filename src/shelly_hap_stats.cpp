@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_hap_stats.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "HAPAccessoryServer+Internal.h"
+#include "HAPPlatformTCPStreamManager+Init.h"
+
+#include "shelly_common.hpp"
+
+// Unused portion of the scratch buffer is filled with this pattern,
+// high-water mark is determined by looking for the last byte that differs.
+#define SCRATCH_FILL_BYTE 0xa5
+
+namespace shelly {
+
+// Crypto and request handling cost of a session. Per-frame decryption and
+// encryption happens synchronously when data is received, so it is included
+// in the handling time.
+struct HAPSessionStats {
+  HAPPlatformTCPStreamRef ts;
+  uint32_t num_reqs;
+  uint32_t num_verifies;
+  uint64_t rx_bytes;
+  uint64_t tx_bytes;
+  uint64_t time_us;
+};
+
+static HAPIPAccessoryServerStorage *s_storage = nullptr;
+static HAPPlatformTCPStreamManagerRef s_tcpm;
+static HAPMemStats s_mem_stats = {};
+static HAPRequestStats s_req_stats[(int) HAPRequestType::kMax] = {};
+static HAPSessionStats *s_sess_stats = nullptr;
+static uint32_t s_num_pair_verify_ok = 0;
+static mg_event_handler_t s_hap_conn_handler = nullptr;
+
+static const char *RequestTypeName(HAPRequestType type) {
+  switch (type) {
+    case HAPRequestType::kRead:
+      return "read";
+    case HAPRequestType::kWrite:
+      return "write";
+    case HAPRequestType::kEvent:
+      return "event";
+    case HAPRequestType::kAccessories:
+      return "accessories";
+    case HAPRequestType::kPairSetup:
+      return "pair_setup";
+    case HAPRequestType::kPairVerify:
+      return "pair_verify";
+    case HAPRequestType::kOther:
+    case HAPRequestType::kMax:
+      break;
+  }
+  return "other";
+}
+
+static bool StartsWith(const char *p, size_t len, const char *prefix) {
+  size_t prefix_len = strlen(prefix);
+  return (len >= prefix_len && strncmp(p, prefix, prefix_len) == 0);
+}
+
+// Looks at the request line of the last request processed by the session.
+// Inbound buffer is decrypted in place, so it contains plain text.
+static HAPRequestType GetRequestType(const HAPIPSessionDescriptor *sd) {
+  const char *p = sd->inboundBuffer.data;
+  size_t len = sd->inboundBuffer.capacity;
+  if (p == nullptr) return HAPRequestType::kOther;
+  if (StartsWith(p, len, "GET /characteristics")) {
+    return HAPRequestType::kRead;
+  } else if (StartsWith(p, len, "PUT /characteristics")) {
+    return HAPRequestType::kWrite;
+  } else if (StartsWith(p, len, "GET /accessories")) {
+    return HAPRequestType::kAccessories;
+  } else if (StartsWith(p, len, "POST /pair-setup")) {
+    return HAPRequestType::kPairSetup;
+  } else if (StartsWith(p, len, "POST /pair-verify")) {
+    return HAPRequestType::kPairVerify;
+  }
+  return HAPRequestType::kOther;
+}
+
+static int FindSession(HAPPlatformTCPStreamRef ts) {
+  for (size_t i = 0; i < s_storage->numSessions; i++) {
+    const HAPIPSessionDescriptor *sd =
+        (const HAPIPSessionDescriptor *) &s_storage->sessions[i].descriptor;
+    if (sd->server != nullptr && sd->tcpStreamIsOpen && sd->tcpStream == ts) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void HAPStatsRecordRequest(HAPRequestType type, int64_t duration_us) {
+  HAPRequestStats *rs = &s_req_stats[(int) type];
+  rs->count++;
+  rs->total_us += duration_us;
+  rs->max_us = std::max(rs->max_us, (uint32_t) duration_us);
+}
+
+// Wraps the stream manager's handler for HAP connections. Received data is
+// decrypted, processed and the response is encrypted and queued for sending
+// within the handler, so we time the whole thing.
+static void HAPConnHandler(struct mg_connection *nc, int ev, void *ev_data,
+                           void *user_data) {
+  if (ev != MG_EV_RECV) {
+    s_hap_conn_handler(nc, ev, ev_data, user_data);
+    return;
+  }
+  HAPPlatformTCPStreamRef ts = (HAPPlatformTCPStreamRef) nc->user_data;
+  int si = FindSession(ts);
+  const HAPIPSessionDescriptor *sd = nullptr;
+  bool was_secured = false;
+  if (si >= 0) {
+    sd = (const HAPIPSessionDescriptor *) &s_storage->sessions[si].descriptor;
+    was_secured = sd->securitySession.isSecured;
+  }
+  size_t tx_before = nc->send_mbuf.len;
+  int64_t start = mgos_uptime_micros();
+  s_hap_conn_handler(nc, ev, ev_data, user_data);
+  int64_t duration_us = mgos_uptime_micros() - start;
+  size_t tx_len = nc->send_mbuf.len - std::min(tx_before, nc->send_mbuf.len);
+  if (sd == nullptr) return;
+  HAPSessionStats *ss = &s_sess_stats[si];
+  if (ss->ts != ts) {
+    *ss = {};
+    ss->ts = ts;
+  }
+  ss->rx_bytes += *((int *) ev_data);
+  ss->tx_bytes += tx_len;
+  ss->time_us += duration_us;
+  if (!was_secured && sd->securitySession.isSecured) {
+    ss->num_verifies++;
+    s_num_pair_verify_ok++;
+  }
+  // No response means the request is not complete yet.
+  if (tx_len == 0) return;
+  ss->num_reqs++;
+  HAPStatsRecordRequest(GetRequestType(sd), duration_us);
+}
+
+static void WrapHAPConnHandlers() {
+  uint16_t port = HAPPlatformTCPStreamManagerGetListenerPort(s_tcpm);
+  struct mg_mgr *mgr = mgos_get_mgr();
+  for (struct mg_connection *nc = mg_next(mgr, nullptr); nc != nullptr;
+       nc = mg_next(mgr, nc)) {
+    if (nc->listener == nullptr || nc->handler == HAPConnHandler ||
+        ntohs(nc->listener->sa.sin.sin_port) != port) {
+      continue;
+    }
+    s_hap_conn_handler = nc->handler;
+    nc->handler = HAPConnHandler;
+  }
+}
+
+static size_t GetBufUsage(const HAPIPByteBuffer &buf) {
+  // In write mode limit == capacity and position is the fill level,
+  // in read mode data occupies [0, limit).
+  return (buf.limit < buf.capacity ? buf.limit : buf.position);
+}
+
+// Sessions are sampled on every iteration of the event loop, that is where
+// requests are processed.
+static void HAPStatsPollCB(void *arg) {
+  HAPMemStats *ms = &s_mem_stats;
+  int num_sessions = 0;
+  for (size_t i = 0; i < s_storage->numSessions; i++) {
+    HAPIPSessionDescriptor *sd =
+        (HAPIPSessionDescriptor *) &s_storage->sessions[i].descriptor;
+    if (sd->server == nullptr) continue;
+    num_sessions++;
+    ms->in_buf_cap = std::max(ms->in_buf_cap, sd->inboundBuffer.capacity);
+    ms->in_buf_hwm = std::max(ms->in_buf_hwm, GetBufUsage(sd->inboundBuffer));
+    ms->out_buf_cap = std::max(ms->out_buf_cap, sd->outboundBuffer.capacity);
+    size_t out_used = GetBufUsage(sd->outboundBuffer);
+    ms->out_buf_hwm = std::max(ms->out_buf_hwm, out_used);
+    // Outbound buffer in read mode contains a complete serialized response.
+    if (sd->outboundBuffer.limit < sd->outboundBuffer.capacity) {
+      ms->resp_size_hwm = std::max(ms->resp_size_hwm, out_used);
+    }
+  }
+  ms->num_sessions_hwm = std::max(ms->num_sessions_hwm, num_sessions);
+  WrapHAPConnHandlers();
+  (void) arg;
+}
+
+static size_t GetScratchHWM() {
+  if (s_storage == nullptr) return 0;
+  const uint8_t *p = (const uint8_t *) s_storage->scratchBuffer.bytes;
+  size_t n = s_storage->scratchBuffer.numBytes;
+  while (n > 0 && p[n - 1] == SCRATCH_FILL_BYTE) n--;
+  return n;
+}
+
+bool HAPStatsInit(HAPIPAccessoryServerStorage *storage,
+                  HAPPlatformTCPStreamManagerRef tcpm) {
+  // Stats stay disabled (s_storage == nullptr) if allocation fails.
+  s_sess_stats = (HAPSessionStats *) calloc(storage->numSessions,
+                                            sizeof(HAPSessionStats));
+  if (s_sess_stats == nullptr) return false;
+  s_storage = storage;
+  s_tcpm = tcpm;
+  // Must be done before the server is started.
+  memset(storage->scratchBuffer.bytes, SCRATCH_FILL_BYTE,
+         storage->scratchBuffer.numBytes);
+  s_mem_stats.scratch_size = storage->scratchBuffer.numBytes;
+  mgos_add_poll_cb(HAPStatsPollCB, nullptr);
+  return true;
+}
+
+void HAPStatsGetMem(HAPMemStats *stats) {
+  s_mem_stats.scratch_hwm = GetScratchHWM();
+  *stats = s_mem_stats;
+}
+
+void HAPStatsWriteNC(struct mg_connection *nc) {
+  HAPMemStats ms;
+  HAPStatsGetMem(&ms);
+  mg_printf(nc,
+            "HAP scratch buffer: %u/%u\r\n"
+            "HAP session buffers: in %u/%u, out %u/%u, max sessions %d\r\n"
+            "HAP max response size: %u\r\n",
+            (unsigned) ms.scratch_hwm, (unsigned) ms.scratch_size,
+            (unsigned) ms.in_buf_hwm, (unsigned) ms.in_buf_cap,
+            (unsigned) ms.out_buf_hwm, (unsigned) ms.out_buf_cap,
+            ms.num_sessions_hwm, (unsigned) ms.resp_size_hwm);
+  mg_printf(nc, "HAP requests (count/avg/max us):");
+  for (int i = 0; i < (int) HAPRequestType::kMax; i++) {
+    const HAPRequestStats &rs = s_req_stats[i];
+    mg_printf(nc, " %s %u/%u/%u", RequestTypeName((HAPRequestType) i),
+              (unsigned) rs.count,
+              (unsigned) (rs.count > 0 ? rs.total_us / rs.count : 0),
+              (unsigned) rs.max_us);
+  }
+  mg_printf(nc, "\r\nHAP pair verify: %u ok\r\n",
+            (unsigned) s_num_pair_verify_ok);
+}
+
+std::string HAPStatsGetJSON() {
+  HAPMemStats ms;
+  HAPStatsGetMem(&ms);
+  std::string res = mgos::JSONPrintStringf(
+      "{hap_mem: {scratch_size: %u, scratch_hwm: %u, "
+      "in_buf_cap: %u, in_buf_hwm: %u, out_buf_cap: %u, out_buf_hwm: %u, "
+      "resp_size_hwm: %u, num_sessions_hwm: %d}",
+      (unsigned) ms.scratch_size, (unsigned) ms.scratch_hwm,
+      (unsigned) ms.in_buf_cap, (unsigned) ms.in_buf_hwm,
+      (unsigned) ms.out_buf_cap, (unsigned) ms.out_buf_hwm,
+      (unsigned) ms.resp_size_hwm, ms.num_sessions_hwm);
+  res.append(", hap_req: {");
+  for (int i = 0; i < (int) HAPRequestType::kMax; i++) {
+    const HAPRequestStats &rs = s_req_stats[i];
+    mgos::JSONAppendStringf(
+        &res, "%s%s: {count: %u, total_us: %llu, max_us: %u}",
+        (i > 0 ? ", " : ""), RequestTypeName((HAPRequestType) i),
+        (unsigned) rs.count, (unsigned long long) rs.total_us,
+        (unsigned) rs.max_us);
+  }
+  mgos::JSONAppendStringf(&res, "}, hap_pair_verify_ok: %u, hap_sessions: [",
+                          (unsigned) s_num_pair_verify_ok);
+  bool first = true;
+  size_t num_sessions = (s_storage != nullptr ? s_storage->numSessions : 0);
+  for (size_t i = 0; i < num_sessions; i++) {
+    const HAPIPSessionDescriptor *sd =
+        (const HAPIPSessionDescriptor *) &s_storage->sessions[i].descriptor;
+    const HAPSessionStats &ss = s_sess_stats[i];
+    if (sd->server == nullptr || !sd->tcpStreamIsOpen ||
+        ss.ts != sd->tcpStream) {
+      continue;
+    }
+    mgos::JSONAppendStringf(
+        &res,
+        "%s{slot: %d, secured: %B, reqs: %u, verifies: %u, rx_bytes: %llu, "
+        "tx_bytes: %llu, time_us: %llu}",
+        (first ? "" : ", "), (int) i, sd->securitySession.isSecured,
+        (unsigned) ss.num_reqs, (unsigned) ss.num_verifies,
+        (unsigned long long) ss.rx_bytes, (unsigned long long) ss.tx_bytes,
+        (unsigned long long) ss.time_us);
+    first = false;
+  }
+  res.append("]}");
+  return res;
+}
+
+}  // namespace shelly
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "mgos.h"
+
+#include "HAP.h"
+
+namespace shelly {
+
+// High-water marks of HAP server memory usage.
+struct HAPMemStats {
+  size_t scratch_size;   // Size of the shared scratch buffer.
+  size_t scratch_hwm;    // Max number of scratch buffer bytes ever used.
+  size_t in_buf_cap;     // Max capacity of a session inbound buffer.
+  size_t in_buf_hwm;     // Max number of bytes in a session inbound buffer.
+  size_t out_buf_cap;    // Max capacity of a session outbound buffer.
+  size_t out_buf_hwm;    // Max number of bytes in a session outbound buffer.
+  size_t resp_size_hwm;  // Largest serialized response seen.
+  int num_sessions_hwm;  // Max number of sessions in use at the same time.
+};
+
+enum class HAPRequestType {
+  kRead = 0,
+  kWrite = 1,
+  kEvent = 2,
+  kAccessories = 3,
+  kPairSetup = 4,
+  kPairVerify = 5,
+  kOther = 6,
+  kMax,
+};
+
+struct HAPRequestStats {
+  uint32_t count;
+  uint32_t max_us;
+  uint64_t total_us;
+};
+
+bool HAPStatsInit(HAPIPAccessoryServerStorage *storage,
+                  HAPPlatformTCPStreamManagerRef tcpm);
+
+void HAPStatsGetMem(HAPMemStats *stats);
+
+void HAPStatsRecordRequest(HAPRequestType type, int64_t duration_us);
+
+void HAPStatsWriteNC(struct mg_connection *nc);
+
+std::string HAPStatsGetJSON();
+
+}  // namespace shelly
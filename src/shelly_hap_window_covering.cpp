@@ -0,0 +1,539 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_hap_window_covering.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <map>
+
+#include "mgos.h"
+
+#include "shelly_clock.hpp"
+#include "shelly_config_store.hpp"
+
+// Motion tick: power sampling and position notifications.
+#define WC_TICK_INTERVAL_MS 100
+// Motor inrush and startup, power is not checked during this time.
+#define WC_STARTUP_MICROS 1000000
+// Consecutive samples below idle power to declare an end stop.
+#define WC_NUM_IDLE_SAMPLES 3
+// Both outputs are kept off for at least this long when reversing.
+#define WC_REVERSE_DELAY_MICROS 300000
+// Max move time when travel time is unknown or during calibration.
+#define WC_MAX_MOVE_TIME 120.0
+// When moving to an end position, keep going a bit longer to make sure the
+// end is reached and the position estimate is in sync.
+#define WC_END_OVERTRAVEL 0.1
+// Min interval between current position notifications during motion.
+#define WC_NOTIFY_INTERVAL_MICROS 1000000
+
+namespace shelly {
+namespace hap {
+
+WindowCovering::WindowCovering(int id, Input *in_open, Input *in_close,
+                               Output *out_open, Output *out_close,
+                               PowerMeter *pm_open, PowerMeter *pm_close,
+                               struct mgos_config_wc *cfg)
+    : Component(id),
+      Service((SHELLY_HAP_IID_BASE_WINDOW_COVERING +
+               (SHELLY_HAP_IID_STEP_WINDOW_COVERING * (id - 1))),
+              &kHAPServiceType_WindowCovering,
+              kHAPServiceDebugDescription_WindowCovering),
+      in_open_(in_open),
+      in_close_(in_close),
+      out_open_(out_open),
+      out_close_(out_close),
+      pm_open_(pm_open),
+      pm_close_(pm_close),
+      cfg_(cfg),
+      last_stop_(GetLastStop(id)) {
+  // Position is unknown until the first move to an end.
+  cur_pos_ = (cfg_->current_pos >= 0 ? cfg_->current_pos : 50);
+  tgt_pos_ = (int) cur_pos_;
+}
+
+WindowCovering::~WindowCovering() {
+  // Destroyed when the HAP server is restarted. Don't leave the motor running
+  // with nothing tracking the position.
+  cal_step_ = CalStep::kNone;
+  if (dir_ != Direction::kNone) StopMove(false, "destroy", false /* notify */);
+  ClockClearTimer(move_timer_id_);
+  ClockClearTimer(tick_timer_id_);
+  ClockClearTimer(pre_move_timer_id_);
+  if (in_open_ != nullptr) in_open_->RemoveHandler(in_open_handler_);
+  if (in_close_ != nullptr) in_close_->RemoveHandler(in_close_handler_);
+}
+
+// static
+WindowCovering::LastStop &WindowCovering::GetLastStop(int id) {
+  static std::map<int, LastStop> s_last_stops;
+  return s_last_stops[id];
+}
+
+Component::Type WindowCovering::type() const {
+  return Type::kWindowCovering;
+}
+
+Status WindowCovering::Init() {
+  if (out_open_ == nullptr || out_close_ == nullptr) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "outputs are required");
+  }
+  SetOutputs(Direction::kNone, "init");
+
+  uint16_t iid = svc_.iid + 1;
+  // Name
+  AddNameChar(iid++, cfg_->name);
+  // Current Position
+  cur_pos_char_ = new UInt8Characteristic(
+      iid++, &kHAPCharacteristicType_CurrentPosition, 0, 100, 1,
+      [this](HAPAccessoryServerRef *, const HAPUInt8CharacteristicReadRequest *,
+             uint8_t *value) {
+        *value = (uint8_t) std::lround(GetCurrentPosition());
+        return kHAPError_None;
+      },
+      true /* supports_notification */, nullptr /* write_handler */,
+      kHAPCharacteristicDebugDescription_CurrentPosition);
+  AddChar(cur_pos_char_);
+  // Target Position
+  tgt_pos_char_ = new UInt8Characteristic(
+      iid++, &kHAPCharacteristicType_TargetPosition, 0, 100, 1,
+      [this](HAPAccessoryServerRef *, const HAPUInt8CharacteristicReadRequest *,
+             uint8_t *value) {
+        *value = (uint8_t) tgt_pos_;
+        return kHAPError_None;
+      },
+      true /* supports_notification */,
+      [this](HAPAccessoryServerRef *,
+             const HAPUInt8CharacteristicWriteRequest *, uint8_t value) {
+        MoveTo(value, "HAP");
+        return kHAPError_None;
+      },
+      kHAPCharacteristicDebugDescription_TargetPosition);
+  AddChar(tgt_pos_char_);
+  // Position State
+  pos_state_char_ = new UInt8Characteristic(
+      iid++, &kHAPCharacteristicType_PositionState, 0, 2, 1,
+      [this](HAPAccessoryServerRef *, const HAPUInt8CharacteristicReadRequest *,
+             uint8_t *value) {
+        switch (dir_) {
+          case Direction::kOpen:
+            *value = kHAPCharacteristicValue_PositionState_GoingToMaximum;
+            break;
+          case Direction::kClose:
+            *value = kHAPCharacteristicValue_PositionState_GoingToMinimum;
+            break;
+          case Direction::kNone:
+            *value = kHAPCharacteristicValue_PositionState_Stopped;
+            break;
+        }
+        return kHAPError_None;
+      },
+      true /* supports_notification */, nullptr /* write_handler */,
+      kHAPCharacteristicDebugDescription_PositionState);
+  AddChar(pos_state_char_);
+
+  if (in_open_ != nullptr) {
+    in_open_handler_ = in_open_->AddHandler(std::bind(
+        &WindowCovering::InputEventHandler, this, Direction::kOpen, _1, _2));
+  }
+  if (in_close_ != nullptr) {
+    in_close_handler_ = in_close_->AddHandler(std::bind(
+        &WindowCovering::InputEventHandler, this, Direction::kClose, _1, _2));
+  }
+  LOG(LL_INFO, ("Exporting '%s': window covering, pos %d", cfg_->name,
+                cfg_->current_pos));
+  return Status::OK();
+}
+
+StatusOr<std::string> WindowCovering::GetInfo() const {
+  return mgos::JSONPrintStringf(
+      "{id: %d, type: %d, name: %Q, in_mode: %d, swap_outputs: %B, "
+      "open_time: %.3f, close_time: %.3f, idle_power_thr: %.3f, "
+      "state: %d, cal_step: %d, cur_pos: %d, tgt_pos: %d, pos_known: %B}",
+      id(), type(), (cfg_->name ? cfg_->name : ""), cfg_->in_mode,
+      cfg_->swap_outputs, cfg_->open_time, cfg_->close_time,
+      cfg_->idle_power_thr, (int) state_, (int) cal_step_,
+      (int) std::lround(GetCurrentPosition()), tgt_pos_,
+      (cfg_->current_pos >= 0));
+}
+
+Status WindowCovering::SetConfig(const std::string &config_json,
+                                 bool *restart_required) {
+  struct mgos_config_wc cfg = *cfg_;
+  cfg.name = nullptr;
+  bool calibrate = false;
+  json_scanf(config_json.c_str(), config_json.size(),
+             "{name: %Q, in_mode: %d, swap_outputs: %B, open_time: %lf, "
+             "close_time: %lf, idle_power_thr: %lf, calibrate: %B}",
+             &cfg.name, &cfg.in_mode, &cfg.swap_outputs, &cfg.open_time,
+             &cfg.close_time, &cfg.idle_power_thr, &calibrate);
+  mgos::ScopedCPtr name_owner((void *) cfg.name);
+  // Validation.
+  if (cfg.name != nullptr && strlen(cfg.name) > 64) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s",
+                        "name (too long, max 64)");
+  }
+  if (cfg.in_mode < 0 || cfg.in_mode > 1) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "in_mode");
+  }
+  if (cfg.open_time < 0 || cfg.open_time > WC_MAX_MOVE_TIME) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "open_time");
+  }
+  if (cfg.close_time < 0 || cfg.close_time > WC_MAX_MOVE_TIME) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "close_time");
+  }
+  if (cfg.idle_power_thr < 0) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s",
+                        "idle_power_thr");
+  }
+  if (calibrate && !HavePM()) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT,
+                        "calibration requires power metering");
+  }
+  // Now copy over.
+  *restart_required = false;
+  if (cfg.name != nullptr && strcmp(cfg_->name, cfg.name) != 0) {
+    mgos_conf_set_str(&cfg_->name, cfg.name);
+    *restart_required = true;
+  }
+  if (cfg_->swap_outputs != cfg.swap_outputs) {
+    Stop("web");
+    cfg_->swap_outputs = cfg.swap_outputs;
+  }
+  cfg_->in_mode = cfg.in_mode;
+  cfg_->open_time = cfg.open_time;
+  cfg_->close_time = cfg.close_time;
+  cfg_->idle_power_thr = cfg.idle_power_thr;
+  if (calibrate) {
+    Stop("web");
+    LOG(LL_INFO, ("%d: Calibration started", id()));
+    state_ = State::kCalibrating;
+    cal_step_ = CalStep::kInitialClose;
+    StartMove(Direction::kClose, WC_MAX_MOVE_TIME, "calibrate");
+  }
+  return Status::OK();
+}
+
+bool WindowCovering::HavePM() const {
+#if SHELLY_HAVE_PM
+  return (pm_open_ != nullptr && pm_close_ != nullptr);
+#else
+  return false;
+#endif
+}
+
+double WindowCovering::TravelTime(Direction dir) const {
+  return (dir == Direction::kOpen ? cfg_->open_time : cfg_->close_time);
+}
+
+float WindowCovering::GetCurrentPosition() const {
+  if (state_ != State::kMoving && state_ != State::kCalibrating) {
+    return cur_pos_;
+  }
+  double tt = TravelTime(dir_);
+  // Unknown travel time or calibration: position is only known at the end.
+  if (tt <= 0 || state_ == State::kCalibrating) return cur_pos_;
+  double elapsed = (ClockUptimeMicros() - start_micros_) / 1000000.0;
+  double pos = start_pos_ + static_cast<int>(dir_) * elapsed / tt * 100;
+  if (pos < 0) pos = 0;
+  if (pos > 100) pos = 100;
+  return pos;
+}
+
+void WindowCovering::MoveTo(int pos, const char *source) {
+  if (pos < 0) pos = 0;
+  if (pos > 100) pos = 100;
+  if (state_ == State::kCalibrating) {
+    Stop(source);
+  }
+  bool tgt_changed = (pos != tgt_pos_);
+  tgt_pos_ = pos;
+  if (tgt_changed && strcmp(source, "HAP") != 0) {
+    tgt_pos_char_->RaiseEvent();
+  }
+  // Will be picked up when the other direction has settled.
+  if (state_ == State::kPreMove) return;
+  float cur_pos = GetCurrentPosition();
+  Direction dir;
+  double duration;
+  if (pos == 0 || pos == 100) {
+    if (state_ == State::kIdle && std::fabs(cur_pos - pos) < 0.5 &&
+        cfg_->current_pos >= 0) {
+      return;
+    }
+    dir = (pos == 100 ? Direction::kOpen : Direction::kClose);
+    double tt = TravelTime(dir);
+    if (tt > 0 && cfg_->current_pos >= 0) {
+      duration = (std::fabs(pos - cur_pos) / 100 + WC_END_OVERTRAVEL) * tt;
+    } else {
+      duration = WC_MAX_MOVE_TIME;
+    }
+  } else {
+    dir = (pos > cur_pos ? Direction::kOpen : Direction::kClose);
+    double tt = TravelTime(dir);
+    if (tt <= 0 || cfg_->current_pos < 0) {
+      LOG(LL_ERROR, ("%d: Position is unknown or not calibrated", id()));
+      tgt_pos_ = (int) std::lround(cur_pos);
+      tgt_pos_char_->RaiseEvent();
+      return;
+    }
+    duration = std::fabs(pos - cur_pos) / 100 * tt;
+    if (duration * 1000 < WC_TICK_INTERVAL_MS) {
+      if (state_ == State::kMoving) StopMove(false, source);
+      return;
+    }
+  }
+  if (state_ == State::kMoving) {
+    if (dir == dir_) {
+      // Same direction, just re-plan.
+      StartMove(dir, duration, source);
+      return;
+    }
+    StopMove(false, source);
+    tgt_pos_ = pos;
+  }
+  int64_t since_stop = ClockUptimeMicros() - last_stop_.micros;
+  if (last_stop_.dir != Direction::kNone && last_stop_.dir != dir &&
+      since_stop < WC_REVERSE_DELAY_MICROS) {
+    state_ = State::kPreMove;
+    pending_source_ = source;
+    pre_move_timer_id_ =
+        ClockSetTimer((WC_REVERSE_DELAY_MICROS - since_stop) / 1000 + 1, 0,
+                      PreMoveTimerCB, this);
+    return;
+  }
+  StartMove(dir, duration, source);
+}
+
+void WindowCovering::Stop(const char *source) {
+  cal_step_ = CalStep::kNone;
+  // Also armed between calibration steps, while state is kCalibrating.
+  ClockClearTimer(pre_move_timer_id_);
+  pre_move_timer_id_ = MGOS_INVALID_TIMER_ID;
+  switch (state_) {
+    case State::kIdle:
+      break;
+    case State::kPreMove:
+      state_ = State::kIdle;
+      tgt_pos_ = (int) std::lround(cur_pos_);
+      NotifyPosition(true /* force */);
+      break;
+    case State::kMoving:
+    case State::kCalibrating:
+      StopMove(false, source);
+      break;
+  }
+}
+
+void WindowCovering::StartMove(Direction dir, double duration,
+                               const char *source) {
+  start_pos_ = cur_pos_ = GetCurrentPosition();
+  start_micros_ = ClockUptimeMicros();
+  num_idle_samples_ = 0;
+  bool dir_changed = (dir != dir_);
+  dir_ = dir;
+  if (state_ != State::kCalibrating) state_ = State::kMoving;
+  SetOutputs(dir, source);
+  // Stop time is scheduled precisely rather than polled.
+  ClockClearTimer(move_timer_id_);
+  move_timer_id_ = ClockSetTimer(std::lround(duration * 1000), 0,
+                                 MoveTimerCB, this);
+  if (tick_timer_id_ == MGOS_INVALID_TIMER_ID) {
+    tick_timer_id_ = ClockSetTimer(WC_TICK_INTERVAL_MS, MGOS_TIMER_REPEAT,
+                                   TickTimerCB, this);
+  }
+  LOG(LL_INFO, ("%d: Moving %s from %d to %d, %.3f s (%s)", id(),
+                (dir == Direction::kOpen ? "up" : "down"),
+                (int) std::lround(start_pos_), tgt_pos_, duration, source));
+  if (dir_changed) pos_state_char_->RaiseEvent();
+}
+
+void WindowCovering::StopMove(bool at_end, const char *source,
+                              bool notify) {
+  float pos = GetCurrentPosition();
+  if (at_end) {
+    pos = (dir_ == Direction::kOpen ? 100 : 0);
+  }
+  SetOutputs(Direction::kNone, source);
+  ClockClearTimer(move_timer_id_);
+  move_timer_id_ = MGOS_INVALID_TIMER_ID;
+  ClockClearTimer(tick_timer_id_);
+  tick_timer_id_ = MGOS_INVALID_TIMER_ID;
+  last_stop_.dir = dir_;
+  last_stop_.micros = ClockUptimeMicros();
+  dir_ = Direction::kNone;
+  state_ = State::kIdle;
+  cur_pos_ = pos;
+  if (at_end || cfg_->current_pos >= 0) {
+    SavePosition();
+  }
+  tgt_pos_ = (int) std::lround(pos);
+  LOG(LL_INFO, ("%d: Stopped at %d%s", id(), tgt_pos_,
+                (at_end ? " (end)" : "")));
+  if (!notify) return;
+  pos_state_char_->RaiseEvent();
+  NotifyPosition(true /* force */);
+}
+
+void WindowCovering::SavePosition() {
+  int pos = (int) std::lround(cur_pos_);
+  if (cfg_->current_pos == pos) return;
+  cfg_->current_pos = pos;
+  SaveConfig("wc");
+}
+
+void WindowCovering::SetOutputs(Direction dir, const char *source) {
+  Output *out_open = (cfg_->swap_outputs ? out_close_ : out_open_);
+  Output *out_close = (cfg_->swap_outputs ? out_open_ : out_close_);
+  // Inactive output is always turned off first.
+  switch (dir) {
+    case Direction::kNone:
+      out_open->SetState(false, source);
+      out_close->SetState(false, source);
+      break;
+    case Direction::kOpen:
+      out_close->SetState(false, source);
+      out_open->SetState(true, source);
+      break;
+    case Direction::kClose:
+      out_open->SetState(false, source);
+      out_close->SetState(true, source);
+      break;
+  }
+}
+
+void WindowCovering::NotifyPosition(bool force) {
+  int pos = (int) std::lround(GetCurrentPosition());
+  int64_t now = ClockUptimeMicros();
+  if (!force && (pos == last_notify_pos_ ||
+                 now - last_notify_micros_ < WC_NOTIFY_INTERVAL_MICROS)) {
+    return;
+  }
+  last_notify_pos_ = pos;
+  last_notify_micros_ = now;
+  cur_pos_char_->RaiseEvent();
+  if (force) tgt_pos_char_->RaiseEvent();
+}
+
+void WindowCovering::NextCalibrationStep(double travel_time) {
+  StopMove(true /* at_end */, "calibrate");
+  switch (cal_step_) {
+    case CalStep::kNone:
+      return;
+    case CalStep::kInitialClose:
+      cal_step_ = CalStep::kOpen;
+      break;
+    case CalStep::kOpen:
+      cfg_->open_time = travel_time;
+      cal_step_ = CalStep::kClose;
+      break;
+    case CalStep::kClose:
+      cfg_->close_time = travel_time;
+      cal_step_ = CalStep::kNone;
+      LOG(LL_INFO, ("%d: Calibration done, open %.3f s, close %.3f s", id(),
+                    cfg_->open_time, cfg_->close_time));
+      SaveConfig("wc");
+      return;
+  }
+  // Continue after the reversal delay.
+  state_ = State::kCalibrating;
+  pre_move_timer_id_ = ClockSetTimer(WC_REVERSE_DELAY_MICROS / 1000, 0,
+                                     PreMoveTimerCB, this);
+}
+
+void WindowCovering::InputEventHandler(Direction dir, Input::Event ev,
+                                       bool state) {
+  if (ev != Input::Event::kChange) return;
+  int end_pos = (dir == Direction::kOpen ? 100 : 0);
+  switch (static_cast<InMode>(cfg_->in_mode)) {
+    case InMode::kMomentary:
+      if (!state) break;  // Only on 0 -> 1 transitions.
+      if (state_ != State::kIdle) {
+        Stop("button");
+      } else {
+        MoveTo(end_pos, "button");
+      }
+      break;
+    case InMode::kToggle:
+      if (state) {
+        MoveTo(end_pos, "switch");
+      } else if (dir_ == dir || state_ == State::kPreMove) {
+        Stop("switch");
+      }
+      break;
+  }
+}
+
+// static
+void WindowCovering::MoveTimerCB(void *arg) {
+  WindowCovering *wc = static_cast<WindowCovering *>(arg);
+  wc->move_timer_id_ = MGOS_INVALID_TIMER_ID;
+  if (wc->state_ == State::kCalibrating) {
+    LOG(LL_ERROR, ("%d: Calibration failed, no end stop detected", wc->id()));
+    wc->Stop("calibrate");
+    return;
+  }
+  // Planned time has elapsed, for end positions this includes overtravel.
+  bool at_end = (wc->tgt_pos_ == 0 || wc->tgt_pos_ == 100);
+  wc->StopMove(at_end, "timer");
+}
+
+// static
+void WindowCovering::TickTimerCB(void *arg) {
+  WindowCovering *wc = static_cast<WindowCovering *>(arg);
+  int64_t now = ClockUptimeMicros();
+  if (wc->state_ == State::kMoving) {
+    wc->NotifyPosition(false /* force */);
+  }
+  if (!wc->HavePM() || now - wc->start_micros_ < WC_STARTUP_MICROS) return;
+  bool swap = wc->cfg_->swap_outputs;
+  bool open = (wc->dir_ == Direction::kOpen);
+  PowerMeter *pm = ((open != swap) ? wc->pm_open_ : wc->pm_close_);
+  auto power = pm->GetPowerW();
+  if (!power.ok()) return;
+  if (power.ValueOrDie() >= wc->cfg_->idle_power_thr) {
+    wc->num_idle_samples_ = 0;
+    return;
+  }
+  if (wc->num_idle_samples_++ == 0) wc->idle_since_micros_ = now;
+  if (wc->num_idle_samples_ < WC_NUM_IDLE_SAMPLES) return;
+  // Motor has been cut off by the limit switch.
+  double travel_time = (wc->idle_since_micros_ - wc->start_micros_) / 1000000.0;
+  if (wc->state_ == State::kCalibrating) {
+    wc->NextCalibrationStep(travel_time);
+  } else {
+    wc->StopMove(true /* at_end */, "end_stop");
+  }
+}
+
+// static
+void WindowCovering::PreMoveTimerCB(void *arg) {
+  WindowCovering *wc = static_cast<WindowCovering *>(arg);
+  wc->pre_move_timer_id_ = MGOS_INVALID_TIMER_ID;
+  if (wc->state_ == State::kCalibrating) {
+    Direction dir = (wc->cal_step_ == CalStep::kOpen ? Direction::kOpen
+                                                      : Direction::kClose);
+    wc->StartMove(dir, WC_MAX_MOVE_TIME, "calibrate");
+    return;
+  }
+  wc->state_ = State::kIdle;
+  wc->MoveTo(wc->tgt_pos_, wc->pending_source_);
+}
+
+}  // namespace hap
+}  // namespace shelly
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "mgos_sys_config.h"
+#include "mgos_timers.h"
+
+#include "shelly_common.hpp"
+#include "shelly_component.hpp"
+#include "shelly_hap_chars.hpp"
+#include "shelly_hap_service.hpp"
+#include "shelly_input.hpp"
+#include "shelly_output.hpp"
+#include "shelly_pm.hpp"
+
+namespace shelly {
+namespace hap {
+
+// Roller shutter driven by two outputs, one for each direction, which are
+// never on at the same time. Position is estimated from travel time, power
+// meters (if available) are used to detect end stops.
+class WindowCovering : public Component, public Service {
+ public:
+  enum class InMode {
+    kMomentary = 0,
+    kToggle = 1,
+  };
+
+  WindowCovering(int id, Input *in_open, Input *in_close, Output *out_open,
+                 Output *out_close, PowerMeter *pm_open, PowerMeter *pm_close,
+                 struct mgos_config_wc *cfg);
+  virtual ~WindowCovering();
+
+  // Component interface impl.
+  Type type() const override;
+  Status Init() override;
+  StatusOr<std::string> GetInfo() const override;
+  Status SetConfig(const std::string &config_json,
+                   bool *restart_required) override;
+
+  // Position: 0 - closed, 100 - open.
+  void MoveTo(int pos, const char *source);
+  void Stop(const char *source);
+
+ private:
+  enum class State {
+    kIdle = 0,
+    kPreMove = 1,  // Waiting for the other direction to stop.
+    kMoving = 2,
+    kCalibrating = 3,
+  };
+
+  enum class Direction {
+    kNone = 0,
+    kClose = -1,
+    kOpen = 1,
+  };
+
+  // Calibration steps: close fully, then time full open and full close.
+  enum class CalStep {
+    kNone = 0,
+    kInitialClose = 1,
+    kOpen = 2,
+    kClose = 3,
+  };
+
+  bool HavePM() const;
+  float GetCurrentPosition() const;
+  double TravelTime(Direction dir) const;
+
+  // Direction and time of the last stop. Kept per id across recreation of
+  // the component (on HAP server restart), so that the reversal delay is
+  // enforced then too.
+  struct LastStop {
+    Direction dir = Direction::kNone;
+    int64_t micros = 0;
+  };
+  static LastStop &GetLastStop(int id);
+
+  void StartMove(Direction dir, double duration, const char *source);
+  // at_end - position is known to be at the end in the direction of travel.
+  void StopMove(bool at_end, const char *source, bool notify = true);
+  void SetOutputs(Direction dir, const char *source);
+  void NotifyPosition(bool force);
+  void NextCalibrationStep(double travel_time);
+  void SavePosition();
+
+  void InputEventHandler(Direction dir, Input::Event ev, bool state);
+
+  static void MoveTimerCB(void *arg);
+  static void TickTimerCB(void *arg);
+  static void PreMoveTimerCB(void *arg);
+
+  Input *const in_open_, *const in_close_;
+  Output *const out_open_, *const out_close_;
+  PowerMeter *const pm_open_, *const pm_close_;
+  struct mgos_config_wc *cfg_;
+
+  Input::HandlerID in_open_handler_ = Input::kInvalidHandlerID;
+  Input::HandlerID in_close_handler_ = Input::kInvalidHandlerID;
+
+  State state_ = State::kIdle;
+  CalStep cal_step_ = CalStep::kNone;
+  Direction dir_ = Direction::kNone;
+  // Position at the start of the move, move start time and planned
+  // duration. Position is computed from these rather than accumulated,
+  // so late timers do not introduce drift.
+  float start_pos_ = 0;
+  int64_t start_micros_ = 0;
+  float cur_pos_ = 0;
+  int tgt_pos_ = 0;
+  LastStop &last_stop_;
+  int64_t idle_since_micros_ = 0;  // First sample below idle power.
+  int num_idle_samples_ = 0;
+  int64_t last_notify_micros_ = 0;
+  int last_notify_pos_ = -1;
+  const char *pending_source_ = nullptr;
+
+  mgos_timer_id move_timer_id_ = MGOS_INVALID_TIMER_ID;
+  mgos_timer_id tick_timer_id_ = MGOS_INVALID_TIMER_ID;
+  mgos_timer_id pre_move_timer_id_ = MGOS_INVALID_TIMER_ID;
+
+  Characteristic *cur_pos_char_ = nullptr;
+  Characteristic *tgt_pos_char_ = nullptr;
+  Characteristic *pos_state_char_ = nullptr;
+
+  WindowCovering(const WindowCovering &other) = delete;
+};
+
+}  // namespace hap
+}  // namespace shelly
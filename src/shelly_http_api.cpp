@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_http_api.hpp"
+
+#include <string>
+
+#include "mgos.h"
+#include "mgos_http_server.h"
+
+#include "shelly_main.hpp"
+#include "shelly_switch.hpp"
+
+#define HTTP_API_MAX_ID 8
+
+namespace shelly {
+
+static ShellySwitch *FindSwitch(int id) {
+  for (auto *c : g_comps) {
+    if (c->id() != id) continue;
+    switch (c->type()) {
+      case Component::Type::kSwitch:
+      case Component::Type::kOutlet:
+      case Component::Type::kLock:
+        return static_cast<ShellySwitch *>(c);
+      default:
+        break;
+    }
+  }
+  return nullptr;
+}
+
+static void SendJSON(struct mg_connection *nc, int code, const char *body,
+                     int len) {
+  mg_send_head(nc, code, len, "Content-Type: application/json");
+  mg_send(nc, body, len);
+}
+
+static void SendError(struct mg_connection *nc, int code, const char *msg) {
+  mg_send_head(nc, code, strlen(msg), "Content-Type: text/plain");
+  mg_send(nc, msg, strlen(msg));
+}
+
+static void RelayHandler(struct mg_connection *nc, int ev, void *ev_data,
+                         void *user_data) {
+  if (ev != MG_EV_HTTP_REQUEST) return;
+  struct http_message *hm = (struct http_message *) ev_data;
+  // /relay/N, N is 0-based.
+  const struct mg_str prefix = mg_mk_str("/relay/");
+  int idx = -1;
+  if (hm->uri.len > prefix.len && hm->uri.len - prefix.len <= 2) {
+    idx = 0;
+    for (size_t i = prefix.len; i < hm->uri.len; i++) {
+      char c = hm->uri.p[i];
+      if (c < '0' || c > '9') {
+        idx = -1;
+        break;
+      }
+      idx = idx * 10 + (c - '0');
+    }
+  }
+  ShellySwitch *sw = (idx >= 0 ? FindSwitch(idx + 1) : nullptr);
+  if (sw == nullptr) {
+    SendError(nc, 404, "Not Found");
+    return;
+  }
+  char turn[8];
+  if (mg_get_http_var(&hm->query_string, "turn", turn, sizeof(turn)) > 0) {
+    if (strcmp(turn, "on") == 0) {
+      sw->SetState(true, "web");
+    } else if (strcmp(turn, "off") == 0) {
+      sw->SetState(false, "web");
+    } else if (strcmp(turn, "toggle") == 0) {
+      sw->SetState(!sw->GetState(), "web");
+    } else {
+      SendError(nc, 400, "Bad turn!");
+      return;
+    }
+  }
+  char buf[48];
+  int len = snprintf(buf, sizeof(buf), "{\"ison\":%s,\"source\":\"http\"}",
+                     (sw->GetState() ? "true" : "false"));
+  SendJSON(nc, 200, buf, len);
+  (void) user_data;
+}
+
+static void StatusHandler(struct mg_connection *nc, int ev, void *ev_data,
+                          void *user_data) {
+  if (ev != MG_EV_HTTP_REQUEST) return;
+  std::string res;
+  res.reserve(256);
+  char buf[64];
+  res.append("{\"relays\":[");
+  for (int id = 1; id <= HTTP_API_MAX_ID; id++) {
+    ShellySwitch *sw = FindSwitch(id);
+    if (sw == nullptr) break;
+    if (id > 1) res.push_back(',');
+    snprintf(buf, sizeof(buf), "{\"ison\":%s}",
+             (sw->GetState() ? "true" : "false"));
+    res.append(buf);
+  }
+  res.append("],\"meters\":[");
+  for (int id = 1; id <= HTTP_API_MAX_ID; id++) {
+    PowerMeter *pm = FindPM(id);
+    if (pm == nullptr) break;
+    if (id > 1) res.push_back(',');
+    auto power = pm->GetPowerW();
+    auto energy = pm->GetEnergyWH();
+    // Stock firmware reports total energy in watt-minutes.
+    snprintf(buf, sizeof(buf),
+             "{\"power\":%.2f,\"is_valid\":%s,\"total\":%d}",
+             (power.ok() ? power.ValueOrDie() : 0),
+             (power.ok() ? "true" : "false"),
+             (int) (energy.ok() ? energy.ValueOrDie() * 60 : 0));
+    res.append(buf);
+  }
+  res.append("],\"inputs\":[");
+  for (int id = 1; id <= HTTP_API_MAX_ID; id++) {
+    Input *in = FindInput(id);
+    if (in == nullptr) break;
+    if (id > 1) res.push_back(',');
+    snprintf(buf, sizeof(buf), "{\"input\":%d}", in->GetState());
+    res.append(buf);
+  }
+  snprintf(buf, sizeof(buf), "],\"ram_free\":%u,\"uptime\":%d}",
+           (unsigned) mgos_get_free_heap_size(), (int) mgos_uptime());
+  res.append(buf);
+  SendJSON(nc, 200, res.data(), res.size());
+  (void) ev_data;
+  (void) user_data;
+}
+
+bool HTTPAPIInit() {
+  mgos_register_http_endpoint("/relay/", RelayHandler, NULL);
+  mgos_register_http_endpoint("/status", StatusHandler, NULL);
+  return true;
+}
+
+}  // namespace shelly
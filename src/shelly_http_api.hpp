@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+namespace shelly {
+
+// Subset of the stock firmware HTTP API, for existing integrations:
+//   /relay/N[?turn=on|off|toggle] - get or set state of relay N (0-based).
+//   /status - state of relays, inputs and meters.
+// Requests are handled directly by the HTTP server, without RPC framing and
+// JSON parsing, and responses are small fixed-format JSON.
+
+bool HTTPAPIInit();
+
+}  // namespace shelly
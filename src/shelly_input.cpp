@@ -20,6 +20,9 @@
 #include "mgos.h"
 #include "mgos_gpio.h"
 
+#include "shelly_clock.hpp"
+#include "shelly_trace.hpp"
+
 namespace shelly {
 
 // static
@@ -71,8 +74,11 @@ void Input::RemoveHandler(HandlerID hi) {
 
 void Input::CallHandlers(Event ev, bool state) {
   LOG(LL_INFO, ("Input %d: %s (state %d)", id(), EventName(ev), state));
+  if (ev != Event::kChange) {
+    TraceAdd(TraceEvent::kInputEvent, id(), static_cast<int>(ev));
+  }
   for (auto &h : handlers_) {
-    h(ev, state);
+    if (h != nullptr) h(ev, state);
   }
 }
 
@@ -106,14 +112,22 @@ void InputPin::TimerCB(void *arg) {
 
 void InputPin::SetTimer(int ms) {
   ClearTimer();
-  timer_id_ = mgos_set_timer(ms, 0, &InputPin::TimerCB, this);
+  timer_id_ = ClockSetTimer(ms, 0, &InputPin::TimerCB, this);
 }
 
 void InputPin::ClearTimer() {
-  mgos_clear_timer(timer_id_);
+  ClockClearTimer(timer_id_);
   timer_id_ = MGOS_INVALID_TIMER_ID;
 }
 
+void InputPin::ResetState() {
+  ClearTimer();
+  state_ = State::kIdle;
+  timer_cnt_ = 0;
+  change_cnt_ = 0;
+  last_change_ts_ = 0;
+}
+
 void InputPin::DetectReset(double now, bool cur_state) {
   if (enable_reset_ && now < 30) {
     if (now - last_change_ts_ > 5) {
@@ -131,8 +145,9 @@ void InputPin::HandleGPIOInt() {
   bool cur_state = GetState();
   LOG(LL_DEBUG, ("Input %d: %s (%d), st %d", id(), OnOff(cur_state),
                  mgos_gpio_read(pin_), (int) state_));
+  TraceAdd(TraceEvent::kInputEdge, id(), cur_state);
   CallHandlers(Event::kChange, cur_state);
-  double now = mgos_uptime();
+  double now = ClockUptime();
   DetectReset(now, cur_state);
   switch (state_) {
     case State::kIdle:
@@ -177,6 +192,7 @@ void InputPin::HandleGPIOInt() {
 void InputPin::HandleTimer() {
   timer_id_ = MGOS_INVALID_TIMER_ID;
   timer_cnt_++;
+  TraceAdd(TraceEvent::kTimer, id(), static_cast<int>(TraceTimer::kInput));
   bool cur_state = GetState();
   LOG(LL_DEBUG, ("Input %d: timer, st %d", id(), (int) state_));
   switch (state_) {
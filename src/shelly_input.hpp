@@ -69,6 +69,11 @@ class InputPin : public Input {
   // Input interface impl.
   bool GetState() override;
 
+ protected:
+  void HandleGPIOInt();
+  // Cancels the timer and forgets previous edges.
+  void ResetState();
+
  private:
   static constexpr int kLongPressDurationMs = 1000;
 
@@ -88,7 +93,6 @@ class InputPin : public Input {
 
   void DetectReset(double now, bool cur_state);
 
-  void HandleGPIOInt();
   void HandleTimer();
 
   const int pin_;
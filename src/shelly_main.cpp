@@ -35,18 +35,56 @@
 #include "HAPPlatformServiceDiscovery+Init.h"
 #include "HAPPlatformTCPStreamManager+Init.h"
 
+#if SHELLY_HAVE_ANNOUNCE
+#include "shelly_announce.hpp"
+#endif
+#if SHELLY_HAVE_BINDINGS
+#include "shelly_binding.hpp"
+#endif
+#include "shelly_config_store.hpp"
 #include "shelly_debug.hpp"
+#if SHELLY_HAVE_EVE_HISTORY
+#include "shelly_eve_history.hpp"
+#include "shelly_hap_eve.hpp"
+#endif
+#if SHELLY_HAVE_FS_MIGRATION
+#include "shelly_fs_migrate.hpp"
+#endif
+#if SHELLY_HAVE_FLASH_LOG
+#include "shelly_flash_log.hpp"
+#endif
+#include "shelly_fs_stats.hpp"
+#if SHELLY_HAVE_LOCK
 #include "shelly_hap_lock.hpp"
+#endif
+#if SHELLY_HAVE_OUTLET
 #include "shelly_hap_outlet.hpp"
+#endif
+#include "shelly_hap_stats.hpp"
+#if SHELLY_HAVE_SSW
 #include "shelly_hap_stateless_switch.hpp"
+#endif
 #include "shelly_hap_switch.hpp"
+#if SHELLY_HAVE_WINDOW_COVERING
+#include "shelly_hap_window_covering.hpp"
+#endif
+#if SHELLY_HAVE_HTTP_API
+#include "shelly_http_api.hpp"
+#endif
 #include "shelly_input.hpp"
 #include "shelly_output.hpp"
 #include "shelly_rpc_service.hpp"
+#include "shelly_trace.hpp"
+#if SHELLY_HAVE_WEBHOOK
+#include "shelly_webhook.hpp"
+#endif
 
 #define KVS_FILE_NAME "kvs.json"
-#define NUM_SESSIONS 9
 #define SCRATCH_BUF_SIZE 1536
+// Sessions that have been idle for less than this are never evicted.
+#define HAP_SESSION_MIN_IDLE_FOR_EVICTION 10
+// Loop lag is measured as lateness of a timer with this interval.
+#define LOOP_LAG_TIMER_INTERVAL_MS 100
 
 #ifndef LED_ON
 #define LED_ON 0
@@ -57,11 +95,11 @@
 
 namespace shelly {
 
-static HAPIPSession sessions[NUM_SESSIONS];
 static uint8_t scratch_buf[SCRATCH_BUF_SIZE];
+// Session table is allocated at init time, size is set by config.
 static HAPIPAccessoryServerStorage s_ip_storage = {
-    .sessions = sessions,
-    .numSessions = ARRAY_SIZE(sessions),
+    .sessions = nullptr,
+    .numSessions = 0,
     .scratchBuffer =
         {
             .bytes = scratch_buf,
@@ -122,6 +160,8 @@ static bool s_hap_enable = true;
 static bool s_recreate_accs = false;
 static int16_t s_btn_pressed_count = 0;
 static int16_t s_identify_count = 0;
+static uint32_t s_num_hap_evictions = 0;
+static uint32_t s_loop_lag_us = 0, s_loop_lag_cur_us = 0, s_loop_lag_max_us = 0;
 
 static void CheckLED(int pin, bool led_act);
 
@@ -137,7 +177,9 @@ static HAPError AccessoryIdentifyCB(
 std::vector<Component *> g_comps;
 static std::vector<std::unique_ptr<Input>> s_inputs;
 static std::vector<std::unique_ptr<Output>> s_outputs;
+#if SHELLY_HAVE_PM
 static std::vector<std::unique_ptr<PowerMeter>> s_pms;
+#endif
 static std::vector<std::unique_ptr<hap::Accessory>> s_accs;
 static std::vector<const HAPAccessory *> s_hap_accs;
 
@@ -154,9 +196,36 @@ Input *FindInput(int id) {
 Output *FindOutput(int id) {
   return FindById(s_outputs, id);
 }
+#if SHELLY_HAVE_PM
 PowerMeter *FindPM(int id) {
   return FindById(s_pms, id);
 }
+#endif
+
+void CreateOutputGroup(int id, const char *members,
+                       std::vector<std::unique_ptr<Output>> *outputs) {
+  if (mgos_conf_str_empty(members)) return;
+  std::vector<Output *> group_outputs;
+  for (const char *p = members; *p != '\0';) {
+    char *end = nullptr;
+    int out_id = strtol(p, &end, 10);
+    if (end == p) break;
+    Output *out = FindById(*outputs, out_id);
+    if (out == nullptr || out->group_id() != 0) {
+      LOG(LL_ERROR, ("Group %d: invalid output %d", id, out_id));
+      return;
+    }
+    group_outputs.push_back(out);
+    p = end;
+    while (*p == ',' || *p == ' ') p++;
+  }
+  if (group_outputs.size() < 2) {
+    LOG(LL_ERROR, ("Group %d: at least 2 outputs are required", id));
+    return;
+  }
+  LOG(LL_INFO, ("Output group %d: %s", id, members));
+  outputs->emplace_back(new OutputGroup(id, group_outputs));
+}
 
 static void DoReset(void *arg) {
   intptr_t out_gpio = (intptr_t) arg;
@@ -167,7 +236,8 @@ static void DoReset(void *arg) {
 #ifdef MGOS_SYS_CONFIG_HAVE_WIFI
   mgos_sys_config_set_wifi_sta_enable(false);
   mgos_sys_config_set_wifi_ap_enable(true);
-  mgos_sys_config_save(&mgos_sys_config, false, nullptr);
+  // Not delayed: power is often cut right after a reset sequence.
+  ConfigStoreFlush(true /* full */, "reset");
   mgos_wifi_setup((struct mgos_config_wifi *) mgos_sys_config_get_wifi());
 #endif
 }
@@ -183,6 +253,29 @@ void HandleInputResetSequence(InputPin *in, int out_gpio, Input::Event ev,
   (void) cur_state;
 }
 
+#if SHELLY_HAVE_SSW
+// Returns the accessory that groups stateless switches, creating it if needed.
+// Inputs are distinguished by service label index, which is the input id.
+static hap::Accessory *GetSSWGroupAccessory(
+    std::vector<std::unique_ptr<hap::Accessory>> *accs,
+    HAPAccessoryServerRef *svr) {
+  for (const auto &acc : *accs) {
+    if (acc->GetHAPAccessory()->aid == SHELLY_HAP_AID_STATELESS_SWITCH_GROUP) {
+      return acc.get();
+    }
+  }
+  std::unique_ptr<hap::Accessory> acc(new hap::Accessory(
+      SHELLY_HAP_AID_STATELESS_SWITCH_GROUP,
+      kHAPAccessoryCategory_BridgedAccessory, mgos_sys_config_get_device_id(),
+      &AccessoryIdentifyCB, svr));
+  acc->AddHAPService(&mgos_hap_accessory_information_service);
+  acc->AddService(std::unique_ptr<hap::Service>(
+      new hap::ServiceLabelService(1 /* Arabic numerals */)));
+  accs->push_back(std::move(acc));
+  return accs->back().get();
+}
+#endif
+
 void CreateHAPSwitch(int id, const struct mgos_config_sw *sw_cfg,
                      const struct mgos_config_ssw *ssw_cfg,
                      std::vector<Component *> *comps,
@@ -202,17 +295,25 @@ void CreateHAPSwitch(int id, const struct mgos_config_sw *sw_cfg,
       aid = SHELLY_HAP_AID_BASE_SWITCH + id;
       sw.reset(new hap::Switch(id, in, out, pm, cfg));
       break;
+#if SHELLY_HAVE_OUTLET
     case 1:
       cat = kHAPAccessoryCategory_Outlets;
       aid = SHELLY_HAP_AID_BASE_OUTLET + id;
       sw.reset(new hap::Outlet(id, in, out, pm, cfg));
       break;
+#endif
+#if SHELLY_HAVE_LOCK
     case 2:
       cat = kHAPAccessoryCategory_Locks;
       aid = SHELLY_HAP_AID_BASE_LOCK + id;
       sw.reset(new hap::Lock(id, in, out, pm, cfg));
       break;
+#endif
     default:
+      if (sw_cfg->svc_type != -1) {
+        LOG(LL_ERROR, ("%d: Service type %d is not supported", id,
+                       sw_cfg->svc_type));
+      }
       sw.reset(new ShellySwitch(id, in, out, pm, cfg));
       sw_hidden = true;
       break;
@@ -224,6 +325,12 @@ void CreateHAPSwitch(int id, const struct mgos_config_sw *sw_cfg,
     return;
   }
   comps->push_back(sw.get());
+  std::unique_ptr<hap::Service> eve_svc;
+#if SHELLY_HAVE_EVE_HISTORY
+  if (!sw_hidden && pm != nullptr) {
+    eve_svc = hap::CreateEveServices(id, sw.get(), pm);
+  }
+#endif
   hap::Accessory *pri_acc = accs->front().get();
   if (to_pri_acc) {
     // NB: this produces duplicate primary services on multi-switch devices in
@@ -232,6 +339,7 @@ void CreateHAPSwitch(int id, const struct mgos_config_sw *sw_cfg,
     sw->set_primary(true);
     pri_acc->SetCategory(cat);
     pri_acc->AddService(std::move(sw));
+    if (eve_svc != nullptr) pri_acc->AddService(std::move(eve_svc));
     return;
   }
   if (!sw_hidden) {
@@ -240,18 +348,26 @@ void CreateHAPSwitch(int id, const struct mgos_config_sw *sw_cfg,
                            sw_cfg->name, &AccessoryIdentifyCB, svr));
     acc->AddHAPService(&mgos_hap_accessory_information_service);
     acc->AddService(std::move(sw));
+    if (eve_svc != nullptr) acc->AddService(std::move(eve_svc));
     accs->push_back(std::move(acc));
   } else {
     // This one will not be exported so shove it into primary,
     // purely for ownership.
     pri_acc->AddService(std::move(sw));
   }
-  if (sw_cfg->in_mode == 3) {
+#if SHELLY_HAVE_SSW
+  if (sw_cfg->in_mode == 3 && ssw_cfg != nullptr) {
     LOG(LL_INFO, ("Creating a stateless switch for input %d", id));
+    bool group = mgos_sys_config_get_shelly_ssw_group();
     std::unique_ptr<hap::StatelessSwitch> ssw(new hap::StatelessSwitch(
-        id, FindInput(id), (struct mgos_config_ssw *) ssw_cfg, 0));
+        id, FindInput(id), (struct mgos_config_ssw *) ssw_cfg,
+        (group ? SHELLY_HAP_IID_BASE_SERVICE_LABEL : 0)));
     if (ssw != nullptr && ssw->Init().ok()) {
       comps->push_back(ssw.get());
+      if (group) {
+        GetSSWGroupAccessory(accs, svr)->AddService(std::move(ssw));
+        return;
+      }
       std::unique_ptr<hap::Accessory> acc(
           new hap::Accessory(SHELLY_HAP_AID_BASE_STATELESS_SWITCH + id,
                              kHAPAccessoryCategory_BridgedAccessory,
@@ -261,13 +377,42 @@ void CreateHAPSwitch(int id, const struct mgos_config_sw *sw_cfg,
       accs->push_back(std::move(acc));
     }
   }
+#else
+  (void) ssw_cfg;
+#endif
+}
+
+#if SHELLY_HAVE_WINDOW_COVERING
+void CreateHAPWindowCovering(int id, int in_open, int in_close, int out_open,
+                             int out_close, struct mgos_config_wc *cfg,
+                             std::vector<Component *> *comps,
+                             std::vector<std::unique_ptr<hap::Accessory>> *accs,
+                             HAPAccessoryServerRef *svr) {
+  std::unique_ptr<hap::WindowCovering> wc(new hap::WindowCovering(
+      id, FindInput(in_open), FindInput(in_close), FindOutput(out_open),
+      FindOutput(out_close), FindPM(out_open), FindPM(out_close), cfg));
+  auto st = wc->Init();
+  if (!st.ok()) {
+    const std::string &s = st.ToString();
+    LOG(LL_ERROR, ("Error creating window covering: %s", s.c_str()));
+    return;
+  }
+  comps->push_back(wc.get());
+  std::unique_ptr<hap::Accessory> acc(new hap::Accessory(
+      SHELLY_HAP_AID_BASE_WINDOW_COVERING + id,
+      kHAPAccessoryCategory_BridgedAccessory, cfg->name, &AccessoryIdentifyCB,
+      svr));
+  acc->AddHAPService(&mgos_hap_accessory_information_service);
+  acc->AddService(std::move(wc));
+  accs->push_back(std::move(acc));
 }
+#endif
 
 static void DisableLegacyHAPLayout() {
   if (!mgos_sys_config_get_shelly_legacy_hap_layout()) return;
   LOG(LL_INFO, ("Turning off legacy HAP layout"));
   mgos_sys_config_set_shelly_legacy_hap_layout(false);
-  mgos_sys_config_save(&mgos_sys_config, false /* try_once */, nullptr);
+  SaveConfig("hap_layout");
 }
 
 static bool StartHAPServer(bool quiet) {
@@ -442,15 +587,92 @@ out:
   }
 }
 
+uint32_t GetNumHAPSessionEvictions() {
+  return s_num_hap_evictions;
+}
+
+uint32_t GetLoopLagUs() {
+  return s_loop_lag_us;
+}
+
+uint32_t GetLoopLagMaxUs() {
+  return s_loop_lag_max_us;
+}
+
+static void LoopLagTimerCB(void *arg) {
+  static int64_t s_last = 0;
+  int64_t now = mgos_uptime_micros();
+  if (s_last != 0) {
+    int64_t lag = now - s_last - LOOP_LAG_TIMER_INTERVAL_MS * 1000;
+    if (lag < 0) lag = 0;
+    if (lag > (int64_t) s_loop_lag_cur_us) s_loop_lag_cur_us = lag;
+    if (lag > (int64_t) s_loop_lag_max_us) s_loop_lag_max_us = lag;
+  }
+  s_last = now;
+  (void) arg;
+}
+
+// When all the session slots are taken and a new controller is waiting to be
+// let in, close the connection that has been idle for the longest time to
+// make room for it. Idle sessions are normal (hubs keep event-subscribed
+// connections open), so nothing is evicted unless a connection is pending.
+static void CheckHAPSessions() {
+  HAPPlatformTCPStreamManagerStats tcpm_stats = {};
+  HAPPlatformTCPStreamManagerGetStats(&s_tcpm, &tcpm_stats);
+  if (tcpm_stats.numPendingTCPStreams == 0 ||
+      tcpm_stats.numActiveTCPStreams < tcpm_stats.maxNumTCPStreams) {
+    return;
+  }
+  uint16_t port = HAPPlatformTCPStreamManagerGetListenerPort(&s_tcpm);
+  int64_t now_micros = mgos_uptime_micros();
+  int64_t max_idle_micros = 0;
+  struct mg_connection *victim = nullptr;
+  struct mg_mgr *mgr = mgos_get_mgr();
+  for (struct mg_connection *nc = mg_next(mgr, nullptr); nc != nullptr;
+       nc = mg_next(mgr, nc)) {
+    if (nc->listener == nullptr ||
+        ntohs(nc->listener->sa.sin.sin_port) != port) {
+      continue;
+    }
+    HAPPlatformTCPStream *ts = (HAPPlatformTCPStream *) nc->user_data;
+    if (ts == nullptr || (nc->flags & MG_F_CLOSE_IMMEDIATELY)) continue;
+    int64_t idle_micros = now_micros - ts->lastRead;
+    if (idle_micros > max_idle_micros) {
+      max_idle_micros = idle_micros;
+      victim = nc;
+    }
+  }
+  if (victim == nullptr ||
+      max_idle_micros < HAP_SESSION_MIN_IDLE_FOR_EVICTION * 1000000LL) {
+    return;
+  }
+  char addr[32];
+  mg_sock_addr_to_str(&victim->sa, addr, sizeof(addr),
+                      MG_SOCK_STRINGIFY_IP | MG_SOCK_STRINGIFY_PORT);
+  LOG(LL_INFO, ("HAP sessions exhausted (%u/%u, %u pending), evicting %s "
+                "(idle %lld)",
+                (unsigned) tcpm_stats.numActiveTCPStreams,
+                (unsigned) tcpm_stats.maxNumTCPStreams,
+                (unsigned) tcpm_stats.numPendingTCPStreams, addr,
+                (long long) (max_idle_micros / 1000000)));
+  victim->flags |= MG_F_CLOSE_IMMEDIATELY;
+  s_num_hap_evictions++;
+}
+
 static void StatusTimerCB(void *arg) {
   static uint8_t s_cnt = 0;
+  // Max loop lag over the last interval.
+  s_loop_lag_us = s_loop_lag_cur_us;
+  s_loop_lag_cur_us = 0;
   if (++s_cnt % 8 == 0) {
     HAPPlatformTCPStreamManagerStats tcpm_stats = {};
     HAPPlatformTCPStreamManagerGetStats(&s_tcpm, &tcpm_stats);
-    LOG(LL_INFO, ("Uptime: %.2lf, conns %u/%u/%u, RAM: %lu, %lu free",
+    LOG(LL_INFO, ("Uptime: %.2lf, conns %u/%u/%u (%u evicted), RAM: %lu, "
+                  "%lu free",
                   mgos_uptime(), (unsigned) tcpm_stats.numPendingTCPStreams,
                   (unsigned) tcpm_stats.numActiveTCPStreams,
                   (unsigned) tcpm_stats.maxNumTCPStreams,
+                  (unsigned) s_num_hap_evictions,
                   (unsigned long) mgos_get_heap_size(),
                   (unsigned long) mgos_get_free_heap_size()));
     s_cnt = 0;
@@ -463,6 +685,7 @@ static void StatusTimerCB(void *arg) {
   }
   /* If provisioning information has been provided, start the server. */
   StartHAPServer(true /* quiet */);
+  CheckHAPSessions();
   CheckButton(BTN_GPIO, BTN_DOWN);
   CheckLED(LED_GPIO, LED_ON);
 #ifdef MGOS_HAVE_OTA_COMMON
@@ -494,6 +717,7 @@ bool mgos_sys_config_get_wifi_sta_enable(void) {
 }
 #endif
 
+#if SHELLY_HAVE_CFG_MIGRATION
 static bool shelly_cfg_migrate(void) {
   bool changed = false;
   if (mgos_sys_config_get_shelly_cfg_version() == 0) {
@@ -527,6 +751,7 @@ static bool shelly_cfg_migrate(void) {
   }
   return changed;
 }
+#endif
 
 static void RebootCB(int ev, void *ev_data, void *userdata) {
   s_hap_enable = false;
@@ -556,6 +781,9 @@ void RestartHAPServer() {
 }
 
 bool InitApp() {
+#if SHELLY_HAVE_FS_MIGRATION && defined(MGOS_HAVE_OTA_COMMON)
+  FSMigrateResult fs_migrate_res = FSMigrate();
+#endif
 #ifdef MGOS_HAVE_OTA_COMMON
   if (mgos_ota_is_first_boot()) {
     LOG(LL_INFO, ("Performing cleanup"));
@@ -568,6 +796,30 @@ bool InitApp() {
     remove("style.css");
   }
 #endif
+#if SHELLY_HAVE_FS_MIGRATION && defined(MGOS_HAVE_OTA_COMMON)
+  if (fs_migrate_res == FSMigrateResult::kFailed) {
+    // Running without config or HAP pairings would lose them for good once
+    // committed. Go back to the previous firmware, its filesystem is intact.
+    LOG(LL_ERROR, ("Filesystem migration failed, reverting update"));
+    if (mgos_ota_revert(true /* reboot */)) return true;
+    LOG(LL_ERROR, ("Revert failed"));
+  } else if (fs_migrate_res == FSMigrateResult::kRestart) {
+    // Config was loaded from the new (empty) filesystem, restart with the one
+    // that was copied. Restarting before commit would revert the update.
+    if (mgos_ota_commit()) {
+      LOG(LL_INFO, ("Filesystem migrated, restarting"));
+      mgos_system_restart_after(100);
+      return true;
+    }
+    LOG(LL_ERROR, ("Commit failed"));
+  }
+#endif
+
+  FSStatsInit(KVS_FILE_NAME);
+  ConfigStoreInit();
+#if SHELLY_HAVE_FLASH_LOG
+  FlashLogInit();
+#endif
 
   // Key-value store.
   static const HAPPlatformKeyValueStoreOptions kvs_opts = {
@@ -579,13 +831,29 @@ bool InitApp() {
   static const HAPPlatformAccessorySetupOptions as_opts = {};
   HAPPlatformAccessorySetupCreate(&s_accessory_setup, &as_opts);
 
+  // HAP sessions.
+  int num_sessions = mgos_sys_config_get_shelly_hap_max_sessions();
+  if (num_sessions < 1) num_sessions = 1;
+  s_ip_storage.sessions =
+      (HAPIPSession *) calloc(num_sessions, sizeof(HAPIPSession));
+  if (s_ip_storage.sessions == nullptr) {
+    LOG(LL_ERROR, ("Failed to allocate %d HAP sessions", num_sessions));
+    return false;
+  }
+  s_ip_storage.numSessions = num_sessions;
+
   // TCP Stream Manager.
-  static const HAPPlatformTCPStreamManagerOptions tcpm_opts = {
+  static HAPPlatformTCPStreamManagerOptions tcpm_opts = {
       .port = kHAPNetworkPort_Any,
-      .maxConcurrentTCPStreams = NUM_SESSIONS,
+      .maxConcurrentTCPStreams = 0,
   };
+  tcpm_opts.maxConcurrentTCPStreams = num_sessions;
   HAPPlatformTCPStreamManagerCreate(&s_tcpm, &tcpm_opts);
 
+  if (!HAPStatsInit(&s_ip_storage, &s_tcpm)) {
+    LOG(LL_ERROR, ("Failed to init HAP stats"));
+  }
+
   // Service discovery.
   static const HAPPlatformServiceDiscoveryOptions sd_opts = {};
   HAPPlatformServiceDiscoveryCreate(&s_service_discovery, &sd_opts);
@@ -596,17 +864,29 @@ bool InitApp() {
   HAPAccessoryServerCreate(&s_server, &s_server_options, &s_platform,
                            &s_callbacks, nullptr /* context */);
 
+#if SHELLY_HAVE_CFG_MIGRATION
   if (shelly_cfg_migrate()) {
-    mgos_sys_config_save(&mgos_sys_config, false /* try_once */,
-                         nullptr /* msg */);
+    SaveConfig("migration");
   }
+#endif
 
+  TraceInit(mgos_sys_config_get_shelly_trace_size());
+
+#if SHELLY_HAVE_PM
   CreatePeripherals(&s_inputs, &s_outputs, &s_pms);
+#else
+  CreatePeripherals(&s_inputs, &s_outputs, nullptr /* pms */);
+#endif
+#if SHELLY_HAVE_EVE_HISTORY
+  EveHistoryInit();
+#endif
 
   StartHAPServer(false /* quiet */);
 
   // House-keeping timer.
   mgos_set_timer(1000, MGOS_TIMER_REPEAT, StatusTimerCB, nullptr);
+  mgos_set_timer(LOOP_LAG_TIMER_INTERVAL_MS, MGOS_TIMER_REPEAT, LoopLagTimerCB,
+                 nullptr);
 
   mgos_hap_add_rpc_service_cb(&s_server, StartHAPServerCB);
 
@@ -616,8 +896,22 @@ bool InitApp() {
 
   shelly_rpc_service_init(&s_server, &s_kvs, &s_tcpm);
 
+#if SHELLY_HAVE_BINDINGS
+  BindingsInit();
+#endif
+#if SHELLY_HAVE_ANNOUNCE
+  AnnounceInit();
+#endif
+#if SHELLY_HAVE_WEBHOOK
+  WebhookInit();
+#endif
+
   shelly_debug_init(&s_kvs, &s_tcpm);
 
+#if SHELLY_HAVE_HTTP_API
+  HTTPAPIInit();
+#endif
+
   mgos_event_add_handler(MGOS_EVENT_REBOOT, RebootCB, nullptr);
   mgos_event_add_handler(MGOS_EVENT_REBOOT_AFTER, RebootCB, nullptr);
 
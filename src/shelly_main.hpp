@@ -35,7 +35,21 @@ extern std::vector<Component *> g_comps;
 
 Input *FindInput(int id);
 Output *FindOutput(int id);
+#if SHELLY_HAVE_PM
 PowerMeter *FindPM(int id);
+#else
+// Power metering is compiled out, code that uses power meters is optimized
+// away with it.
+inline PowerMeter *FindPM(int id) {
+  (void) id;
+  return nullptr;
+}
+#endif
+
+// Creates an output group with the given id from a comma-separated list of
+// member output ids. Switch component with the same id controls the group.
+void CreateOutputGroup(int id, const char *members,
+                       std::vector<std::unique_ptr<Output>> *outputs);
 
 void CreateHAPSwitch(int id, const struct mgos_config_sw *sw_cfg,
                      const struct mgos_config_ssw *ssw_cfg,
@@ -43,12 +57,25 @@ void CreateHAPSwitch(int id, const struct mgos_config_sw *sw_cfg,
                      std::vector<std::unique_ptr<hap::Accessory>> *accs,
                      HAPAccessoryServerRef *server, bool to_pri_acc);
 
+// Roller shutter mode: two outputs drive the motor in opposite directions.
+void CreateHAPWindowCovering(int id, int in_open, int in_close, int out_open,
+                             int out_close, struct mgos_config_wc *cfg,
+                             std::vector<Component *> *comps,
+                             std::vector<std::unique_ptr<hap::Accessory>> *accs,
+                             HAPAccessoryServerRef *svr);
+
 void HandleInputResetSequence(InputPin *in, int out_gpio, Input::Event ev,
                               bool cur_state);
 
 void RestartHAPServer();
 
-// Implemented for each model.
+uint32_t GetNumHAPSessionEvictions();
+
+// Max main loop lag over the last second and since boot.
+uint32_t GetLoopLagUs();
+uint32_t GetLoopLagMaxUs();
+
+// Implemented for each model. pms is null if SHELLY_HAVE_PM is 0.
 
 void CreatePeripherals(std::vector<std::unique_ptr<Input>> *inputs,
                        std::vector<std::unique_ptr<Output>> *outputs,
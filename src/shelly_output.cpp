@@ -32,6 +32,37 @@ int Output::id() const {
   return id_;
 }
 
+int Output::group_id() const {
+  return group_id_;
+}
+
+void Output::set_group_id(int group_id) {
+  group_id_ = group_id;
+}
+
+Output::HandlerID Output::AddHandler(HandlerFn h) {
+  int i;
+  for (i = 0; i < (int) handlers_.size(); i++) {
+    if (handlers_[i] == nullptr) {
+      handlers_[i] = h;
+      return i;
+    }
+  }
+  handlers_.push_back(h);
+  return i;
+}
+
+void Output::RemoveHandler(HandlerID hi) {
+  if (hi < 0) return;
+  handlers_[hi] = nullptr;
+}
+
+void Output::CallHandlers(bool state) {
+  for (auto &h : handlers_) {
+    if (h != nullptr) h(state);
+  }
+}
+
 OutputPin::OutputPin(int id, int pin, int on_value)
     : Output(id), pin_(pin), on_value_(on_value) {
   mgos_gpio_set_mode(pin_, MGOS_GPIO_MODE_OUTPUT);
@@ -51,7 +82,54 @@ Status OutputPin::SetState(bool on, const char *source) {
   if (source == nullptr) source = "";
   LOG(LL_INFO,
       ("Output %d: %s -> %s (%s)", id(), OnOff(cur_state), OnOff(on), source));
+  CallHandlers(on);
   return Status::OK();
 }
 
+OutputGroup::OutputGroup(int id, const std::vector<Output *> &outputs)
+    : Output(id), outputs_(outputs) {
+  set_group_id(id);
+  for (auto *out : outputs_) {
+    out->set_group_id(id);
+    member_handler_ids_.push_back(
+        out->AddHandler([this](bool) { MemberChanged(); }));
+  }
+  state_ = GetState();
+}
+
+OutputGroup::~OutputGroup() {
+  for (size_t i = 0; i < outputs_.size(); i++) {
+    outputs_[i]->RemoveHandler(member_handler_ids_[i]);
+    outputs_[i]->set_group_id(0);
+  }
+}
+
+const std::vector<Output *> &OutputGroup::outputs() const {
+  return outputs_;
+}
+
+bool OutputGroup::GetState() {
+  for (auto *out : outputs_) {
+    if (!out->GetState()) return false;
+  }
+  return !outputs_.empty();
+}
+
+Status OutputGroup::SetState(bool on, const char *source) {
+  // Members are switched back to back, without yielding to the event loop.
+  Status res = Status::OK();
+  for (auto *out : outputs_) {
+    auto st = out->SetState(on, source);
+    if (!st.ok()) res = st;
+  }
+  return res;
+}
+
+void OutputGroup::MemberChanged() {
+  bool new_state = GetState();
+  if (new_state == state_) return;
+  state_ = new_state;
+  CallHandlers(new_state);
+}
+
 }  // namespace shelly
@@ -17,6 +17,9 @@
 
 #pragma once
 
+#include <functional>
+#include <vector>
+
 #include "shelly_common.hpp"
 
 namespace shelly {
@@ -30,8 +33,24 @@ class Output {
   virtual bool GetState() = 0;
   virtual Status SetState(bool on, const char *source) = 0;
 
+  // Id of the group this output belongs to, 0 if none.
+  int group_id() const;
+  void set_group_id(int group_id);
+
+  // Handlers are invoked when output state changes.
+  typedef int HandlerID;
+  static constexpr HandlerID kInvalidHandlerID = -1;
+  typedef std::function<void(bool state)> HandlerFn;
+  HandlerID AddHandler(HandlerFn h);
+  void RemoveHandler(HandlerID hi);
+
+ protected:
+  void CallHandlers(bool state);
+
  private:
   const int id_;
+  int group_id_ = 0;
+  std::vector<HandlerFn> handlers_;
   Output(const Output &other) = delete;
 };
 
@@ -51,4 +70,28 @@ class OutputPin : public Output {
   OutputPin(const OutputPin &other) = delete;
 };
 
+// Several outputs switched together. The group is on when all the members
+// are on. Group handlers are invoked when that changes, whether the group or
+// a member was switched.
+class OutputGroup : public Output {
+ public:
+  OutputGroup(int id, const std::vector<Output *> &outputs);
+  virtual ~OutputGroup();
+
+  const std::vector<Output *> &outputs() const;
+
+  // Output interface impl.
+  bool GetState() override;
+  Status SetState(bool on, const char *source) override;
+
+ private:
+  void MemberChanged();
+
+  const std::vector<Output *> outputs_;
+  std::vector<HandlerID> member_handler_ids_;
+  bool state_ = false;
+
+  OutputGroup(const OutputGroup &other) = delete;
+};
+
 }  // namespace shelly
@@ -23,9 +23,12 @@
 
 #include "HAPAccessoryServer+Internal.h"
 
+#include "shelly_config_store.hpp"
 #include "shelly_debug.hpp"
+#include "shelly_hap_stats.hpp"
 #include "shelly_hap_switch.hpp"
 #include "shelly_main.hpp"
+#include "shelly_trace.hpp"
 
 namespace shelly {
 
@@ -41,8 +44,7 @@ static void SendStatusResp(struct mg_rpc_request_info *ri, const Status &st) {
   mg_rpc_send_errorf(ri, st.error_code(), "%s", st.error_message().c_str());
 }
 
-static void GetInfoHandler(struct mg_rpc_request_info *ri, void *cb_arg,
-                           struct mg_rpc_frame_info *fi, struct mg_str args) {
+std::string GetInfoJSON() {
 #ifdef MGOS_HAVE_WIFI
   const char *ssid = mgos_sys_config_get_wifi_sta_ssid();
   const char *pass = mgos_sys_config_get_wifi_sta_pass();
@@ -58,16 +60,20 @@ static void GetInfoHandler(struct mg_rpc_request_info *ri, void *cb_arg,
   std::string res = mgos::JSONPrintStringf(
       "{id: %Q, app: %Q, model: %Q, host: %Q, "
       "version: %Q, fw_build: %Q, uptime: %d, "
+      "ram_size: %u, ram_free: %u, ram_min_free: %u, "
 #ifdef MGOS_HAVE_WIFI
       "wifi_en: %B, wifi_ssid: %Q, wifi_pass: %Q, "
 #endif
       "hap_cn: %d, hap_provisioned: %B, hap_paired: %B, "
       "hap_ip_conns_pending: %u, hap_ip_conns_active: %u, "
-      "hap_ip_conns_max: %u",
+      "hap_ip_conns_max: %u, hap_ip_conns_evicted: %u, "
+      "loop_lag_us: %u, loop_lag_max_us: %u",
       mgos_sys_config_get_device_id(), MGOS_APP,
       CS_STRINGIFY_MACRO(PRODUCT_MODEL), mgos_dns_sd_get_host_name(),
       mgos_sys_ro_vars_get_fw_version(), mgos_sys_ro_vars_get_fw_id(),
-      (int) mgos_uptime(),
+      (int) mgos_uptime(), (unsigned) mgos_get_heap_size(),
+      (unsigned) mgos_get_free_heap_size(),
+      (unsigned) mgos_get_min_free_heap_size(),
 #ifdef MGOS_HAVE_WIFI
       mgos_sys_config_get_wifi_sta_enable(), (ssid ? ssid : ""),
       (pass ? pass : ""),
@@ -75,7 +81,9 @@ static void GetInfoHandler(struct mg_rpc_request_info *ri, void *cb_arg,
       hap_cn, hap_provisioned, hap_paired,
       (unsigned) tcpm_stats.numPendingTCPStreams,
       (unsigned) tcpm_stats.numActiveTCPStreams,
-      (unsigned) tcpm_stats.maxNumTCPStreams);
+      (unsigned) tcpm_stats.maxNumTCPStreams,
+      (unsigned) GetNumHAPSessionEvictions(), (unsigned) GetLoopLagUs(),
+      (unsigned) GetLoopLagMaxUs());
   mgos::JSONAppendStringf(&res, ", components: [");
   bool first = true;
   for (const auto *c : g_comps) {
@@ -88,7 +96,12 @@ static void GetInfoHandler(struct mg_rpc_request_info *ri, void *cb_arg,
   }
 
   mgos::JSONAppendStringf(&res, "]}");
+  return res;
+}
 
+static void GetInfoHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                           struct mg_rpc_frame_info *fi, struct mg_str args) {
+  std::string res = GetInfoJSON();
   mg_rpc_send_responsef(ri, "%s", res.c_str());
 
   (void) cb_arg;
@@ -125,7 +138,8 @@ static void SetConfigHandler(struct mg_rpc_request_info *ri, void *cb_arg,
   auto st = c->SetConfig(std::string(config_tok.ptr, config_tok.len),
                          &restart_required);
   if (st.ok()) {
-    mgos_sys_config_save(&mgos_sys_config, false /* try once */, NULL);
+    TraceAdd(TraceEvent::kConfig, id, type);
+    SaveConfig("rpc");
     if (restart_required) {
       LOG(LL_INFO, ("Configuration change requires server restart"));
       RestartHAPServer();
@@ -150,6 +164,15 @@ static void GetDebugInfoHandler(struct mg_rpc_request_info *ri, void *cb_arg,
   (void) fi;
 }
 
+static void GetStatsHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                            struct mg_rpc_frame_info *fi, struct mg_str args) {
+  std::string res = HAPStatsGetJSON();
+  mg_rpc_send_responsef(ri, "%s", res.c_str());
+  (void) cb_arg;
+  (void) args;
+  (void) fi;
+}
+
 static void SetSwitchHandler(struct mg_rpc_request_info *ri, void *cb_arg,
                              struct mg_rpc_frame_info *fi, struct mg_str args) {
   int id = -1;
@@ -190,6 +213,8 @@ bool shelly_rpc_service_init(HAPAccessoryServerRef *server,
                      "{id: %d, type: %d, config: %T}", SetConfigHandler, NULL);
   mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.GetDebugInfo", "",
                      GetDebugInfoHandler, NULL);
+  mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.GetStats", "",
+                     GetStatsHandler, NULL);
   mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.SetSwitch",
                      "{id: %d, state: %B}", SetSwitchHandler, NULL);
   return true;
@@ -15,10 +15,15 @@
  * limitations under the License.
  */
 
+#include <string>
+
 #include "HAP.h"
 
 namespace shelly {
 
+// Returns Shelly.GetInfo response.
+std::string GetInfoJSON();
+
 bool shelly_rpc_service_init(HAPAccessoryServerRef *server,
                              HAPPlatformKeyValueStoreRef kvs,
                              HAPPlatformTCPStreamManagerRef tcpm);
@@ -19,8 +19,11 @@
 
 #include "mgos.h"
 
+#include "shelly_clock.hpp"
+#include "shelly_config_store.hpp"
 #include "shelly_hap_accessory.hpp"
 #include "shelly_hap_chars.hpp"
+#include "shelly_trace.hpp"
 
 #define SHELLY_HAP_IID_BASE_SWITCH 0x100
 #define SHELLY_HAP_IID_STEP_SWITCH 4
@@ -38,13 +41,11 @@ ShellySwitch::ShellySwitch(int id, Input *in, Output *out, PowerMeter *out_pm,
 }
 
 ShellySwitch::~ShellySwitch() {
-  if (auto_off_timer_id_ != MGOS_INVALID_TIMER_ID) {
-    mgos_clear_timer(auto_off_timer_id_);
-    auto_off_timer_id_ = MGOS_INVALID_TIMER_ID;
-  }
+  ClearTimers();
   if (in_ != nullptr) {
     in_->RemoveHandler(handler_id_);
   }
+  out_->RemoveHandler(out_handler_id_);
 }
 
 Component::Type ShellySwitch::type() const {
@@ -54,10 +55,11 @@ Component::Type ShellySwitch::type() const {
 StatusOr<std::string> ShellySwitch::GetInfo() const {
   std::string res = mgos::JSONPrintStringf(
       "{id: %d, type: %d, name: %Q, svc_type: %d, in_mode: %d, initial: %d, "
-      "state: %B, auto_off: %B, auto_off_delay: %.3f",
+      "state: %B, auto_off: %B, auto_off_delay: %.3f, group: %d",
       id(), type(), (cfg_->name ? cfg_->name : ""), cfg_->svc_type,
       cfg_->in_mode, cfg_->initial_state, out_->GetState(), cfg_->auto_off,
-      cfg_->auto_off_delay);
+      cfg_->auto_off_delay, out_->group_id());
+#if SHELLY_HAVE_PM
   if (out_pm_ != nullptr) {
     auto power = out_pm_->GetPowerW();
     if (power.ok()) {
@@ -68,6 +70,7 @@ StatusOr<std::string> ShellySwitch::GetInfo() const {
       mgos::JSONAppendStringf(&res, ", aenergy: %.3f", energy.ValueOrDie());
     }
   }
+#endif
   res.append("}");
   return res;
 }
@@ -90,9 +93,19 @@ Status ShellySwitch::SetConfig(const std::string &config_json,
   if (cfg.svc_type < -1 || cfg.svc_type > 2) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "svc_type");
   }
+  if ((cfg.svc_type == 1 && !SHELLY_HAVE_OUTLET) ||
+      (cfg.svc_type == 2 && !SHELLY_HAVE_LOCK)) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "%s is not supported",
+                        "svc_type");
+  }
   if (cfg.in_mode < 0 || cfg.in_mode > 3) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "in_mode");
   }
+  // Stateless switch config belongs to the member inputs.
+  if (IsGroup() && cfg.in_mode == (int) InMode::kDetached) {
+    return mgos::Errorf(STATUS_INVALID_ARGUMENT, "%s is not supported",
+                        "detached in_mode for a group");
+  }
   if (cfg.initial_state < 0 || cfg.initial_state > 3) {
     return mgos::Errorf(STATUS_INVALID_ARGUMENT, "invalid %s", "initial_state");
   }
@@ -102,7 +115,8 @@ Status ShellySwitch::SetConfig(const std::string &config_json,
   }
   // Now copy over.
   *restart_required = false;
-  if (cfg_->name != nullptr && strcmp(cfg_->name, cfg.name) != 0) {
+  if (cfg.name != nullptr &&
+      (cfg_->name == nullptr || strcmp(cfg_->name, cfg.name) != 0)) {
     mgos_conf_set_str(&cfg_->name, cfg.name);
     *restart_required = true;
   }
@@ -128,22 +142,31 @@ Status ShellySwitch::Init() {
     LOG(LL_INFO, ("'%s' is disabled", cfg_->name));
     return Status::OK();
   }
-  switch (static_cast<InitialState>(cfg_->initial_state)) {
-    case InitialState::kOff:
-      SetState(false, "init");
-      break;
-    case InitialState::kOn:
-      SetState(true, "init");
-      break;
-    case InitialState::kLast:
-      SetState(cfg_->state, "init");
-      break;
-    case InitialState::kInput:
-      if (in_ != nullptr &&
-          cfg_->in_mode == static_cast<int>(InMode::kToggle)) {
-        SetState(in_->GetState(), "init");
-      }
-      break;
+  // Output may also be switched by a group it is a member of. Added first
+  // so that auto-off applies to the initial state too.
+  out_handler_id_ =
+      out_->AddHandler(std::bind(&ShellySwitch::OutputChanged, this, _1));
+  if (IsGroup()) {
+    // Members have been initialized already, their initial state prevails.
+    cfg_->state = out_->GetState();
+  } else {
+    switch (static_cast<InitialState>(cfg_->initial_state)) {
+      case InitialState::kOff:
+        SetState(false, "init");
+        break;
+      case InitialState::kOn:
+        SetState(true, "init");
+        break;
+      case InitialState::kLast:
+        SetState(cfg_->state, "init");
+        break;
+      case InitialState::kInput:
+        if (in_ != nullptr &&
+            cfg_->in_mode == static_cast<int>(InMode::kToggle)) {
+          SetState(in_->GetState(), "init");
+        }
+        break;
+    }
   }
   LOG(LL_INFO, ("Exporting '%s': type %d, state: %d", cfg_->name,
                 cfg_->svc_type, out_->GetState()));
@@ -154,46 +177,65 @@ Status ShellySwitch::Init() {
   return Status::OK();
 }
 
-void ShellySwitch::SetState(bool new_state, const char *source) {
-  SetStateInternal(new_state, source, false /* is_auto_off */);
+bool ShellySwitch::GetState() const {
+  return out_->GetState();
+}
+
+void ShellySwitch::ClearTimers() {
+  ClockClearTimer(auto_off_timer_id_);
+  auto_off_timer_id_ = MGOS_INVALID_TIMER_ID;
+}
+
+bool ShellySwitch::IsGroup() const {
+  return (out_->group_id() == out_->id());
 }
 
-void ShellySwitch::SetStateInternal(bool new_state, const char *source,
-                                    bool is_auto_off) {
-  bool cur_state = out_->GetState();
+void ShellySwitch::SetState(bool new_state, const char *source) {
+  TraceAdd(TraceEvent::kSwitchState, id(),
+           new_state | (static_cast<int>(TraceSourceFromString(source)) << 1));
+  // Switching a group changes the state of the group and all its members,
+  // they are persisted together.
+  ConfigSaveBatch save_batch;
   out_->SetState(new_state, source);
   if (cfg_->state != new_state) {
     cfg_->state = new_state;
-    mgos_sys_config_save(&mgos_sys_config, false /* try_once */,
-                         NULL /* msg */);
+    SaveConfig("switch");
   }
-  if (new_state == cur_state) return;
-  for (auto *c : state_notify_chars_) {
-    c->RaiseEvent();
+}
+
+// static
+void ShellySwitch::AutoOffTimerCB(void *ctx) {
+  ShellySwitch *sw = static_cast<ShellySwitch *>(ctx);
+  sw->auto_off_timer_id_ = MGOS_INVALID_TIMER_ID;
+  TraceAdd(TraceEvent::kTimer, sw->id(),
+           static_cast<int>(TraceTimer::kAutoOff));
+  if (sw->cfg_->auto_off) {
+    // Don't set state if auto off has been disabled during timer run
+    sw->SetState(false, "auto_off");
   }
+}
 
+// Called on every change of the output, whether it was switched by this
+// switch or by a group it is a member of.
+void ShellySwitch::OutputChanged(bool state) {
+  if (cfg_->state != state) {
+    cfg_->state = state;
+    SaveConfig("switch");
+  }
   if (auto_off_timer_id_ != MGOS_INVALID_TIMER_ID) {
     // Cancel timer if state changes so that only the last timer is triggered if
     // state changes multiple times
-    mgos_clear_timer(auto_off_timer_id_);
+    ClockClearTimer(auto_off_timer_id_);
     auto_off_timer_id_ = MGOS_INVALID_TIMER_ID;
   }
-
-  if (cfg_->auto_off && !is_auto_off) {
+  if (state && cfg_->auto_off) {
     auto_off_timer_id_ =
-        mgos_set_timer(cfg_->auto_off_delay * 1000, 0, AutoOffTimerCB, this);
+        ClockSetTimer(cfg_->auto_off_delay * 1000, 0, AutoOffTimerCB, this);
     LOG(LL_INFO,
         ("%d: Set auto-off timer for %.3f", id(), cfg_->auto_off_delay));
   }
-}
-
-// static
-void ShellySwitch::AutoOffTimerCB(void *ctx) {
-  ShellySwitch *sw = static_cast<ShellySwitch *>(ctx);
-  sw->auto_off_timer_id_ = MGOS_INVALID_TIMER_ID;
-  if (sw->cfg_->auto_off) {
-    // Don't set state if auto off has been disabled during timer run
-    sw->SetStateInternal(false, "auto_off", true /* is_auto_off */);
+  for (auto *c : state_notify_chars_) {
+    c->RaiseEvent();
   }
 }
 
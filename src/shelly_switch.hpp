@@ -62,12 +62,18 @@ class ShellySwitch : public Component, public hap::Service {
 
   virtual Status Init() override;
 
+  bool GetState() const;
   void SetState(bool new_state, const char *source);
 
+  // Cancels the auto-off timer, if any.
+  void ClearTimers();
+
  protected:
   void InputEventHandler(Input::Event ev, bool state);
+  void OutputChanged(bool state);
 
-  void SetStateInternal(bool new_state, const char *source, bool is_auto_off);
+  // Whether this switch controls an output group rather than an output.
+  bool IsGroup() const;
 
   static void AutoOffTimerCB(void *ctx);
 
@@ -79,6 +85,7 @@ class ShellySwitch : public Component, public hap::Service {
   struct mgos_config_sw *cfg_;
 
   Input::HandlerID handler_id_ = Input::kInvalidHandlerID;
+  Output::HandlerID out_handler_id_ = Output::kInvalidHandlerID;
   std::vector<hap::Characteristic *> state_notify_chars_;
 
   mgos_timer_id auto_off_timer_id_ = MGOS_INVALID_TIMER_ID;
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_trace.hpp"
+
+#include <cstring>
+#include <memory>
+#include <new>
+
+#include "mgos.h"
+#include "mgos_rpc.h"
+
+#include "shelly_clock.hpp"
+
+namespace shelly {
+
+static std::unique_ptr<TraceRecord[]> s_trace;
+static int s_size = 0;
+static int s_head = 0;  // Next record to write.
+static int s_count = 0;
+
+static const char *s_source_names[] = {
+    "", "init", "button", "switch", "HAP", "web", "auto_off", "binding",
+};
+
+TraceSource TraceSourceFromString(const char *source) {
+  for (size_t i = 1; i < ARRAY_SIZE(s_source_names); i++) {
+    if (strcmp(source, s_source_names[i]) == 0) {
+      return static_cast<TraceSource>(i);
+    }
+  }
+  return TraceSource::kOther;
+}
+
+const char *TraceSourceToString(TraceSource source) {
+  size_t i = static_cast<size_t>(source);
+  if (i >= ARRAY_SIZE(s_source_names)) return "";
+  return s_source_names[i];
+}
+
+void TraceAdd(TraceEvent ev, int id, int arg) {
+  if (s_size == 0) return;
+  TraceRecord &r = s_trace[s_head];
+  r.ts_ms = (uint32_t) (ClockUptimeMicros() / 1000);
+  r.ev = ev;
+  r.id = (uint8_t) id;
+  r.arg = (uint16_t) arg;
+  s_head = (s_head + 1) % s_size;
+  if (s_count < s_size) s_count++;
+}
+
+std::vector<TraceRecord> TraceGet() {
+  std::vector<TraceRecord> res;
+  res.reserve(s_count);
+  for (int i = 0; i < s_count; i++) {
+    res.push_back(s_trace[(s_head - s_count + i + s_size) % s_size]);
+  }
+  return res;
+}
+
+void TraceClear() {
+  s_head = s_count = 0;
+}
+
+std::string TraceGetJSON() {
+  std::string res = mgos::JSONPrintStringf("{size: %d, events: [", s_size);
+  bool first = true;
+  for (const auto &r : TraceGet()) {
+    mgos::JSONAppendStringf(&res, "%s[%u, %u, %u, %u]", (first ? "" : ", "),
+                            (unsigned) r.ts_ms, (unsigned) r.ev,
+                            (unsigned) r.id, (unsigned) r.arg);
+    first = false;
+  }
+  res.append("]}");
+  return res;
+}
+
+static void GetTraceHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                            struct mg_rpc_frame_info *fi, struct mg_str args) {
+  std::string res = TraceGetJSON();
+  mg_rpc_send_responsef(ri, "%s", res.c_str());
+  (void) cb_arg;
+  (void) fi;
+  (void) args;
+}
+
+bool TraceInit(int size) {
+  if (size > 0) {
+    s_trace.reset(new (std::nothrow) TraceRecord[size]);
+    if (s_trace == nullptr) return false;
+    s_size = size;
+  }
+  mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.GetTrace", "",
+                     GetTraceHandler, NULL);
+  return true;
+}
+
+}  // namespace shelly
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace shelly {
+
+// Compact trace of events that affect component state, kept in a ring
+// buffer so it can be retrieved after something unexpected happened and
+// replayed on the host.
+
+enum class TraceEvent : uint8_t {
+  kInputEdge = 0,    // id - input, arg - new state.
+  kInputEvent = 1,   // id - input, arg - Input::Event.
+  kSwitchState = 2,  // id - switch, arg - state | (TraceSource << 1).
+  kTimer = 3,        // id - component, arg - TraceTimer.
+  kConfig = 4,       // id - component, arg - component type.
+};
+
+enum class TraceSource : uint8_t {
+  kOther = 0,
+  kInit = 1,
+  kButton = 2,
+  kSwitch = 3,
+  kHAP = 4,
+  kRPC = 5,
+  kAutoOff = 6,
+  kBinding = 7,
+};
+
+enum class TraceTimer : uint8_t {
+  kInput = 0,
+  kAutoOff = 1,
+};
+
+struct TraceRecord {
+  uint32_t ts_ms;  // Uptime.
+  TraceEvent ev;
+  uint8_t id;
+  uint16_t arg;
+};
+
+bool TraceInit(int size);
+
+void TraceAdd(TraceEvent ev, int id, int arg);
+
+TraceSource TraceSourceFromString(const char *source);
+const char *TraceSourceToString(TraceSource source);
+
+// Returns recorded events, oldest first.
+std::vector<TraceRecord> TraceGet();
+
+void TraceClear();
+
+// {size: N, events: [[ts_ms, ev, id, arg], ...]}
+std::string TraceGetJSON();
+
+}  // namespace shelly
@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_webhook.hpp"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "mgos.h"
+#include "mgos_rpc.h"
+
+#include "shelly_input.hpp"
+#include "shelly_main.hpp"
+#include "shelly_output.hpp"
+
+#define WEBHOOK_MAX_ID 8
+#define WEBHOOK_RETRY_BASE_MS 500
+#define WEBHOOK_IDLE_CLOSE_MS 10000
+
+namespace shelly {
+
+enum class WebhookEvent {
+  kOff = 0,
+  kOn = 1,
+  kSingle = 2,
+  kDouble = 3,
+  kLong = 4,
+};
+
+struct WebhookAction {
+  bool is_input;
+  int id;
+  WebhookEvent ev;
+  std::string addr;  // tcp://host:port
+  std::string req;   // Complete request.
+};
+
+struct WebhookRequest {
+  const WebhookAction *action;
+  int64_t queued_at;
+  int attempts;
+};
+
+struct WebhookStats {
+  uint32_t queued, sent, failed, dropped, retries;
+  uint32_t conns, reused;
+  int queue_max;
+  int64_t lat_sum, lat_max;
+};
+
+static std::vector<WebhookAction> s_actions;
+static std::deque<WebhookRequest> s_queue;
+static struct mg_connection *s_nc = nullptr;
+static std::string s_nc_addr;
+static bool s_nc_connected = false;
+static bool s_in_flight = false;
+// Request timeout, retry backoff or idle connection close.
+static mgos_timer_id s_timer_id = MGOS_INVALID_TIMER_ID;
+static bool s_backoff = false;
+static WebhookStats s_stats = {};
+
+static void Kick();
+
+static void SetTimer(int msecs, timer_callback cb) {
+  if (s_timer_id != MGOS_INVALID_TIMER_ID) mgos_clear_timer(s_timer_id);
+  s_timer_id = mgos_set_timer(msecs, 0, cb, nullptr);
+}
+
+static void ClearTimer() {
+  if (s_timer_id == MGOS_INVALID_TIMER_ID) return;
+  mgos_clear_timer(s_timer_id);
+  s_timer_id = MGOS_INVALID_TIMER_ID;
+}
+
+static void CloseConn() {
+  if (s_nc == nullptr) return;
+  s_nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+  s_nc = nullptr;
+  s_nc_connected = false;
+}
+
+static void IdleTimerCB(void *arg) {
+  s_timer_id = MGOS_INVALID_TIMER_ID;
+  if (!s_in_flight) CloseConn();
+  (void) arg;
+}
+
+static void BackoffTimerCB(void *arg) {
+  s_timer_id = MGOS_INVALID_TIMER_ID;
+  s_backoff = false;
+  Kick();
+  (void) arg;
+}
+
+static void RequestDone(bool ok, bool retry) {
+  ClearTimer();
+  s_in_flight = false;
+  WebhookRequest &r = s_queue.front();
+  r.attempts++;
+  if (!ok && retry && r.attempts <= mgos_sys_config_get_webhook_retries()) {
+    s_stats.retries++;
+    s_backoff = true;
+    SetTimer(WEBHOOK_RETRY_BASE_MS << (r.attempts - 1), BackoffTimerCB);
+    return;
+  }
+  if (ok) {
+    int64_t lat = mgos_uptime_micros() - r.queued_at;
+    s_stats.sent++;
+    s_stats.lat_sum += lat;
+    if (lat > s_stats.lat_max) s_stats.lat_max = lat;
+  } else {
+    LOG(LL_ERROR, ("%s failed", r.action->addr.c_str()));
+    s_stats.failed++;
+  }
+  s_queue.pop_front();
+  Kick();
+}
+
+static void TimeoutTimerCB(void *arg) {
+  s_timer_id = MGOS_INVALID_TIMER_ID;
+  LOG(LL_ERROR, ("%s: timeout", s_nc_addr.c_str()));
+  CloseConn();
+  RequestDone(false /* ok */, true /* retry */);
+  (void) arg;
+}
+
+static void WebhookConnHandler(struct mg_connection *nc, int ev,
+                               void *ev_data, void *user_data) {
+  if (nc != s_nc) return;
+  switch (ev) {
+    case MG_EV_CONNECT: {
+      int err = *((int *) ev_data);
+      if (err != 0) {
+        LOG(LL_ERROR, ("%s: connect error %d", s_nc_addr.c_str(), err));
+        s_nc = nullptr;
+        RequestDone(false /* ok */, true /* retry */);
+        break;
+      }
+      s_nc_connected = true;
+      break;
+    }
+    case MG_EV_HTTP_REPLY: {
+      struct http_message *hm = (struct http_message *) ev_data;
+      if (!s_in_flight) break;
+      int code = hm->resp_code;
+      struct mg_str *conn_hdr = mg_get_http_header(hm, "Connection");
+      if (conn_hdr != nullptr && mg_vcasecmp(conn_hdr, "close") == 0) {
+        CloseConn();
+      }
+      // Client errors are not going to go away.
+      RequestDone(code >= 200 && code < 400, code >= 500);
+      break;
+    }
+    case MG_EV_CLOSE: {
+      s_nc = nullptr;
+      s_nc_connected = false;
+      if (s_in_flight) {
+        RequestDone(false /* ok */, true /* retry */);
+      }
+      break;
+    }
+  }
+  (void) user_data;
+}
+
+// Sends the next request, if possible.
+static void Kick() {
+  if (s_in_flight || s_backoff) return;
+  if (s_queue.empty()) {
+    if (s_nc != nullptr) SetTimer(WEBHOOK_IDLE_CLOSE_MS, IdleTimerCB);
+    return;
+  }
+  const WebhookAction *a = s_queue.front().action;
+  if (s_nc != nullptr && s_nc_addr == a->addr) {
+    if (s_nc_connected) s_stats.reused++;
+  } else {
+    CloseConn();
+    s_nc = mg_connect(mgos_get_mgr(), a->addr.c_str(), WebhookConnHandler,
+                      nullptr);
+    if (s_nc == nullptr) {
+      LOG(LL_ERROR, ("Failed to connect to %s", a->addr.c_str()));
+      s_in_flight = true;
+      RequestDone(false /* ok */, true /* retry */);
+      return;
+    }
+    mg_set_protocol_http_websocket(s_nc);
+    s_nc_addr = a->addr;
+    s_stats.conns++;
+  }
+  // Sent once connected if connection is still being established.
+  mg_send(s_nc, a->req.data(), a->req.size());
+  s_in_flight = true;
+  SetTimer(mgos_sys_config_get_webhook_timeout() * 1000, TimeoutTimerCB);
+}
+
+static void Enqueue(const WebhookAction *a) {
+  if ((int) s_queue.size() >= mgos_sys_config_get_webhook_queue_size()) {
+    // Drop the oldest request that is not being sent.
+    auto it = s_queue.begin();
+    if (s_in_flight) it++;
+    if (it == s_queue.end()) {
+      s_stats.dropped++;
+      return;
+    }
+    LOG(LL_ERROR, ("Queue full, dropping %s", it->action->addr.c_str()));
+    s_queue.erase(it);
+    s_stats.dropped++;
+  }
+  s_queue.push_back({a, mgos_uptime_micros(), 0});
+  s_stats.queued++;
+  if ((int) s_queue.size() > s_stats.queue_max) {
+    s_stats.queue_max = s_queue.size();
+  }
+  Kick();
+}
+
+static void Trigger(bool is_input, int id, WebhookEvent ev) {
+  for (const auto &a : s_actions) {
+    if (a.is_input == is_input && a.id == id && a.ev == ev) Enqueue(&a);
+  }
+}
+
+static void InputEventHandler(int id, Input::Event ev, bool state) {
+  switch (ev) {
+    case Input::Event::kChange:
+      Trigger(true, id, (state ? WebhookEvent::kOn : WebhookEvent::kOff));
+      break;
+    case Input::Event::kSingle:
+      Trigger(true, id, WebhookEvent::kSingle);
+      break;
+    case Input::Event::kDouble:
+      Trigger(true, id, WebhookEvent::kDouble);
+      break;
+    case Input::Event::kLong:
+      Trigger(true, id, WebhookEvent::kLong);
+      break;
+    case Input::Event::kReset:
+      break;
+  }
+}
+
+static bool ParseEvent(const std::string &s, WebhookEvent *ev) {
+  static const char *names[] = {"off", "on", "single", "double", "long"};
+  for (int i = 0; i < (int) ARRAY_SIZE(names); i++) {
+    if (s == names[i]) {
+      *ev = static_cast<WebhookEvent>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+// (in|sw)<N>:<event>=http://host[:port]/path[?query]
+static bool ParseAction(const std::string &s, WebhookAction *a) {
+  size_t colon = s.find(':'), eq = s.find('=');
+  if (colon == std::string::npos || eq == std::string::npos || eq < colon) {
+    return false;
+  }
+  if (s.compare(0, 2, "in") == 0) {
+    a->is_input = true;
+  } else if (s.compare(0, 2, "sw") == 0) {
+    a->is_input = false;
+  } else {
+    return false;
+  }
+  a->id = atoi(s.substr(2, colon - 2).c_str());
+  if (a->id < 1 || a->id > WEBHOOK_MAX_ID) return false;
+  if (!ParseEvent(s.substr(colon + 1, eq - colon - 1), &a->ev)) return false;
+  if (!a->is_input && a->ev != WebhookEvent::kOn &&
+      a->ev != WebhookEvent::kOff) {
+    return false;
+  }
+  std::string url = s.substr(eq + 1);
+  struct mg_str scheme, user_info, host, path, query, fragment;
+  unsigned int port = 0;
+  if (mg_parse_uri(mg_mk_str_n(url.data(), url.size()), &scheme, &user_info,
+                   &host, &port, &path, &query, &fragment) != 0 ||
+      mg_vcmp(&scheme, "http") != 0 || host.len == 0) {
+    return false;
+  }
+  if (port == 0) port = 80;
+  char port_str[8];
+  snprintf(port_str, sizeof(port_str), ":%u", port);
+  std::string host_str(host.p, host.len);
+  a->addr = "tcp://" + host_str + port_str;
+  if (port != 80) host_str.append(port_str);
+  a->req = "GET ";
+  a->req.append(path.len > 0 ? std::string(path.p, path.len) : "/");
+  if (query.len > 0) a->req.append("?").append(query.p, query.len);
+  a->req.append(" HTTP/1.1\r\nHost: ").append(host_str);
+  a->req.append("\r\nConnection: keep-alive\r\nContent-Length: 0\r\n\r\n");
+  return true;
+}
+
+static void GetWebhooksHandler(struct mg_rpc_request_info *ri, void *cb_arg,
+                               struct mg_rpc_frame_info *fi,
+                               struct mg_str args) {
+  const WebhookStats &s = s_stats;
+  int64_t oldest_age = 0;
+  if (!s_queue.empty()) {
+    oldest_age = mgos_uptime_micros() - s_queue.front().queued_at;
+  }
+  mg_rpc_send_responsef(
+      ri,
+      "{actions: %d, queue_len: %d, queue_max: %d, queue_size: %d, "
+      "oldest_age_ms: %d, queued: %u, sent: %u, failed: %u, dropped: %u, "
+      "retries: %u, conns: %u, reused: %u, "
+      "lat_avg_ms: %d, lat_max_ms: %d}",
+      (int) s_actions.size(), (int) s_queue.size(), s.queue_max,
+      mgos_sys_config_get_webhook_queue_size(), (int) (oldest_age / 1000),
+      (unsigned) s.queued, (unsigned) s.sent, (unsigned) s.failed,
+      (unsigned) s.dropped, (unsigned) s.retries, (unsigned) s.conns,
+      (unsigned) s.reused,
+      (int) (s.sent > 0 ? s.lat_sum / s.sent / 1000 : 0),
+      (int) (s.lat_max / 1000));
+  (void) cb_arg;
+  (void) fi;
+  (void) args;
+}
+
+bool WebhookInit() {
+  mg_rpc_add_handler(mgos_rpc_get_global(), "Shelly.GetWebhooks", "",
+                     GetWebhooksHandler, NULL);
+  const char *actions = mgos_sys_config_get_webhook_actions();
+  if (mgos_conf_str_empty(actions)) return true;
+  // Entries are never added later, pointers to them stay valid.
+  std::string as(actions);
+  size_t start = 0;
+  while (start < as.size()) {
+    size_t end = as.find(' ', start);
+    if (end == std::string::npos) end = as.size();
+    std::string s = as.substr(start, end - start);
+    start = end + 1;
+    if (s.empty()) continue;
+    WebhookAction a;
+    if (!ParseAction(s, &a)) {
+      LOG(LL_ERROR, ("Invalid action '%s'", s.c_str()));
+      continue;
+    }
+    s_actions.push_back(a);
+  }
+  for (int id = 1; id <= WEBHOOK_MAX_ID; id++) {
+    bool have_in = false, have_out = false;
+    for (const auto &a : s_actions) {
+      if (a.id != id) continue;
+      if (a.is_input) have_in = true;
+      if (!a.is_input) have_out = true;
+    }
+    Input *in = FindInput(id);
+    if (in != nullptr && have_in) {
+      in->AddHandler([id](Input::Event ev, bool state) {
+        InputEventHandler(id, ev, state);
+      });
+    }
+    Output *out = FindOutput(id);
+    if (out != nullptr && have_out) {
+      out->AddHandler([id](bool state) {
+        Trigger(false, id, (state ? WebhookEvent::kOn : WebhookEvent::kOff));
+      });
+    }
+  }
+  LOG(LL_INFO, ("%d URL actions", (int) s_actions.size()));
+  return true;
+}
+
+}  // namespace shelly
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+namespace shelly {
+
+// URL actions: HTTP GET requests made on input events and output state
+// changes. Configured in webhook.actions as a space-separated list of
+//   in<N>:<event>=<url>  (event: on, off, single, double, long)
+//   sw<N>:<event>=<url>  (event: on, off)
+// Requests are queued and sent one at a time, reusing the connection when
+// the next request goes to the same host. When the queue is full, the
+// oldest request is dropped.
+
+bool WebhookInit();
+
+}  // namespace shelly
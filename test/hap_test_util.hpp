@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "HAP.h"
+
+// Access to the HAP attribute database built by the accessory model, the way
+// the HAP server sees it.
+namespace hap_test {
+
+inline std::vector<const HAPBaseCharacteristic *> GetChars(
+    const HAPService *svc) {
+  std::vector<const HAPBaseCharacteristic *> res;
+  for (auto *cp = svc->characteristics; *cp != nullptr; cp++) {
+    res.push_back(static_cast<const HAPBaseCharacteristic *>(*cp));
+  }
+  return res;
+}
+
+inline HAPError ReadBool(const HAPBaseCharacteristic *c, bool *value) {
+  auto *hc = reinterpret_cast<const HAPBoolCharacteristic *>(c);
+  HAPBoolCharacteristicReadRequest req = {};
+  req.characteristic = c;
+  return hc->callbacks.handleRead(nullptr, &req, value, nullptr);
+}
+
+inline HAPError WriteBool(const HAPBaseCharacteristic *c, bool value) {
+  auto *hc = reinterpret_cast<const HAPBoolCharacteristic *>(c);
+  HAPBoolCharacteristicWriteRequest req = {};
+  req.characteristic = c;
+  return hc->callbacks.handleWrite(nullptr, &req, value, nullptr);
+}
+
+inline HAPError ReadUInt8(const HAPBaseCharacteristic *c, uint8_t *value) {
+  auto *hc = reinterpret_cast<const HAPUInt8Characteristic *>(c);
+  HAPUInt8CharacteristicReadRequest req = {};
+  req.characteristic = c;
+  return hc->callbacks.handleRead(nullptr, &req, value, nullptr);
+}
+
+inline HAPError WriteUInt8(const HAPBaseCharacteristic *c, uint8_t value) {
+  auto *hc = reinterpret_cast<const HAPUInt8Characteristic *>(c);
+  HAPUInt8CharacteristicWriteRequest req = {};
+  req.characteristic = c;
+  return hc->callbacks.handleWrite(nullptr, &req, value, nullptr);
+}
+
+inline std::string ReadString(const HAPBaseCharacteristic *c) {
+  auto *hc = reinterpret_cast<const HAPStringCharacteristic *>(c);
+  HAPStringCharacteristicReadRequest req = {};
+  req.characteristic = c;
+  char buf[128];
+  if (hc->callbacks.handleRead(nullptr, &req, buf, sizeof(buf), nullptr) !=
+      kHAPError_None) {
+    return "";
+  }
+  return buf;
+}
+
+}  // namespace hap_test
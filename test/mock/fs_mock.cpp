@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos_mock.hpp"
+
+#include "esp_rboot.h"
+#include "mgos_ota.h"
+#include "mgos_vfs.h"
+
+namespace mock {
+
+static bool s_first_boot = false;
+static int s_ota_partition = 0;
+static bool s_mount_ok = false;
+static size_t s_space_free = 0;
+static std::vector<Mount> s_mounts;
+static int s_num_umounts = 0;
+
+void ResetFS() {
+  s_first_boot = false;
+  s_ota_partition = 0;
+  s_mount_ok = false;
+  s_space_free = 0;
+  s_mounts.clear();
+  s_num_umounts = 0;
+}
+
+void SetFirstBoot(bool first_boot) {
+  s_first_boot = first_boot;
+}
+
+void SetOTAPartition(int partition) {
+  s_ota_partition = partition;
+}
+
+void SetMountOK(bool mount_ok) {
+  s_mount_ok = mount_ok;
+}
+
+void SetSpaceFree(size_t space_free) {
+  s_space_free = space_free;
+}
+
+const std::vector<Mount> &GetMounts() {
+  return s_mounts;
+}
+
+int NumUmounts() {
+  return s_num_umounts;
+}
+
+}  // namespace mock
+
+using namespace mock;
+
+bool mgos_vfs_mount(const char *path, const char *dev_type,
+                    const char *dev_opts, const char *fs_type,
+                    const char *fs_opts) {
+  s_mounts.push_back({path, dev_type, dev_opts, fs_type});
+  (void) fs_opts;
+  return s_mount_ok;
+}
+
+bool mgos_vfs_umount(const char *path) {
+  s_num_umounts++;
+  (void) path;
+  return true;
+}
+
+size_t mgos_vfs_get_space_free(const char *path) {
+  (void) path;
+  return s_space_free;
+}
+
+bool mgos_ota_get_status(struct mgos_ota_status *s) {
+  *s = {};
+  s->is_committed = !s_first_boot;
+  s->partition = s_ota_partition;
+  return true;
+}
+
+bool mgos_ota_is_first_boot(void) {
+  return s_first_boot;
+}
+
+// Each slot has its own filesystem.
+rboot_config rboot_get_config(void) {
+  rboot_config cfg = {};
+  cfg.count = 2;
+  cfg.current_rom = s_ota_partition;
+  cfg.is_first_boot = s_first_boot;
+  cfg.roms[0] = 0x8000;
+  cfg.roms[1] = 0x108000;
+  cfg.fs_addresses[0] = 0xbb000;
+  cfg.fs_addresses[1] = 0x1bb000;
+  cfg.fs_sizes[0] = cfg.fs_sizes[1] = 0x40000;
+  return cfg;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <map>
+
+#include "HAP.h"
+#include "HAPAccessoryServer+Internal.h"
+
+#include "mgos_mock.hpp"
+
+// Only need to be distinct.
+#define HAP_MOCK_UUID(n) \
+  {                      \
+    { n }                \
+  }
+
+const HAPUUID kHAPServiceType_Switch = HAP_MOCK_UUID(0x49);
+const HAPUUID kHAPServiceType_Outlet = HAP_MOCK_UUID(0x47);
+const HAPUUID kHAPServiceType_LockMechanism = HAP_MOCK_UUID(0x45);
+const HAPUUID kHAPServiceType_StatelessProgrammableSwitch =
+    HAP_MOCK_UUID(0x89);
+const HAPUUID kHAPServiceType_ServiceLabel = HAP_MOCK_UUID(0xCC);
+const HAPUUID kHAPServiceType_WindowCovering = HAP_MOCK_UUID(0x8C);
+
+const HAPUUID kHAPCharacteristicType_Name = HAP_MOCK_UUID(0x23);
+const HAPUUID kHAPCharacteristicType_On = HAP_MOCK_UUID(0x25);
+const HAPUUID kHAPCharacteristicType_OutletInUse = HAP_MOCK_UUID(0x26);
+const HAPUUID kHAPCharacteristicType_LockCurrentState = HAP_MOCK_UUID(0x1D);
+const HAPUUID kHAPCharacteristicType_LockTargetState = HAP_MOCK_UUID(0x1E);
+const HAPUUID kHAPCharacteristicType_ProgrammableSwitchEvent =
+    HAP_MOCK_UUID(0x73);
+const HAPUUID kHAPCharacteristicType_ServiceLabelIndex = HAP_MOCK_UUID(0xCB);
+const HAPUUID kHAPCharacteristicType_ServiceLabelNamespace =
+    HAP_MOCK_UUID(0xCD);
+const HAPUUID kHAPCharacteristicType_CurrentPosition = HAP_MOCK_UUID(0x6D);
+const HAPUUID kHAPCharacteristicType_TargetPosition = HAP_MOCK_UUID(0x7C);
+const HAPUUID kHAPCharacteristicType_PositionState = HAP_MOCK_UUID(0x72);
+
+namespace mock {
+
+static int s_num_events = 0;
+static std::map<const HAPCharacteristic *, int> s_events;
+
+void ResetHAP() {
+  s_num_events = 0;
+  s_events.clear();
+}
+
+int NumEvents() {
+  return s_num_events;
+}
+
+int NumEvents(const HAPCharacteristic *c) {
+  auto it = s_events.find(c);
+  return (it != s_events.end() ? it->second : 0);
+}
+
+}  // namespace mock
+
+void HAPAccessoryServerRaiseEvent(HAPAccessoryServerRef *server,
+                                  const HAPCharacteristic *characteristic,
+                                  const HAPService *service,
+                                  const HAPAccessory *accessory) {
+  mock::s_num_events++;
+  mock::s_events[characteristic]++;
+  (void) server;
+  (void) service;
+  (void) accessory;
+}
+
+bool HAPAccessoryServerIsPaired(HAPAccessoryServerRef *server) {
+  (void) server;
+  return false;
+}
+
+HAPError HAPAccessoryServerGetCN(HAPPlatformKeyValueStoreRef keyValueStore,
+                                 uint16_t *cn) {
+  (void) keyValueStore;
+  *cn = 1;
+  return kHAPError_None;
+}
+
+void HAPPlatformTCPStreamManagerGetStats(
+    HAPPlatformTCPStreamManagerRef tcpStreamManager,
+    HAPPlatformTCPStreamManagerStats *stats) {
+  (void) tcpStreamManager;
+  stats->numPendingTCPStreams = 0;
+  stats->numActiveTCPStreams = 0;
+  stats->maxNumTCPStreams = 9;
+}
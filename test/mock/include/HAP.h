@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host test mock of the HomeKit ADK public API: the types and constants used
+// by the accessory model, with the layouts the code relies on (all
+// characteristic types share the HAPBaseCharacteristic prefix). Raised events
+// are recorded, see hap_mock.hpp.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+  kHAPError_None = 0,
+  kHAPError_Unknown,
+  kHAPError_InvalidState,
+  kHAPError_InvalidData,
+  kHAPError_OutOfResources,
+  kHAPError_NotAuthorized,
+  kHAPError_Busy,
+} HAPError;
+
+typedef struct {
+  uint8_t bytes[16];
+} HAPUUID;
+
+typedef struct HAPAccessoryServer {
+  int unused;
+} HAPAccessoryServerRef;
+
+typedef struct HAPPlatformKeyValueStore *HAPPlatformKeyValueStoreRef;
+typedef struct HAPPlatformTCPStreamManager *HAPPlatformTCPStreamManagerRef;
+typedef struct HAPIPAccessoryServerStorage HAPIPAccessoryServerStorage;
+typedef struct HAPSession HAPSession;
+
+typedef struct {
+  size_t numPendingTCPStreams;
+  size_t numActiveTCPStreams;
+  size_t maxNumTCPStreams;
+} HAPPlatformTCPStreamManagerStats;
+
+void HAPPlatformTCPStreamManagerGetStats(
+    HAPPlatformTCPStreamManagerRef tcpStreamManager,
+    HAPPlatformTCPStreamManagerStats *stats);
+
+typedef enum {
+  kHAPCharacteristicFormat_Data,
+  kHAPCharacteristicFormat_Bool,
+  kHAPCharacteristicFormat_UInt8,
+  kHAPCharacteristicFormat_UInt16,
+  kHAPCharacteristicFormat_UInt32,
+  kHAPCharacteristicFormat_UInt64,
+  kHAPCharacteristicFormat_Int,
+  kHAPCharacteristicFormat_Float,
+  kHAPCharacteristicFormat_String,
+  kHAPCharacteristicFormat_TLV8,
+} HAPCharacteristicFormat;
+
+typedef void HAPCharacteristic;
+
+typedef struct {
+  bool readable;
+  bool writable;
+  bool supportsEventNotification;
+  bool hidden;
+  bool requiresTimedWrite;
+  bool supportsAuthorizationData;
+  struct {
+    bool supportsBroadcastNotification;
+    bool supportsDisconnectedNotification;
+  } ble;
+} HAPCharacteristicProperties;
+
+#define HAP_CHARACTERISTIC_HEADER      \
+  HAPCharacteristicFormat format;      \
+  uint64_t iid;                        \
+  const HAPUUID *characteristicType;   \
+  const char *debugDescription;        \
+  const char *manufacturerDescription; \
+  HAPCharacteristicProperties properties;
+
+typedef struct {
+  HAP_CHARACTERISTIC_HEADER
+} HAPBaseCharacteristic;
+
+typedef struct HAPService HAPService;
+typedef struct HAPAccessory HAPAccessory;
+
+#define HAP_REQUEST_HEADER                 \
+  int transportType;                       \
+  HAPSession *session;                     \
+  const HAPCharacteristic *characteristic; \
+  const HAPService *service;               \
+  const HAPAccessory *accessory;
+
+#define HAP_DECLARE_CHARACTERISTIC(name, val_type, constraints_type) \
+  typedef struct {                                                   \
+    HAP_REQUEST_HEADER                                               \
+  } name##ReadRequest;                                               \
+  typedef struct {                                                   \
+    HAP_REQUEST_HEADER                                               \
+    const void *remote;                                              \
+  } name##WriteRequest;                                              \
+  typedef struct {                                                   \
+    HAP_CHARACTERISTIC_HEADER                                        \
+    constraints_type constraints;                                    \
+    struct {                                                         \
+      HAPError (*handleRead)(HAPAccessoryServerRef * server,         \
+                             const name##ReadRequest *request,       \
+                             val_type *value, void *context);        \
+      HAPError (*handleWrite)(HAPAccessoryServerRef * server,        \
+                              const name##WriteRequest *request,     \
+                              val_type value, void *context);        \
+      void *handleSubscribe;                                         \
+      void *handleUnsubscribe;                                       \
+    } callbacks;                                                     \
+  } name;
+
+typedef struct {
+  int unused;
+} HAPBoolConstraints;
+
+#define HAP_NUMERIC_CONSTRAINTS(name, val_type) \
+  typedef struct {                              \
+    val_type minimumValue;                      \
+    val_type maximumValue;                      \
+    val_type stepValue;                         \
+  } name;
+
+HAP_NUMERIC_CONSTRAINTS(HAPUInt8Constraints, uint8_t)
+HAP_NUMERIC_CONSTRAINTS(HAPUInt16Constraints, uint16_t)
+HAP_NUMERIC_CONSTRAINTS(HAPUInt32Constraints, uint32_t)
+HAP_NUMERIC_CONSTRAINTS(HAPUInt64Constraints, uint64_t)
+HAP_NUMERIC_CONSTRAINTS(HAPIntConstraints, int32_t)
+HAP_NUMERIC_CONSTRAINTS(HAPFloatConstraints, float)
+
+typedef struct {
+  uint32_t maxLength;
+} HAPLengthConstraints;
+
+HAP_DECLARE_CHARACTERISTIC(HAPBoolCharacteristic, bool, HAPBoolConstraints)
+HAP_DECLARE_CHARACTERISTIC(HAPUInt8Characteristic, uint8_t,
+                           HAPUInt8Constraints)
+HAP_DECLARE_CHARACTERISTIC(HAPUInt16Characteristic, uint16_t,
+                           HAPUInt16Constraints)
+HAP_DECLARE_CHARACTERISTIC(HAPUInt32Characteristic, uint32_t,
+                           HAPUInt32Constraints)
+HAP_DECLARE_CHARACTERISTIC(HAPUInt64Characteristic, uint64_t,
+                           HAPUInt64Constraints)
+HAP_DECLARE_CHARACTERISTIC(HAPIntCharacteristic, int32_t, HAPIntConstraints)
+HAP_DECLARE_CHARACTERISTIC(HAPFloatCharacteristic, float, HAPFloatConstraints)
+HAP_DECLARE_CHARACTERISTIC(HAPTLV8Characteristic, void *, HAPBoolConstraints)
+
+// Variable length types have different callback signatures.
+
+typedef struct {
+  HAP_REQUEST_HEADER
+} HAPStringCharacteristicReadRequest;
+
+typedef struct {
+  HAP_CHARACTERISTIC_HEADER
+  HAPLengthConstraints constraints;
+  struct {
+    HAPError (*handleRead)(HAPAccessoryServerRef *server,
+                           const HAPStringCharacteristicReadRequest *request,
+                           char *value, size_t maxValueBytes, void *context);
+    void *handleWrite;
+    void *handleSubscribe;
+    void *handleUnsubscribe;
+  } callbacks;
+} HAPStringCharacteristic;
+
+typedef struct {
+  HAP_REQUEST_HEADER
+} HAPDataCharacteristicReadRequest;
+
+typedef struct {
+  HAP_REQUEST_HEADER
+  const void *remote;
+} HAPDataCharacteristicWriteRequest;
+
+typedef struct {
+  HAP_CHARACTERISTIC_HEADER
+  HAPLengthConstraints constraints;
+  struct {
+    HAPError (*handleRead)(HAPAccessoryServerRef *server,
+                           const HAPDataCharacteristicReadRequest *request,
+                           void *valueBytes, size_t maxValueBytes,
+                           size_t *numValueBytes, void *context);
+    HAPError (*handleWrite)(HAPAccessoryServerRef *server,
+                            const HAPDataCharacteristicWriteRequest *request,
+                            const void *valueBytes, size_t numValueBytes,
+                            void *context);
+    void *handleSubscribe;
+    void *handleUnsubscribe;
+  } callbacks;
+} HAPDataCharacteristic;
+
+struct HAPService {
+  uint64_t iid;
+  const HAPUUID *serviceType;
+  const char *debugDescription;
+  const char *name;
+  struct {
+    bool primaryService;
+    bool hidden;
+    struct {
+      bool supportsConfiguration;
+    } ble;
+  } properties;
+  const uint16_t *linkedServices;
+  const HAPCharacteristic *const *characteristics;
+};
+
+typedef enum {
+  kHAPAccessoryCategory_BridgedAccessory = 0,
+  kHAPAccessoryCategory_Other = 1,
+  kHAPAccessoryCategory_Bridges = 2,
+  kHAPAccessoryCategory_Locks = 6,
+  kHAPAccessoryCategory_Outlets = 7,
+  kHAPAccessoryCategory_Switches = 8,
+  kHAPAccessoryCategory_ProgrammableSwitches = 15,
+  kHAPAccessoryCategory_WindowCoverings = 14,
+} HAPAccessoryCategory;
+
+typedef struct {
+  int transportType;
+  HAPSession *session;
+  const HAPAccessory *accessory;
+} HAPAccessoryIdentifyRequest;
+
+struct HAPAccessory {
+  uint64_t aid;
+  HAPAccessoryCategory category;
+  const char *name;
+  const char *manufacturer;
+  const char *model;
+  const char *serialNumber;
+  const char *firmwareVersion;
+  const char *hardwareVersion;
+  const HAPService *const *services;
+  struct {
+    HAPError (*identify)(HAPAccessoryServerRef *server,
+                         const HAPAccessoryIdentifyRequest *request,
+                         void *context);
+  } callbacks;
+};
+
+void HAPAccessoryServerRaiseEvent(HAPAccessoryServerRef *server,
+                                  const HAPCharacteristic *characteristic,
+                                  const HAPService *service,
+                                  const HAPAccessory *accessory);
+
+bool HAPAccessoryServerIsPaired(HAPAccessoryServerRef *server);
+
+extern const HAPUUID kHAPServiceType_Switch;
+extern const HAPUUID kHAPServiceType_Outlet;
+extern const HAPUUID kHAPServiceType_LockMechanism;
+extern const HAPUUID kHAPServiceType_StatelessProgrammableSwitch;
+extern const HAPUUID kHAPServiceType_ServiceLabel;
+extern const HAPUUID kHAPServiceType_WindowCovering;
+
+#define kHAPServiceDebugDescription_Switch "switch"
+#define kHAPServiceDebugDescription_Outlet "outlet"
+#define kHAPServiceDebugDescription_LockMechanism "lock-mechanism"
+#define kHAPServiceDebugDescription_StatelessProgrammableSwitch \
+  "stateless-programmable-switch"
+#define kHAPServiceDebugDescription_ServiceLabel "service-label"
+#define kHAPServiceDebugDescription_WindowCovering "window-covering"
+
+extern const HAPUUID kHAPCharacteristicType_Name;
+extern const HAPUUID kHAPCharacteristicType_On;
+extern const HAPUUID kHAPCharacteristicType_OutletInUse;
+extern const HAPUUID kHAPCharacteristicType_LockCurrentState;
+extern const HAPUUID kHAPCharacteristicType_LockTargetState;
+extern const HAPUUID kHAPCharacteristicType_ProgrammableSwitchEvent;
+extern const HAPUUID kHAPCharacteristicType_ServiceLabelIndex;
+extern const HAPUUID kHAPCharacteristicType_ServiceLabelNamespace;
+extern const HAPUUID kHAPCharacteristicType_CurrentPosition;
+extern const HAPUUID kHAPCharacteristicType_TargetPosition;
+extern const HAPUUID kHAPCharacteristicType_PositionState;
+
+#define kHAPCharacteristicDebugDescription_Name "name"
+#define kHAPCharacteristicDebugDescription_On "on"
+#define kHAPCharacteristicDebugDescription_OutletInUse "outlet-in-use"
+#define kHAPCharacteristicDebugDescription_LockCurrentState \
+  "lock-current-state"
+#define kHAPCharacteristicDebugDescription_LockTargetState "lock-target-state"
+#define kHAPCharacteristicDebugDescription_ProgrammableSwitchEvent \
+  "programmable-switch-event"
+#define kHAPCharacteristicDebugDescription_ServiceLabelIndex \
+  "service-label-index"
+#define kHAPCharacteristicDebugDescription_ServiceLabelNamespace \
+  "service-label-namespace"
+#define kHAPCharacteristicDebugDescription_CurrentPosition "current-position"
+#define kHAPCharacteristicDebugDescription_TargetPosition "target-position"
+#define kHAPCharacteristicDebugDescription_PositionState "position-state"
+
+enum {
+  kHAPCharacteristicValue_ProgrammableSwitchEvent_SinglePress = 0,
+  kHAPCharacteristicValue_ProgrammableSwitchEvent_DoublePress = 1,
+  kHAPCharacteristicValue_ProgrammableSwitchEvent_LongPress = 2,
+};
+
+enum {
+  kHAPCharacteristicValue_PositionState_GoingToMinimum = 0,
+  kHAPCharacteristicValue_PositionState_GoingToMaximum = 1,
+  kHAPCharacteristicValue_PositionState_Stopped = 2,
+};
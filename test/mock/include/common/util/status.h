@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host test mock of mgos Status.
+
+#pragma once
+
+#include <string>
+
+enum {
+  STATUS_OK = 0,
+  STATUS_CANCELLED = 1,
+  STATUS_UNKNOWN = 2,
+  STATUS_INVALID_ARGUMENT = 3,
+  STATUS_NOT_FOUND = 5,
+  STATUS_ALREADY_EXISTS = 6,
+  STATUS_RESOURCE_EXHAUSTED = 8,
+  STATUS_FAILED_PRECONDITION = 9,
+  STATUS_UNIMPLEMENTED = 12,
+  STATUS_INTERNAL = 13,
+  STATUS_UNAVAILABLE = 14,
+};
+
+namespace mgos {
+
+class Status {
+ public:
+  Status() : code_(STATUS_OK) {
+  }
+  Status(int code, const std::string &msg) : code_(code), msg_(msg) {
+  }
+
+  static Status OK() {
+    return Status();
+  }
+
+  bool ok() const {
+    return code_ == STATUS_OK;
+  }
+  int error_code() const {
+    return code_;
+  }
+  const std::string &error_message() const {
+    return msg_;
+  }
+  std::string ToString() const {
+    if (ok()) return "OK";
+    return std::to_string(code_) + ": " + msg_;
+  }
+
+ private:
+  int code_;
+  std::string msg_;
+};
+
+Status Errorf(int code, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+}  // namespace mgos
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host test mock of mgos StatusOr.
+
+#pragma once
+
+#include <cstdlib>
+#include <utility>
+
+#include "common/util/status.h"
+
+namespace mgos {
+
+template <typename T>
+class StatusOr {
+ public:
+  StatusOr() : status_(STATUS_UNKNOWN, "") {
+  }
+  StatusOr(const Status &status) : status_(status) {  // NOLINT
+    if (status_.ok()) abort();  // A value is required.
+  }
+  StatusOr(const T &value) : value_(value) {  // NOLINT
+  }
+  StatusOr(T &&value) : value_(std::move(value)) {  // NOLINT
+  }
+
+  const Status &status() const {
+    return status_;
+  }
+  bool ok() const {
+    return status_.ok();
+  }
+  const T &ValueOrDie() const & {
+    if (!ok()) abort();
+    return value_;
+  }
+  T &ValueOrDie() & {
+    if (!ok()) abort();
+    return value_;
+  }
+  T &&ValueOrDie() && {
+    if (!ok()) abort();
+    return std::move(value_);
+  }
+
+ private:
+  Status status_;
+  T value_{};
+};
+
+}  // namespace mgos
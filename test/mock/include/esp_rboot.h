@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host test mock of the rboot config, with the per-slot filesystem
+// locations.
+
+#pragma once
+
+#include <stdint.h>
+
+#define MAX_ROMS 2
+
+typedef struct {
+  uint8_t magic;
+  uint8_t version;
+  uint8_t mode;
+  uint8_t current_rom;
+  uint8_t gpio_rom;
+  uint8_t count;
+  uint8_t previous_rom;
+  uint8_t is_first_boot;
+  uint32_t roms[MAX_ROMS];
+  uint32_t roms_sizes[MAX_ROMS];
+  uint32_t fs_addresses[MAX_ROMS];
+  uint32_t fs_sizes[MAX_ROMS];
+} rboot_config;
+
+rboot_config rboot_get_config(void);
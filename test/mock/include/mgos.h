@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host test mock of mgos.h: logging, uptime, JSON helpers.
+
+#pragma once
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "common/util/status.h"
+#include "mgos_event.h"
+#include "mgos_gpio.h"
+#include "mgos_sys_config.h"
+#include "mgos_timers.h"
+
+enum cs_log_level {
+  LL_NONE = -1,
+  LL_ERROR = 0,
+  LL_WARN = 1,
+  LL_INFO = 2,
+  LL_DEBUG = 3,
+  LL_VERBOSE_DEBUG = 4,
+};
+
+// Messages above this level are discarded, LL_ERROR by default.
+extern int mgos_mock_log_level;
+
+#define LOG(l, x)                     \
+  do {                                \
+    if ((l) <= mgos_mock_log_level) { \
+      printf x;                       \
+      printf("\n");                   \
+    }                                 \
+  } while (0)
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof(array[0]))
+#endif
+#define CS_STRINGIFY_LIT(...) #__VA_ARGS__
+#define CS_STRINGIFY_MACRO(x) CS_STRINGIFY_LIT(x)
+
+struct mg_str {
+  const char *p;
+  size_t len;
+};
+
+double mgos_uptime(void);
+int64_t mgos_uptime_micros(void);
+double mg_time(void);
+
+size_t mgos_get_heap_size(void);
+size_t mgos_get_free_heap_size(void);
+size_t mgos_get_min_free_heap_size(void);
+
+void mgos_expand_mac_address_placeholders(char *str);
+
+// Subset of frozen: %d, %lf, %B (writes one byte), %Q (malloc'd string)
+// and %T, keys are matched at the top level of the object only.
+enum json_token_type {
+  JSON_TYPE_INVALID = 0,
+  JSON_TYPE_STRING,
+  JSON_TYPE_NUMBER,
+  JSON_TYPE_TRUE,
+  JSON_TYPE_FALSE,
+  JSON_TYPE_NULL,
+  JSON_TYPE_OBJECT_START,
+  JSON_TYPE_OBJECT_END,
+  JSON_TYPE_ARRAY_START,
+  JSON_TYPE_ARRAY_END,
+  JSON_TYPES_CNT,
+};
+
+struct json_token {
+  const char *ptr;
+  int len;
+  enum json_token_type type;
+};
+
+#define JSON_INVALID_TOKEN \
+  { 0, 0, JSON_TYPE_INVALID }
+
+int json_scanf(const char *str, int len, const char *fmt, ...);
+int json_vscanf(const char *str, int len, const char *fmt, va_list ap);
+
+namespace mgos {
+
+// printf with frozen extensions: bare keys are quoted, %Q prints a quoted
+// string (null for nullptr), %B prints a bool.
+std::string JSONPrintStringv(const char *fmt, va_list ap);
+std::string JSONPrintStringf(const char *fmt, ...);
+void JSONAppendStringf(std::string *res, const char *fmt, ...);
+
+class ScopedCPtr {
+ public:
+  explicit ScopedCPtr(void *ptr) : ptr_(ptr) {
+  }
+  ~ScopedCPtr() {
+    free(ptr_);
+  }
+  void *get() const {
+    return ptr_;
+  }
+
+ private:
+  void *ptr_;
+  ScopedCPtr(const ScopedCPtr &other) = delete;
+};
+
+}  // namespace mgos
@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host test mock of mgos events. Nothing is delivered.
+
+#pragma once
+
+#include <stdbool.h>
+
+typedef void (*mgos_event_handler_t)(int ev, void *ev_data, void *userdata);
+
+bool mgos_event_add_handler(int ev, mgos_event_handler_t cb, void *userdata);
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host test mock of mgos OTA status.
+
+#pragma once
+
+#include <stdbool.h>
+
+enum mgos_ota_state {
+  MGOS_OTA_STATE_IDLE = 0,
+  MGOS_OTA_STATE_PROGRESS,
+  MGOS_OTA_STATE_ERROR,
+  MGOS_OTA_STATE_SUCCESS,
+};
+
+struct mgos_ota_status {
+  bool is_committed;
+  int commit_timeout;
+  int partition;
+  enum mgos_ota_state state;
+  const char *msg;
+  int progress_percent;
+};
+
+bool mgos_ota_get_status(struct mgos_ota_status *s);
+bool mgos_ota_is_first_boot(void);
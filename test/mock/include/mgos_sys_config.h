@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host test mock of the generated mgos config, with the settings used by the
+// code under test.
+
+#pragma once
+
+#include <stdbool.h>
+
+#define MGOS_APP "shelly-homekit"
+
+struct mgos_config_sw {
+  const char *name;
+  int enable;
+  int in_mode;
+  int state;
+  int svc_type;
+  int initial_state;
+  int auto_off;
+  double auto_off_delay;
+  int persist_state;
+};
+
+struct mgos_config_ssw {
+  const char *name;
+  int in_mode;
+};
+
+// Frees the previous value if it was set by this function.
+void mgos_conf_set_str(const char **vp, const char *v);
+bool mgos_conf_str_empty(const char *s);
+
+int mgos_sys_config_get_shelly_ssw_group(void);
+void mgos_sys_config_set_shelly_ssw_group(int v);
+int mgos_sys_config_get_shelly_cfg_save_delay(void);
+const char *mgos_sys_config_get_device_id(void);
+const char *mgos_sys_config_get_device_sn(void);
+const char *mgos_sys_config_get_hap_salt(void);
+void mgos_sys_config_set_hap_salt(const char *v);
+
+const char *mgos_sys_ro_vars_get_fw_version(void);
+const char *mgos_sys_ro_vars_get_fw_id(void);
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host test mock of mgos timers. Time only moves when advanced by the test,
+// see mgos_mock.hpp.
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MGOS_TIMER_REPEAT 1
+#define MGOS_TIMER_RUN_NOW 2
+
+typedef uintptr_t mgos_timer_id;
+#define MGOS_INVALID_TIMER_ID 0
+
+typedef void (*timer_callback)(void *param);
+
+mgos_timer_id mgos_set_timer(int msecs, int flags, timer_callback cb,
+                             void *cb_arg);
+void mgos_clear_timer(mgos_timer_id id);
+
+#ifdef __cplusplus
+}
+#endif
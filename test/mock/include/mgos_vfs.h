@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host test mock of mgos VFS. Mounts are recorded, the mounted filesystem is
+// provided by the test as a directory, see mgos_mock.hpp.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+bool mgos_vfs_mount(const char *path, const char *dev_type,
+                    const char *dev_opts, const char *fs_type,
+                    const char *fs_opts);
+bool mgos_vfs_umount(const char *path);
+size_t mgos_vfs_get_space_free(const char *path);
@@ -0,0 +1,379 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Subset of frozen JSON printing and scanning used by the code under test.
+
+#include <ctype.h>
+
+#include <string>
+#include <vector>
+
+#include "mgos.h"
+
+namespace {
+
+bool IsIdentStart(char c) {
+  return (isalpha((unsigned char) c) || c == '_');
+}
+
+bool IsIdent(char c) {
+  return (isalnum((unsigned char) c) || c == '_');
+}
+
+void AppendQuoted(std::string *res, const char *s) {
+  if (s == nullptr) {
+    res->append("null");
+    return;
+  }
+  res->push_back('"');
+  for (; *s != '\0'; s++) {
+    unsigned char c = *s;
+    switch (c) {
+      case '"':
+        res->append("\\\"");
+        break;
+      case '\\':
+        res->append("\\\\");
+        break;
+      case '\n':
+        res->append("\\n");
+        break;
+      case '\r':
+        res->append("\\r");
+        break;
+      case '\t':
+        res->append("\\t");
+        break;
+      default:
+        if (c < 0x20) {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", c);
+          res->append(buf);
+        } else {
+          res->push_back(c);
+        }
+    }
+  }
+  res->push_back('"');
+}
+
+template <typename T>
+void AppendFormatted(std::string *res, const std::string &spec, T v) {
+  int n = snprintf(nullptr, 0, spec.c_str(), v);
+  if (n <= 0) return;
+  std::vector<char> buf(n + 1);
+  snprintf(buf.data(), buf.size(), spec.c_str(), v);
+  res->append(buf.data(), n);
+}
+
+class Parser {
+ public:
+  Parser(const char *s, int len) : p_(s), end_(s + len) {
+  }
+
+  void SkipSpace() {
+    while (p_ < end_ && isspace((unsigned char) *p_)) p_++;
+  }
+
+  bool Consume(char c) {
+    SkipSpace();
+    if (p_ < end_ && *p_ == c) {
+      p_++;
+      return true;
+    }
+    return false;
+  }
+
+  bool AtEnd() {
+    SkipSpace();
+    return p_ >= end_;
+  }
+
+  // String or bare identifier (frozen accepts both as keys).
+  bool ParseKey(std::string *key) {
+    SkipSpace();
+    if (p_ < end_ && *p_ == '"') {
+      json_token t;
+      if (!ParseString(&t)) return false;
+      key->assign(t.ptr, t.len);
+      return true;
+    }
+    const char *start = p_;
+    while (p_ < end_ && IsIdent(*p_)) p_++;
+    key->assign(start, p_ - start);
+    return !key->empty();
+  }
+
+  // Token covers the contents of a string and the whole of other values.
+  bool ParseValue(json_token *t) {
+    SkipSpace();
+    if (p_ >= end_) return false;
+    const char *start = p_;
+    switch (*p_) {
+      case '"':
+        return ParseString(t);
+      case '{':
+      case '[': {
+        const char open = *p_, close = (open == '{' ? '}' : ']');
+        p_++;
+        if (!Consume(close)) {
+          do {
+            if (open == '{') {
+              std::string key;
+              if (!ParseKey(&key) || !Consume(':')) return false;
+            }
+            json_token v;
+            if (!ParseValue(&v)) return false;
+          } while (Consume(','));
+          if (!Consume(close)) return false;
+        }
+        *t = {start, (int) (p_ - start),
+              (open == '{' ? JSON_TYPE_OBJECT_END : JSON_TYPE_ARRAY_END)};
+        return true;
+      }
+      default:
+        break;
+    }
+    while (p_ < end_ && (IsIdent(*p_) || *p_ == '-' || *p_ == '+' ||
+                         *p_ == '.')) {
+      p_++;
+    }
+    std::string v(start, p_ - start);
+    json_token_type type = JSON_TYPE_NUMBER;
+    if (v == "true") {
+      type = JSON_TYPE_TRUE;
+    } else if (v == "false") {
+      type = JSON_TYPE_FALSE;
+    } else if (v == "null") {
+      type = JSON_TYPE_NULL;
+    } else if (v.empty() || !(isdigit((unsigned char) v[0]) || v[0] == '-')) {
+      return false;
+    }
+    *t = {start, (int) v.size(), type};
+    return true;
+  }
+
+ private:
+  bool ParseString(json_token *t) {
+    const char *start = ++p_;
+    while (p_ < end_ && *p_ != '"') {
+      if (*p_ == '\\') p_++;
+      p_++;
+    }
+    if (p_ >= end_) return false;
+    *t = {start, (int) (p_ - start), JSON_TYPE_STRING};
+    p_++;
+    return true;
+  }
+
+  const char *p_;
+  const char *end_;
+};
+
+char *Unescape(const json_token &t) {
+  std::string res;
+  for (int i = 0; i < t.len; i++) {
+    char c = t.ptr[i];
+    if (c == '\\' && i + 1 < t.len) {
+      c = t.ptr[++i];
+      switch (c) {
+        case 'n':
+          c = '\n';
+          break;
+        case 'r':
+          c = '\r';
+          break;
+        case 't':
+          c = '\t';
+          break;
+        default:
+          break;
+      }
+    }
+    res.push_back(c);
+  }
+  return strdup(res.c_str());
+}
+
+}  // namespace
+
+int json_vscanf(const char *str, int len, const char *fmt, va_list ap) {
+  // Format: {key: %X, ...}
+  struct Field {
+    std::string key;
+    std::string conv;
+    void *target;
+  };
+  std::vector<Field> fields;
+  for (const char *p = strchr(fmt, '%'); p != nullptr; p = strchr(p, '%')) {
+    // Key precedes the colon: "key: %X" or "\"key\": %X".
+    const char *kend = p;
+    while (kend > fmt && (isspace((unsigned char) kend[-1]) ||
+                          kend[-1] == ':' || kend[-1] == '"')) {
+      kend--;
+    }
+    const char *kstart = kend;
+    while (kstart > fmt && IsIdent(kstart[-1])) kstart--;
+    const char *cstart = ++p;
+    while (isalpha((unsigned char) *p)) p++;
+    fields.push_back({std::string(kstart, kend - kstart),
+                      std::string(cstart, p - cstart), va_arg(ap, void *)});
+  }
+  Parser ip(str, len);
+  if (!ip.Consume('{')) return -1;
+  int num_matched = 0;
+  if (ip.Consume('}')) return 0;
+  do {
+    std::string key;
+    json_token t;
+    if (!ip.ParseKey(&key) || !ip.Consume(':') || !ip.ParseValue(&t)) break;
+    for (const auto &f : fields) {
+      if (f.key != key) continue;
+      if (f.conv == "d") {
+        if (t.type != JSON_TYPE_NUMBER) continue;
+        *static_cast<int *>(f.target) = (int) strtol(t.ptr, nullptr, 10);
+      } else if (f.conv == "lf") {
+        if (t.type != JSON_TYPE_NUMBER) continue;
+        *static_cast<double *>(f.target) = strtod(t.ptr, nullptr);
+      } else if (f.conv == "f") {
+        if (t.type != JSON_TYPE_NUMBER) continue;
+        *static_cast<float *>(f.target) = strtof(t.ptr, nullptr);
+      } else if (f.conv == "B") {
+        if (t.type != JSON_TYPE_TRUE && t.type != JSON_TYPE_FALSE) continue;
+        // Like frozen, writes a single byte.
+        *static_cast<char *>(f.target) = (t.type == JSON_TYPE_TRUE);
+      } else if (f.conv == "Q") {
+        if (t.type != JSON_TYPE_STRING) continue;
+        *static_cast<char **>(f.target) = Unescape(t);
+      } else if (f.conv == "T") {
+        *static_cast<json_token *>(f.target) = t;
+      } else {
+        abort();
+      }
+      num_matched++;
+    }
+  } while (ip.Consume(','));
+  return num_matched;
+}
+
+int json_scanf(const char *str, int len, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int res = json_vscanf(str, len, fmt, ap);
+  va_end(ap);
+  return res;
+}
+
+namespace mgos {
+
+std::string JSONPrintStringv(const char *fmt, va_list ap) {
+  std::string res;
+  const char *p = fmt;
+  while (*p != '\0') {
+    if (*p == '%') {
+      const char *start = p++;
+      if (*p == '%') {
+        res.push_back(*p++);
+        continue;
+      }
+      while (*p != '\0' && strchr("-+ #0", *p) != nullptr) p++;
+      while (isdigit((unsigned char) *p) || *p == '.') p++;
+      int num_l = 0;
+      bool z = false;
+      while (*p == 'l' || *p == 'h' || *p == 'z') {
+        if (*p == 'l') num_l++;
+        if (*p == 'z') z = true;
+        p++;
+      }
+      const char conv = *p++;
+      const std::string spec(start, p - start);
+      switch (conv) {
+        case 'Q':
+          AppendQuoted(&res, va_arg(ap, const char *));
+          break;
+        case 'B':
+          res.append(va_arg(ap, int) ? "true" : "false");
+          break;
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'c':
+          if (z) {
+            AppendFormatted(&res, spec, va_arg(ap, size_t));
+          } else if (num_l >= 2) {
+            AppendFormatted(&res, spec, va_arg(ap, long long));
+          } else if (num_l == 1) {
+            AppendFormatted(&res, spec, va_arg(ap, long));
+          } else {
+            AppendFormatted(&res, spec, va_arg(ap, int));
+          }
+          break;
+        case 'f':
+        case 'g':
+        case 'e':
+          AppendFormatted(&res, spec, va_arg(ap, double));
+          break;
+        case 's':
+          AppendFormatted(&res, spec, va_arg(ap, const char *));
+          break;
+        case 'p':
+          AppendFormatted(&res, spec, va_arg(ap, void *));
+          break;
+        default:
+          abort();
+      }
+    } else if (*p == '"') {
+      // String literal, copied as is.
+      const char *start = p++;
+      while (*p != '\0' && *p != '"') {
+        if (*p == '\\' && p[1] != '\0') p++;
+        p++;
+      }
+      if (*p == '"') p++;
+      res.append(start, p - start);
+    } else if (IsIdentStart(*p)) {
+      // Bare keys are quoted.
+      const char *start = p;
+      while (IsIdent(*p)) p++;
+      res.push_back('"');
+      res.append(start, p - start);
+      res.push_back('"');
+    } else {
+      res.push_back(*p++);
+    }
+  }
+  return res;
+}
+
+std::string JSONPrintStringf(const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  std::string res = JSONPrintStringv(fmt, ap);
+  va_end(ap);
+  return res;
+}
+
+void JSONAppendStringf(std::string *res, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  res->append(JSONPrintStringv(fmt, ap));
+  va_end(ap);
+}
+
+}  // namespace mgos
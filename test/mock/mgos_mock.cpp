@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos_mock.hpp"
+
+#include <ctype.h>
+
+#include <map>
+#include <set>
+#include <utility>
+
+#include "mgos.h"
+#include "mgos_dns_sd.h"
+#include "mgos_rpc.h"
+
+int mgos_mock_log_level = LL_ERROR;
+
+namespace mock {
+
+struct Timer {
+  int msecs;
+  int flags;
+  timer_callback cb;
+  void *arg;
+};
+
+struct RPCHandler {
+  std::string args_fmt;
+  mg_handler_cb_t cb;
+  void *cb_arg;
+};
+
+struct ButtonHandler {
+  mgos_gpio_int_handler_f cb;
+  void *arg;
+};
+
+static int64_t s_now = 0;
+// Ids are even, like addresses of real timer records.
+static mgos_timer_id s_next_timer_id = 2;
+static std::map<std::pair<int64_t, mgos_timer_id>, Timer> s_timers;
+static std::map<int, bool> s_pins;
+static std::map<int, ButtonHandler> s_button_handlers;
+static std::map<std::string, RPCHandler> s_rpc_handlers;
+static RPCResult *s_rpc_result = nullptr;
+static int s_ssw_group = 0;
+static const char *s_hap_salt = nullptr;
+static std::set<const char *> s_conf_strs;
+
+void Reset() {
+  s_now = 0;
+  s_next_timer_id = 2;
+  s_timers.clear();
+  s_pins.clear();
+  s_button_handlers.clear();
+  s_rpc_handlers.clear();
+  s_ssw_group = 0;
+  mgos_conf_set_str(&s_hap_salt, nullptr);
+  ResetFS();
+  ResetHAP();
+  ResetStubs();
+}
+
+void AdvanceTimeMs(int64_t ms) {
+  int64_t until = s_now + ms * 1000;
+  while (!s_timers.empty() && s_timers.begin()->first.first <= until) {
+    auto it = s_timers.begin();
+    Timer t = it->second;
+    mgos_timer_id id = it->first.second;
+    s_now = it->first.first;
+    s_timers.erase(it);
+    if (t.flags & MGOS_TIMER_REPEAT) {
+      s_timers[std::make_pair(s_now + t.msecs * 1000LL, id)] = t;
+    }
+    t.cb(t.arg);
+  }
+  s_now = until;
+}
+
+int NumTimers() {
+  return (int) s_timers.size();
+}
+
+void SetInput(int pin, bool level) {
+  if (s_pins[pin] == level) return;
+  s_pins[pin] = level;
+  auto it = s_button_handlers.find(pin);
+  if (it != s_button_handlers.end()) it->second.cb(pin, it->second.arg);
+}
+
+bool GetPin(int pin) {
+  return s_pins[pin];
+}
+
+void SetSSWGroup(bool ssw_group) {
+  s_ssw_group = ssw_group;
+}
+
+bool HaveRPCHandler(const char *method) {
+  return s_rpc_handlers.count(method) != 0;
+}
+
+RPCResult CallRPC(const char *method, const std::string &args_json) {
+  RPCResult res = {false, "", -1, "no response"};
+  auto it = s_rpc_handlers.find(method);
+  if (it == s_rpc_handlers.end()) {
+    res.error_code = 404;
+    res.error_msg = "no handler";
+    return res;
+  }
+  struct mg_rpc_request_info ri = {};
+  ri.method = {method, strlen(method)};
+  ri.args_fmt = it->second.args_fmt.c_str();
+  s_rpc_result = &res;
+  it->second.cb(&ri, it->second.cb_arg, nullptr,
+                {args_json.data(), args_json.size()});
+  s_rpc_result = nullptr;
+  return res;
+}
+
+}  // namespace mock
+
+using namespace mock;
+
+// Time and system.
+
+double mgos_uptime(void) {
+  return s_now / 1000000.0;
+}
+
+int64_t mgos_uptime_micros(void) {
+  return s_now;
+}
+
+double mg_time(void) {
+  return 1600000000 + mgos_uptime();
+}
+
+size_t mgos_get_heap_size(void) {
+  return 80 * 1024;
+}
+
+size_t mgos_get_free_heap_size(void) {
+  return 40 * 1024;
+}
+
+size_t mgos_get_min_free_heap_size(void) {
+  return 30 * 1024;
+}
+
+void mgos_expand_mac_address_placeholders(char *str) {
+  for (char *p = str; *p != '\0'; p++) {
+    if (*p == '?') *p = '0';
+  }
+}
+
+bool mgos_event_add_handler(int ev, mgos_event_handler_t cb, void *userdata) {
+  (void) ev;
+  (void) cb;
+  (void) userdata;
+  return true;
+}
+
+const char *mgos_dns_sd_get_host_name(void) {
+  return "shellytest-000000.local";
+}
+
+// Timers.
+
+mgos_timer_id mgos_set_timer(int msecs, int flags, timer_callback cb,
+                             void *cb_arg) {
+  mgos_timer_id id = s_next_timer_id;
+  s_next_timer_id += 2;
+  s_timers[std::make_pair(s_now + msecs * 1000LL, id)] = {msecs, flags, cb,
+                                                          cb_arg};
+  return id;
+}
+
+void mgos_clear_timer(mgos_timer_id id) {
+  for (auto it = s_timers.begin(); it != s_timers.end(); it++) {
+    if (it->first.second == id) {
+      s_timers.erase(it);
+      return;
+    }
+  }
+}
+
+// GPIO.
+
+bool mgos_gpio_set_mode(int pin, enum mgos_gpio_mode mode) {
+  (void) pin;
+  (void) mode;
+  return true;
+}
+
+bool mgos_gpio_set_pull(int pin, enum mgos_gpio_pull_type pull) {
+  (void) pin;
+  (void) pull;
+  return true;
+}
+
+bool mgos_gpio_setup_input(int pin, enum mgos_gpio_pull_type pull) {
+  (void) pin;
+  (void) pull;
+  return true;
+}
+
+bool mgos_gpio_setup_output(int pin, bool level) {
+  s_pins[pin] = level;
+  return true;
+}
+
+bool mgos_gpio_read(int pin) {
+  return s_pins[pin];
+}
+
+bool mgos_gpio_read_out(int pin) {
+  return s_pins[pin];
+}
+
+void mgos_gpio_write(int pin, bool level) {
+  s_pins[pin] = level;
+}
+
+bool mgos_gpio_toggle(int pin) {
+  s_pins[pin] = !s_pins[pin];
+  return s_pins[pin];
+}
+
+bool mgos_gpio_set_button_handler(int pin, enum mgos_gpio_pull_type pull_type,
+                                  enum mgos_gpio_int_mode int_mode,
+                                  int debounce_ms, mgos_gpio_int_handler_f cb,
+                                  void *arg) {
+  s_button_handlers[pin] = {cb, arg};
+  (void) pull_type;
+  (void) int_mode;
+  (void) debounce_ms;
+  return true;
+}
+
+void mgos_gpio_remove_int_handler(int pin, mgos_gpio_int_handler_f *old_cb,
+                                  void **old_arg) {
+  auto it = s_button_handlers.find(pin);
+  if (it == s_button_handlers.end()) return;
+  if (old_cb != nullptr) *old_cb = it->second.cb;
+  if (old_arg != nullptr) *old_arg = it->second.arg;
+  s_button_handlers.erase(it);
+}
+
+// Config.
+
+void mgos_conf_set_str(const char **vp, const char *v) {
+  if (s_conf_strs.erase(*vp) != 0) free((void *) *vp);
+  *vp = nullptr;
+  if (v == nullptr) return;
+  *vp = strdup(v);
+  s_conf_strs.insert(*vp);
+}
+
+bool mgos_conf_str_empty(const char *s) {
+  return (s == nullptr || s[0] == '\0');
+}
+
+int mgos_sys_config_get_shelly_ssw_group(void) {
+  return s_ssw_group;
+}
+
+void mgos_sys_config_set_shelly_ssw_group(int v) {
+  s_ssw_group = v;
+}
+
+int mgos_sys_config_get_shelly_cfg_save_delay(void) {
+  return 0;
+}
+
+const char *mgos_sys_config_get_device_id(void) {
+  return "shellytest-000000";
+}
+
+const char *mgos_sys_config_get_device_sn(void) {
+  return nullptr;
+}
+
+const char *mgos_sys_config_get_hap_salt(void) {
+  return s_hap_salt;
+}
+
+void mgos_sys_config_set_hap_salt(const char *v) {
+  mgos_conf_set_str(&s_hap_salt, v);
+}
+
+const char *mgos_sys_ro_vars_get_fw_version(void) {
+  return "0.0.0-test";
+}
+
+const char *mgos_sys_ro_vars_get_fw_id(void) {
+  return "20200101-000000/test";
+}
+
+// RPC.
+
+struct mg_rpc *mgos_rpc_get_global(void) {
+  static int s_rpc;
+  return reinterpret_cast<struct mg_rpc *>(&s_rpc);
+}
+
+void mg_rpc_add_handler(struct mg_rpc *c, const char *method,
+                        const char *args_fmt, mg_handler_cb_t cb,
+                        void *cb_arg) {
+  s_rpc_handlers[method] = {args_fmt, cb, cb_arg};
+  (void) c;
+}
+
+bool mg_rpc_send_responsef(struct mg_rpc_request_info *ri,
+                           const char *result_json_fmt, ...) {
+  if (s_rpc_result == nullptr) return false;
+  s_rpc_result->ok = true;
+  s_rpc_result->error_code = 0;
+  s_rpc_result->error_msg.clear();
+  if (result_json_fmt != nullptr) {
+    va_list ap;
+    va_start(ap, result_json_fmt);
+    s_rpc_result->result = mgos::JSONPrintStringv(result_json_fmt, ap);
+    va_end(ap);
+  } else {
+    s_rpc_result->result = "null";
+  }
+  (void) ri;
+  return true;
+}
+
+bool mg_rpc_send_errorf(struct mg_rpc_request_info *ri, int error_code,
+                        const char *error_msg_fmt, ...) {
+  if (s_rpc_result == nullptr) return false;
+  char buf[256];
+  va_list ap;
+  va_start(ap, error_msg_fmt);
+  vsnprintf(buf, sizeof(buf), error_msg_fmt, ap);
+  va_end(ap);
+  s_rpc_result->ok = false;
+  s_rpc_result->error_code = error_code;
+  s_rpc_result->error_msg = buf;
+  (void) ri;
+  return true;
+}
+
+// Status.
+
+namespace mgos {
+
+Status Errorf(int code, const char *fmt, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  return Status(code, buf);
+}
+
+}  // namespace mgos
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "HAP.h"
+
+// Control of the host test mocks.
+namespace mock {
+
+// Restores the initial state: time 0, no timers, handlers or events, all
+// pins low, default config.
+void Reset();
+
+// Advances time, firing due timers in order.
+void AdvanceTimeMs(int64_t ms);
+int NumTimers();
+
+// Sets level of an input pin, the button handler is invoked on change.
+void SetInput(int pin, bool level);
+bool GetPin(int pin);
+
+// Config.
+void SetSSWGroup(bool ssw_group);
+
+// Number of config saves requested since reset, saves done within a
+// ConfigSaveBatch count once.
+int NumConfigSaves();
+int NumHAPServerRestarts();
+
+// RPC.
+struct RPCResult {
+  bool ok;
+  std::string result;  // "null" if none.
+  int error_code;
+  std::string error_msg;
+};
+bool HaveRPCHandler(const char *method);
+RPCResult CallRPC(const char *method, const std::string &args_json);
+
+// HAP events raised since reset, total or for a characteristic.
+int NumEvents();
+int NumEvents(const HAPCharacteristic *c);
+
+// Filesystem and OTA. Mounting succeeds if enabled, what is mounted is up to
+// the test.
+struct Mount {
+  std::string path;
+  std::string dev_type;
+  std::string dev_opts;
+  std::string fs_type;
+};
+void SetFirstBoot(bool first_boot);
+void SetOTAPartition(int partition);
+void SetMountOK(bool mount_ok);
+void SetSpaceFree(size_t space_free);
+const std::vector<Mount> &GetMounts();
+int NumUmounts();
+
+// Parts of Reset(), implemented by the respective mocks.
+void ResetFS();
+void ResetHAP();
+void ResetStubs();
+
+}  // namespace mock
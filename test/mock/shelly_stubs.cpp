@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Stand-ins for the parts of the firmware that are not built into the tests:
+// main, config store, debug info and HAP server stats.
+
+#include <string>
+#include <vector>
+
+#include "mgos_mock.hpp"
+
+#include "shelly_config_store.hpp"
+#include "shelly_debug.hpp"
+#include "shelly_hap_stats.hpp"
+#include "shelly_main.hpp"
+
+namespace mock {
+
+static int s_num_config_saves = 0;
+static int s_num_hap_server_restarts = 0;
+static int s_batch_depth = 0;
+static bool s_batch_save = false;
+
+void ResetStubs() {
+  shelly::g_comps.clear();
+  s_num_config_saves = 0;
+  s_num_hap_server_restarts = 0;
+  s_batch_depth = 0;
+  s_batch_save = false;
+}
+
+int NumConfigSaves() {
+  return s_num_config_saves;
+}
+
+int NumHAPServerRestarts() {
+  return s_num_hap_server_restarts;
+}
+
+}  // namespace mock
+
+void shelly_get_debug_info(std::string *out) {
+  *out = "debug info";
+}
+
+namespace shelly {
+
+std::vector<Component *> g_comps;
+
+void SaveConfig(const char *source) {
+  if (mock::s_batch_depth > 0) {
+    mock::s_batch_save = true;
+    return;
+  }
+  mock::s_num_config_saves++;
+  (void) source;
+}
+
+ConfigSaveBatch::ConfigSaveBatch() {
+  mock::s_batch_depth++;
+}
+
+ConfigSaveBatch::~ConfigSaveBatch() {
+  if (--mock::s_batch_depth > 0 || !mock::s_batch_save) return;
+  mock::s_batch_save = false;
+  SaveConfig("batch");
+}
+
+void RestartHAPServer() {
+  mock::s_num_hap_server_restarts++;
+}
+
+uint32_t GetNumHAPSessionEvictions() {
+  return 0;
+}
+
+uint32_t GetLoopLagUs() {
+  return 0;
+}
+
+uint32_t GetLoopLagMaxUs() {
+  return 0;
+}
+
+void HAPStatsRecordRequest(HAPRequestType type, int64_t duration_us) {
+  (void) type;
+  (void) duration_us;
+}
+
+std::string HAPStatsGetJSON() {
+  return "{}";
+}
+
+}  // namespace shelly
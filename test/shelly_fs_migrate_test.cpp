@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_fs_migrate.hpp"
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "mgos_mock.hpp"
+
+namespace shelly {
+namespace {
+
+// Runs in a temporary directory, which stands for the new root filesystem.
+// The previous filesystem is "mounted" at old/ (FS_MIGRATE_OLD_MOUNT_POINT).
+class FSMigrateTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    mock::Reset();
+    mock::SetFirstBoot(true);
+    mock::SetMountOK(true);
+    mock::SetSpaceFree(1024 * 1024);
+    char tmpl[] = "/tmp/fs_migrate_test_XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(tmpl));
+    dir_ = tmpl;
+    ASSERT_NE(nullptr, getcwd(cwd_, sizeof(cwd_)));
+    ASSERT_EQ(0, chdir(dir_.c_str()));
+    ASSERT_EQ(0, mkdir("old", 0755));
+  }
+
+  void TearDown() override {
+    ASSERT_EQ(0, chdir(cwd_));
+    nftw(dir_.c_str(),
+         [](const char *path, const struct stat *, int, struct FTW *) {
+           return remove(path);
+         },
+         8, FTW_DEPTH | FTW_PHYS);
+  }
+
+  static void WriteFile(const std::string &name, const std::string &data) {
+    FILE *fp = fopen(name.c_str(), "wb");
+    ASSERT_NE(nullptr, fp);
+    ASSERT_EQ(data.size(), fwrite(data.data(), 1, data.size(), fp));
+    fclose(fp);
+  }
+
+  static std::string ReadFile(const std::string &name) {
+    std::string res;
+    FILE *fp = fopen(name.c_str(), "rb");
+    if (fp == nullptr) return "<none>";
+    char buf[256];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) res.append(buf, n);
+    fclose(fp);
+    return res;
+  }
+
+  static bool Exists(const std::string &name) {
+    struct stat st;
+    return (stat(name.c_str(), &st) == 0);
+  }
+
+  std::string dir_;
+  char cwd_[256];
+};
+
+TEST_F(FSMigrateTest, NotFirstBoot) {
+  mock::SetFirstBoot(false);
+  WriteFile("old/conf9.json", "{}");
+  EXPECT_EQ(FSMigrateResult::kNotNeeded, FSMigrate());
+  EXPECT_TRUE(mock::GetMounts().empty());
+  EXPECT_FALSE(Exists("conf9.json"));
+}
+
+// Update from a version that already uses the new filesystem type.
+TEST_F(FSMigrateTest, OldFSNotMountable) {
+  mock::SetMountOK(false);
+  EXPECT_EQ(FSMigrateResult::kNotNeeded, FSMigrate());
+  EXPECT_EQ(1u, mock::GetMounts().size());
+}
+
+TEST_F(FSMigrateTest, MountsPreviousSlot) {
+  mock::SetOTAPartition(0);
+  EXPECT_EQ(FSMigrateResult::kDone, FSMigrate());
+  mock::SetOTAPartition(1);
+  EXPECT_EQ(FSMigrateResult::kDone, FSMigrate());
+  const auto &mounts = mock::GetMounts();
+  ASSERT_EQ(2u, mounts.size());
+  EXPECT_EQ("old", mounts[0].path);
+  EXPECT_EQ("sysflash", mounts[0].dev_type);
+  EXPECT_EQ("SPIFFS", mounts[0].fs_type);
+  EXPECT_EQ("{addr: 1814528, size: 262144}", mounts[0].dev_opts);
+  EXPECT_EQ("{addr: 765952, size: 262144}", mounts[1].dev_opts);
+  EXPECT_EQ(2, mock::NumUmounts());
+}
+
+TEST_F(FSMigrateTest, CopiesRuntimeFiles) {
+  WriteFile("old/conf9.json", "{\"sw1\": {\"name\": \"Lamp\"}}");
+  WriteFile("old/kvs.json", "{\"pairings\": 1}");
+  WriteFile("old/log.0", std::string(5000, 'x'));
+  // Part of both images, the new one is kept.
+  WriteFile("old/index.html.gz", "old page");
+  WriteFile("index.html.gz", "new page");
+  EXPECT_EQ(FSMigrateResult::kRestart, FSMigrate());
+  EXPECT_EQ("{\"sw1\": {\"name\": \"Lamp\"}}", ReadFile("conf9.json"));
+  EXPECT_EQ("{\"pairings\": 1}", ReadFile("kvs.json"));
+  EXPECT_EQ(std::string(5000, 'x'), ReadFile("log.0"));
+  EXPECT_EQ("new page", ReadFile("index.html.gz"));
+  // Previous filesystem is left intact for rollback.
+  EXPECT_EQ("{\"pairings\": 1}", ReadFile("old/kvs.json"));
+  EXPECT_FALSE(Exists("conf9.json.tmp"));
+  EXPECT_EQ(1, mock::NumUmounts());
+}
+
+TEST_F(FSMigrateTest, NoConfig) {
+  WriteFile("old/kvs.json", "{}");
+  EXPECT_EQ(FSMigrateResult::kDone, FSMigrate());
+  EXPECT_EQ("{}", ReadFile("kvs.json"));
+}
+
+TEST_F(FSMigrateTest, NotEnoughSpace) {
+  WriteFile("old/conf9.json", "{}");
+  WriteFile("old/kvs.json", "{}");
+  WriteFile("old/log.0", std::string(5000, 'x'));
+  // Whole blocks are counted: 4096 + 4096 + 8192.
+  mock::SetSpaceFree(16383);
+  EXPECT_EQ(FSMigrateResult::kFailed, FSMigrate());
+  EXPECT_FALSE(Exists("conf9.json"));
+  EXPECT_FALSE(Exists("kvs.json"));
+  EXPECT_FALSE(Exists("log.0"));
+  EXPECT_EQ(1, mock::NumUmounts());
+  mock::SetSpaceFree(16384);
+  EXPECT_EQ(FSMigrateResult::kRestart, FSMigrate());
+}
+
+TEST_F(FSMigrateTest, CopyFailed) {
+  WriteFile("old/conf9.json", "{}");
+  // Cannot be read as a file.
+  ASSERT_EQ(0, mkdir("old/bad", 0755));
+  EXPECT_EQ(FSMigrateResult::kFailed, FSMigrate());
+  EXPECT_EQ("{}", ReadFile("conf9.json"));
+  EXPECT_FALSE(Exists("bad"));
+  EXPECT_FALSE(Exists("bad.tmp"));
+}
+
+}  // namespace
+}  // namespace shelly
@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_hap_stateless_switch.hpp"
+
+#include <memory>
+
+#include "gtest/gtest.h"
+
+#include "hap_test_util.hpp"
+#include "mgos_mock.hpp"
+
+#include "shelly_hap_accessory.hpp"
+
+namespace shelly {
+namespace hap {
+namespace {
+
+using hap_test::GetChars;
+
+constexpr int kInPin = 4;
+
+class HAPStatelessSwitchTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    mock::Reset();
+    // Last event time 0 means there was none, uptime is never 0 on a device.
+    mock::AdvanceTimeMs(10000);
+    cfg_ = {};
+    cfg_.name = "Test SSW";
+    cfg_.in_mode = static_cast<int>(StatelessSwitch::InMode::kMomentary);
+    in_.reset(new InputPin(1, kInPin, 1, MGOS_GPIO_PULL_NONE, false));
+    acc_.reset(new Accessory(SHELLY_HAP_AID_PRIMARY,
+                             kHAPAccessoryCategory_ProgrammableSwitches,
+                             "Test", nullptr, &server_));
+  }
+
+  void TearDown() override {
+    ssw_.reset();
+  }
+
+  void Create(int id, uint16_t label_service_iid = 0) {
+    ssw_.reset(new StatelessSwitch(id, in_.get(), &cfg_, label_service_iid));
+    ASSERT_TRUE(ssw_->Init().ok());
+    ssw_->set_parent(acc_.get());
+    svc_ = ssw_->GetHAPService();
+    ASSERT_NE(nullptr, svc_);
+    chars_ = GetChars(svc_);
+  }
+
+  // Returns the last event, -1 if none.
+  int LastEvent() {
+    uint8_t ev = 0;
+    if (hap_test::ReadUInt8(chars_[1], &ev) != kHAPError_None) return -1;
+    return ev;
+  }
+
+  int NumEvents() {
+    return mock::NumEvents(chars_[1]);
+  }
+
+  void Press(int duration_ms) {
+    mock::SetInput(kInPin, true);
+    mock::AdvanceTimeMs(duration_ms);
+    mock::SetInput(kInPin, false);
+  }
+
+  HAPAccessoryServerRef server_ = {};
+  struct mgos_config_ssw cfg_;
+  std::unique_ptr<InputPin> in_;
+  std::unique_ptr<Accessory> acc_;
+  std::unique_ptr<StatelessSwitch> ssw_;
+  const HAPService *svc_ = nullptr;
+  std::vector<const HAPBaseCharacteristic *> chars_;
+};
+
+TEST_F(HAPStatelessSwitchTest, Layout) {
+  Create(1);
+  EXPECT_EQ(0x400u, svc_->iid);
+  EXPECT_EQ(&kHAPServiceType_StatelessProgrammableSwitch, svc_->serviceType);
+  EXPECT_EQ(nullptr, svc_->linkedServices);
+  ASSERT_EQ(2u, chars_.size());
+  EXPECT_EQ(0x401u, chars_[0]->iid);
+  EXPECT_EQ(&kHAPCharacteristicType_Name, chars_[0]->characteristicType);
+  EXPECT_EQ(0x402u, chars_[1]->iid);
+  EXPECT_EQ(&kHAPCharacteristicType_ProgrammableSwitchEvent,
+            chars_[1]->characteristicType);
+  EXPECT_TRUE(chars_[1]->properties.supportsEventNotification);
+  EXPECT_FALSE(chars_[1]->properties.writable);
+}
+
+TEST_F(HAPStatelessSwitchTest, LayoutSecond) {
+  Create(2);
+  EXPECT_EQ(0x404u, svc_->iid);
+  EXPECT_EQ(0x405u, chars_[0]->iid);
+  EXPECT_EQ(0x406u, chars_[1]->iid);
+}
+
+TEST_F(HAPStatelessSwitchTest, LayoutLabeled) {
+  Create(2, SHELLY_HAP_IID_BASE_SERVICE_LABEL);
+  ASSERT_NE(nullptr, svc_->linkedServices);
+  EXPECT_EQ(0x1030, svc_->linkedServices[0]);
+  EXPECT_EQ(0, svc_->linkedServices[1]);
+  ASSERT_EQ(3u, chars_.size());
+  EXPECT_EQ(0x407u, chars_[2]->iid);
+  EXPECT_EQ(&kHAPCharacteristicType_ServiceLabelIndex,
+            chars_[2]->characteristicType);
+  uint8_t index = 0;
+  EXPECT_EQ(kHAPError_None, hap_test::ReadUInt8(chars_[2], &index));
+  EXPECT_EQ(2, index);
+}
+
+TEST_F(HAPStatelessSwitchTest, ServiceLabelLayout) {
+  ServiceLabelService svc(1);
+  const HAPService *hs = svc.GetHAPService();
+  EXPECT_EQ(0x1030u, hs->iid);
+  auto chars = GetChars(hs);
+  ASSERT_EQ(1u, chars.size());
+  EXPECT_EQ(0x1031u, chars[0]->iid);
+  uint8_t ns = 0;
+  EXPECT_EQ(kHAPError_None, hap_test::ReadUInt8(chars[0], &ns));
+  EXPECT_EQ(1, ns);
+}
+
+TEST_F(HAPStatelessSwitchTest, InputRequired) {
+  ssw_.reset(new StatelessSwitch(1, nullptr, &cfg_));
+  EXPECT_FALSE(ssw_->Init().ok());
+}
+
+TEST_F(HAPStatelessSwitchTest, NoEventYet) {
+  Create(1);
+  EXPECT_EQ(-1, LastEvent());
+}
+
+TEST_F(HAPStatelessSwitchTest, MomentarySingle) {
+  Create(1);
+  Press(100);
+  EXPECT_EQ(0, NumEvents());
+  mock::AdvanceTimeMs(400);
+  EXPECT_EQ(1, NumEvents());
+  EXPECT_EQ(kHAPCharacteristicValue_ProgrammableSwitchEvent_SinglePress,
+            LastEvent());
+}
+
+TEST_F(HAPStatelessSwitchTest, MomentaryDouble) {
+  Create(1);
+  Press(100);
+  mock::AdvanceTimeMs(100);
+  Press(100);
+  EXPECT_EQ(1, NumEvents());
+  EXPECT_EQ(kHAPCharacteristicValue_ProgrammableSwitchEvent_DoublePress,
+            LastEvent());
+  mock::AdvanceTimeMs(2000);
+  EXPECT_EQ(1, NumEvents());
+}
+
+TEST_F(HAPStatelessSwitchTest, MomentaryLong) {
+  Create(1);
+  Press(1500);
+  EXPECT_EQ(1, NumEvents());
+  EXPECT_EQ(kHAPCharacteristicValue_ProgrammableSwitchEvent_LongPress,
+            LastEvent());
+  mock::AdvanceTimeMs(2000);
+  EXPECT_EQ(1, NumEvents());
+}
+
+TEST_F(HAPStatelessSwitchTest, ToggleShort) {
+  cfg_.in_mode = static_cast<int>(StatelessSwitch::InMode::kToggleShort);
+  Create(1);
+  mock::SetInput(kInPin, true);
+  EXPECT_EQ(1, NumEvents());
+  EXPECT_EQ(kHAPCharacteristicValue_ProgrammableSwitchEvent_SinglePress,
+            LastEvent());
+  mock::SetInput(kInPin, false);
+  EXPECT_EQ(2, NumEvents());
+  EXPECT_EQ(kHAPCharacteristicValue_ProgrammableSwitchEvent_SinglePress,
+            LastEvent());
+}
+
+TEST_F(HAPStatelessSwitchTest, ToggleShortLong) {
+  cfg_.in_mode = static_cast<int>(StatelessSwitch::InMode::kToggleShortLong);
+  Create(1);
+  mock::SetInput(kInPin, true);
+  EXPECT_EQ(kHAPCharacteristicValue_ProgrammableSwitchEvent_SinglePress,
+            LastEvent());
+  mock::SetInput(kInPin, false);
+  EXPECT_EQ(kHAPCharacteristicValue_ProgrammableSwitchEvent_DoublePress,
+            LastEvent());
+  EXPECT_EQ(2, NumEvents());
+}
+
+TEST_F(HAPStatelessSwitchTest, GetInfo) {
+  Create(1);
+  auto info = ssw_->GetInfo();
+  ASSERT_TRUE(info.ok());
+  EXPECT_EQ(
+      "{\"id\": 1, \"type\": 3, \"name\": \"Test SSW\", \"in_mode\": 0, "
+      "\"group\": false, \"last_ev\": 0, \"last_ev_age\": -1.000}",
+      info.ValueOrDie());
+  Press(1500);
+  mock::AdvanceTimeMs(500);
+  info = ssw_->GetInfo();
+  EXPECT_EQ(
+      "{\"id\": 1, \"type\": 3, \"name\": \"Test SSW\", \"in_mode\": 0, "
+      "\"group\": false, \"last_ev\": 2, \"last_ev_age\": 1.000}",
+      info.ValueOrDie());
+}
+
+TEST_F(HAPStatelessSwitchTest, SetConfig) {
+  Create(1);
+  bool restart_required = true;
+  ASSERT_TRUE(
+      ssw_->SetConfig("{\"in_mode\": 2}", &restart_required).ok());
+  EXPECT_FALSE(restart_required);
+  EXPECT_EQ(2, cfg_.in_mode);
+  ASSERT_TRUE(ssw_->SetConfig("{\"name\": \"New name\", \"in_mode\": 2}",
+                              &restart_required)
+                  .ok());
+  EXPECT_TRUE(restart_required);
+  EXPECT_STREQ("New name", cfg_.name);
+  mgos_conf_set_str(&cfg_.name, nullptr);
+}
+
+TEST_F(HAPStatelessSwitchTest, SetConfigGroup) {
+  Create(1);
+  bool restart_required = false;
+  ASSERT_TRUE(ssw_->SetConfig("{\"in_mode\": 0, \"group\": true}",
+                              &restart_required)
+                  .ok());
+  EXPECT_TRUE(restart_required);
+  EXPECT_TRUE(mgos_sys_config_get_shelly_ssw_group());
+  // Unchanged if not specified.
+  ASSERT_TRUE(ssw_->SetConfig("{\"in_mode\": 0}", &restart_required).ok());
+  EXPECT_FALSE(restart_required);
+  EXPECT_TRUE(mgos_sys_config_get_shelly_ssw_group());
+}
+
+TEST_F(HAPStatelessSwitchTest, SetConfigValidation) {
+  Create(1);
+  const char *invalid[] = {
+      "{}",
+      "{\"in_mode\": -1}",
+      "{\"in_mode\": 3}",
+      "{\"in_mode\": 0, \"name\": \"0123456789012345678901234567890123456789"
+      "012345678901234567890123456789\"}",
+  };
+  for (const char *config : invalid) {
+    bool restart_required = false;
+    auto st = ssw_->SetConfig(config, &restart_required);
+    EXPECT_EQ(STATUS_INVALID_ARGUMENT, st.error_code()) << config;
+  }
+  EXPECT_STREQ("Test SSW", cfg_.name);
+  EXPECT_EQ(0, cfg_.in_mode);
+}
+
+}  // namespace
+}  // namespace hap
+}  // namespace shelly
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_hap_switch.hpp"
+
+#include <memory>
+
+#include "gtest/gtest.h"
+
+#include "hap_test_util.hpp"
+#include "mgos_mock.hpp"
+
+#include "shelly_hap_accessory.hpp"
+#include "shelly_hap_lock.hpp"
+#include "shelly_hap_outlet.hpp"
+
+namespace shelly {
+namespace hap {
+namespace {
+
+using hap_test::GetChars;
+
+constexpr int kInPin = 4;
+constexpr int kOutPin = 5;
+
+// IIDs must not change between versions, controllers refer to
+// characteristics by IID. Hence the literal values.
+class HAPSwitchTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    mock::Reset();
+    cfg_ = {};
+    cfg_.name = "Test SW";
+    cfg_.enable = true;
+    cfg_.in_mode = static_cast<int>(ShellySwitch::InMode::kToggle);
+    in_.reset(new InputPin(1, kInPin, 1, MGOS_GPIO_PULL_NONE, false));
+    out_.reset(new OutputPin(1, kOutPin, 1));
+    acc_.reset(new Accessory(SHELLY_HAP_AID_PRIMARY,
+                             kHAPAccessoryCategory_Switches, "Test", nullptr,
+                             &server_));
+  }
+
+  void TearDown() override {
+    sw_.reset();
+  }
+
+  template <class T>
+  void Create(int id) {
+    sw_.reset(new T(id, in_.get(), out_.get(), nullptr, &cfg_));
+    ASSERT_TRUE(sw_->Init().ok());
+    sw_->set_parent(acc_.get());
+    svc_ = sw_->GetHAPService();
+    ASSERT_NE(nullptr, svc_);
+    chars_ = GetChars(svc_);
+  }
+
+  void ExpectChar(size_t i, uint64_t iid, const HAPUUID *type, bool writable,
+                  bool notify) {
+    ASSERT_LT(i, chars_.size());
+    const HAPBaseCharacteristic *c = chars_[i];
+    EXPECT_EQ(iid, c->iid) << i;
+    EXPECT_EQ(type, c->characteristicType) << i;
+    EXPECT_TRUE(c->properties.readable) << i;
+    EXPECT_EQ(writable, c->properties.writable) << i;
+    EXPECT_EQ(notify, c->properties.supportsEventNotification) << i;
+  }
+
+  HAPAccessoryServerRef server_ = {};
+  struct mgos_config_sw cfg_;
+  std::unique_ptr<InputPin> in_;
+  std::unique_ptr<OutputPin> out_;
+  std::unique_ptr<Accessory> acc_;
+  std::unique_ptr<ShellySwitch> sw_;
+  const HAPService *svc_ = nullptr;
+  std::vector<const HAPBaseCharacteristic *> chars_;
+};
+
+TEST_F(HAPSwitchTest, SwitchLayout) {
+  Create<Switch>(1);
+  EXPECT_EQ(0x100u, svc_->iid);
+  EXPECT_EQ(&kHAPServiceType_Switch, svc_->serviceType);
+  EXPECT_STREQ("Test SW", svc_->name);
+  ASSERT_EQ(2u, chars_.size());
+  ExpectChar(0, 0x101, &kHAPCharacteristicType_Name, false, false);
+  ExpectChar(1, 0x102, &kHAPCharacteristicType_On, true, true);
+  EXPECT_EQ("Test SW", hap_test::ReadString(chars_[0]));
+}
+
+TEST_F(HAPSwitchTest, SwitchLayoutSecond) {
+  Create<Switch>(2);
+  EXPECT_EQ(0x104u, svc_->iid);
+  ExpectChar(0, 0x105, &kHAPCharacteristicType_Name, false, false);
+  ExpectChar(1, 0x106, &kHAPCharacteristicType_On, true, true);
+}
+
+TEST_F(HAPSwitchTest, OutletLayout) {
+  Create<Outlet>(1);
+  EXPECT_EQ(0x200u, svc_->iid);
+  EXPECT_EQ(&kHAPServiceType_Outlet, svc_->serviceType);
+  ASSERT_EQ(3u, chars_.size());
+  ExpectChar(0, 0x201, &kHAPCharacteristicType_Name, false, false);
+  ExpectChar(1, 0x202, &kHAPCharacteristicType_On, true, true);
+  ExpectChar(2, 0x203, &kHAPCharacteristicType_OutletInUse, false, true);
+  bool in_use = false;
+  EXPECT_EQ(kHAPError_None, hap_test::ReadBool(chars_[2], &in_use));
+  EXPECT_TRUE(in_use);
+}
+
+TEST_F(HAPSwitchTest, OutletLayoutSecond) {
+  Create<Outlet>(2);
+  EXPECT_EQ(0x205u, svc_->iid);
+  ExpectChar(2, 0x208, &kHAPCharacteristicType_OutletInUse, false, true);
+}
+
+TEST_F(HAPSwitchTest, LockLayout) {
+  Create<Lock>(1);
+  EXPECT_EQ(0x300u, svc_->iid);
+  EXPECT_EQ(&kHAPServiceType_LockMechanism, svc_->serviceType);
+  ASSERT_EQ(3u, chars_.size());
+  ExpectChar(0, 0x301, &kHAPCharacteristicType_Name, false, false);
+  ExpectChar(1, 0x302, &kHAPCharacteristicType_LockCurrentState, false, true);
+  ExpectChar(2, 0x303, &kHAPCharacteristicType_LockTargetState, true, true);
+}
+
+TEST_F(HAPSwitchTest, LockLayoutSecond) {
+  Create<Lock>(2);
+  EXPECT_EQ(0x304u, svc_->iid);
+  ExpectChar(2, 0x307, &kHAPCharacteristicType_LockTargetState, true, true);
+}
+
+TEST_F(HAPSwitchTest, SwitchReadWrite) {
+  Create<Switch>(1);
+  bool on = true;
+  EXPECT_EQ(kHAPError_None, hap_test::ReadBool(chars_[1], &on));
+  EXPECT_FALSE(on);
+  EXPECT_EQ(kHAPError_None, hap_test::WriteBool(chars_[1], true));
+  EXPECT_TRUE(mock::GetPin(kOutPin));
+  EXPECT_TRUE(cfg_.state);
+  EXPECT_EQ(kHAPError_None, hap_test::ReadBool(chars_[1], &on));
+  EXPECT_TRUE(on);
+}
+
+TEST_F(HAPSwitchTest, SwitchEvents) {
+  Create<Switch>(1);
+  sw_->SetState(true, "web");
+  EXPECT_EQ(1, mock::NumEvents(chars_[1]));
+  // No change, no event.
+  sw_->SetState(true, "web");
+  EXPECT_EQ(1, mock::NumEvents(chars_[1]));
+  mock::SetInput(kInPin, true);
+  mock::SetInput(kInPin, false);
+  EXPECT_EQ(2, mock::NumEvents(chars_[1]));
+  EXPECT_EQ(2, mock::NumEvents());
+}
+
+TEST_F(HAPSwitchTest, AutoOffEvent) {
+  cfg_.auto_off = true;
+  cfg_.auto_off_delay = 1;
+  Create<Switch>(1);
+  EXPECT_EQ(kHAPError_None, hap_test::WriteBool(chars_[1], true));
+  mock::AdvanceTimeMs(1000);
+  EXPECT_FALSE(mock::GetPin(kOutPin));
+  EXPECT_EQ(2, mock::NumEvents(chars_[1]));
+}
+
+TEST_F(HAPSwitchTest, LockReadWrite) {
+  Create<Lock>(1);
+  uint8_t cur = 0, tgt = 0;
+  // Output off - unsecured.
+  EXPECT_EQ(kHAPError_None, hap_test::ReadUInt8(chars_[1], &cur));
+  EXPECT_EQ(1, cur);
+  EXPECT_EQ(kHAPError_None, hap_test::ReadUInt8(chars_[2], &tgt));
+  EXPECT_EQ(1, tgt);
+  // Secured - output on.
+  EXPECT_EQ(kHAPError_None, hap_test::WriteUInt8(chars_[2], 0));
+  EXPECT_TRUE(mock::GetPin(kOutPin));
+  EXPECT_EQ(kHAPError_None, hap_test::ReadUInt8(chars_[1], &cur));
+  EXPECT_EQ(0, cur);
+  EXPECT_LE(1, mock::NumEvents(chars_[1]));
+  EXPECT_LE(1, mock::NumEvents(chars_[2]));
+  EXPECT_EQ(kHAPError_None, hap_test::WriteUInt8(chars_[2], 1));
+  EXPECT_FALSE(mock::GetPin(kOutPin));
+}
+
+TEST_F(HAPSwitchTest, NoEventsWithoutServer) {
+  acc_->set_server(nullptr);
+  Create<Switch>(1);
+  sw_->SetState(true, "web");
+  EXPECT_EQ(0, mock::NumEvents());
+}
+
+}  // namespace
+}  // namespace hap
+}  // namespace shelly
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_rpc_service.hpp"
+
+#include <memory>
+
+#include "gtest/gtest.h"
+
+#include "mgos_mock.hpp"
+
+#include "shelly_hap_stateless_switch.hpp"
+#include "shelly_hap_switch.hpp"
+#include "shelly_main.hpp"
+
+namespace shelly {
+namespace {
+
+constexpr int kInPin = 4;
+constexpr int kOutPin = 5;
+
+class RPCServiceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    mock::Reset();
+    sw_cfg_ = {};
+    sw_cfg_.name = "Test SW";
+    sw_cfg_.enable = true;
+    sw_cfg_.in_mode = static_cast<int>(ShellySwitch::InMode::kToggle);
+    ssw_cfg_ = {};
+    ssw_cfg_.name = "Test SSW";
+    in_.reset(new InputPin(2, kInPin, 1, MGOS_GPIO_PULL_NONE, false));
+    out_.reset(new OutputPin(1, kOutPin, 1));
+    sw_.reset(new hap::Switch(1, nullptr, out_.get(), nullptr, &sw_cfg_));
+    ASSERT_TRUE(sw_->Init().ok());
+    ssw_.reset(new hap::StatelessSwitch(2, in_.get(), &ssw_cfg_));
+    ASSERT_TRUE(ssw_->Init().ok());
+    g_comps.push_back(sw_.get());
+    g_comps.push_back(ssw_.get());
+    ASSERT_TRUE(shelly_rpc_service_init(&server_, nullptr, nullptr));
+  }
+
+  void TearDown() override {
+    g_comps.clear();
+    sw_.reset();
+    ssw_.reset();
+  }
+
+  HAPAccessoryServerRef server_ = {};
+  struct mgos_config_sw sw_cfg_;
+  struct mgos_config_ssw ssw_cfg_;
+  std::unique_ptr<InputPin> in_;
+  std::unique_ptr<OutputPin> out_;
+  std::unique_ptr<ShellySwitch> sw_;
+  std::unique_ptr<hap::StatelessSwitch> ssw_;
+};
+
+TEST_F(RPCServiceTest, Handlers) {
+  EXPECT_TRUE(mock::HaveRPCHandler("Shelly.GetInfo"));
+  EXPECT_TRUE(mock::HaveRPCHandler("Shelly.SetConfig"));
+  EXPECT_TRUE(mock::HaveRPCHandler("Shelly.GetDebugInfo"));
+  EXPECT_TRUE(mock::HaveRPCHandler("Shelly.GetStats"));
+  EXPECT_TRUE(mock::HaveRPCHandler("Shelly.SetSwitch"));
+}
+
+TEST_F(RPCServiceTest, GetInfo) {
+  auto res = mock::CallRPC("Shelly.GetInfo", "{}");
+  ASSERT_TRUE(res.ok);
+  EXPECT_EQ(0u, res.result.find("{\"id\": \"shellytest-000000\", "
+                                "\"app\": \"shelly-homekit\", "
+                                "\"model\": \"ShellyTest\""))
+      << res.result;
+  EXPECT_NE(std::string::npos, res.result.find("\"hap_provisioned\": false"));
+  EXPECT_NE(std::string::npos,
+            res.result.find(", \"components\": [{\"id\": 1, \"type\": 0, "
+                            "\"name\": \"Test SW\""))
+      << res.result;
+  EXPECT_NE(std::string::npos,
+            res.result.find("}, {\"id\": 2, \"type\": 3, "
+                            "\"name\": \"Test SSW\""))
+      << res.result;
+  EXPECT_EQ("}]}", res.result.substr(res.result.size() - 3));
+}
+
+TEST_F(RPCServiceTest, SetSwitch) {
+  auto res = mock::CallRPC("Shelly.SetSwitch", "{\"id\": 1, \"state\": true}");
+  ASSERT_TRUE(res.ok) << res.error_msg;
+  EXPECT_EQ("null", res.result);
+  EXPECT_TRUE(mock::GetPin(kOutPin));
+  EXPECT_TRUE(sw_cfg_.state);
+  res = mock::CallRPC("Shelly.SetSwitch", "{\"id\": 1, \"state\": false}");
+  ASSERT_TRUE(res.ok);
+  EXPECT_FALSE(mock::GetPin(kOutPin));
+}
+
+TEST_F(RPCServiceTest, SetSwitchNotFound) {
+  // Stateless switch is not a switch.
+  auto res = mock::CallRPC("Shelly.SetSwitch", "{\"id\": 2, \"state\": true}");
+  EXPECT_FALSE(res.ok);
+  EXPECT_EQ(400, res.error_code);
+  EXPECT_EQ("component not found", res.error_msg);
+  res = mock::CallRPC("Shelly.SetSwitch", "{\"id\": 5, \"state\": true}");
+  EXPECT_FALSE(res.ok);
+  EXPECT_EQ(400, res.error_code);
+}
+
+TEST_F(RPCServiceTest, SetConfig) {
+  auto res = mock::CallRPC("Shelly.SetConfig",
+                           "{\"id\": 1, \"type\": 0, \"config\": "
+                           "{\"auto_off\": true, \"auto_off_delay\": 5}}");
+  ASSERT_TRUE(res.ok) << res.error_msg;
+  EXPECT_TRUE(sw_cfg_.auto_off);
+  EXPECT_EQ(5, sw_cfg_.auto_off_delay);
+  EXPECT_EQ(1, mock::NumConfigSaves());
+  EXPECT_EQ(0, mock::NumHAPServerRestarts());
+}
+
+TEST_F(RPCServiceTest, SetConfigRestart) {
+  auto res =
+      mock::CallRPC("Shelly.SetConfig",
+                    "{\"id\": 1, \"type\": 0, \"config\": {\"svc_type\": 2}}");
+  ASSERT_TRUE(res.ok) << res.error_msg;
+  EXPECT_EQ(2, sw_cfg_.svc_type);
+  EXPECT_EQ(1, mock::NumConfigSaves());
+  EXPECT_EQ(1, mock::NumHAPServerRestarts());
+}
+
+TEST_F(RPCServiceTest, SetConfigStatelessSwitch) {
+  auto res =
+      mock::CallRPC("Shelly.SetConfig",
+                    "{\"id\": 2, \"type\": 3, \"config\": {\"in_mode\": 1}}");
+  ASSERT_TRUE(res.ok) << res.error_msg;
+  EXPECT_EQ(1, ssw_cfg_.in_mode);
+}
+
+TEST_F(RPCServiceTest, SetConfigErrors) {
+  auto res = mock::CallRPC("Shelly.SetConfig", "{\"id\": 1, \"type\": 0}");
+  EXPECT_FALSE(res.ok);
+  EXPECT_EQ(400, res.error_code);
+  EXPECT_EQ("config is required", res.error_msg);
+  // Type must match too.
+  res = mock::CallRPC("Shelly.SetConfig",
+                      "{\"id\": 1, \"type\": 3, \"config\": {}}");
+  EXPECT_FALSE(res.ok);
+  EXPECT_EQ(400, res.error_code);
+  EXPECT_EQ("component not found", res.error_msg);
+  res =
+      mock::CallRPC("Shelly.SetConfig",
+                    "{\"id\": 1, \"type\": 0, \"config\": {\"in_mode\": 7}}");
+  EXPECT_FALSE(res.ok);
+  EXPECT_EQ(STATUS_INVALID_ARGUMENT, res.error_code);
+  EXPECT_EQ("invalid in_mode", res.error_msg);
+  EXPECT_EQ(1, sw_cfg_.in_mode);
+  EXPECT_EQ(0, mock::NumConfigSaves());
+}
+
+TEST_F(RPCServiceTest, GetDebugInfo) {
+  auto res = mock::CallRPC("Shelly.GetDebugInfo", "{}");
+  ASSERT_TRUE(res.ok);
+  EXPECT_EQ("{\"info\": \"debug info\"}", res.result);
+}
+
+}  // namespace
+}  // namespace shelly
@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2020 Deomid "rojer" Ryabkov
+ * All rights reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shelly_switch.hpp"
+
+#include <memory>
+
+#include "gtest/gtest.h"
+
+#include "mgos_mock.hpp"
+
+namespace shelly {
+namespace {
+
+constexpr int kInPin = 4;
+constexpr int kOutPin = 5;
+
+class ShellySwitchTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    mock::Reset();
+    cfg_ = {};
+    cfg_.name = "Test SW";
+    cfg_.enable = true;
+    cfg_.in_mode = static_cast<int>(ShellySwitch::InMode::kToggle);
+    cfg_.initial_state = static_cast<int>(ShellySwitch::InitialState::kOff);
+    in_.reset(new InputPin(1, kInPin, 1, MGOS_GPIO_PULL_NONE, false));
+    out_.reset(new OutputPin(1, kOutPin, 1));
+  }
+
+  void TearDown() override {
+    sw_.reset();
+  }
+
+  void CreateSwitch() {
+    sw_.reset(new ShellySwitch(1, in_.get(), out_.get(), nullptr, &cfg_));
+    ASSERT_TRUE(sw_->Init().ok());
+  }
+
+  Status SetConfig(const std::string &config_json,
+                   bool *restart_required = nullptr) {
+    bool rr = false;
+    auto st = sw_->SetConfig(config_json, &rr);
+    if (restart_required != nullptr) *restart_required = rr;
+    return st;
+  }
+
+  struct mgos_config_sw cfg_;
+  std::unique_ptr<InputPin> in_;
+  std::unique_ptr<OutputPin> out_;
+  std::unique_ptr<ShellySwitch> sw_;
+};
+
+TEST_F(ShellySwitchTest, InitialStateOff) {
+  cfg_.state = true;
+  mock::SetInput(kInPin, true);
+  CreateSwitch();
+  EXPECT_FALSE(sw_->GetState());
+  EXPECT_FALSE(mock::GetPin(kOutPin));
+  EXPECT_FALSE(cfg_.state);
+}
+
+TEST_F(ShellySwitchTest, InitialStateOn) {
+  cfg_.initial_state = static_cast<int>(ShellySwitch::InitialState::kOn);
+  CreateSwitch();
+  EXPECT_TRUE(sw_->GetState());
+  EXPECT_TRUE(mock::GetPin(kOutPin));
+  EXPECT_TRUE(cfg_.state);
+}
+
+TEST_F(ShellySwitchTest, InitialStateLast) {
+  cfg_.initial_state = static_cast<int>(ShellySwitch::InitialState::kLast);
+  cfg_.state = true;
+  CreateSwitch();
+  EXPECT_TRUE(sw_->GetState());
+  // Restoring the persisted state does not need another save.
+  EXPECT_EQ(0, mock::NumConfigSaves());
+}
+
+TEST_F(ShellySwitchTest, InitialStateInput) {
+  cfg_.initial_state = static_cast<int>(ShellySwitch::InitialState::kInput);
+  mock::SetInput(kInPin, true);
+  CreateSwitch();
+  EXPECT_TRUE(sw_->GetState());
+}
+
+TEST_F(ShellySwitchTest, InitialStateInputNotToggle) {
+  cfg_.initial_state = static_cast<int>(ShellySwitch::InitialState::kInput);
+  cfg_.in_mode = static_cast<int>(ShellySwitch::InMode::kMomentary);
+  mock::SetInput(kInPin, true);
+  CreateSwitch();
+  EXPECT_FALSE(sw_->GetState());
+}
+
+TEST_F(ShellySwitchTest, Disabled) {
+  cfg_.enable = false;
+  cfg_.initial_state = static_cast<int>(ShellySwitch::InitialState::kOn);
+  CreateSwitch();
+  EXPECT_FALSE(sw_->GetState());
+  mock::SetInput(kInPin, true);
+  EXPECT_FALSE(sw_->GetState());
+}
+
+TEST_F(ShellySwitchTest, InModeMomentary) {
+  cfg_.in_mode = static_cast<int>(ShellySwitch::InMode::kMomentary);
+  CreateSwitch();
+  mock::SetInput(kInPin, true);
+  EXPECT_TRUE(sw_->GetState());
+  mock::SetInput(kInPin, false);
+  EXPECT_TRUE(sw_->GetState());
+  mock::SetInput(kInPin, true);
+  EXPECT_FALSE(sw_->GetState());
+  mock::SetInput(kInPin, false);
+  EXPECT_FALSE(sw_->GetState());
+}
+
+TEST_F(ShellySwitchTest, InModeToggle) {
+  CreateSwitch();
+  mock::SetInput(kInPin, true);
+  EXPECT_TRUE(sw_->GetState());
+  mock::SetInput(kInPin, false);
+  EXPECT_FALSE(sw_->GetState());
+  // Switched by other means, input takes over on the next change.
+  sw_->SetState(true, "HAP");
+  mock::SetInput(kInPin, true);
+  EXPECT_TRUE(sw_->GetState());
+  mock::SetInput(kInPin, false);
+  EXPECT_FALSE(sw_->GetState());
+}
+
+TEST_F(ShellySwitchTest, InModeEdge) {
+  cfg_.in_mode = static_cast<int>(ShellySwitch::InMode::kEdge);
+  CreateSwitch();
+  mock::SetInput(kInPin, true);
+  EXPECT_TRUE(sw_->GetState());
+  mock::SetInput(kInPin, false);
+  EXPECT_FALSE(sw_->GetState());
+  mock::SetInput(kInPin, true);
+  EXPECT_TRUE(sw_->GetState());
+}
+
+TEST_F(ShellySwitchTest, InModeDetached) {
+  cfg_.in_mode = static_cast<int>(ShellySwitch::InMode::kDetached);
+  CreateSwitch();
+  mock::SetInput(kInPin, true);
+  EXPECT_FALSE(sw_->GetState());
+  mock::SetInput(kInPin, false);
+  EXPECT_FALSE(sw_->GetState());
+}
+
+TEST_F(ShellySwitchTest, StateIsPersisted) {
+  CreateSwitch();
+  sw_->SetState(true, "HAP");
+  EXPECT_TRUE(cfg_.state);
+  EXPECT_EQ(1, mock::NumConfigSaves());
+  // No change, nothing to save.
+  sw_->SetState(true, "HAP");
+  EXPECT_EQ(1, mock::NumConfigSaves());
+  sw_->SetState(false, "web");
+  EXPECT_FALSE(cfg_.state);
+  EXPECT_EQ(2, mock::NumConfigSaves());
+}
+
+TEST_F(ShellySwitchTest, AutoOff) {
+  cfg_.auto_off = true;
+  cfg_.auto_off_delay = 1.5;
+  CreateSwitch();
+  sw_->SetState(true, "HAP");
+  mock::AdvanceTimeMs(1499);
+  EXPECT_TRUE(sw_->GetState());
+  mock::AdvanceTimeMs(1);
+  EXPECT_FALSE(sw_->GetState());
+  EXPECT_FALSE(cfg_.state);
+  EXPECT_EQ(0, mock::NumTimers());
+}
+
+TEST_F(ShellySwitchTest, AutoOffRestartedByLastChange) {
+  cfg_.auto_off = true;
+  cfg_.auto_off_delay = 1;
+  CreateSwitch();
+  sw_->SetState(true, "HAP");
+  mock::AdvanceTimeMs(800);
+  sw_->SetState(false, "HAP");
+  sw_->SetState(true, "HAP");
+  EXPECT_EQ(1, mock::NumTimers());
+  mock::AdvanceTimeMs(800);
+  EXPECT_TRUE(sw_->GetState());
+  mock::AdvanceTimeMs(200);
+  EXPECT_FALSE(sw_->GetState());
+}
+
+TEST_F(ShellySwitchTest, AutoOffCancelledByOff) {
+  cfg_.auto_off = true;
+  cfg_.auto_off_delay = 1;
+  CreateSwitch();
+  sw_->SetState(true, "HAP");
+  sw_->SetState(false, "HAP");
+  EXPECT_EQ(0, mock::NumTimers());
+}
+
+TEST_F(ShellySwitchTest, AutoOffDisabledWhileRunning) {
+  cfg_.auto_off = true;
+  cfg_.auto_off_delay = 1;
+  CreateSwitch();
+  sw_->SetState(true, "HAP");
+  ASSERT_TRUE(SetConfig("{\"auto_off\": false}").ok());
+  mock::AdvanceTimeMs(2000);
+  EXPECT_TRUE(sw_->GetState());
+}
+
+TEST_F(ShellySwitchTest, AutoOffAppliesToInitialState) {
+  cfg_.initial_state = static_cast<int>(ShellySwitch::InitialState::kOn);
+  cfg_.auto_off = true;
+  cfg_.auto_off_delay = 1;
+  CreateSwitch();
+  EXPECT_TRUE(sw_->GetState());
+  mock::AdvanceTimeMs(1000);
+  EXPECT_FALSE(sw_->GetState());
+}
+
+TEST_F(ShellySwitchTest, AutoOffFromInput) {
+  cfg_.in_mode = static_cast<int>(ShellySwitch::InMode::kMomentary);
+  cfg_.auto_off = true;
+  cfg_.auto_off_delay = 2;
+  CreateSwitch();
+  mock::SetInput(kInPin, true);
+  mock::SetInput(kInPin, false);
+  EXPECT_TRUE(sw_->GetState());
+  mock::AdvanceTimeMs(2000);
+  EXPECT_FALSE(sw_->GetState());
+}
+
+TEST_F(ShellySwitchTest, DestroyClearsTimers) {
+  cfg_.auto_off = true;
+  cfg_.auto_off_delay = 1;
+  CreateSwitch();
+  sw_->SetState(true, "HAP");
+  sw_.reset();
+  EXPECT_EQ(0, mock::NumTimers());
+  // Input no longer drives the output.
+  mock::SetInput(kInPin, true);
+  mock::SetInput(kInPin, false);
+  EXPECT_TRUE(mock::GetPin(kOutPin));
+}
+
+TEST_F(ShellySwitchTest, GetInfo) {
+  cfg_.auto_off_delay = 2.5;
+  CreateSwitch();
+  sw_->SetState(true, "HAP");
+  auto info = sw_->GetInfo();
+  ASSERT_TRUE(info.ok());
+  EXPECT_EQ(
+      "{\"id\": 1, \"type\": 0, \"name\": \"Test SW\", \"svc_type\": 0, "
+      "\"in_mode\": 1, \"initial\": 0, \"state\": true, \"auto_off\": false, "
+      "\"auto_off_delay\": 2.500, \"group\": 0}",
+      info.ValueOrDie());
+}
+
+TEST_F(ShellySwitchTest, SetConfig) {
+  CreateSwitch();
+  bool restart_required = true;
+  ASSERT_TRUE(SetConfig("{\"name\": \"Test SW\", \"svc_type\": 0, "
+                        "\"in_mode\": 2, \"initial_state\": 1, "
+                        "\"auto_off\": true, \"auto_off_delay\": 10.5}",
+                        &restart_required)
+                  .ok());
+  EXPECT_FALSE(restart_required);
+  EXPECT_EQ(2, cfg_.in_mode);
+  EXPECT_EQ(1, cfg_.initial_state);
+  EXPECT_TRUE(cfg_.auto_off);
+  EXPECT_EQ(10.5, cfg_.auto_off_delay);
+}
+
+TEST_F(ShellySwitchTest, SetConfigRestartRequired) {
+  CreateSwitch();
+  bool restart_required = false;
+  ASSERT_TRUE(SetConfig("{\"name\": \"New name\"}", &restart_required).ok());
+  EXPECT_TRUE(restart_required);
+  EXPECT_STREQ("New name", cfg_.name);
+  ASSERT_TRUE(SetConfig("{\"svc_type\": 1}", &restart_required).ok());
+  EXPECT_TRUE(restart_required);
+  EXPECT_EQ(1, cfg_.svc_type);
+  ASSERT_TRUE(SetConfig("{\"in_mode\": 0}", &restart_required).ok());
+  EXPECT_FALSE(restart_required);
+  // To and from detached the service changes.
+  ASSERT_TRUE(SetConfig("{\"in_mode\": 3}", &restart_required).ok());
+  EXPECT_TRUE(restart_required);
+  ASSERT_TRUE(SetConfig("{\"in_mode\": 1}", &restart_required).ok());
+  EXPECT_TRUE(restart_required);
+  mgos_conf_set_str(&cfg_.name, nullptr);
+}
+
+TEST_F(ShellySwitchTest, SetConfigValidation) {
+  CreateSwitch();
+  const char *invalid[] = {
+      "{\"svc_type\": -2}",
+      "{\"svc_type\": 3}",
+      "{\"in_mode\": -1}",
+      "{\"in_mode\": 4}",
+      "{\"initial_state\": -1}",
+      "{\"initial_state\": 4}",
+      "{\"name\": \"0123456789012345678901234567890123456789012345678901234567"
+      "890123456789\"}",
+  };
+  for (const char *config : invalid) {
+    auto st = SetConfig(config);
+    EXPECT_FALSE(st.ok()) << config;
+    EXPECT_EQ(STATUS_INVALID_ARGUMENT, st.error_code()) << config;
+  }
+  // Nothing has been applied.
+  EXPECT_STREQ("Test SW", cfg_.name);
+  EXPECT_EQ(0, cfg_.svc_type);
+  EXPECT_EQ(1, cfg_.in_mode);
+  EXPECT_EQ(0, cfg_.initial_state);
+}
+
+class ShellySwitchGroupTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    mock::Reset();
+    for (int i = 0; i < 2; i++) {
+      cfgs_[i] = {};
+      cfgs_[i].name = "Member";
+      cfgs_[i].enable = true;
+      cfgs_[i].in_mode = static_cast<int>(ShellySwitch::InMode::kToggle);
+      outs_[i].reset(new OutputPin(i + 1, kOutPin + i, 1));
+    }
+    gcfg_ = cfgs_[0];
+    gcfg_.name = "Group";
+    gcfg_.in_mode = static_cast<int>(ShellySwitch::InMode::kDetached);
+    gcfg_.initial_state = static_cast<int>(ShellySwitch::InitialState::kOn);
+    group_.reset(new OutputGroup(3, {outs_[0].get(), outs_[1].get()}));
+  }
+
+  void TearDown() override {
+    gsw_.reset();
+    for (auto &sw : sws_) sw.reset();
+  }
+
+  void CreateSwitches() {
+    for (int i = 0; i < 2; i++) {
+      sws_[i].reset(
+          new ShellySwitch(i + 1, nullptr, outs_[i].get(), nullptr, &cfgs_[i]));
+      ASSERT_TRUE(sws_[i]->Init().ok());
+    }
+    gsw_.reset(new ShellySwitch(3, nullptr, group_.get(), nullptr, &gcfg_));
+    ASSERT_TRUE(gsw_->Init().ok());
+  }
+
+  struct mgos_config_sw cfgs_[2];
+  struct mgos_config_sw gcfg_;
+  std::unique_ptr<OutputPin> outs_[2];
+  std::unique_ptr<OutputGroup> group_;
+  std::unique_ptr<ShellySwitch> sws_[2];
+  std::unique_ptr<ShellySwitch> gsw_;
+};
+
+TEST_F(ShellySwitchGroupTest, MembersInitialStatePrevails) {
+  cfgs_[1].initial_state = static_cast<int>(ShellySwitch::InitialState::kOn);
+  CreateSwitches();
+  EXPECT_FALSE(sws_[0]->GetState());
+  EXPECT_TRUE(sws_[1]->GetState());
+  EXPECT_FALSE(gsw_->GetState());
+  EXPECT_FALSE(gcfg_.state);
+}
+
+TEST_F(ShellySwitchGroupTest, SwitchGroup) {
+  CreateSwitches();
+  int saves = mock::NumConfigSaves();
+  gsw_->SetState(true, "HAP");
+  EXPECT_TRUE(mock::GetPin(kOutPin));
+  EXPECT_TRUE(mock::GetPin(kOutPin + 1));
+  EXPECT_TRUE(cfgs_[0].state);
+  EXPECT_TRUE(cfgs_[1].state);
+  EXPECT_TRUE(gcfg_.state);
+  // Group and members are persisted together.
+  EXPECT_EQ(saves + 1, mock::NumConfigSaves());
+}
+
+TEST_F(ShellySwitchGroupTest, SwitchMember) {
+  CreateSwitches();
+  gsw_->SetState(true, "HAP");
+  sws_[0]->SetState(false, "HAP");
+  EXPECT_FALSE(gsw_->GetState());
+  EXPECT_FALSE(gcfg_.state);
+  sws_[0]->SetState(true, "HAP");
+  EXPECT_TRUE(gsw_->GetState());
+  EXPECT_TRUE(gcfg_.state);
+}
+
+TEST_F(ShellySwitchGroupTest, MemberAutoOffViaGroup) {
+  cfgs_[1].auto_off = true;
+  cfgs_[1].auto_off_delay = 1;
+  CreateSwitches();
+  gsw_->SetState(true, "HAP");
+  mock::AdvanceTimeMs(1000);
+  EXPECT_TRUE(sws_[0]->GetState());
+  EXPECT_FALSE(sws_[1]->GetState());
+  EXPECT_FALSE(gsw_->GetState());
+  EXPECT_FALSE(gcfg_.state);
+}
+
+TEST_F(ShellySwitchGroupTest, DetachedNotSupported) {
+  CreateSwitches();
+  bool restart_required = false;
+  gcfg_.in_mode = static_cast<int>(ShellySwitch::InMode::kToggle);
+  auto st = gsw_->SetConfig("{\"in_mode\": 3}", &restart_required);
+  EXPECT_EQ(STATUS_INVALID_ARGUMENT, st.error_code());
+  // Members can be detached.
+  st = sws_[0]->SetConfig("{\"in_mode\": 3}", &restart_required);
+  EXPECT_TRUE(st.ok());
+}
+
+}  // namespace
+}  // namespace shelly
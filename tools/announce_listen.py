@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+#
+#  Copyright (c) 2020 Deomid "rojer" Ryabkov
+#  All rights reserved
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+#  Listens for status announcements (announce.*) from devices and decodes
+#  them. One listener monitors all the devices on the network, packets lost
+#  are detected from sequence numbers.
+#
+#  Packet format, all integers are big-endian:
+#     0  'S' 'A'
+#     2  version (1)
+#     3  flags: bit 0 - sent because of a change
+#     4  seq (4 bytes)
+#     8  uptime, seconds (4 bytes)
+#    12  id_len, device id (id_len bytes)
+#  followed by records: type, component id, value length, value.
+#  Records with unknown types are skipped.
+#
+#  Example:
+#    tools/announce_listen.py
+#    tools/announce_listen.py --json > status.jsonl
+
+import argparse
+import json
+import socket
+import struct
+import sys
+import time
+
+EVENTS = ("change", "single", "double", "long", "reset")
+
+
+def decode(data):
+    """Returns decoded announcement as a dict, raises ValueError if invalid."""
+    if len(data) < 13 or data[:2] != b"SA":
+        raise ValueError("bad magic")
+    if data[2] != 1:
+        raise ValueError("unsupported version %d" % data[2])
+    flags, seq, uptime, id_len = struct.unpack(">BIIB", data[3:13])
+    dev_id = data[13:13 + id_len].decode("utf-8", "replace")
+    res = {"id": dev_id, "seq": seq, "uptime": uptime,
+           "changed": bool(flags & 1), "outputs": {}, "inputs": {},
+           "events": {}, "power": {}, "energy": {}}
+    i = 13 + id_len
+    while i + 3 <= len(data):
+        rtype, cid, vlen = data[i], data[i + 1], data[i + 2]
+        v = data[i + 3:i + 3 + vlen]
+        i += 3 + vlen
+        if len(v) != vlen:
+            raise ValueError("truncated record")
+        if rtype == 1 and vlen == 1:
+            res["outputs"][cid] = bool(v[0])
+        elif rtype == 2 and vlen == 1:
+            res["inputs"][cid] = bool(v[0])
+        elif rtype == 3 and vlen == 3:
+            ev, count = struct.unpack(">BH", v)
+            res["events"][cid] = {
+                "ev": EVENTS[ev] if ev < len(EVENTS) else ev, "count": count}
+        elif rtype == 4 and vlen == 4:
+            res["power"][cid] = round(struct.unpack(">f", v)[0], 3)
+        elif rtype == 5 and vlen == 4:
+            res["energy"][cid] = round(struct.unpack(">f", v)[0], 3)
+        elif rtype == 6 and vlen == 4:
+            res["free_heap"] = struct.unpack(">I", v)[0]
+    return res
+
+
+def format_status(st):
+    parts = ["%-20s" % st["id"], "%6d" % st["seq"],
+             "chg" if st["changed"] else "per"]
+    for cid, s in sorted(st["outputs"].items()):
+        parts.append("out%d=%s" % (cid, "on" if s else "off"))
+    for cid, s in sorted(st["inputs"].items()):
+        parts.append("in%d=%d" % (cid, s))
+    for cid, e in sorted(st["events"].items()):
+        parts.append("ev%d=%s#%d" % (cid, e["ev"], e["count"]))
+    for cid, p in sorted(st["power"].items()):
+        parts.append("pm%d=%.1fW/%.1fWh" % (cid, p,
+                                            st["energy"].get(cid, 0)))
+    if "free_heap" in st:
+        parts.append("heap=%d" % st["free_heap"])
+    return " ".join(parts)
+
+
+class Tracker(object):
+    """Keeps track of devices, detects lost packets and missed events."""
+
+    def __init__(self):
+        self.devs = {}
+
+    def update(self, st):
+        """Returns a list of warnings."""
+        warnings = []
+        prev = self.devs.get(st["id"])
+        self.devs[st["id"]] = st
+        if prev is None:
+            return warnings
+        if st["uptime"] < prev["uptime"]:
+            warnings.append("rebooted")
+            return warnings
+        lost = st["seq"] - prev["seq"] - 1
+        if lost > 0:
+            warnings.append("%d packets lost" % lost)
+        for cid, e in st["events"].items():
+            pe = prev["events"].get(cid)
+            if pe and (e["count"] - pe["count"]) % 65536 > 1:
+                warnings.append("input %d: %d events missed" % (
+                    cid, (e["count"] - pe["count"]) % 65536 - 1))
+        return warnings
+
+
+def main():
+    p = argparse.ArgumentParser(description="Status announcement listener")
+    p.add_argument("--group", default="239.255.42.42",
+                   help="Multicast group to join, empty for unicast only")
+    p.add_argument("--port", type=int, default=4220)
+    p.add_argument("--iface", default="0.0.0.0",
+                   help="Address of the interface to join the group on")
+    p.add_argument("--json", action="store_true",
+                   help="Print decoded packets as JSON, one per line")
+    args = p.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", args.port))
+    if args.group:
+        mreq = socket.inet_aton(args.group) + socket.inet_aton(args.iface)
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, mreq)
+
+    tracker = Tracker()
+    while True:
+        try:
+            data, addr = sock.recvfrom(1500)
+        except KeyboardInterrupt:
+            break
+        try:
+            st = decode(data)
+        except (ValueError, struct.error) as e:
+            print("%s: invalid packet: %s" % (addr[0], e), file=sys.stderr)
+            continue
+        st["addr"] = addr[0]
+        warnings = tracker.update(st)
+        if args.json:
+            st["ts"] = round(time.time(), 3)
+            if warnings:
+                st["warnings"] = warnings
+            print(json.dumps(st), flush=True)
+        else:
+            print("%s %-15s %s%s" % (
+                time.strftime("%H:%M:%S"), addr[0], format_status(st),
+                "".join(" [%s]" % w for w in warnings)), flush=True)
+    print("%d devices seen" % len(tracker.devs), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
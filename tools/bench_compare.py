@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+#
+#  Copyright (c) 2020 Deomid "rojer" Ryabkov
+#  All rights reserved
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+#  Compares two Shelly.RunBench results.
+#
+#  Example:
+#    curl -d '{"iters": 10000}' http://127.0.0.1/rpc/Shelly.RunBench > new.json
+#    tools/bench_compare.py old.json new.json --threshold 10
+
+import argparse
+import json
+import sys
+
+
+def main():
+    p = argparse.ArgumentParser(description="Compare microbenchmark results")
+    p.add_argument("base")
+    p.add_argument("new")
+    p.add_argument("--threshold", type=float, default=0,
+                   help="Fail if any benchmark is slower by more than this "
+                   "many percent, 0 - don't fail")
+    args = p.parse_args()
+    with open(args.base) as f:
+        base = json.load(f)
+    with open(args.new) as f:
+        new = json.load(f)
+    print("%-20s %12s %12s %8s" % ("", "base ns", "new ns", "change"))
+    failed = []
+    for name, r in sorted(new["results"].items()):
+        b = base["results"].get(name)
+        if b is None:
+            print("%-20s %12s %12d %8s" % (name, "-", r["ns_per_iter"], "new"))
+            continue
+        change = ((r["ns_per_iter"] - b["ns_per_iter"]) * 100.0 /
+                  max(b["ns_per_iter"], 1))
+        print("%-20s %12d %12d %+7.1f%%" % (name, b["ns_per_iter"],
+                                            r["ns_per_iter"], change))
+        if args.threshold > 0 and change > args.threshold:
+            failed.append(name)
+    if failed:
+        print("Regressions: %s" % ", ".join(failed))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,327 @@
+#!/usr/bin/env python3
+#
+#  Copyright (c) 2020 Deomid "rojer" Ryabkov
+#  All rights reserved
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+#  Fleet management: query, configure and update many devices concurrently.
+#
+#  Devices are taken from an inventory file (one host[:port] per line),
+#  the command line, a port range (for ShellyU instances started by
+#  fleet_sim.py) or discovered via mDNS. Progress is recorded in a state
+#  file, so an interrupted rollout can be resumed: devices that already
+#  completed the same operation are skipped.
+#
+#  Examples:
+#    tools/fleet.py --discover info
+#    tools/fleet.py --inventory devices.txt --state rollout.json \
+#        ota --url http://server/shelly-homekit-Shelly1.zip --version 2.3.0
+#    tools/fleet.py --range 127.0.0.1:8101-8200 --parallel 32 \
+#        config --id 1 --type 0 --set '{"auto_off": true}'
+
+import argparse
+import concurrent.futures
+import hashlib
+import json
+import os
+import shutil
+import subprocess
+import sys
+import threading
+import time
+import urllib.error
+import urllib.request
+
+
+def rpc_call(host, port, method, args=None, timeout=10):
+    url = "http://%s:%d/rpc/%s" % (host, port, method)
+    data = json.dumps(args).encode() if args is not None else None
+    req = urllib.request.Request(url, data=data)
+    with urllib.request.urlopen(req, timeout=timeout) as f:
+        return json.loads(f.read() or b"null")
+
+
+def discover(timeout):
+    """Finds devices announcing _http._tcp via mDNS."""
+    hosts = set()
+    if shutil.which("avahi-browse"):
+        try:
+            out = subprocess.run(
+                ["avahi-browse", "-p", "-r", "-t", "-d", "local", "_http._tcp"],
+                stdout=subprocess.PIPE, universal_newlines=True,
+                timeout=timeout + 5).stdout
+        except subprocess.TimeoutExpired:
+            out = ""
+        for line in out.splitlines():
+            # =;iface;proto;name;type;domain;host;addr;port;txt
+            parts = line.split(";")
+            if parts[0] == "=" and len(parts) > 8 and parts[2] == "IPv4":
+                if "shelly" in parts[3].lower():
+                    hosts.add("%s:%s" % (parts[7], parts[8]))
+    elif shutil.which("dns-sd"):
+        try:
+            out = subprocess.run(["dns-sd", "-B", "_http", "."],
+                                 stdout=subprocess.PIPE,
+                                 universal_newlines=True,
+                                 timeout=timeout).stdout
+        except subprocess.TimeoutExpired as e:
+            out = (e.stdout or b"").decode(errors="replace")
+        for line in out.splitlines():
+            parts = line.split()
+            if len(parts) >= 7 and "shelly" in parts[6].lower():
+                hosts.add("%s.local" % parts[6])
+    else:
+        sys.exit("Neither avahi-browse nor dns-sd is available")
+    return sorted(hosts)
+
+
+def load_devices(args):
+    devs = list(args.hosts)
+    if args.inventory:
+        with open(args.inventory) as f:
+            for line in f:
+                line = line.split("#")[0].strip()
+                if line:
+                    devs.append(line)
+    if args.range:
+        host, ports = args.range.rsplit(":", 1)
+        first, last = (int(p) for p in ports.split("-"))
+        devs += ["%s:%d" % (host, p) for p in range(first, last + 1)]
+    if args.discover:
+        devs += discover(args.discover_timeout)
+    res = []
+    for d in devs:
+        if d not in res:
+            res.append(d)
+    return res
+
+
+def split_host(dev):
+    if ":" in dev:
+        host, port = dev.rsplit(":", 1)
+        return host, int(port)
+    return dev, 80
+
+
+class Fleet(object):
+
+    def __init__(self, args, op_key):
+        self.args = args
+        self.op_key = op_key
+        self.lock = threading.Lock()
+        self.state = {}
+        if args.state and os.path.exists(args.state):
+            with open(args.state) as f:
+                self.state = json.load(f)
+
+    def save_state(self):
+        if not self.args.state:
+            return
+        tmp = self.args.state + ".tmp"
+        with open(tmp, "w") as f:
+            json.dump(self.state, f, indent=1, sort_keys=True)
+        os.replace(tmp, self.args.state)
+
+    def record(self, dev, status, result):
+        with self.lock:
+            st = self.state.setdefault(dev, {})
+            st.update(op=self.op_key, status=status, result=result,
+                      time=int(time.time()))
+            self.save_state()
+
+    def done(self, dev):
+        st = self.state.get(dev, {})
+        return (st.get("op") == self.op_key and
+                st.get("status") in ("ok", "unchanged"))
+
+    def rpc(self, dev, method, params=None, timeout=None):
+        host, port = split_host(dev)
+        return rpc_call(host, port, method, params,
+                        timeout=timeout or self.args.timeout)
+
+    def run_one(self, dev, fn):
+        if self.done(dev) and not self.args.force:
+            return dev, "skipped", self.state[dev].get("result")
+        err = None
+        for attempt in range(self.args.retries + 1):
+            if attempt > 0:
+                time.sleep(min(self.args.retry_delay * 2 ** (attempt - 1), 60))
+            try:
+                status, result = fn(dev)
+                self.record(dev, status, result)
+                return dev, status, result
+            except (OSError, ValueError, KeyError, RuntimeError) as e:
+                if isinstance(e, urllib.error.HTTPError):
+                    err = "HTTP %d: %s" % (e.code, e.read().decode(
+                        errors="replace").strip())
+                else:
+                    err = str(e) or type(e).__name__
+        self.record(dev, "failed", err)
+        return dev, "failed", err
+
+    def run(self, devs, fn):
+        results = []
+        with concurrent.futures.ThreadPoolExecutor(self.args.parallel) as ex:
+            futs = [ex.submit(self.run_one, d, fn) for d in devs]
+            for f in concurrent.futures.as_completed(futs):
+                dev, status, result = f.result()
+                results.append((dev, status, result))
+                if self.args.verbose or status == "failed":
+                    print("%-24s %-9s %s" % (dev, status, fmt_result(result)))
+        return results
+
+
+def fmt_result(r):
+    if isinstance(r, dict):
+        return ", ".join("%s: %s" % (k, v) for k, v in sorted(r.items()))
+    return str(r)
+
+
+def op_info(fleet, dev):
+    info = fleet.rpc(dev, "Shelly.GetInfo")
+    return "ok", {"id": info.get("id"), "model": info.get("model"),
+                  "version": info.get("version"),
+                  "uptime": info.get("uptime"),
+                  "hap_paired": info.get("hap_paired")}
+
+
+def make_op_config(args):
+    cfg = json.loads(args.set)
+
+    def op(fleet, dev):
+        info = fleet.rpc(dev, "Shelly.GetInfo")
+        comp = None
+        for c in info.get("components", []):
+            if c["id"] == args.id and c["type"] == args.type:
+                comp = c
+        if comp is None:
+            raise RuntimeError("component %d/%d not found" % (args.id,
+                                                              args.type))
+        if all(comp.get(k) == v for k, v in cfg.items()):
+            return "unchanged", None
+        fleet.rpc(dev, "Shelly.SetConfig",
+                  {"id": args.id, "type": args.type, "config": cfg})
+        return "ok", None
+
+    return op
+
+
+def make_op_ota(args):
+
+    def op(fleet, dev):
+        info = fleet.rpc(dev, "Shelly.GetInfo")
+        if args.version and info.get("version") == args.version:
+            return "unchanged", {"version": info.get("version")}
+        if args.model and info.get("model") != args.model:
+            return "unchanged", {"model": info.get("model")}
+        old_build = info.get("fw_build")
+        # The device downloads and applies the update, then reboots.
+        fleet.rpc(dev, "OTA.Update", {"url": args.url, "commit_timeout": 0},
+                  timeout=args.ota_timeout)
+        deadline = time.monotonic() + args.ota_timeout
+        while time.monotonic() < deadline:
+            time.sleep(5)
+            try:
+                info = fleet.rpc(dev, "Shelly.GetInfo")
+            except OSError:
+                continue  # Rebooting.
+            if info.get("fw_build") != old_build:
+                if args.version and info.get("version") != args.version:
+                    raise RuntimeError("version %s after update" %
+                                       info.get("version"))
+                return "ok", {"version": info.get("version")}
+        raise RuntimeError("device did not come back with new firmware")
+
+    return op
+
+
+def main():
+    p = argparse.ArgumentParser(description="Shelly HomeKit fleet tool")
+    p.add_argument("hosts", nargs="*", help="host[:port]")
+    p.add_argument("--inventory", help="File with one host[:port] per line")
+    p.add_argument("--range", help="host:first-last port range, "
+                   "e.g. 127.0.0.1:8101-8200")
+    p.add_argument("--discover", action="store_true",
+                   help="Discover devices via mDNS")
+    p.add_argument("--discover-timeout", type=float, default=5)
+    p.add_argument("--parallel", type=int, default=16)
+    p.add_argument("--retries", type=int, default=3)
+    p.add_argument("--retry-delay", type=float, default=2)
+    p.add_argument("--timeout", type=float, default=10, help="RPC timeout")
+    p.add_argument("--state", help="Progress file, allows resuming")
+    p.add_argument("--force", action="store_true",
+                   help="Do not skip devices already done")
+    p.add_argument("--report", help="Save the summary report to this file")
+    p.add_argument("-v", "--verbose", action="store_true")
+    sp = p.add_subparsers(dest="cmd")
+    sp.required = True
+    sp.add_parser("info", help="Query device info")
+    pc = sp.add_parser("config", help="Set component config")
+    pc.add_argument("--id", type=int, required=True)
+    pc.add_argument("--type", type=int, required=True)
+    pc.add_argument("--set", required=True, help="Config JSON")
+    po = sp.add_parser("ota", help="Update firmware")
+    po.add_argument("--url", required=True)
+    po.add_argument("--version", help="Skip devices already on this "
+                    "version and verify it after the update")
+    po.add_argument("--model", help="Only update devices of this model")
+    po.add_argument("--ota-timeout", type=float, default=300)
+    args = p.parse_args()
+
+    devs = load_devices(args)
+    if not devs:
+        p.error("no devices")
+
+    if args.cmd == "info":
+        fn = op_info
+        key = "info"
+    elif args.cmd == "config":
+        fn = make_op_config(args)
+        key = "config %d %d %s" % (args.id, args.type, args.set)
+    else:
+        fn = make_op_ota(args)
+        key = "ota %s" % args.url
+    op_key = hashlib.sha1(key.encode()).hexdigest()[:12]
+    if args.cmd == "info":
+        # Info is never "done", always query.
+        args.force = True
+
+    fleet = Fleet(args, op_key)
+    start = time.monotonic()
+    results = fleet.run(devs, lambda dev: fn(fleet, dev))
+    elapsed = time.monotonic() - start
+
+    if args.cmd == "info":
+        for dev, status, r in sorted(results):
+            if status == "ok":
+                print("%-24s %s" % (dev, fmt_result(r)))
+    counts = {}
+    for _, status, _ in results:
+        counts[status] = counts.get(status, 0) + 1
+    print("%d devices in %.1fs: %s" % (
+        len(results), elapsed,
+        ", ".join("%s %d" % kv for kv in sorted(counts.items()))))
+    failed = sorted((d, r) for d, s, r in results if s == "failed")
+    if args.report:
+        with open(args.report, "w") as f:
+            json.dump({"op": key, "elapsed": elapsed, "counts": counts,
+                       "results": {d: {"status": s, "result": r}
+                                   for d, s, r in results}},
+                      f, indent=1, sort_keys=True)
+    if failed:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
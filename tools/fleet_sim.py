@@ -0,0 +1,254 @@
+#!/usr/bin/env python3
+#
+#  Copyright (c) 2020 Deomid "rojer" Ryabkov
+#  All rights reserved
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+#  Simulates a fleet of devices on one host using ShellyU.
+#
+#  Each virtual device is a ShellyU process with its own working directory
+#  (config, KVS), device id, mDNS host name, RPC port and HAP port. Read-only
+#  files are shared via symlinks and the executable is shared by all
+#  processes, so per-device overhead is the private memory of the process,
+#  which is measured and reported.
+#
+#  Example:
+#    make ShellyUFleet
+#    tools/fleet_sim.py --elf build_ShellyUFleet/objs/shelly-homekit.elf \
+#        --fs-dir build_ShellyUFleet/objs/fs --num 100 --code 111-22-333
+
+import argparse
+import concurrent.futures
+import json
+import os
+import shutil
+import signal
+import subprocess
+import sys
+import time
+
+from hap_client import rpc_call
+
+
+def proc_mem_kb(pid):
+    """Returns {Rss, Pss, Private} in KB from smaps_rollup."""
+    res = {"Rss": 0, "Pss": 0, "Private": 0}
+    try:
+        with open("/proc/%d/smaps_rollup" % pid) as f:
+            for line in f:
+                parts = line.split()
+                key = parts[0].rstrip(":")
+                if key in ("Rss", "Pss"):
+                    res[key] = int(parts[1])
+                elif key in ("Private_Clean", "Private_Dirty"):
+                    res["Private"] += int(parts[1])
+    except OSError:
+        pass
+    return res
+
+
+class Device(object):
+
+    def __init__(self, args, idx):
+        self.idx = idx
+        self.id = "%s-%04X" % (args.id_prefix, idx)
+        self.port = args.base_port + idx
+        self.dir = os.path.join(args.work_dir, self.id)
+        self.proc = None
+        self.log = None
+        self.info = None
+
+    def setup(self, args):
+        os.makedirs(self.dir, exist_ok=True)
+        for f in os.listdir(args.fs_dir):
+            dst = os.path.join(self.dir, f)
+            # Device-specific files are created by the firmware.
+            if f in ("conf9.json", "kvs.json") or os.path.lexists(dst):
+                continue
+            os.symlink(os.path.abspath(os.path.join(args.fs_dir, f)), dst)
+        conf = {
+            "device": {"id": self.id},
+            "dns_sd": {"host_name": self.id.lower()},
+            "http": {"listen_addr": str(self.port)},
+        }
+        if args.bind_base_port:
+            conf["bind"] = {"port": args.bind_base_port + self.idx}
+        for k, v in args.conf.items():
+            conf.setdefault(k, {}).update(v)
+        conf_file = os.path.join(self.dir, "conf9.json")
+        if not os.path.exists(conf_file) or args.reset:
+            with open(conf_file, "w") as f:
+                json.dump(conf, f)
+            if args.reset and os.path.exists(os.path.join(self.dir,
+                                                          "kvs.json")):
+                os.unlink(os.path.join(self.dir, "kvs.json"))
+
+    def start(self, args):
+        self.log = open(os.path.join(self.dir, "log.txt"), "w")
+        self.proc = subprocess.Popen([os.path.abspath(args.elf)],
+                                     cwd=self.dir, stdout=self.log,
+                                     stderr=subprocess.STDOUT,
+                                     start_new_session=True)
+
+    def stop(self):
+        if self.proc is None:
+            return
+        if self.proc.poll() is None:
+            os.killpg(self.proc.pid, signal.SIGTERM)
+            try:
+                self.proc.wait(10)
+            except subprocess.TimeoutExpired:
+                os.killpg(self.proc.pid, signal.SIGKILL)
+                self.proc.wait()
+        self.log.close()
+
+    def rpc(self, method, params=None):
+        return rpc_call("127.0.0.1", self.port, method, params)
+
+    def wait_up(self, timeout):
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            if self.proc.poll() is not None:
+                return False
+            try:
+                self.info = self.rpc("Shelly.GetInfo")
+                return True
+            except OSError:
+                time.sleep(0.5)
+        return False
+
+
+def report(devs, baseline_kb):
+    mem = [proc_mem_kb(d.proc.pid) for d in devs
+           if d.proc is not None and d.proc.poll() is None]
+    if not mem:
+        print("No devices running")
+        return {}
+    priv = sorted(m["Private"] for m in mem)
+    heap = []
+    for d in devs:
+        try:
+            info = d.rpc("Shelly.GetInfo")
+            heap.append(info["ram_size"] - info["ram_free"])
+        except (OSError, ValueError, KeyError):
+            pass
+    res = {
+        "num_running": len(mem),
+        "pss_total_kb": sum(m["Pss"] for m in mem),
+        "private_avg_kb": sum(priv) / len(priv),
+        "private_max_kb": priv[-1],
+        "heap_used_avg": sum(heap) / len(heap) if heap else 0,
+    }
+    print("%d devices running, total PSS %d KB, private per device "
+          "avg %.0f max %d KB, heap used avg %.0f B" % (
+              res["num_running"], res["pss_total_kb"],
+              res["private_avg_kb"], res["private_max_kb"],
+              res["heap_used_avg"]))
+    if baseline_kb:
+        print("  overhead per additional device %.0f KB" % (
+            (res["pss_total_kb"] - baseline_kb) / max(len(mem) - 1, 1)))
+    return res
+
+
+def main():
+    p = argparse.ArgumentParser(description="ShellyU fleet simulator")
+    p.add_argument("--elf", required=True, help="ShellyU executable")
+    p.add_argument("--fs-dir", help="Directory with the filesystem files, "
+                   "defaults to fs next to the executable")
+    p.add_argument("--num", type=int, default=10)
+    p.add_argument("--base-port", type=int, default=8100,
+                   help="RPC port of the first device, HAP ports are "
+                   "assigned dynamically")
+    p.add_argument("--work-dir", default="/tmp/shelly_fleet")
+    p.add_argument("--id-prefix", default="ShellyU")
+    p.add_argument("--conf", type=json.loads, default={},
+                   help="Extra config for all devices, as JSON, "
+                   "e.g. '{\"sw1\": {\"svc_type\": 1}}'")
+    p.add_argument("--code", help="Provision HAP with this setup code")
+    p.add_argument("--bind-base-port", type=int, default=0,
+                   help="Binding port of the first device, "
+                   "by default all devices use the same port")
+    p.add_argument("--reset", action="store_true",
+                   help="Reset config and pairings of existing devices")
+    p.add_argument("--start-rate", type=float, default=20,
+                   help="Devices started per second")
+    p.add_argument("--duration", type=float, default=0,
+                   help="Seconds to run, 0 - until interrupted")
+    p.add_argument("--report-interval", type=float, default=60)
+    p.add_argument("--json", help="Save the final report to this file")
+    args = p.parse_args()
+    if not args.fs_dir:
+        args.fs_dir = os.path.join(os.path.dirname(args.elf), "fs")
+    if not os.path.isdir(args.fs_dir):
+        p.error("%s is not a directory, use --fs-dir" % args.fs_dir)
+    if args.reset and os.path.isdir(args.work_dir):
+        shutil.rmtree(args.work_dir)
+
+    devs = [Device(args, i) for i in range(1, args.num + 1)]
+    baseline_kb = 0
+    stopping = []
+    signal.signal(signal.SIGINT, lambda *_: stopping.append(1))
+    signal.signal(signal.SIGTERM, lambda *_: stopping.append(1))
+    try:
+        for d in devs:
+            if stopping:
+                break
+            d.setup(args)
+            d.start(args)
+            if d.idx == 1:
+                d.wait_up(30)
+                baseline_kb = proc_mem_kb(d.proc.pid)["Pss"]
+            time.sleep(1.0 / args.start_rate)
+        with concurrent.futures.ThreadPoolExecutor(16) as ex:
+            up = list(ex.map(lambda d: d.wait_up(60), devs))
+        failed = [d.id for d, ok in zip(devs, up) if not ok]
+        print("%d devices up, RPC ports %d-%d" % (
+            len(devs) - len(failed), devs[0].port, devs[-1].port))
+        if failed:
+            print("Failed to start: %s" % " ".join(failed))
+        if args.code:
+            todo = [d for d in devs if d.info and
+                    not d.info.get("hap_provisioned")]
+            with concurrent.futures.ThreadPoolExecutor(16) as ex:
+                list(ex.map(lambda d: d.rpc("HAP.Setup",
+                                            {"code": args.code}), todo))
+            print("Provisioned %d devices" % len(todo))
+
+        start = last_report = time.monotonic()
+        res = report(devs, baseline_kb)
+        while not stopping:
+            now = time.monotonic()
+            if args.duration and now - start >= args.duration:
+                break
+            if now - last_report >= args.report_interval:
+                last_report = now
+                res = report(devs, baseline_kb)
+            time.sleep(1)
+        res = report(devs, baseline_kb)
+        if args.json:
+            with open(args.json, "w") as f:
+                json.dump(res, f, indent=1)
+    finally:
+        for d in devs:
+            d.stop()
+    exited = [d.id for d in devs
+              if d.proc is not None and d.proc.returncode not in
+              (0, -signal.SIGTERM, 128 + signal.SIGTERM)]
+    if exited:
+        print("Devices exited abnormally: %s" % " ".join(exited))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
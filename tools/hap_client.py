@@ -0,0 +1,471 @@
+#!/usr/bin/env python3
+#
+#  Copyright (c) 2020 Deomid "rojer" Ryabkov
+#  All rights reserved
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+#  Minimal HAP-over-IP controller: pair-setup, pair-verify, encrypted
+#  sessions, characteristic reads, writes and events.
+#  Used by the benchmark and soak tools, not meant to be a full controller.
+#
+#  Requires the "cryptography" package (pip3 install cryptography).
+
+import asyncio
+import hashlib
+import json
+import os
+import struct
+import time
+import urllib.request
+import uuid
+
+from cryptography.hazmat.primitives import hashes, serialization
+from cryptography.hazmat.primitives.asymmetric import ed25519, x25519
+from cryptography.hazmat.primitives.ciphers.aead import ChaCha20Poly1305
+from cryptography.hazmat.primitives.kdf.hkdf import HKDF
+
+# TLV8 item types.
+TLV_METHOD = 0
+TLV_IDENTIFIER = 1
+TLV_SALT = 2
+TLV_PUBLIC_KEY = 3
+TLV_PROOF = 4
+TLV_ENCRYPTED_DATA = 5
+TLV_STATE = 6
+TLV_ERROR = 7
+TLV_SIGNATURE = 10
+
+# SRP-6a group (RFC 5054, 3072 bit), as used by HAP.
+SRP_N = int(
+    "FFFFFFFFFFFFFFFFC90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74"
+    "020BBEA63B139B22514A08798E3404DDEF9519B3CD3A431B302B0A6DF25F1437"
+    "4FE1356D6D51C245E485B576625E7EC6F44C42E9A637ED6B0BFF5CB6F406B7ED"
+    "EE386BFB5A899FA5AE9F24117C4B1FE649286651ECE45B3DC2007CB8A163BF05"
+    "98DA48361C55D39A69163FA8FD24CF5F83655D23DCA3AD961C62F356208552BB"
+    "9ED529077096966D670C354E4ABC9804F1746C08CA18217C32905E462E36CE3B"
+    "E39E772C180E86039B2783A2EC07A28FB5C55DF06F4C52C9DE2BCBF695581718"
+    "3995497CEA956AE515D2261898FA051015728E5A8AAAC42DAD33170D04507A33"
+    "A85521ABDF1CBA64ECFB850458DBEF0A8AEA71575D060C7DB3970F85A6E1E4C7"
+    "ABF5AE8CDB0933D71E8C94E04A25619DCEE3D2261AD2EE6BF12FFA06D98A0864"
+    "D87602733EC86A64521F2B18177B200CBBE117577A615D6C770988C0BAD946E2"
+    "08E24FA074E5AB3143DB5BFCE0FD108E4B82D120A93AD2CAFFFFFFFFFFFFFFFF", 16)
+SRP_G = 5
+SRP_LEN = 384
+SRP_USER = b"Pair-Setup"
+
+MAX_FRAME_LEN = 1024
+
+
+class HAPError(Exception):
+    pass
+
+
+def tlv_encode(*items):
+    res = bytearray()
+    for t, v in items:
+        if isinstance(v, int):
+            v = bytes([v])
+        if not v:
+            res += bytes([t, 0])
+        while v:
+            chunk, v = v[:255], v[255:]
+            res += bytes([t, len(chunk)]) + chunk
+    return bytes(res)
+
+
+def tlv_decode(data):
+    res, i, last_t = {}, 0, None
+    while i + 2 <= len(data):
+        t, l = data[i], data[i + 1]
+        v = data[i + 2:i + 2 + l]
+        # Consecutive items of the same type are fragments of one value.
+        if t == last_t and t in res:
+            res[t] += v
+        else:
+            res[t] = v
+        last_t = t
+        i += 2 + l
+    return res
+
+
+def _hkdf(ikm, salt, info):
+    return HKDF(algorithm=hashes.SHA512(), length=32, salt=salt,
+                info=info).derive(ikm)
+
+
+def _h(*parts):
+    h = hashlib.sha512()
+    for p in parts:
+        h.update(p)
+    return h.digest()
+
+
+def _to_bytes(n, length=None):
+    if length is None:
+        length = (n.bit_length() + 7) // 8
+    return n.to_bytes(length, "big")
+
+
+def _from_bytes(b):
+    return int.from_bytes(b, "big")
+
+
+def _ed25519_raw_pub(key):
+    return key.public_key().public_bytes(serialization.Encoding.Raw,
+                                         serialization.PublicFormat.Raw)
+
+
+def _ed25519_raw_priv(key):
+    return key.private_bytes(serialization.Encoding.Raw,
+                             serialization.PrivateFormat.Raw,
+                             serialization.NoEncryption())
+
+
+def _pairing_nonce(label):
+    return b"\x00\x00\x00\x00" + label
+
+
+class Pairing:
+    """Long-term keys of the controller and the accessory."""
+
+    def __init__(self, controller_id, ltsk, accessory_id, accessory_ltpk):
+        self.controller_id = controller_id
+        self.ltsk = ltsk
+        self.accessory_id = accessory_id
+        self.accessory_ltpk = accessory_ltpk
+
+    def save(self, file_name):
+        with open(file_name, "w") as f:
+            json.dump({
+                "controller_id": self.controller_id,
+                "ltsk": _ed25519_raw_priv(self.ltsk).hex(),
+                "accessory_id": self.accessory_id,
+                "accessory_ltpk": self.accessory_ltpk.hex(),
+            }, f, indent=2)
+
+    @staticmethod
+    def load(file_name):
+        with open(file_name) as f:
+            d = json.load(f)
+        return Pairing(
+            d["controller_id"],
+            ed25519.Ed25519PrivateKey.from_private_bytes(
+                bytes.fromhex(d["ltsk"])),
+            d["accessory_id"], bytes.fromhex(d["accessory_ltpk"]))
+
+
+class HTTPMessage:
+
+    def __init__(self, start_line, headers, body, ts):
+        self.start_line = start_line
+        self.headers = headers
+        self.body = body
+        self.ts = ts  # Time of arrival.
+
+    @property
+    def status(self):
+        return int(self.start_line.split(" ")[1])
+
+    @property
+    def is_event(self):
+        return self.start_line.startswith("EVENT/")
+
+    def json(self):
+        return json.loads(self.body) if self.body else None
+
+
+def _parse_http_message(buf):
+    """Returns (message, remaining bytes) or (None, buf) if incomplete."""
+    hdr_end = buf.find(b"\r\n\r\n")
+    if hdr_end < 0:
+        return None, buf
+    lines = buf[:hdr_end].decode("latin-1").split("\r\n")
+    headers = {}
+    for line in lines[1:]:
+        k, _, v = line.partition(":")
+        headers[k.strip().lower()] = v.strip()
+    rest = buf[hdr_end + 4:]
+    if headers.get("transfer-encoding", "").lower() == "chunked":
+        body, pos = b"", 0
+        while True:
+            eol = rest.find(b"\r\n", pos)
+            if eol < 0:
+                return None, buf
+            n = int(rest[pos:eol].split(b";")[0], 16)
+            if len(rest) < eol + 2 + n + 2:
+                return None, buf
+            body += rest[eol + 2:eol + 2 + n]
+            pos = eol + 2 + n + 2
+            if n == 0:
+                break
+        return HTTPMessage(lines[0], headers, body, time.monotonic()), \
+            rest[pos:]
+    n = int(headers.get("content-length", "0"))
+    if len(rest) < n:
+        return None, buf
+    return HTTPMessage(lines[0], headers, rest[:n], time.monotonic()), rest[n:]
+
+
+class HAPSession:
+    """A single controller connection. Responses are matched to requests in
+    order, events are delivered to the on_event callback."""
+
+    def __init__(self, host, port, on_event=None):
+        self.host = host
+        self.port = port
+        self.on_event = on_event
+        self._reader = None
+        self._writer = None
+        self._enc_key = None
+        self._dec_key = None
+        self._enc_cnt = 0
+        self._dec_cnt = 0
+        self._pending = []
+        self._read_task = None
+        self.rx_bytes = 0
+        self.tx_bytes = 0
+
+    async def connect(self):
+        self._reader, self._writer = await asyncio.open_connection(
+            self.host, self.port)
+
+    async def close(self):
+        if self._read_task is not None:
+            self._read_task.cancel()
+        if self._writer is not None:
+            self._writer.close()
+            try:
+                await self._writer.wait_closed()
+            except Exception:
+                pass
+
+    def _encrypt(self, data):
+        res = bytearray()
+        while data:
+            frame, data = data[:MAX_FRAME_LEN], data[MAX_FRAME_LEN:]
+            aad = struct.pack("<H", len(frame))
+            nonce = b"\x00" * 4 + struct.pack("<Q", self._enc_cnt)
+            self._enc_cnt += 1
+            res += aad + ChaCha20Poly1305(self._enc_key).encrypt(
+                nonce, frame, aad)
+        return bytes(res)
+
+    async def _read_frame(self):
+        aad = await self._reader.readexactly(2)
+        n = struct.unpack("<H", aad)[0]
+        data = await self._reader.readexactly(n + 16)
+        self.rx_bytes += 2 + n + 16
+        nonce = b"\x00" * 4 + struct.pack("<Q", self._dec_cnt)
+        self._dec_cnt += 1
+        return ChaCha20Poly1305(self._dec_key).decrypt(nonce, data, aad)
+
+    async def _read_loop(self):
+        buf = b""
+        try:
+            while True:
+                buf += await self._read_frame()
+                while True:
+                    msg, buf = _parse_http_message(buf)
+                    if msg is None:
+                        break
+                    if msg.is_event:
+                        if self.on_event is not None:
+                            self.on_event(self, msg)
+                    elif self._pending:
+                        self._pending.pop(0).set_result(msg)
+        except (asyncio.IncompleteReadError, ConnectionError) as e:
+            for f in self._pending:
+                if not f.done():
+                    f.set_exception(HAPError("connection closed: %s" % e))
+            self._pending = []
+
+    def _format_request(self, method, path, body, content_type):
+        req = "%s %s HTTP/1.1\r\nHost: %s\r\n" % (method, path, self.host)
+        if body is not None:
+            req += "Content-Type: %s\r\nContent-Length: %d\r\n" % (
+                content_type, len(body))
+        return req.encode("ascii") + b"\r\n" + (body or b"")
+
+    async def _plain_request(self, path, body):
+        """Unencrypted request, used during pairing."""
+        data = self._format_request("POST", path, body,
+                                    "application/pairing+tlv8")
+        self._writer.write(data)
+        self.tx_bytes += len(data)
+        buf = b""
+        while True:
+            msg, buf = _parse_http_message(buf)
+            if msg is not None:
+                return tlv_decode(msg.body)
+            chunk = await self._reader.read(4096)
+            if not chunk:
+                raise HAPError("connection closed")
+            self.rx_bytes += len(chunk)
+            buf += chunk
+
+    async def request(self, method, path, body=None,
+                      content_type="application/hap+json"):
+        """Sends an encrypted request and waits for the response."""
+        if self._enc_key is None:
+            raise HAPError("session is not verified")
+        f = asyncio.get_running_loop().create_future()
+        self._pending.append(f)
+        data = self._encrypt(
+            self._format_request(method, path, body, content_type))
+        self._writer.write(data)
+        self.tx_bytes += len(data)
+        return await f
+
+    async def pair_setup(self, setup_code, controller_id=None):
+        """Performs pair-setup, returns a Pairing."""
+        r = await self._plain_request(
+            "/pair-setup", tlv_encode((TLV_STATE, 1), (TLV_METHOD, 0)))
+        if TLV_ERROR in r:
+            raise HAPError("pair-setup M2 error %d" % r[TLV_ERROR][0])
+        salt, B = r[TLV_SALT], _from_bytes(r[TLV_PUBLIC_KEY])
+        a = _from_bytes(os.urandom(32))
+        A = pow(SRP_G, a, SRP_N)
+        A_b, B_b = _to_bytes(A, SRP_LEN), _to_bytes(B, SRP_LEN)
+        k = _from_bytes(_h(_to_bytes(SRP_N), _to_bytes(SRP_G, SRP_LEN)))
+        u = _from_bytes(_h(A_b, B_b))
+        x = _from_bytes(_h(salt, _h(SRP_USER + b":" +
+                                    setup_code.encode("ascii"))))
+        S = pow((B - k * pow(SRP_G, x, SRP_N)) % SRP_N, a + u * x, SRP_N)
+        K = _h(_to_bytes(S, SRP_LEN))
+        hn, hg = _h(_to_bytes(SRP_N)), _h(_to_bytes(SRP_G))
+        M1 = _h(bytes(i ^ j for i, j in zip(hn, hg)), _h(SRP_USER), salt,
+                A_b, B_b, K)
+        r = await self._plain_request(
+            "/pair-setup",
+            tlv_encode((TLV_STATE, 3), (TLV_PUBLIC_KEY, A_b),
+                       (TLV_PROOF, M1)))
+        if TLV_ERROR in r:
+            raise HAPError("pair-setup M4 error %d (wrong code?)" %
+                           r[TLV_ERROR][0])
+        if r[TLV_PROOF] != _h(A_b, M1, K):
+            raise HAPError("pair-setup M4: accessory proof mismatch")
+        enc_key = _hkdf(K, b"Pair-Setup-Encrypt-Salt",
+                        b"Pair-Setup-Encrypt-Info")
+        controller_id = controller_id or str(uuid.uuid4()).upper()
+        ltsk = ed25519.Ed25519PrivateKey.generate()
+        ltpk = _ed25519_raw_pub(ltsk)
+        cx = _hkdf(K, b"Pair-Setup-Controller-Sign-Salt",
+                   b"Pair-Setup-Controller-Sign-Info")
+        sig = ltsk.sign(cx + controller_id.encode("ascii") + ltpk)
+        sub = tlv_encode((TLV_IDENTIFIER, controller_id.encode("ascii")),
+                         (TLV_PUBLIC_KEY, ltpk), (TLV_SIGNATURE, sig))
+        enc = ChaCha20Poly1305(enc_key).encrypt(
+            _pairing_nonce(b"PS-Msg05"), sub, None)
+        r = await self._plain_request(
+            "/pair-setup",
+            tlv_encode((TLV_STATE, 5), (TLV_ENCRYPTED_DATA, enc)))
+        if TLV_ERROR in r:
+            raise HAPError("pair-setup M6 error %d" % r[TLV_ERROR][0])
+        sub = tlv_decode(ChaCha20Poly1305(enc_key).decrypt(
+            _pairing_nonce(b"PS-Msg06"), r[TLV_ENCRYPTED_DATA], None))
+        acc_id, acc_ltpk = sub[TLV_IDENTIFIER], sub[TLV_PUBLIC_KEY]
+        ax = _hkdf(K, b"Pair-Setup-Accessory-Sign-Salt",
+                   b"Pair-Setup-Accessory-Sign-Info")
+        ed25519.Ed25519PublicKey.from_public_bytes(acc_ltpk).verify(
+            sub[TLV_SIGNATURE], ax + acc_id + acc_ltpk)
+        return Pairing(controller_id, ltsk, acc_id.decode("ascii"), acc_ltpk)
+
+    async def pair_verify(self, pairing):
+        """Performs pair-verify and switches the session to encrypted mode."""
+        esk = x25519.X25519PrivateKey.generate()
+        epk = esk.public_key().public_bytes(serialization.Encoding.Raw,
+                                            serialization.PublicFormat.Raw)
+        r = await self._plain_request(
+            "/pair-verify", tlv_encode((TLV_STATE, 1), (TLV_PUBLIC_KEY, epk)))
+        if TLV_ERROR in r:
+            raise HAPError("pair-verify M2 error %d" % r[TLV_ERROR][0])
+        acc_epk = r[TLV_PUBLIC_KEY]
+        shared = esk.exchange(x25519.X25519PublicKey.from_public_bytes(acc_epk))
+        key = _hkdf(shared, b"Pair-Verify-Encrypt-Salt",
+                    b"Pair-Verify-Encrypt-Info")
+        sub = tlv_decode(ChaCha20Poly1305(key).decrypt(
+            _pairing_nonce(b"PV-Msg02"), r[TLV_ENCRYPTED_DATA], None))
+        acc_id = sub[TLV_IDENTIFIER]
+        if acc_id.decode("ascii") != pairing.accessory_id:
+            raise HAPError("pair-verify: unexpected accessory %s" % acc_id)
+        ed25519.Ed25519PublicKey.from_public_bytes(
+            pairing.accessory_ltpk).verify(sub[TLV_SIGNATURE],
+                                           acc_epk + acc_id + epk)
+        cid = pairing.controller_id.encode("ascii")
+        sig = pairing.ltsk.sign(epk + cid + acc_epk)
+        enc = ChaCha20Poly1305(key).encrypt(
+            _pairing_nonce(b"PV-Msg03"),
+            tlv_encode((TLV_IDENTIFIER, cid), (TLV_SIGNATURE, sig)), None)
+        r = await self._plain_request(
+            "/pair-verify",
+            tlv_encode((TLV_STATE, 3), (TLV_ENCRYPTED_DATA, enc)))
+        if TLV_ERROR in r:
+            raise HAPError("pair-verify M4 error %d" % r[TLV_ERROR][0])
+        self._enc_key = _hkdf(shared, b"Control-Salt",
+                              b"Control-Write-Encryption-Key")
+        self._dec_key = _hkdf(shared, b"Control-Salt",
+                              b"Control-Read-Encryption-Key")
+        self._read_task = asyncio.get_running_loop().create_task(
+            self._read_loop())
+
+    async def get_accessories(self):
+        return (await self.request("GET", "/accessories")).json()
+
+    async def read(self, ids):
+        q = ",".join("%d.%d" % i for i in ids)
+        resp = await self.request("GET", "/characteristics?id=%s" % q)
+        if resp.status not in (200, 207):
+            raise HAPError("read failed: %s" % resp.start_line)
+        return resp.json()["characteristics"]
+
+    async def write(self, values):
+        """values: list of (aid, iid, value)."""
+        body = json.dumps({"characteristics": [
+            {"aid": aid, "iid": iid, "value": v} for aid, iid, v in values]})
+        resp = await self.request("PUT", "/characteristics", body.encode())
+        if resp.status not in (200, 204):
+            raise HAPError("write failed: %s" % resp.start_line)
+
+    async def subscribe(self, ids, enable=True):
+        body = json.dumps({"characteristics": [
+            {"aid": aid, "iid": iid, "ev": enable} for aid, iid in ids]})
+        resp = await self.request("PUT", "/characteristics", body.encode())
+        if resp.status not in (200, 204):
+            raise HAPError("subscribe failed: %s" % resp.start_line)
+
+
+def find_chars(accessories, char_type, writable=None):
+    """Returns (aid, iid) of characteristics of a given short type, e.g. "25"
+    for On."""
+    res = []
+    for acc in accessories["accessories"]:
+        for svc in acc["services"]:
+            for c in svc["characteristics"]:
+                t = c["type"].split("-")[0].lstrip("0").upper()
+                if t != char_type.upper():
+                    continue
+                if writable is not None and (("pw" in c["perms"]) !=
+                                             writable):
+                    continue
+                res.append((acc["aid"], c["iid"]))
+    return res
+
+
+def rpc_call(host, port, method, args=None, timeout=5):
+    """Calls a device RPC method over HTTP."""
+    url = "http://%s:%d/rpc/%s" % (host, port, method)
+    data = json.dumps(args).encode() if args is not None else None
+    req = urllib.request.Request(url, data=data)
+    with urllib.request.urlopen(req, timeout=timeout) as f:
+        return json.loads(f.read() or b"null")
@@ -0,0 +1,409 @@
+#!/usr/bin/env python3
+#
+#  Copyright (c) 2020 Deomid "rojer" Ryabkov
+#  All rights reserved
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+#  HAP-over-IP load and latency benchmark.
+#
+#  Opens N verified sessions to a device (normally a ShellyU instance),
+#  subscribes all of them to events, then for the configured duration issues
+#  characteristic reads and writes at the given rate and toggles virtual
+#  inputs, measuring request and notification latency.
+#
+#  With --sweep (ShellyUBench build), instead measures how the bridge scales
+#  with the number of accessories: for each count the device re-creates its
+#  accessories and the cost of the build and of the /accessories request is
+#  recorded, until something fails or the scratch buffer is exhausted.
+#
+#  With --ssw-group N (ShellyUBench build), creates N stateless switches with
+#  one accessory per input and then grouped in one accessory
+#  (shelly.ssw_group) and compares heap and /accessories response size.
+#
+#  Examples:
+#    tools/hapbench.py --host 127.0.0.1 --code 111-22-333 \
+#        --sessions 8 --rate 50 --duration 30
+#    tools/hapbench.py --host 127.0.0.1 --sweep 10 --json accs.json
+#    tools/hapbench.py --host 127.0.0.1 --ssw-group 2
+
+import argparse
+import asyncio
+import json
+import os
+import random
+import sys
+import time
+
+from hap_client import (HAPError, HAPSession, Pairing, find_chars,
+                        rpc_call)
+
+# Short characteristic type ids.
+CHAR_ON = "25"
+CHAR_PROGRAMMABLE_SWITCH_EVENT = "73"
+CHAR_CONTACT_SENSOR_STATE = "6A"
+CHAR_MOTION_DETECTED = "22"
+CHAR_OCCUPANCY_DETECTED = "71"
+
+INPUT_EVENT_CHARS = (CHAR_PROGRAMMABLE_SWITCH_EVENT, CHAR_CONTACT_SENSOR_STATE,
+                     CHAR_MOTION_DETECTED, CHAR_OCCUPANCY_DETECTED, CHAR_ON)
+
+
+def percentile(values, p):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def fmt_lat(name, values):
+    if not values:
+        return "%-8s      0" % name
+    return "%-8s %6d  p50 %7.2f  p99 %7.2f  max %7.2f ms" % (
+        name, len(values), percentile(values, 50) * 1000,
+        percentile(values, 99) * 1000, max(values) * 1000)
+
+
+def rss_kb(pid):
+    try:
+        with open("/proc/%d/status" % pid) as f:
+            for line in f:
+                if line.startswith("VmRSS:"):
+                    return int(line.split()[1])
+    except OSError:
+        pass
+    return None
+
+
+class Bench:
+
+    def __init__(self, args):
+        self.args = args
+        self.sessions = []
+        self.lat = {"read": [], "write": [], "notify": []}
+        self.errors = 0
+        # Pending notifications: (aid, iid) -> time of the triggering action.
+        self.expect = {}
+        self.num_events = 0
+
+    def on_event(self, sess, msg):
+        now = msg.ts
+        for c in msg.json()["characteristics"]:
+            self.num_events += 1
+            t0 = self.expect.get((c["aid"], c["iid"]))
+            if t0 is not None:
+                self.lat["notify"].append(now - t0)
+
+    def heap(self):
+        try:
+            info = rpc_call(self.args.host, self.args.http_port,
+                            "Shelly.GetInfo")
+            res = "heap %u free (min %u) of %u" % (
+                info.get("ram_free", 0), info.get("ram_min_free", 0),
+                info.get("ram_size", 0))
+        except Exception as e:
+            res = "heap n/a (%s)" % e
+        if self.args.pid:
+            res += ", RSS %s KB" % rss_kb(self.args.pid)
+        return res
+
+    async def pair(self):
+        a = self.args
+        if os.path.exists(a.pairing):
+            return Pairing.load(a.pairing)
+        if not a.code:
+            raise HAPError("not paired and no --code given")
+        s = HAPSession(a.host, a.port)
+        await s.connect()
+        try:
+            p = await s.pair_setup(a.code)
+        finally:
+            await s.close()
+        p.save(a.pairing)
+        print("Paired with %s, pairing saved to %s" % (p.accessory_id,
+                                                        a.pairing))
+        return p
+
+    async def open_sessions(self, pairing):
+        t0 = time.monotonic()
+        for _ in range(self.args.sessions):
+            s = HAPSession(self.args.host, self.args.port, self.on_event)
+            await s.connect()
+            await s.pair_verify(pairing)
+            self.sessions.append(s)
+        dt = time.monotonic() - t0
+        print("%d sessions verified in %.2f s (%.1f ms per session)" % (
+            len(self.sessions), dt, dt * 1000 / len(self.sessions)))
+
+    async def timed(self, kind, coro):
+        t0 = time.monotonic()
+        try:
+            await coro
+        except (HAPError, asyncio.TimeoutError) as e:
+            self.errors += 1
+            if self.args.verbose:
+                print("%s error: %s" % (kind, e))
+            return
+        self.lat[kind].append(time.monotonic() - t0)
+
+    async def run(self):
+        a = self.args
+        pairing = await self.pair()
+        print("Before: %s" % self.heap())
+        await self.open_sessions(pairing)
+        accs = await self.sessions[0].get_accessories()
+        on_chars = find_chars(accs, CHAR_ON, writable=True)
+        ev_chars = []
+        for t in INPUT_EVENT_CHARS:
+            ev_chars += find_chars(accs, t, writable=False)
+        read_chars = on_chars + ev_chars
+        if not read_chars:
+            raise HAPError("no usable characteristics found")
+        for s in self.sessions:
+            await s.subscribe(on_chars + ev_chars)
+        print("%d switch, %d input characteristics, subscribed" % (
+            len(on_chars), len(ev_chars)))
+        print("Sessions open: %s" % self.heap())
+
+        interval = 1.0 / a.rate
+        deadline = time.monotonic() + a.duration
+        next_t = time.monotonic()
+        next_toggle = next_t
+        tasks = set()
+        n = 0
+        while time.monotonic() < deadline:
+            now = time.monotonic()
+            if next_t > now:
+                await asyncio.sleep(next_t - now)
+            next_t += interval
+            s = self.sessions[n % len(self.sessions)]
+            n += 1
+            if on_chars and random.random() < a.write_ratio:
+                aid, iid = random.choice(on_chars)
+                self.expect[(aid, iid)] = time.monotonic()
+                c = s.write([(aid, iid, random.random() < 0.5)])
+                t = asyncio.ensure_future(self.timed("write", c))
+            else:
+                c = s.read([random.choice(read_chars)])
+                t = asyncio.ensure_future(self.timed("read", c))
+            tasks.add(t)
+            t.add_done_callback(tasks.discard)
+            if a.inputs and time.monotonic() >= next_toggle:
+                next_toggle += a.toggle_interval
+                # Time of the toggle is the reference for input notifications.
+                t0 = time.monotonic()
+                for aid_iid in ev_chars:
+                    self.expect[aid_iid] = t0
+                for i in a.inputs:
+                    await asyncio.get_running_loop().run_in_executor(
+                        None, rpc_call, a.host, a.http_port,
+                        "Shelly.SetVirtualInput", {"id": i, "toggle": True})
+        if tasks:
+            await asyncio.wait(tasks, timeout=5)
+        # Let the last notifications arrive.
+        await asyncio.sleep(0.5)
+
+        total = len(self.lat["read"]) + len(self.lat["write"])
+        print()
+        print("Duration %.1f s, %d requests, %.1f req/s, %d errors, "
+              "%d events" % (a.duration, total, total / a.duration,
+                             self.errors, self.num_events))
+        for k in ("read", "write", "notify"):
+            print(fmt_lat(k, self.lat[k]))
+        print("After: %s" % self.heap())
+        for s in self.sessions:
+            await s.close()
+
+    async def wait_for_accessories(self, num_accs, timeout=30):
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            await asyncio.sleep(0.5)
+            try:
+                info = rpc_call(self.args.host, self.args.http_port,
+                                "Shelly.GetBenchInfo")
+            except Exception:
+                continue
+            if info["num_accs"] == num_accs:
+                return info
+        raise HAPError("accessories were not re-created in %d s" % timeout)
+
+    async def measure_accessories(self, pairing, repeat):
+        # Server has been restarted, so a new session is needed every time.
+        s = HAPSession(self.args.host, self.args.port)
+        for _ in range(20):
+            try:
+                await s.connect()
+                await s.pair_verify(pairing)
+                break
+            except (ConnectionError, HAPError, asyncio.IncompleteReadError):
+                await s.close()
+                await asyncio.sleep(0.5)
+                s = HAPSession(self.args.host, self.args.port)
+        else:
+            raise HAPError("failed to connect")
+        lat, size = [], 0
+        try:
+            for _ in range(repeat):
+                t0 = time.monotonic()
+                resp = await asyncio.wait_for(
+                    s.request("GET", "/accessories"), 10)
+                lat.append(time.monotonic() - t0)
+                if resp.status != 200:
+                    raise HAPError("/accessories: %s" % resp.start_line)
+                size = len(resp.body)
+                json.loads(resp.body)
+        finally:
+            await s.close()
+        return lat, size
+
+    async def ssw_group(self):
+        a = self.args
+        pairing = await self.pair()
+        n = a.ssw_group
+        cfg = {"switches": 0, "outlets": 0, "locks": 0, "ssw": n}
+        results = {}
+        for group in (False, True):
+            rpc_call(a.host, a.http_port, "Config.Set",
+                     {"config": {"shelly": {"ssw_group": group}}})
+            # Re-creates the accessories with the new layout.
+            rpc_call(a.host, a.http_port, "Shelly.SetBenchConfig", cfg)
+            info = await self.wait_for_accessories(1 if group else n)
+            lat, size = await self.measure_accessories(pairing, a.repeat)
+            results["grouped" if group else "separate"] = {
+                "num_accs": info["num_accs"],
+                "heap_used": info["heap_used"],
+                "resp_size": size,
+                "resp_p50_ms": percentile(lat, 50) * 1000,
+            }
+        print("%-9s %5s %6s %6s %8s" % ("layout", "accs", "heap", "resp",
+                                        "p50_ms"))
+        for k, r in results.items():
+            print("%-9s %5d %6d %6d %8.2f" % (
+                k, r["num_accs"], r["heap_used"], r["resp_size"],
+                r["resp_p50_ms"]))
+        sep, grp = results["separate"], results["grouped"]
+        print("Saved by grouping %d inputs: heap %d, response %d bytes" % (
+            n, sep["heap_used"] - grp["heap_used"],
+            sep["resp_size"] - grp["resp_size"]))
+        if a.json:
+            with open(a.json, "w") as f:
+                json.dump({"num_ssw": n, "results": results}, f, indent=2)
+
+    async def sweep(self):
+        a = self.args
+        pairing = await self.pair()
+        types = ("switches", "outlets", "locks", "ssw")
+        results = []
+        n = a.sweep
+        print("%5s %6s %8s %8s %8s %8s %9s %s" % (
+            "accs", "heap", "per_acc", "build_ms", "resp", "p50_ms",
+            "srv_max_ms", "scratch"))
+        while True:
+            if a.sweep_type == "mixed":
+                cfg = {t: n // 4 + (1 if i < n % 4 else 0)
+                       for i, t in enumerate(types)}
+            else:
+                cfg = {t: 0 for t in types}
+                cfg[a.sweep_type] = n
+            try:
+                rpc_call(a.host, a.http_port, "Shelly.SetBenchConfig", cfg)
+            except Exception as e:
+                print("Stopping at %d: %s" % (n, e))
+                break
+            try:
+                info = await self.wait_for_accessories(n)
+                lat, size = await self.measure_accessories(pairing, a.repeat)
+                stats = rpc_call(a.host, a.http_port, "Shelly.GetStats")
+            except (HAPError, asyncio.TimeoutError, OSError) as e:
+                print("Failed at %d accessories: %s" % (n, e))
+                break
+            mem = stats["hap_mem"]
+            r = {
+                "num_accs": n,
+                "heap_used": info["heap_used"],
+                "heap_per_acc": info["heap_used"] // max(n, 1),
+                "build_us": info["build_us"],
+                "resp_size": size,
+                "resp_p50_ms": percentile(lat, 50) * 1000,
+                "resp_srv_max_ms": stats["hap_req"]["accessories"]["max_us"] /
+                                   1000.0,
+                "scratch_hwm": mem["scratch_hwm"],
+                "scratch_size": mem["scratch_size"],
+                "ram_free": info["ram_free"],
+            }
+            results.append(r)
+            print("%5d %6d %8d %8.2f %8d %8.2f %9.2f %d/%d" % (
+                n, r["heap_used"], r["heap_per_acc"], r["build_us"] / 1000.0,
+                size, r["resp_p50_ms"], r["resp_srv_max_ms"],
+                r["scratch_hwm"], r["scratch_size"]))
+            if mem["scratch_hwm"] >= mem["scratch_size"]:
+                print("Scratch buffer exhausted at %d accessories" % n)
+                break
+            n += a.sweep
+            if n > info["max_accessories"]:
+                break
+        if a.json:
+            with open(a.json, "w") as f:
+                json.dump({"sweep_type": a.sweep_type, "results": results},
+                          f, indent=2)
+
+
+def main():
+    p = argparse.ArgumentParser(description="HAP-over-IP benchmark")
+    p.add_argument("--host", default="127.0.0.1")
+    p.add_argument("--port", type=int, default=9000, help="HAP port")
+    p.add_argument("--http-port", type=int, default=80,
+                   help="HTTP port, used for RPC calls")
+    p.add_argument("--code", help="Setup code, used if not paired yet")
+    p.add_argument("--pairing", default="hapbench_pairing.json",
+                   help="File to store the pairing in")
+    p.add_argument("--sessions", type=int, default=4)
+    p.add_argument("--rate", type=float, default=20,
+                   help="Total request rate, req/s")
+    p.add_argument("--write-ratio", type=float, default=0.3,
+                   help="Fraction of requests that are writes")
+    p.add_argument("--duration", type=float, default=10, help="Seconds")
+    p.add_argument("--inputs", type=int, nargs="*", default=[],
+                   help="Virtual input ids to toggle")
+    p.add_argument("--toggle-interval", type=float, default=1.0,
+                   help="Seconds between input toggles")
+    p.add_argument("--pid", type=int, help="ShellyU process id, to report RSS")
+    p.add_argument("--sweep", type=int, default=0, metavar="STEP",
+                   help="Accessory scaling sweep with the given step "
+                   "(ShellyUBench only)")
+    p.add_argument("--sweep-type", default="switches",
+                   choices=("switches", "outlets", "locks", "ssw", "mixed"))
+    p.add_argument("--ssw-group", type=int, default=0, metavar="N",
+                   help="Compare separate and grouped layout of N stateless "
+                   "switches (ShellyUBench only)")
+    p.add_argument("--repeat", type=int, default=5,
+                   help="Number of /accessories requests per sweep step")
+    p.add_argument("--json", help="Write sweep or comparison results to "
+                   "this file")
+    p.add_argument("-v", "--verbose", action="store_true")
+    args = p.parse_args()
+    try:
+        b = Bench(args)
+        if args.ssw_group > 0:
+            asyncio.run(b.ssw_group())
+        elif args.sweep > 0:
+            asyncio.run(b.sweep())
+        else:
+            asyncio.run(b.run())
+    except HAPError as e:
+        print("Error: %s" % e)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
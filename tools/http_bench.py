@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+#
+#  Copyright (c) 2020 Deomid "rojer" Ryabkov
+#  All rights reserved
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+#  Measures request rate and latency of the stock-compatible HTTP API
+#  (/relay/N, /status) and the equivalent RPC calls (Shelly.SetSwitch,
+#  Shelly.GetInfo) over keep-alive HTTP connections.
+#
+#  Example:
+#    tools/http_bench.py --host 127.0.0.1:8080 --conns 4 --duration 10
+
+import argparse
+import http.client
+import json
+import socket
+import sys
+import threading
+import time
+
+TESTS = {
+    "relay": ("GET", "/relay/{idx}?turn=toggle", None),
+    "rpc_set_switch": ("POST", "/rpc/Shelly.SetSwitch",
+                       '{{"id": {id}, "state": {state}}}'),
+    "status": ("GET", "/status", None),
+    "rpc_get_info": ("POST", "/rpc/Shelly.GetInfo", ""),
+}
+
+
+def percentile(values, p):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+class Connection(http.client.HTTPConnection):
+
+    def connect(self):
+        super().connect()
+        # Headers and body are sent separately, don't let Nagle delay them.
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+
+
+def worker(args, test, deadline, res):
+    method, path, body = TESTS[test]
+    conn = Connection(args.host, timeout=10)
+    state = False
+    lat, errors = [], 0
+    while time.monotonic() < deadline:
+        state = not state
+        b = body.format(id=args.id, state=json.dumps(state)) if body else body
+        t0 = time.monotonic()
+        try:
+            conn.request(method, path.format(idx=args.id - 1), body=b)
+            resp = conn.getresponse()
+            resp.read()
+            if resp.status != 200:
+                errors += 1
+            if resp.will_close:
+                conn.close()
+        except (OSError, http.client.HTTPException):
+            errors += 1
+            conn.close()
+            time.sleep(0.1)
+            continue
+        lat.append(time.monotonic() - t0)
+    conn.close()
+    res.append((lat, errors))
+
+
+def run_test(args, test):
+    res = []
+    deadline = time.monotonic() + args.duration
+    threads = [threading.Thread(target=worker,
+                                args=(args, test, deadline, res))
+               for _ in range(args.conns)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    lat = [v for r in res for v in r[0]]
+    return {
+        "requests": len(lat),
+        "errors": sum(r[1] for r in res),
+        "rps": round(len(lat) / args.duration, 1),
+        "p50_ms": round(percentile(lat, 50) * 1000, 2),
+        "p99_ms": round(percentile(lat, 99) * 1000, 2),
+    }
+
+
+def main():
+    p = argparse.ArgumentParser(description="HTTP API benchmark")
+    p.add_argument("--host", default="127.0.0.1:8080",
+                   help="Device address, host[:port]")
+    p.add_argument("--id", type=int, default=1, help="Switch id")
+    p.add_argument("--conns", type=int, default=1,
+                   help="Number of concurrent connections")
+    p.add_argument("--duration", type=float, default=10,
+                   help="Duration of each test, seconds")
+    p.add_argument("--tests", default=",".join(TESTS),
+                   help="Comma-separated list of tests to run")
+    p.add_argument("--json", help="Save results to this file")
+    args = p.parse_args()
+
+    results = {}
+    for test in args.tests.split(","):
+        if test not in TESTS:
+            p.error("unknown test %s" % test)
+        r = run_test(args, test)
+        results[test] = r
+        print("%-16s %8.1f rps  p50 %6.2f ms  p99 %6.2f ms  %d errors" % (
+            test, r["rps"], r["p50_ms"], r["p99_ms"], r["errors"]))
+        sys.stdout.flush()
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(results, f, indent=1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+#
+#  Copyright (c) 2020 Deomid "rojer" Ryabkov
+#  All rights reserved
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+#  Decodes the on-flash log (log.*), either from log files copied off the
+#  device (e.g. with `mos get log0.bin`) or fetched with Shelly.GetLog.
+#
+#  Block format, all integers are little-endian:
+#     0  'S' 'L'
+#     2  version (1)
+#     3  flags: bit 0 - data is compressed
+#     4  seq (4 bytes)
+#     8  time, UNIX timestamp of the flush, 0 if not set (4 bytes)
+#    12  uptime, seconds (4 bytes)
+#    16  raw_len, length of the text (2 bytes)
+#    18  len, length of the data (2 bytes)
+#    20  CRC-32 of the above and the data (4 bytes)
+#    24  data
+#  Corrupted blocks (e.g. power lost during write) are skipped.
+#
+#  Example:
+#    tools/log_decode.py --host 192.168.1.10 --flush
+#    tools/log_decode.py --host 192.168.1.10 --follow 10
+#    tools/log_decode.py log*.bin
+
+import argparse
+import base64
+import json
+import struct
+import sys
+import time
+import urllib.request
+import zlib
+
+HDR = struct.Struct("<2sBBIIIHHI")
+
+
+def decompress(data):
+    """Reverses LogCompress: literal runs and (length, distance) matches."""
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        t = data[i]
+        i += 1
+        if t < 0x80:
+            out += data[i:i + t + 1]
+            i += t + 1
+            continue
+        n = (t & 0x7f) + 3
+        dist = (data[i] << 8) | data[i + 1]
+        i += 2
+        if dist == 0 or dist > len(out):
+            raise ValueError("bad distance %d at %d" % (dist, i - 2))
+        start = len(out) - dist
+        # Matches can overlap the output being produced.
+        for k in range(n):
+            out.append(out[start + k])
+    return bytes(out)
+
+
+def parse_blocks(data):
+    """Yields (header dict, text) for valid blocks in data."""
+    i = 0
+    while i + HDR.size <= len(data):
+        (magic, ver, flags, seq, ts, uptime, raw_len, dlen,
+         crc) = HDR.unpack_from(data, i)
+        payload = data[i + HDR.size:i + HDR.size + dlen]
+        if (magic != b"SL" or ver != 1 or len(payload) != dlen or
+                zlib.crc32(payload, zlib.crc32(data[i:i + 20])) != crc):
+            # Resync on the next magic.
+            i = data.find(b"SL", i + 1)
+            if i < 0:
+                break
+            continue
+        i += HDR.size + dlen
+        try:
+            text = decompress(payload) if flags & 1 else payload
+        except (ValueError, IndexError) as e:
+            print("block %d: %s" % (seq, e), file=sys.stderr)
+            continue
+        if len(text) != raw_len:
+            print("block %d: length mismatch, %d != %d" % (
+                seq, len(text), raw_len), file=sys.stderr)
+        yield {"seq": seq, "time": ts, "uptime": uptime, "flags": flags,
+               "raw_len": raw_len, "len": dlen}, text
+
+
+def rpc_call(host, method, args):
+    url = "http://%s/rpc/%s" % (host, method)
+    req = urllib.request.Request(url, data=json.dumps(args).encode())
+    with urllib.request.urlopen(req, timeout=10) as f:
+        return json.loads(f.read())
+
+
+def fetch(host, after, flush):
+    """Fetches blocks after the given seq, returns (data, last_seq, stats)."""
+    data = b""
+    while True:
+        res = rpc_call(host, "Shelly.GetLog",
+                       {"after": after, "max_size": 4096, "flush": flush})
+        flush = False
+        data += base64.b64decode(res.get("data") or "")
+        after = res["last_seq"]
+        if not res["more"]:
+            return data, after, res
+
+
+def output(blocks, args, stats):
+    for hdr, text in sorted(blocks, key=lambda b: b[0]["seq"]):
+        stats["blocks"] += 1
+        stats["raw"] += hdr["raw_len"]
+        stats["stored"] += hdr["len"] + HDR.size
+        if args.headers:
+            if not stats["eol"]:
+                sys.stdout.write("\n")
+            ts = (time.strftime("%Y-%m-%d %H:%M:%S",
+                                time.localtime(hdr["time"]))
+                  if hdr["time"] > 0 else "-")
+            print("--- seq %d, %s, uptime %d, %d -> %d bytes" % (
+                hdr["seq"], ts, hdr["uptime"], hdr["raw_len"], hdr["len"]))
+        sys.stdout.write(text.decode("utf-8", "replace"))
+        if text:
+            stats["eol"] = text.endswith(b"\n")
+    sys.stdout.flush()
+
+
+def main():
+    p = argparse.ArgumentParser(description="On-flash log decoder")
+    p.add_argument("files", nargs="*", help="Log files to decode")
+    p.add_argument("--host", help="Fetch from the device with Shelly.GetLog")
+    p.add_argument("--after", type=int, default=0,
+                   help="Only fetch blocks after this seq")
+    p.add_argument("--flush", action="store_true",
+                   help="Write out lines buffered on the device first")
+    p.add_argument("--follow", type=float, metavar="SECONDS",
+                   help="Keep fetching new blocks at this interval")
+    p.add_argument("--headers", action="store_true",
+                   help="Print block headers")
+    args = p.parse_args()
+    if bool(args.files) == bool(args.host):
+        p.error("either files or --host must be given")
+
+    stats = {"blocks": 0, "raw": 0, "stored": 0, "eol": True}
+    if args.files:
+        blocks = []
+        for fn in args.files:
+            with open(fn, "rb") as f:
+                blocks.extend(parse_blocks(f.read()))
+        output(blocks, args, stats)
+    else:
+        after, res = args.after, None
+        try:
+            while True:
+                data, after, res = fetch(args.host, after, args.flush)
+                output(list(parse_blocks(data)), args, stats)
+                if not args.follow:
+                    break
+                time.sleep(args.follow)
+        except KeyboardInterrupt:
+            pass
+        if res is not None:
+            print("# device: %d flushes, %d bytes dropped, %d write errors" % (
+                res["flushes"], res["dropped"], res["write_errors"]),
+                file=sys.stderr)
+    if stats["stored"] > 0:
+        print("# %d blocks, %d bytes of text in %d bytes (%.2fx)" % (
+            stats["blocks"], stats["raw"], stats["stored"],
+            float(stats["raw"]) / stats["stored"]), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
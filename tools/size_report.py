@@ -0,0 +1,244 @@
+#!/usr/bin/env python3
+#
+#  Copyright (c) 2020 Deomid "rojer" Ryabkov
+#  All rights reserved
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+#  Flash and static RAM usage report for a firmware ELF.
+#
+#  Breaks the image down by section group (flash code, IRAM code, rodata,
+#  data, bss), by object file and by symbol, optionally diffs it against a
+#  stored baseline and fails if any group grew by more than a threshold.
+#
+#  Example:
+#    tools/size_report.py build_Shelly25/objs/shelly-homekit.elf \
+#        --baseline size_baseline/Shelly25.json --threshold 1024
+
+import argparse
+import collections
+import json
+import os
+import shutil
+import subprocess
+import sys
+
+# Section name -> group. On ESP8266 code in .text lives in IRAM, code that
+# runs from flash is in .irom0.text.
+SECTION_GROUPS = {
+    ".irom0.text": "flash",
+    ".text": "iram",
+    ".iram0.text": "iram",
+    ".rodata": "rodata",
+    ".data": "data",
+    ".bss": "bss",
+}
+GROUPS = ("flash", "iram", "rodata", "data", "bss")
+
+
+def section_group(name, is_esp):
+    for prefix, group in SECTION_GROUPS.items():
+        if name == prefix or name.startswith(prefix + "."):
+            if group == "iram" and not is_esp:
+                return "flash"
+            return group
+    if name.startswith(".irom"):
+        return "flash"
+    return None
+
+
+def find_tool(name, explicit):
+    if explicit:
+        return explicit
+    for prefix in ("xtensa-lx106-elf-", ""):
+        if shutil.which(prefix + name):
+            return prefix + name
+    sys.exit("%s not found, use --toolchain-prefix" % name)
+
+
+def run(*args):
+    return subprocess.run(args, check=True, stdout=subprocess.PIPE,
+                          universal_newlines=True).stdout
+
+
+def elf_sections(objdump, elf):
+    """Returns {section name: (size, address)} of allocated sections."""
+    res = {}
+    lines = run(objdump, "-h", elf).splitlines()
+    for i, line in enumerate(lines):
+        parts = line.split()
+        if len(parts) < 7 or not parts[0].isdigit():
+            continue
+        flags = lines[i + 1] if i + 1 < len(lines) else ""
+        if "ALLOC" not in flags:
+            continue
+        res[parts[1]] = (int(parts[2], 16), int(parts[3], 16))
+    return res
+
+
+def elf_symbols(nm, elf, sections, is_esp):
+    """Returns {group: {symbol: size}}, using section addresses to assign
+    symbols to groups."""
+    ranges = []
+    for name, (size, addr) in sections.items():
+        group = section_group(name, is_esp)
+        if group is not None and size > 0:
+            ranges.append((addr, addr + size, group))
+    res = collections.defaultdict(dict)
+    out = run(nm, "-S", "-C", "--size-sort", elf)
+    for line in out.splitlines():
+        parts = line.split(None, 3)
+        if len(parts) < 4:
+            continue
+        addr, size, name = int(parts[0], 16), int(parts[1], 16), parts[3]
+        for start, end, group in ranges:
+            if start <= addr < end:
+                res[group][name] = res[group].get(name, 0) + size
+                break
+    return res
+
+
+def object_sizes(size_tool, objs_dir, is_esp):
+    """Returns {object: {group: size}} for objects compiled from our sources.
+    These are pre-link sizes, so they include code later removed by
+    --gc-sections."""
+    res = {}
+    for root, _, files in os.walk(objs_dir):
+        for f in files:
+            if not f.endswith(".o"):
+                continue
+            path = os.path.join(root, f)
+            sizes = collections.Counter()
+            for line in run(size_tool, "-A", path).splitlines():
+                parts = line.split()
+                if len(parts) < 2 or not parts[1].isdigit():
+                    continue
+                group = section_group(parts[0], is_esp)
+                if group is not None:
+                    sizes[group] += int(parts[1])
+            if sizes:
+                res[os.path.relpath(path, objs_dir)] = dict(sizes)
+    return res
+
+
+def make_report(args):
+    prefix = args.toolchain_prefix
+    objdump = find_tool("objdump", prefix and prefix + "objdump")
+    nm = find_tool("nm", prefix and prefix + "nm")
+    size_tool = find_tool("size", prefix and prefix + "size")
+    sections = elf_sections(objdump, args.elf)
+    is_esp = any(s.startswith(".irom") for s in sections)
+    totals = collections.Counter()
+    for name, (size, _) in sections.items():
+        group = section_group(name, is_esp)
+        if group is not None:
+            totals[group] += size
+    report = {
+        "elf": os.path.basename(args.elf),
+        "totals": {g: totals[g] for g in GROUPS},
+        "sections": {k: v[0] for k, v in sections.items()},
+        "symbols": elf_symbols(nm, args.elf, sections, is_esp),
+    }
+    objs_dir = args.objs_dir or os.path.dirname(args.elf)
+    report["objects"] = object_sizes(size_tool, objs_dir, is_esp)
+    return report
+
+
+def print_top(title, items, n):
+    print("\n%s:" % title)
+    for name, size in sorted(items.items(), key=lambda x: -x[1])[:n]:
+        print("  %8d  %s" % (size, name))
+
+
+def print_diff(title, base, new, n):
+    diff = {}
+    for k in set(base) | set(new):
+        d = new.get(k, 0) - base.get(k, 0)
+        if d != 0:
+            diff[k] = d
+    if not diff:
+        return
+    print("\n%s:" % title)
+    for name, d in sorted(diff.items(), key=lambda x: -abs(x[1]))[:n]:
+        print("  %+8d  %s" % (d, name))
+
+
+def obj_total(sizes, groups=("flash", "iram", "rodata", "data")):
+    return sum(sizes.get(g, 0) for g in groups)
+
+
+def main():
+    p = argparse.ArgumentParser(description="Firmware size report")
+    p.add_argument("elf")
+    p.add_argument("--objs-dir", help="Directory with object files, "
+                   "defaults to the directory of the ELF")
+    p.add_argument("--toolchain-prefix", default="",
+                   help="e.g. xtensa-lx106-elf-")
+    p.add_argument("--baseline", help="Baseline report to compare with")
+    p.add_argument("--save", help="Save the report to this file")
+    p.add_argument("--threshold", type=int, default=-1,
+                   help="Fail if any group grew by more than this many bytes "
+                   "compared to baseline, -1 - don't fail")
+    p.add_argument("--top", type=int, default=20,
+                   help="Number of top entries to show")
+    args = p.parse_args()
+
+    report = make_report(args)
+    totals = report["totals"]
+    print("%s: %s" % (report["elf"], ", ".join(
+        "%s %d" % (g, totals[g]) for g in GROUPS)))
+    print_top("Largest objects (code + data)",
+              {k: obj_total(v) for k, v in report["objects"].items()},
+              args.top)
+    print_top("Largest objects (bss)",
+              {k: v.get("bss", 0) for k, v in report["objects"].items()},
+              args.top)
+    for g in GROUPS:
+        print_top("Largest symbols (%s)" % g, report["symbols"].get(g, {}),
+                  args.top)
+
+    failed = []
+    if args.baseline and os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            base = json.load(f)
+        print("\nCompared to %s:" % args.baseline)
+        for g in GROUPS:
+            d = totals[g] - base["totals"].get(g, 0)
+            print("  %-6s %8d %+8d" % (g, totals[g], d))
+            if args.threshold >= 0 and d > args.threshold:
+                failed.append(g)
+        print_diff("Object changes",
+                   {k: obj_total(v) + v.get("bss", 0)
+                    for k, v in base["objects"].items()},
+                   {k: obj_total(v) + v.get("bss", 0)
+                    for k, v in report["objects"].items()}, args.top)
+        for g in GROUPS:
+            print_diff("Symbol changes (%s)" % g,
+                       base["symbols"].get(g, {}),
+                       report["symbols"].get(g, {}), args.top)
+    elif args.baseline:
+        print("\nNo baseline at %s" % args.baseline)
+
+    if args.save:
+        os.makedirs(os.path.dirname(args.save) or ".", exist_ok=True)
+        with open(args.save, "w") as f:
+            json.dump(report, f, indent=1, sort_keys=True)
+
+    if failed:
+        print("\nSize regression over %d bytes: %s" % (args.threshold,
+                                                      ", ".join(failed)))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
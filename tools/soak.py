@@ -0,0 +1,468 @@
+#!/usr/bin/env python3
+#
+#  Copyright (c) 2020 Deomid "rojer" Ryabkov
+#  All rights reserved
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+#  Long-running soak test against ShellyU.
+#
+#  Generates random virtual input edges, floods the device with
+#  Shelly.GetInfo / Shelly.SetSwitch calls over HTTP and WebSocket and
+#  periodically changes switch config, which re-creates the accessories.
+#  Meanwhile samples heap, RSS and loop lag. At the end fails if heap or RSS
+#  keep growing, loop lag or error rate are too high, the process died or
+#  sanitizers reported anything.
+#
+#  Example (ShellyU is built with ASAN and UBSAN):
+#    tools/soak.py --cmd ./build_ShellyU/objs/shelly-homekit.elf \
+#        --http-port 8080 --duration 4h
+
+import argparse
+import asyncio
+import base64
+import json
+import os
+import random
+import re
+import signal
+import struct
+import subprocess
+import sys
+import time
+
+SANITIZER_RE = re.compile(
+    r"ERROR: (AddressSanitizer|LeakSanitizer)|runtime error:")
+
+
+def parse_duration(s):
+    m = re.match(r"^(\d+(?:\.\d+)?)([smhd]?)$", s)
+    if not m:
+        raise argparse.ArgumentTypeError("invalid duration %s" % s)
+    mult = {"": 1, "s": 1, "m": 60, "h": 3600, "d": 86400}[m.group(2)]
+    return float(m.group(1)) * mult
+
+
+def percentile(values, p):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def slope_per_hour(samples):
+    """Least squares slope of (t, v) samples, per hour."""
+    n = len(samples)
+    if n < 2:
+        return 0
+    mt = sum(t for t, _ in samples) / n
+    mv = sum(v for _, v in samples) / n
+    den = sum((t - mt) ** 2 for t, _ in samples)
+    if den == 0:
+        return 0
+    return sum((t - mt) * (v - mv) for t, v in samples) / den * 3600
+
+
+def rss_kb(pid):
+    try:
+        with open("/proc/%d/status" % pid) as f:
+            for line in f:
+                if line.startswith("VmRSS:"):
+                    return int(line.split()[1])
+    except OSError:
+        pass
+    return None
+
+
+class RPCError(Exception):
+    pass
+
+
+async def http_rpc(host, port, method, params=None, timeout=10):
+    """Async RPC call over HTTP, one connection per call."""
+    body = json.dumps(params or {}).encode()
+    r, w = await asyncio.wait_for(asyncio.open_connection(host, port),
+                                  timeout)
+    try:
+        w.write(("POST /rpc/%s HTTP/1.1\r\nHost: %s\r\n"
+                 "Content-Type: application/json\r\nContent-Length: %d\r\n"
+                 "Connection: close\r\n\r\n" % (method, host, len(body))
+                 ).encode() + body)
+        data = await asyncio.wait_for(r.read(), timeout)
+    finally:
+        w.close()
+    hdr, _, body = data.partition(b"\r\n\r\n")
+    status = int(hdr.split(b" ", 2)[1])
+    if status != 200:
+        raise RPCError("%s: HTTP %d %s" % (method, status, body[:100]))
+    return json.loads(body) if body else None
+
+
+class WSRPC:
+    """Minimal WebSocket RPC client for the /rpc endpoint."""
+
+    def __init__(self, host, port):
+        self.host = host
+        self.port = port
+        self._id = 0
+        self._pending = {}
+        self._r = self._w = None
+        self._task = None
+
+    async def connect(self):
+        self._r, self._w = await asyncio.open_connection(self.host, self.port)
+        key = base64.b64encode(os.urandom(16)).decode()
+        self._w.write((
+            "GET /rpc HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\n"
+            "Connection: Upgrade\r\nSec-WebSocket-Key: %s\r\n"
+            "Sec-WebSocket-Version: 13\r\n"
+            "Sec-WebSocket-Protocol: json-rpc\r\n\r\n" % (self.host, key)
+        ).encode())
+        hdr = await self._r.readuntil(b"\r\n\r\n")
+        if b" 101 " not in hdr.split(b"\r\n")[0]:
+            raise RPCError("WS handshake failed: %s" % hdr[:100])
+        self._task = asyncio.ensure_future(self._read_loop())
+
+    async def close(self):
+        if self._task:
+            self._task.cancel()
+        if self._w:
+            self._w.close()
+
+    def _send_frame(self, data):
+        mask = os.urandom(4)
+        n = len(data)
+        if n < 126:
+            hdr = struct.pack("!BB", 0x81, 0x80 | n)
+        elif n < 65536:
+            hdr = struct.pack("!BBH", 0x81, 0x80 | 126, n)
+        else:
+            hdr = struct.pack("!BBQ", 0x81, 0x80 | 127, n)
+        payload = bytes(b ^ mask[i % 4] for i, b in enumerate(data))
+        self._w.write(hdr + mask + payload)
+
+    async def _read_loop(self):
+        try:
+            while True:
+                b0, b1 = await self._r.readexactly(2)
+                n = b1 & 0x7f
+                if n == 126:
+                    n = struct.unpack("!H", await self._r.readexactly(2))[0]
+                elif n == 127:
+                    n = struct.unpack("!Q", await self._r.readexactly(8))[0]
+                data = await self._r.readexactly(n)
+                if (b0 & 0x0f) == 8:
+                    raise ConnectionError("closed by peer")
+                if (b0 & 0x0f) != 1:
+                    continue
+                msg = json.loads(data)
+                f = self._pending.pop(msg.get("id"), None)
+                if f is None or f.done():
+                    continue
+                if "error" in msg:
+                    f.set_exception(RPCError(msg["error"]))
+                else:
+                    f.set_result(msg.get("result"))
+        except (asyncio.IncompleteReadError, ConnectionError) as e:
+            for f in self._pending.values():
+                if not f.done():
+                    f.set_exception(RPCError("WS: %s" % e))
+            self._pending = {}
+
+    async def call(self, method, params=None, timeout=10):
+        self._id += 1
+        f = asyncio.get_running_loop().create_future()
+        self._pending[self._id] = f
+        self._send_frame(json.dumps(
+            {"id": self._id, "method": method,
+             "params": params or {}}).encode())
+        return await asyncio.wait_for(f, timeout)
+
+
+class Soak:
+
+    def __init__(self, args):
+        self.args = args
+        self.proc = None
+        self.log = None
+        self.lat = {}
+        self.ops = 0
+        self.errors = {}
+        self.heap = []  # (t, ram_free)
+        self.rss = []  # (t, rss_kb)
+        self.lag = []  # loop lag samples, us
+        self.start = 0
+        self.stop = False
+        self.sw_id = 1
+        self.sw_type = 0
+        self.sw_name = ""
+
+    def record(self, kind, t0, err=None):
+        if err is not None:
+            self.errors[kind] = self.errors.get(kind, 0) + 1
+            if self.args.verbose:
+                print("%s: %s" % (kind, err))
+            return
+        self.ops += 1
+        self.lat.setdefault(kind, []).append(time.monotonic() - t0)
+
+    async def timed(self, kind, coro):
+        t0 = time.monotonic()
+        try:
+            res = await coro
+        except (RPCError, OSError, asyncio.TimeoutError, ValueError) as e:
+            self.record(kind, t0, e)
+            return None
+        self.record(kind, t0)
+        return res
+
+    def rpc(self, method, params=None):
+        return http_rpc(self.args.host, self.args.http_port, method, params)
+
+    async def random_call(self, call, transport):
+        if random.random() < 0.5:
+            await self.timed("%s GetInfo" % transport, call("Shelly.GetInfo"))
+        else:
+            await self.timed("%s SetSwitch" % transport, call(
+                "Shelly.SetSwitch",
+                {"id": self.sw_id, "state": random.random() < 0.5}))
+
+    async def http_worker(self):
+        while not self.stop:
+            await self.random_call(self.rpc, "http")
+            await asyncio.sleep(random.expovariate(self.args.http_rate))
+
+    async def ws_worker(self):
+        while not self.stop:
+            ws = WSRPC(self.args.host, self.args.http_port)
+            try:
+                await ws.connect()
+                while not self.stop:
+                    await self.random_call(ws.call, "ws")
+                    await asyncio.sleep(random.expovariate(self.args.ws_rate))
+            except (RPCError, OSError, asyncio.IncompleteReadError) as e:
+                self.record("ws connect", 0, e)
+                await asyncio.sleep(1)
+            finally:
+                await ws.close()
+
+    async def input_worker(self):
+        while not self.stop:
+            # Bursts of edges, to exercise press detection as well.
+            for _ in range(random.randint(1, 4)):
+                await self.timed("input", self.rpc(
+                    "Shelly.SetVirtualInput",
+                    {"id": random.choice(self.args.inputs), "toggle": True}))
+                await asyncio.sleep(random.uniform(0.01, 0.3))
+            await asyncio.sleep(random.expovariate(self.args.input_rate))
+
+    async def config_worker(self):
+        n = 0
+        while not self.stop:
+            await asyncio.sleep(self.args.config_interval)
+            n += 1
+            # Name change requires server restart and accessory re-creation.
+            name = self.sw_name + (" *" if n % 2 else "")
+            await self.timed("SetConfig", self.rpc("Shelly.SetConfig", {
+                "id": self.sw_id, "type": self.sw_type,
+                "config": {"name": name}}))
+
+    async def sampler(self):
+        last_report = time.monotonic()
+        while not self.stop:
+            t = time.monotonic() - self.start
+            info = await self.timed("sample", self.rpc("Shelly.GetInfo"))
+            if info is not None:
+                if t >= self.args.warmup:
+                    self.heap.append((t, info.get("ram_free", 0)))
+                self.lag.append(info.get("loop_lag_us", 0))
+            pid = self.proc.pid if self.proc else self.args.pid
+            if pid:
+                rss = rss_kb(pid)
+                if rss is not None and t >= self.args.warmup:
+                    self.rss.append((t, rss))
+            if self.proc is not None and self.proc.poll() is not None:
+                print("Process exited with %d" % self.proc.returncode)
+                self.stop = True
+            if time.monotonic() - last_report >= self.args.report_interval:
+                last_report = time.monotonic()
+                self.report(final=False)
+            await asyncio.sleep(self.args.sample_interval)
+
+    def report(self, final):
+        t = time.monotonic() - self.start
+        print("\n=== %s %.0f s, %d ops, %d errors" % (
+            "Final" if final else "At", t, self.ops,
+            sum(self.errors.values())))
+        for k in sorted(self.lat):
+            v = self.lat[k]
+            print("  %-14s %8d  p50 %7.2f  p99 %7.2f  max %7.2f ms" % (
+                k, len(v), percentile(v, 50) * 1000,
+                percentile(v, 99) * 1000, max(v) * 1000))
+            if not final:
+                # Keep memory bounded on long runs.
+                self.lat[k] = v[-10000:]
+        for k, n in sorted(self.errors.items()):
+            print("  %-14s %8d errors" % (k, n))
+        if self.heap:
+            print("  heap free %d, trend %+.0f B/h" % (
+                self.heap[-1][1], slope_per_hour(self.heap)))
+        if self.rss:
+            print("  RSS %d KB, trend %+.0f KB/h" % (
+                self.rss[-1][1], slope_per_hour(self.rss)))
+        if self.lag:
+            print("  loop lag p50 %.1f p99 %.1f max %.1f ms" % (
+                percentile(self.lag, 50) / 1000.0,
+                percentile(self.lag, 99) / 1000.0, max(self.lag) / 1000.0))
+
+    def start_process(self):
+        a = self.args
+        self.log = open(a.log, "w")
+        env = dict(os.environ)
+        env.setdefault("ASAN_OPTIONS", "detect_leaks=1")
+        env.setdefault("UBSAN_OPTIONS", "print_stacktrace=1")
+        self.proc = subprocess.Popen(a.cmd, shell=True, stdout=self.log,
+                                     stderr=subprocess.STDOUT, env=env,
+                                     start_new_session=True)
+        print("Started %s, pid %d, log in %s" % (a.cmd, self.proc.pid, a.log))
+
+    def stop_process(self):
+        if self.proc is None or self.proc.poll() is not None:
+            return
+        # SIGTERM lets the process exit normally, so LeakSanitizer runs.
+        os.killpg(self.proc.pid, signal.SIGTERM)
+        try:
+            self.proc.wait(30)
+        except subprocess.TimeoutExpired:
+            os.killpg(self.proc.pid, signal.SIGKILL)
+            self.proc.wait()
+        self.log.close()
+
+    async def wait_for_device(self):
+        deadline = time.monotonic() + 60
+        while time.monotonic() < deadline:
+            try:
+                return await self.rpc("Shelly.GetInfo")
+            except (RPCError, OSError, asyncio.TimeoutError):
+                await asyncio.sleep(1)
+        raise RPCError("device did not come up")
+
+    async def run(self):
+        a = self.args
+        if a.cmd:
+            self.start_process()
+        info = await self.wait_for_device()
+        sw = [c for c in info.get("components", []) if c["type"] <= 2]
+        if sw:
+            self.sw_id, self.sw_type = sw[0]["id"], sw[0]["type"]
+            self.sw_name = sw[0]["name"]
+        self.start = time.monotonic()
+        tasks = [asyncio.ensure_future(self.sampler())]
+        tasks += [asyncio.ensure_future(self.http_worker())
+                  for _ in range(a.http_workers)]
+        tasks += [asyncio.ensure_future(self.ws_worker())
+                  for _ in range(a.ws_workers)]
+        if a.inputs:
+            tasks.append(asyncio.ensure_future(self.input_worker()))
+        if a.config_interval > 0:
+            tasks.append(asyncio.ensure_future(self.config_worker()))
+        deadline = self.start + a.duration
+        while not self.stop and time.monotonic() < deadline:
+            await asyncio.sleep(1)
+        self.stop = True
+        await asyncio.wait(tasks, timeout=15)
+        for t in tasks:
+            t.cancel()
+        self.report(final=True)
+
+    def check(self):
+        a = self.args
+        failures = []
+        heap_trend = slope_per_hour(self.heap)
+        if len(self.heap) > 10 and -heap_trend > a.max_heap_leak:
+            failures.append("heap shrinks by %.0f B/h" % -heap_trend)
+        rss_trend = slope_per_hour(self.rss)
+        if len(self.rss) > 10 and rss_trend > a.max_rss_growth:
+            failures.append("RSS grows by %.0f KB/h" % rss_trend)
+        if self.lag and max(self.lag) > a.max_loop_lag * 1000:
+            failures.append("loop lag %.1f ms" % (max(self.lag) / 1000.0))
+        num_errors = sum(self.errors.values())
+        if num_errors > (self.ops + num_errors) * a.max_error_rate:
+            failures.append("%d errors" % num_errors)
+        if self.proc is not None:
+            if self.proc.returncode not in (None, 0, -signal.SIGTERM,
+                                            128 + signal.SIGTERM):
+                failures.append("process exited with %d" %
+                                self.proc.returncode)
+            with open(a.log, errors="replace") as f:
+                for line in f:
+                    if SANITIZER_RE.search(line):
+                        failures.append("sanitizer: %s" % line.strip())
+                        break
+        return failures
+
+
+def main():
+    p = argparse.ArgumentParser(description="ShellyU soak test")
+    p.add_argument("--host", default="127.0.0.1")
+    p.add_argument("--http-port", type=int, default=80)
+    p.add_argument("--cmd", help="Command to start ShellyU with. If not "
+                   "specified, an already running instance is used")
+    p.add_argument("--pid", type=int,
+                   help="PID of an already running instance, for RSS")
+    p.add_argument("--log", default="soak.log", help="ShellyU output")
+    p.add_argument("--duration", type=parse_duration, default="1h",
+                   help="e.g. 30m, 8h")
+    p.add_argument("--warmup", type=parse_duration, default="2m",
+                   help="Heap and RSS samples before this are not used")
+    p.add_argument("--http-workers", type=int, default=4)
+    p.add_argument("--http-rate", type=float, default=5,
+                   help="Calls per second per HTTP worker")
+    p.add_argument("--ws-workers", type=int, default=2)
+    p.add_argument("--ws-rate", type=float, default=10,
+                   help="Calls per second per WS worker")
+    p.add_argument("--inputs", type=int, nargs="*", default=[1],
+                   help="Virtual input ids")
+    p.add_argument("--input-rate", type=float, default=1,
+                   help="Input edge bursts per second")
+    p.add_argument("--config-interval", type=float, default=60,
+                   help="Seconds between config changes, 0 - disable")
+    p.add_argument("--sample-interval", type=float, default=5)
+    p.add_argument("--report-interval", type=float, default=300)
+    p.add_argument("--max-heap-leak", type=float, default=1024,
+                   help="Max heap decrease, bytes per hour")
+    p.add_argument("--max-rss-growth", type=float, default=1024,
+                   help="Max RSS growth, KB per hour")
+    p.add_argument("--max-loop-lag", type=float, default=500,
+                   help="Max loop lag, ms")
+    p.add_argument("--max-error-rate", type=float, default=0.001)
+    p.add_argument("-v", "--verbose", action="store_true")
+    args = p.parse_args()
+    s = Soak(args)
+    try:
+        asyncio.run(s.run())
+    except KeyboardInterrupt:
+        pass
+    except RPCError as e:
+        print("Error: %s" % e)
+    finally:
+        s.stop_process()
+    failures = s.check()
+    if failures:
+        print("\nFAIL:\n  " + "\n  ".join(failures))
+        sys.exit(1)
+    print("\nPASS")
+
+
+if __name__ == "__main__":
+    main()
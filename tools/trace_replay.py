@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+#
+#  Copyright (c) 2020 Deomid "rojer" Ryabkov
+#  All rights reserved
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+#  Replays an event trace captured on a device on ShellyU.
+#
+#  Fetches the trace (Shelly.GetTrace) and switch configuration
+#  (Shelly.GetInfo) from a device or loads them from a file saved earlier,
+#  applies the configuration to ShellyU, replays the external events there
+#  under virtual time (Shelly.ReplayTrace) and compares derived events
+#  (input events, timers, switch state changes made by the firmware itself)
+#  with the original ones.
+#
+#  Example:
+#    tools/trace_replay.py --device 192.168.1.10 --save trace.json
+#    tools/trace_replay.py --file trace.json --host 127.0.0.1
+
+import argparse
+import json
+import sys
+
+from hap_client import rpc_call
+
+EV_INPUT_EDGE, EV_INPUT_EVENT, EV_SWITCH_STATE, EV_TIMER, EV_CONFIG = range(5)
+EV_NAMES = ("input_edge", "input_event", "switch_state", "timer", "config")
+SOURCES = ("", "init", "button", "switch", "HAP", "web", "auto_off",
+           "binding")
+# Switch state changes made by the firmware in response to other events.
+DERIVED_SOURCES = (2, 3, 6)
+SWITCH_TYPES = (0, 1, 2)  # kSwitch, kOutlet, kLock
+SWITCH_CFG_KEYS = ("name", "svc_type", "in_mode", "auto_off",
+                   "auto_off_delay")
+
+
+def fmt_event(e):
+    ts, ev, id, arg = e
+    name = EV_NAMES[ev] if ev < len(EV_NAMES) else str(ev)
+    if ev == EV_SWITCH_STATE:
+        src = arg >> 1
+        desc = "state %d, source %s" % (
+            arg & 1, SOURCES[src] if src < len(SOURCES) else src)
+    else:
+        desc = "arg %d" % arg
+    return "%10.3f %-12s id %d, %s" % (ts / 1000.0, name, id, desc)
+
+
+def is_derived(e):
+    _, ev, _, arg = e
+    if ev in (EV_INPUT_EVENT, EV_TIMER):
+        return True
+    return ev == EV_SWITCH_STATE and (arg >> 1) in DERIVED_SOURCES
+
+
+def diff_events(orig, replay, tolerance_ms):
+    """Matches derived events in order. Returns a list of (orig, replay)
+    pairs that differ, either of which may be None."""
+    a = [e for e in orig if is_derived(e)]
+    b = [e for e in replay if is_derived(e)]
+    res = []
+    i = j = 0
+    while i < len(a) or j < len(b):
+        ea = a[i] if i < len(a) else None
+        eb = b[j] if j < len(b) else None
+        if ea and eb and ea[1:] == eb[1:]:
+            if abs(ea[0] - eb[0]) > tolerance_ms:
+                res.append((ea, eb))
+            i += 1
+            j += 1
+        elif eb is None or (ea is not None and ea[0] <= eb[0]):
+            res.append((ea, None))
+            i += 1
+        else:
+            res.append((None, eb))
+            j += 1
+    return res
+
+
+def main():
+    p = argparse.ArgumentParser(description="Replay device event trace")
+    p.add_argument("--device", help="Device to fetch the trace from")
+    p.add_argument("--device-port", type=int, default=80)
+    p.add_argument("--file", help="Load trace from this file")
+    p.add_argument("--save", help="Save the fetched trace to this file")
+    p.add_argument("--host", help="ShellyU instance to replay on")
+    p.add_argument("--port", type=int, default=80)
+    p.add_argument("--tolerance", type=int, default=50,
+                   help="Allowed difference in event times, ms")
+    args = p.parse_args()
+
+    if args.device:
+        data = {
+            "trace": rpc_call(args.device, args.device_port, "Shelly.GetTrace"),
+            "info": rpc_call(args.device, args.device_port, "Shelly.GetInfo"),
+        }
+        if args.save:
+            with open(args.save, "w") as f:
+                json.dump(data, f, indent=1)
+    elif args.file:
+        with open(args.file) as f:
+            data = json.load(f)
+    else:
+        p.error("either --device or --file is required")
+
+    events = data["trace"]["events"]
+    print("%s %s, %d events" % (data["info"].get("model"),
+                                data["info"].get("version"), len(events)))
+    if not args.host or not events:
+        for e in events:
+            print(fmt_event(e))
+        return
+
+    for c in data["info"].get("components", []):
+        if c.get("type") not in SWITCH_TYPES:
+            continue
+        cfg = {k: c[k] for k in SWITCH_CFG_KEYS if k in c}
+        try:
+            rpc_call(args.host, args.port, "Shelly.SetConfig",
+                     {"id": c["id"], "type": c["type"], "config": cfg})
+        except Exception as e:
+            print("Failed to apply config of %d: %s" % (c["id"], e))
+
+    res = rpc_call(args.host, args.port, "Shelly.ReplayTrace",
+                   {"events": events}, timeout=60)
+    print("Replayed %d events (%d skipped), %d timers pending" % (
+        res["num_events"], res["num_skipped"], res["num_pending_timers"]))
+
+    diff = diff_events(events, res["trace"]["events"], args.tolerance)
+    for ea, eb in diff:
+        print("- %s" % (fmt_event(ea) if ea else ""))
+        print("+ %s" % (fmt_event(eb) if eb else ""))
+    if diff:
+        print("%d mismatches" % len(diff))
+        sys.exit(1)
+    print("Replay matches")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+#
+#  Copyright (c) 2020 Deomid "rojer" Ryabkov
+#  All rights reserved
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+#  Local stand-in for a webhook receiver, to test URL actions (webhook.*).
+#  Logs requests with the time since the previous one and the connection
+#  they came on, so connection reuse is visible. Can delay responses and
+#  fail a fraction of them to exercise retries and the queue drop policy.
+#
+#  Example:
+#    tools/webhook_server.py --port 8888 --delay 0.5 --fail 0.2
+#    (device) webhook.actions=in1:single=http://<host>:8888/single
+
+import argparse
+import http.server
+import random
+import sys
+import threading
+import time
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def do_GET(self):
+        srv = self.server
+        with srv.lock:
+            srv.num_reqs += 1
+            now = time.monotonic()
+            since_last = now - srv.last_req if srv.last_req else 0
+            srv.last_req = now
+            conn_id = srv.conn_ids.setdefault(self.connection,
+                                              len(srv.conn_ids) + 1)
+        if srv.args.delay:
+            time.sleep(srv.args.delay)
+        fail = random.random() < srv.args.fail
+        code = 500 if fail else 200
+        print("%s %-21s conn %3d +%7.3fs %s %d" % (
+            time.strftime("%H:%M:%S"), "%s:%d" % self.client_address,
+            conn_id, since_last, self.path, code), flush=True)
+        body = b"error\n" if fail else b"ok\n"
+        self.send_response(code)
+        self.send_header("Content-Type", "text/plain")
+        self.send_header("Content-Length", str(len(body)))
+        if srv.args.close:
+            self.send_header("Connection", "close")
+            self.close_connection = True
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, fmt, *args):
+        pass
+
+
+def main():
+    p = argparse.ArgumentParser(description="Webhook receiver stand-in")
+    p.add_argument("--port", type=int, default=8888)
+    p.add_argument("--delay", type=float, default=0,
+                   help="Delay responses by this many seconds")
+    p.add_argument("--fail", type=float, default=0,
+                   help="Fraction of requests to fail with 500")
+    p.add_argument("--close", action="store_true",
+                   help="Close connection after each response")
+    args = p.parse_args()
+
+    srv = http.server.ThreadingHTTPServer(("", args.port), Handler)
+    srv.args = args
+    srv.lock = threading.Lock()
+    srv.num_reqs = 0
+    srv.last_req = 0
+    srv.conn_ids = {}
+    print("Listening on port %d" % args.port, flush=True)
+    try:
+        srv.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    print("%d requests on %d connections" % (
+        srv.num_reqs, len(srv.conn_ids)), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()